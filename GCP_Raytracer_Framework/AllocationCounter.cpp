@@ -0,0 +1,176 @@
+#include "AllocationCounter.h"
+
+#if defined(GCP_COUNT_ALLOCATIONS)
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#if defined(_WIN32)
+	#include <malloc.h>
+#endif
+
+static std::atomic<unsigned long long> allocationCount(0);
+
+
+unsigned long long AllocationCounter::GetCount()
+{
+	return allocationCount.load(std::memory_order_relaxed);
+}
+
+static void* Allocate(std::size_t size)
+{
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+
+	// malloc(0) may give back nullptr, operator new has to give back something
+	return std::malloc(size != 0 ? size : 1);
+}
+
+#if defined(__cpp_aligned_new)
+
+// Memory from these has to go back through FreeAligned, Windows can't free it with free()
+static void* AllocateAligned(std::size_t size, std::align_val_t alignment)
+{
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+
+#if defined(_WIN32)
+	return _aligned_malloc(size != 0 ? size : 1, (std::size_t)alignment);
+#else
+	void* memory = nullptr;
+
+	return posix_memalign(&memory, (std::size_t)alignment, size != 0 ? size : 1) == 0 ? memory : nullptr;
+#endif
+}
+
+static void FreeAligned(void* memory)
+{
+#if defined(_WIN32)
+	_aligned_free(memory);
+#else
+	std::free(memory);
+#endif
+}
+
+#endif
+
+
+void* operator new(std::size_t size)
+{
+	void* memory = Allocate(size);
+
+	if (memory == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+
+	return memory;
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	return Allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+	return Allocate(size);
+}
+
+void operator delete(void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void* memory, const std::nothrow_t&) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory, const std::nothrow_t&) noexcept
+{
+	std::free(memory);
+}
+
+// Types aligned more strictly than malloc guarantees come through these, which only exist from C++17
+#if defined(__cpp_aligned_new)
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+	void* memory = AllocateAligned(size, alignment);
+
+	if (memory == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+
+	return memory;
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+	return operator new(size, alignment);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return AllocateAligned(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return AllocateAligned(size, alignment);
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept
+{
+	FreeAligned(memory);
+}
+
+void operator delete[](void* memory, std::align_val_t) noexcept
+{
+	FreeAligned(memory);
+}
+
+void operator delete(void* memory, std::size_t, std::align_val_t) noexcept
+{
+	FreeAligned(memory);
+}
+
+void operator delete[](void* memory, std::size_t, std::align_val_t) noexcept
+{
+	FreeAligned(memory);
+}
+
+void operator delete(void* memory, std::align_val_t, const std::nothrow_t&) noexcept
+{
+	FreeAligned(memory);
+}
+
+void operator delete[](void* memory, std::align_val_t, const std::nothrow_t&) noexcept
+{
+	FreeAligned(memory);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,23 @@
+#pragma once
+
+// Counts heap allocations made through operator new anywhere in the program, so a benchmark can check a loop makes none
+// Only built with GCP_COUNT_ALLOCATIONS defined, as in the Benchmark configuration, where AllocationCounter.cpp replaces the global
+// operator new and delete to do it, the count is one relaxed atomic add on top of malloc
+// Other builds keep the standard library's allocator and the count stays at 0
+namespace AllocationCounter
+{
+#if defined(GCP_COUNT_ALLOCATIONS)
+
+	const bool enabled = true;
+
+	// Allocations since the program started, on every thread
+	unsigned long long GetCount();
+
+#else
+
+	const bool enabled = false;
+
+	inline unsigned long long GetCount() { return 0; }
+
+#endif
+}
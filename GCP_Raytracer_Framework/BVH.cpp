@@ -0,0 +1,1196 @@
+
+#include "BVH.h"
+#include "Simd.h"
+#include "RadixSort.h"
+
+#include <GLM/gtc/bitfield.hpp>
+
+#include <emmintrin.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+
+// Cost of stepping into a node compared with intersecting one primitive
+static const float traversalCost = 1.0f;
+static const float intersectCost = 1.0f;
+
+// Most buckets the centroids are sorted into along each axis when looking for a split
+// Small nodes use fewer, as there's no point having many more buckets than primitives and the sweep over them costs the same however few primitives there are
+static const int binCount = 16;
+
+// Past this depth nodes are split in half by primitive count, which keeps the tree shallow enough for the traversal stack
+static const int maxSahDepth = 64;
+
+// Below this many primitives a parallel build isn't worth starting the threads for
+static const unsigned int parallelBuildMin = 16384;
+
+// Nodes at least this big are split by all threads together, smaller ones become subtree tasks
+// Aiming for a few tasks per thread lets the pool balance out subtrees of different sizes
+static const unsigned int subtreeTaskMin = 4096;
+static const unsigned int subtreeTasksPerThread = 8;
+
+// Primitives per chunk when a node's primitives are shared out across threads
+static const unsigned int chunkSize = 16384;
+
+// The linear build makes a leaf of any run of sorted primitives this short, rather than splitting it all the way down
+static const unsigned int linearLeafSize = 4;
+
+
+struct BuildTask
+{
+	unsigned int nodeIndex;
+
+	int depth;
+};
+
+// A node of the linear build's intermediate tree, covering sorted primitives first to last
+// The left child holds first to split and the right one split + 1 to last, each child is a single primitive if its range is one long
+// or else the intermediate node with the same index as the end of its range that it shares with its parent
+struct LinearNode
+{
+	unsigned int first;
+
+	unsigned int last;
+
+	unsigned int split;
+};
+
+struct SplitBin
+{
+	AABB bounds;
+
+	unsigned int count = 0;
+};
+
+// Bins along all three axes
+struct AxisBins
+{
+	SplitBin bins[3][binCount];
+
+	void Merge(const AxisBins& other)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			for (int i = 0; i < binCount; ++i)
+			{
+				bins[axis][i].bounds.Grow(other.bins[axis][i].bounds);
+				bins[axis][i].count += other.bins[axis][i].count;
+			}
+		}
+	}
+};
+
+// A primitive's bounds and where it came from, 32 bytes like a node
+// The build moves these around rather than indices into the caller's list, so every pass over a node reads memory in order
+struct BuildPrim
+{
+	glm::vec3 boundsMin;
+
+	unsigned int index;
+
+	glm::vec3 boundsMax;
+
+	unsigned int padding;
+
+	glm::vec3 Centre() const
+	{
+		return (boundsMin + boundsMax) * 0.5f;
+	}
+};
+
+
+// A node's share of the SAH cost before it's divided by the root's surface area
+static double NodeCost(const BVHNode& node)
+{
+	AABB box;
+	box.min = node.boundsMin;
+	box.max = node.boundsMax;
+
+	return box.SurfaceArea() * (node.IsLeaf() ? intersectCost * node.count : traversalCost);
+}
+
+// Bounds of the node's primitives, and of their centres
+static void CalculateBounds(const BuildPrim* prims, unsigned int count, AABB& bounds, AABB& centreBounds)
+{
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		bounds.min = glm::min(bounds.min, prims[i].boundsMin);
+		bounds.max = glm::max(bounds.max, prims[i].boundsMax);
+		centreBounds.Grow(prims[i].Centre());
+	}
+}
+
+// Bins used for a node with count primitives
+static int NodeBinCount(unsigned int count)
+{
+	return (int)std::min((unsigned int)binCount, std::max(2u, count));
+}
+
+// Which bin a centre falls in along an axis
+static int BinIndex(float centre, float axisMin, float scale, int bins)
+{
+	return std::max(0, std::min(bins - 1, (int)((centre - axisMin) * scale)));
+}
+
+// Bin scale along each axis, 0 for an axis where every centre is in the same place as there's nothing to split there
+// An extent small enough to be denormal counts as the same place too, as dividing by it overflows
+static glm::vec3 BinScales(const AABB& centreBounds, int bins)
+{
+	glm::vec3 scales(0.0f);
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float extent = centreBounds.max[axis] - centreBounds.min[axis];
+		float scale = bins / extent;
+
+		if (extent > 0.0f && std::isfinite(scale))
+		{
+			scales[axis] = scale;
+		}
+	}
+
+	return scales;
+}
+
+// Adds the primitives to the bins of every axis
+// Axes that can't be split have a scale of 0, so everything lands in their first bin and ChooseSahSplit skips them
+static void BinPrimitives(const BuildPrim* prims, unsigned int count, const AABB& centreBounds, int nodeBins, AxisBins& bins)
+{
+	glm::vec3 scales = BinScales(centreBounds, nodeBins);
+
+	// This is most of the build time, so it's done with SSE2, which every x64 CPU has
+	// One lane per axis, the fourth lane is loaded with the primitive's index or padding and cleared straight away,
+	// as an index read as a float is denormal and arithmetic on those is very slow
+	// The bin for each axis comes out exactly as BinIndex works it out, so the partition afterwards agrees with the counts
+	__m128 binMin[3][binCount];
+	__m128 binMax[3][binCount];
+	unsigned int binCounts[3][binCount] = {};
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		for (int i = 0; i < nodeBins; ++i)
+		{
+			binMin[axis][i] = _mm_set1_ps(FLT_MAX);
+			binMax[axis][i] = _mm_set1_ps(-FLT_MAX);
+		}
+	}
+
+	__m128 axisMin = _mm_setr_ps(centreBounds.min.x, centreBounds.min.y, centreBounds.min.z, 0.0f);
+	__m128 scale = _mm_setr_ps(scales.x, scales.y, scales.z, 0.0f);
+	__m128 half = _mm_set1_ps(0.5f);
+	__m128 xyzMask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+
+	// Bin indices are small, so 16 bit min and max do the clamp SSE2 has no 32 bit version of
+	// A NaN centre converts to INT_MIN, which the max takes to 0 as BinIndex does
+	__m128i lastBin = _mm_set1_epi32(nodeBins - 1);
+
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		__m128 primMin = _mm_and_ps(_mm_loadu_ps(&prims[i].boundsMin.x), xyzMask);
+		__m128 primMax = _mm_and_ps(_mm_loadu_ps(&prims[i].boundsMax.x), xyzMask);
+
+		__m128 centre = _mm_mul_ps(_mm_add_ps(primMin, primMax), half);
+
+		__m128i index = _mm_max_epi16(_mm_min_epi16(_mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(centre, axisMin), scale)), lastBin), _mm_setzero_si128());
+
+		int binIndex[3] = { _mm_cvtsi128_si32(index), _mm_cvtsi128_si32(_mm_srli_si128(index, 4)), _mm_cvtsi128_si32(_mm_srli_si128(index, 8)) };
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			binMin[axis][binIndex[axis]] = _mm_min_ps(binMin[axis][binIndex[axis]], primMin);
+			binMax[axis][binIndex[axis]] = _mm_max_ps(binMax[axis][binIndex[axis]], primMax);
+			binCounts[axis][binIndex[axis]]++;
+		}
+	}
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		for (int i = 0; i < nodeBins; ++i)
+		{
+			if (binCounts[axis][i] == 0)
+			{
+				continue;
+			}
+
+			alignas(16) float boxMin[4];
+			alignas(16) float boxMax[4];
+			_mm_store_ps(boxMin, binMin[axis][i]);
+			_mm_store_ps(boxMax, binMax[axis][i]);
+
+			AABB box;
+			box.min = glm::vec3(boxMin[0], boxMin[1], boxMin[2]);
+			box.max = glm::vec3(boxMax[0], boxMax[1], boxMax[2]);
+
+			bins.bins[axis][i].bounds.Grow(box);
+			bins.bins[axis][i].count += binCounts[axis][i];
+		}
+	}
+}
+
+// Finds the cheapest split between the bins, returns false if no split beats leaving the node as a leaf
+// Primitives in bins 0 to splitBin go on the left
+static bool ChooseSahSplit(const AxisBins& axisBins, int nodeBins, unsigned int count, const AABB& bounds, const AABB& centreBounds, int& splitAxis, int& splitBin)
+{
+	float leafCost = intersectCost * count;
+	float bestCost = leafCost;
+	float parentArea = bounds.SurfaceArea();
+
+	if (parentArea <= 0.0f)
+	{
+		return false;
+	}
+
+	bool found = false;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		// Every centre is in the same place along this axis, there's nothing to split
+		if (centreBounds.max[axis] <= centreBounds.min[axis])
+		{
+			continue;
+		}
+
+		const SplitBin* bins = axisBins.bins[axis];
+
+		// Sweep from both ends to get the area and count either side of each of the nodeBins - 1 planes
+		float leftArea[binCount - 1];
+		unsigned int leftCount[binCount - 1];
+		float rightArea[binCount - 1];
+		unsigned int rightCount[binCount - 1];
+
+		AABB leftBox;
+		AABB rightBox;
+		unsigned int leftSum = 0;
+		unsigned int rightSum = 0;
+
+		for (int i = 0; i < nodeBins - 1; ++i)
+		{
+			leftSum += bins[i].count;
+			leftBox.Grow(bins[i].bounds);
+			leftCount[i] = leftSum;
+			leftArea[i] = leftBox.SurfaceArea();
+
+			rightSum += bins[nodeBins - 1 - i].count;
+			rightBox.Grow(bins[nodeBins - 1 - i].bounds);
+			rightCount[nodeBins - 2 - i] = rightSum;
+			rightArea[nodeBins - 2 - i] = rightBox.SurfaceArea();
+		}
+
+		for (int i = 0; i < nodeBins - 1; ++i)
+		{
+			if (leftCount[i] == 0 || rightCount[i] == 0)
+			{
+				continue;
+			}
+
+			float cost = traversalCost + intersectCost * (leftArea[i] * leftCount[i] + rightArea[i] * rightCount[i]) / parentArea;
+
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				splitAxis = axis;
+				splitBin = i;
+				found = true;
+			}
+		}
+	}
+
+	return found;
+}
+
+// Cuts the primitives in half along the longest axis of their centres, for when the heuristic won't split a node that's too big for a leaf
+static unsigned int MedianSplit(BuildPrim* prims, unsigned int count, const AABB& centreBounds)
+{
+	glm::vec3 extent = centreBounds.max - centreBounds.min;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+	unsigned int leftCount = count / 2;
+	std::nth_element(prims, prims + leftCount, prims + count, [&](const BuildPrim& a, const BuildPrim& b) { return a.Centre()[axis] < b.Centre()[axis]; });
+
+	return leftCount;
+}
+
+// Turns a node into an inner node with its primitives split into two new children at the end of nodes
+static unsigned int AddChildren(std::vector<BVHNode>& nodes, unsigned int nodeIndex, unsigned int leftCount)
+{
+	BVHNode& node = nodes[nodeIndex];
+
+	unsigned int leftIndex = (unsigned int)nodes.size();
+
+	BVHNode left;
+	left.leftFirst = node.leftFirst;
+	left.count = leftCount;
+
+	BVHNode right;
+	right.leftFirst = node.leftFirst + leftCount;
+	right.count = node.count - leftCount;
+
+	node.leftFirst = leftIndex;
+	node.count = 0;
+
+	// node is a reference into nodes, so it has to be finished with before these can reallocate
+	nodes.push_back(left);
+	nodes.push_back(right);
+
+	return leftIndex;
+}
+
+// Builds everything under nodes[rootIndex] on the calling thread, appending the new nodes to nodes
+// The root's leftFirst and count say which run of prims it holds, only that run is touched
+static void BuildSubtree(std::vector<BuildPrim>& allPrims, std::vector<BVHNode>& nodes, unsigned int rootIndex, int rootDepth)
+{
+	std::vector<BuildTask> tasks;
+	tasks.push_back({ rootIndex, rootDepth });
+
+	while (!tasks.empty())
+	{
+		BuildTask task = tasks.back();
+		tasks.pop_back();
+
+		BVHNode& node = nodes[task.nodeIndex];
+		unsigned int first = node.leftFirst;
+		unsigned int count = node.count;
+		BuildPrim* prims = &allPrims[first];
+
+		AABB bounds;
+		AABB centreBounds;
+		CalculateBounds(prims, count, bounds, centreBounds);
+
+		node.boundsMin = bounds.min;
+		node.boundsMax = bounds.max;
+
+		if (count == 1)
+		{
+			continue;
+		}
+
+		unsigned int leftCount = 0;
+		int axis = 0;
+		int splitBin = 0;
+
+		int nodeBins = NodeBinCount(count);
+		AxisBins bins;
+
+		if (task.depth < maxSahDepth)
+		{
+			BinPrimitives(prims, count, centreBounds, nodeBins, bins);
+		}
+
+		if (task.depth < maxSahDepth && ChooseSahSplit(bins, nodeBins, count, bounds, centreBounds, axis, splitBin))
+		{
+			float axisMin = centreBounds.min[axis];
+			float scale = BinScales(centreBounds, nodeBins)[axis];
+
+			BuildPrim* middle = std::partition(prims, prims + count, [&](const BuildPrim& prim) { return BinIndex(prim.Centre()[axis], axisMin, scale, nodeBins) <= splitBin; });
+			leftCount = (unsigned int)(middle - prims);
+		}
+		else if (count > BVH::maxLeafSize)
+		{
+			// Splitting isn't worth it by the heuristic but the leaf would be too big
+			leftCount = MedianSplit(prims, count, centreBounds);
+		}
+
+		// Either the heuristic says stop here, or the split would leave one side empty
+		if (leftCount == 0 || leftCount == count)
+		{
+			if (count <= BVH::maxLeafSize)
+			{
+				continue;
+			}
+
+			leftCount = count / 2;
+		}
+
+		unsigned int leftIndex = AddChildren(nodes, task.nodeIndex, leftCount);
+
+		tasks.push_back({ leftIndex + 1, task.depth + 1 });
+		tasks.push_back({ leftIndex, task.depth + 1 });
+	}
+}
+
+// Splits one big node using every thread in the pool, giving the same split BuildSubtree would
+// scratch must be as long as allPrims, it's where the partition puts primitives before copying them back
+static void SplitNodeParallel(std::vector<BuildPrim>& allPrims, std::vector<BVHNode>& nodes, const BuildTask& task, std::vector<BuildPrim>& scratch, ThreadPool& pool, std::vector<BuildTask>& children)
+{
+	unsigned int first = nodes[task.nodeIndex].leftFirst;
+	unsigned int count = nodes[task.nodeIndex].count;
+	BuildPrim* prims = &allPrims[first];
+
+	unsigned int chunkCount = (count + chunkSize - 1) / chunkSize;
+
+	// Each chunk works into its own results, which are then merged on this thread
+
+	std::vector<AABB> chunkBounds(chunkCount);
+	std::vector<AABB> chunkCentreBounds(chunkCount);
+
+	ParallelForChunks(&pool, count, chunkSize, [&](unsigned int chunk, unsigned int start, unsigned int end)
+	{
+		CalculateBounds(prims + start, end - start, chunkBounds[chunk], chunkCentreBounds[chunk]);
+	});
+
+	AABB bounds;
+	AABB centreBounds;
+
+	for (unsigned int chunk = 0; chunk < chunkCount; ++chunk)
+	{
+		bounds.Grow(chunkBounds[chunk]);
+		centreBounds.Grow(chunkCentreBounds[chunk]);
+	}
+
+	nodes[task.nodeIndex].boundsMin = bounds.min;
+	nodes[task.nodeIndex].boundsMax = bounds.max;
+
+	unsigned int leftCount = 0;
+	int axis = 0;
+	int splitBin = 0;
+
+	int nodeBins = NodeBinCount(count);
+	AxisBins bins;
+
+	if (task.depth < maxSahDepth)
+	{
+		std::vector<AxisBins> chunkBins(chunkCount);
+
+		ParallelForChunks(&pool, count, chunkSize, [&](unsigned int chunk, unsigned int start, unsigned int end)
+		{
+			BinPrimitives(prims + start, end - start, centreBounds, nodeBins, chunkBins[chunk]);
+		});
+
+		for (unsigned int chunk = 0; chunk < chunkCount; ++chunk)
+		{
+			bins.Merge(chunkBins[chunk]);
+		}
+	}
+
+	if (task.depth < maxSahDepth && ChooseSahSplit(bins, nodeBins, count, bounds, centreBounds, axis, splitBin))
+	{
+		float axisMin = centreBounds.min[axis];
+		float scale = BinScales(centreBounds, nodeBins)[axis];
+
+		auto goesLeft = [&](const BuildPrim& prim) { return BinIndex(prim.Centre()[axis], axisMin, scale, nodeBins) <= splitBin; };
+
+		// Count each chunk's left side, so every chunk knows where in scratch its primitives go
+		std::vector<unsigned int> chunkLeft(chunkCount);
+
+		ParallelForChunks(&pool, count, chunkSize, [&](unsigned int chunk, unsigned int start, unsigned int end)
+		{
+			chunkLeft[chunk] = (unsigned int)std::count_if(prims + start, prims + end, goesLeft);
+		});
+
+		std::vector<unsigned int> leftOffsets(chunkCount);
+		std::vector<unsigned int> rightOffsets(chunkCount);
+
+		for (unsigned int chunk = 0; chunk < chunkCount; ++chunk)
+		{
+			leftOffsets[chunk] = leftCount;
+			leftCount += chunkLeft[chunk];
+		}
+
+		unsigned int rightStart = leftCount;
+
+		for (unsigned int chunk = 0; chunk < chunkCount; ++chunk)
+		{
+			unsigned int start = chunk * chunkSize;
+
+			rightOffsets[chunk] = rightStart;
+			rightStart += std::min(chunkSize, count - start) - chunkLeft[chunk];
+		}
+
+		BuildPrim* out = &scratch[first];
+
+		ParallelForChunks(&pool, count, chunkSize, [&](unsigned int chunk, unsigned int start, unsigned int end)
+		{
+			unsigned int left = leftOffsets[chunk];
+			unsigned int right = rightOffsets[chunk];
+
+			for (unsigned int i = start; i < end; ++i)
+			{
+				if (goesLeft(prims[i]))
+				{
+					out[left++] = prims[i];
+				}
+				else
+				{
+					out[right++] = prims[i];
+				}
+			}
+		});
+
+		ParallelForChunks(&pool, count, chunkSize, [&](unsigned int, unsigned int start, unsigned int end)
+		{
+			std::copy(out + start, out + end, prims + start);
+		});
+	}
+	else
+	{
+		// Only big nodes get here, so this is always too many for a leaf
+		leftCount = MedianSplit(prims, count, centreBounds);
+	}
+
+	if (leftCount == 0 || leftCount == count)
+	{
+		leftCount = count / 2;
+	}
+
+	unsigned int leftIndex = AddChildren(nodes, task.nodeIndex, leftCount);
+
+	children.push_back({ leftIndex, task.depth + 1 });
+	children.push_back({ leftIndex + 1, task.depth + 1 });
+}
+
+// Splits the nodes near the root across all the threads until they're small enough, then builds the subtrees under them in parallel
+static void BuildParallel(std::vector<BuildPrim>& prims, std::vector<BVHNode>& nodes, ThreadPool& pool)
+{
+	unsigned int primCount = (unsigned int)prims.size();
+	unsigned int subtreeMin = std::max(subtreeTaskMin, primCount / (pool.GetThreadCount() * subtreeTasksPerThread));
+
+	std::vector<BuildPrim> scratch(primCount);
+
+	// The top of the tree, a level at a time
+
+	std::vector<BuildTask> subtrees;
+	std::vector<BuildTask> level;
+	std::vector<BuildTask> nextLevel;
+
+	level.push_back({ 0, 0 });
+
+	while (!level.empty())
+	{
+		nextLevel.clear();
+
+		for (const BuildTask& task : level)
+		{
+			if (nodes[task.nodeIndex].count < subtreeMin)
+			{
+				subtrees.push_back(task);
+			}
+			else
+			{
+				SplitNodeParallel(prims, nodes, task, scratch, pool, nextLevel);
+			}
+		}
+
+		level.swap(nextLevel);
+	}
+
+	// Biggest first, so a large subtree isn't left starting on its own at the end
+	std::sort(subtrees.begin(), subtrees.end(), [&](const BuildTask& a, const BuildTask& b) { return nodes[a.nodeIndex].count > nodes[b.nodeIndex].count; });
+
+	// Each subtree is built into its own list of nodes starting with a copy of its root, so threads don't share anything they write
+	std::vector<std::vector<BVHNode>> subtreeNodes(subtrees.size());
+
+	pool.ParallelFor((unsigned int)subtrees.size(), [&](unsigned int index, unsigned int)
+	{
+		std::vector<BVHNode>& local = subtreeNodes[index];
+
+		local.push_back(nodes[subtrees[index].nodeIndex]);
+
+		BuildSubtree(prims, local, 0, subtrees[index].depth);
+	});
+
+	// Then they're copied onto the end of the tree one after another, with their child indices moved to match
+	std::vector<unsigned int> offsets(subtrees.size());
+	unsigned int nodeCount = (unsigned int)nodes.size();
+
+	for (size_t i = 0; i < subtrees.size(); ++i)
+	{
+		offsets[i] = nodeCount;
+		nodeCount += (unsigned int)subtreeNodes[i].size() - 1;
+	}
+
+	nodes.resize(nodeCount);
+
+	pool.ParallelFor((unsigned int)subtrees.size(), [&](unsigned int index, unsigned int)
+	{
+		const std::vector<BVHNode>& local = subtreeNodes[index];
+
+		// Local node i > 0 goes to offset + i - 1, the local root replaces the node it was copied from
+		unsigned int offset = offsets[index];
+
+		for (size_t i = 0; i < local.size(); ++i)
+		{
+			BVHNode node = local[i];
+
+			if (!node.IsLeaf())
+			{
+				node.leftFirst = offset + node.leftFirst - 1;
+			}
+
+			nodes[i == 0 ? subtrees[index].nodeIndex : offset + (unsigned int)i - 1] = node;
+		}
+
+		// Free each list as soon as it's copied, these can be big
+		std::vector<BVHNode>().swap(subtreeNodes[index]);
+	});
+}
+
+
+// Builds the tree over primitives sorted along a Morton curve, after Karras, "Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees"
+// Neighbouring primitives in the sorted list are close in space, and every node's primitives are one run of the list,
+// split where the highest bit of Morton code changes within the run
+// primIndices gets the sorted order, so leaves point into it the same as they do after the SAH build
+static void BuildLinear(const std::vector<AABB>& primBounds, int mortonBits, ThreadPool* pool, std::vector<BVHNode>& nodes, std::vector<unsigned int>& primIndices)
+{
+	unsigned int primCount = (unsigned int)primBounds.size();
+	unsigned int chunkCount = (primCount + chunkSize - 1) / chunkSize;
+
+	// The Morton codes place centres within the box around all of them
+
+	std::vector<AABB> chunkCentreBounds(chunkCount);
+
+	ParallelForChunks(pool, primCount, chunkSize, [&](unsigned int chunk, unsigned int start, unsigned int end)
+	{
+		for (unsigned int i = start; i < end; ++i)
+		{
+			chunkCentreBounds[chunk].Grow(primBounds[i].Centre());
+		}
+	});
+
+	AABB centreBounds;
+
+	for (const AABB& box : chunkCentreBounds)
+	{
+		centreBounds.Grow(box);
+	}
+
+	int axisBits = mortonBits / 3;
+	float cells = (float)(1u << axisBits);
+
+	glm::vec3 scales(0.0f);
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float extent = centreBounds.max[axis] - centreBounds.min[axis];
+
+		if (extent > 0.0f)
+		{
+			scales[axis] = cells / extent;
+		}
+	}
+
+	std::vector<unsigned long long> codes(primCount);
+
+	ParallelForChunks(pool, primCount, chunkSize, [&](unsigned int, unsigned int start, unsigned int end)
+	{
+		for (unsigned int i = start; i < end; ++i)
+		{
+			glm::vec3 cell = glm::min((primBounds[i].Centre() - centreBounds.min) * scales, glm::vec3(cells - 1.0f));
+
+			if (axisBits <= 10)
+			{
+				codes[i] = glm::bitfieldInterleave((glm::uint16)cell.x, (glm::uint16)cell.y, (glm::uint16)cell.z);
+			}
+			else
+			{
+				codes[i] = glm::bitfieldInterleave((glm::uint32)cell.x, (glm::uint32)cell.y, (glm::uint32)cell.z);
+			}
+
+			primIndices[i] = i;
+		}
+	});
+
+	RadixSort::Sort(codes, primIndices, mortonBits, pool);
+
+	// Every intermediate node is found on its own from the codes around it, so they're shared out in chunks
+	// Primitives with the same code are told apart by their place in the list, so codes never need to be unique
+
+	int count = (int)primCount;
+
+	auto commonPrefix = [&](int i, int j)
+	{
+		if (j < 0 || j >= count)
+		{
+			return -1;
+		}
+
+		if (codes[i] == codes[j])
+		{
+			return 64 + LeadingZeros64((unsigned long long)(i ^ j));
+		}
+
+		return LeadingZeros64(codes[i] ^ codes[j]);
+	};
+
+	std::vector<LinearNode> linearNodes(primCount - 1);
+
+	ParallelForChunks(pool, primCount - 1, chunkSize, [&](unsigned int, unsigned int start, unsigned int end)
+	{
+		for (int i = (int)start; i < (int)end; ++i)
+		{
+			// The node reaches out from i in the direction of the neighbour sharing more of its code
+			int direction = commonPrefix(i, i + 1) > commonPrefix(i, i - 1) ? 1 : -1;
+			int minPrefix = commonPrefix(i, i - direction);
+
+			// Find the other end of the range, the last primitive sharing more than minPrefix bits with i
+			int maxLength = 2;
+
+			while (commonPrefix(i, i + maxLength * direction) > minPrefix)
+			{
+				maxLength *= 2;
+			}
+
+			int length = 0;
+
+			for (int step = maxLength / 2; step >= 1; step /= 2)
+			{
+				if (commonPrefix(i, i + (length + step) * direction) > minPrefix)
+				{
+					length += step;
+				}
+			}
+
+			int j = i + length * direction;
+
+			// Then the split, the furthest point from i that still shares more bits with it than the whole range does
+			int nodePrefix = commonPrefix(i, j);
+			int split = 0;
+
+			for (int divisor = 2; ; divisor *= 2)
+			{
+				int step = (length + divisor - 1) / divisor;
+
+				if (commonPrefix(i, i + (split + step) * direction) > nodePrefix)
+				{
+					split += step;
+				}
+
+				if (step == 1)
+				{
+					break;
+				}
+			}
+
+			linearNodes[i].first = (unsigned int)std::min(i, j);
+			linearNodes[i].last = (unsigned int)std::max(i, j);
+			linearNodes[i].split = (unsigned int)(i + split * direction + std::min(direction, 0));
+		}
+	});
+
+	// Lay the intermediate tree out as BVH nodes, both children next to each other
+	// nodes is its own queue, an inner node's leftFirst holds the intermediate node it stands for until its children are added,
+	// so the loop makes the whole tree in one pass, finishing with the last node added
+	// A child covering linearLeafSize primitives or fewer becomes a leaf straight away rather than being split any further
+
+	nodes.reserve(2 * primCount - 1);
+
+	auto addNode = [&](unsigned int first, unsigned int last, unsigned int linearIndex)
+	{
+		BVHNode node;
+
+		if (last - first < linearLeafSize)
+		{
+			node.leftFirst = first;
+			node.count = last - first + 1;
+		}
+		else
+		{
+			node.leftFirst = linearIndex;
+			node.count = 0;
+		}
+
+		nodes.push_back(node);
+	};
+
+	addNode(0, primCount - 1, 0);
+
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		if (nodes[i].IsLeaf())
+		{
+			continue;
+		}
+
+		const LinearNode& linearNode = linearNodes[nodes[i].leftFirst];
+
+		nodes[i].leftFirst = (unsigned int)nodes.size();
+
+		addNode(linearNode.first, linearNode.split, linearNode.split);
+		addNode(linearNode.split + 1, linearNode.last, linearNode.split + 1);
+	}
+
+	// Children always come after their parents, so going backwards every inner node's children already have their bounds
+	// The leaves have no such order and are done first, across the pool
+
+	ParallelForChunks(pool, (unsigned int)nodes.size(), chunkSize, [&](unsigned int, unsigned int start, unsigned int end)
+	{
+		for (unsigned int i = start; i < end; ++i)
+		{
+			BVHNode& node = nodes[i];
+
+			if (!node.IsLeaf())
+			{
+				continue;
+			}
+
+			AABB bounds;
+
+			for (unsigned int j = node.leftFirst; j < node.leftFirst + node.count; ++j)
+			{
+				bounds.Grow(primBounds[primIndices[j]]);
+			}
+
+			node.boundsMin = bounds.min;
+			node.boundsMax = bounds.max;
+		}
+	});
+
+	for (size_t i = nodes.size(); i-- > 0;)
+	{
+		BVHNode& node = nodes[i];
+
+		if (!node.IsLeaf())
+		{
+			const BVHNode& left = nodes[node.leftFirst];
+			const BVHNode& right = nodes[node.leftFirst + 1];
+
+			node.boundsMin = glm::min(left.boundsMin, right.boundsMin);
+			node.boundsMax = glm::max(left.boundsMax, right.boundsMax);
+		}
+	}
+}
+
+
+// Builds the tree top down by the surface area heuristic, in parallel if there's a pool
+static void BuildSah(const std::vector<AABB>& primBounds, ThreadPool* pool, std::vector<BVHNode>& nodes, std::vector<unsigned int>& primIndices)
+{
+	unsigned int primCount = (unsigned int)primBounds.size();
+
+	std::vector<BuildPrim> prims(primCount);
+
+	ParallelForChunks(pool, primCount, chunkSize, [&](unsigned int, unsigned int start, unsigned int end)
+	{
+		for (unsigned int i = start; i < end; ++i)
+		{
+			prims[i].boundsMin = primBounds[i].min;
+			prims[i].boundsMax = primBounds[i].max;
+			prims[i].index = i;
+			prims[i].padding = 0;
+		}
+	});
+
+	BVHNode root;
+	root.leftFirst = 0;
+	root.count = primCount;
+
+	if (pool != nullptr)
+	{
+		nodes.push_back(root);
+
+		BuildParallel(prims, nodes, *pool);
+	}
+	else
+	{
+		// A binary tree with one primitive per leaf has 2N - 1 nodes, so this is the most we can need
+		nodes.reserve(2 * primCount - 1);
+		nodes.push_back(root);
+
+		BuildSubtree(prims, nodes, 0, 0);
+	}
+
+	// The leaves' runs of prims are now in order, all the caller needs is where each one came from
+	ParallelForChunks(pool, primCount, chunkSize, [&](unsigned int, unsigned int start, unsigned int end)
+	{
+		for (unsigned int i = start; i < end; ++i)
+		{
+			primIndices[i] = prims[i].index;
+		}
+	});
+}
+
+
+const char* BVHBuilderName(BVHBuilder builder)
+{
+	switch (builder)
+	{
+	case BVHBuilder::Linear30:
+		return "LBVH 30 bit";
+	case BVHBuilder::Linear63:
+		return "LBVH 63 bit";
+	default:
+		return "SAH";
+	}
+}
+
+
+void BVH::Build(const std::vector<AABB>& primBounds, ThreadPool* pool, BVHBuilder builder)
+{
+	auto startTime = std::chrono::steady_clock::now();
+
+	unsigned int primCount = (unsigned int)primBounds.size();
+
+	nodes.clear();
+	primIndices.resize(primCount);
+	refitTimeMs = 0.0;
+	mappedNodes = nullptr;
+	mappedNodeCount = 0;
+
+	if (primCount == 0)
+	{
+		buildTimeMs = 0.0;
+		builtSahCost = 0.0f;
+		sahCost = 0.0f;
+		return;
+	}
+
+	bool parallel = pool != nullptr && pool->GetThreadCount() > 1 && primCount >= parallelBuildMin;
+
+	// Both builders only take the pool when it's worth using
+	ThreadPool* buildPool = parallel ? pool : nullptr;
+
+	if (builder == BVHBuilder::SAH)
+	{
+		BuildSah(primBounds, buildPool, nodes, primIndices);
+	}
+	else
+	{
+		BuildLinear(primBounds, builder == BVHBuilder::Linear30 ? 30 : 63, buildPool, nodes, primIndices);
+	}
+
+	// The serial builds reserve room for the most nodes there could be, give back what wasn't used
+	nodes.shrink_to_fit();
+
+	buildTimeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+	// Kept so refits can tell how far they've loosened the tree
+	builtSahCost = CalculateSahCost();
+	sahCost = builtSahCost;
+}
+
+
+void BVH::Refit(const std::vector<AABB>& primBounds, ThreadPool* pool)
+{
+	auto startTime = std::chrono::steady_clock::now();
+
+	if (nodes.empty())
+	{
+		refitTimeMs = 0.0;
+		return;
+	}
+
+	// Sets one node's bounds from its primitives, or from its children which must already be done, and returns its share of the SAH cost
+	auto refitNode = [&](unsigned int index)
+	{
+		BVHNode& node = nodes[index];
+
+		if (node.IsLeaf())
+		{
+			AABB bounds;
+
+			for (unsigned int i = node.leftFirst; i < node.leftFirst + node.count; ++i)
+			{
+				bounds.Grow(primBounds[primIndices[i]]);
+			}
+
+			node.boundsMin = bounds.min;
+			node.boundsMax = bounds.max;
+		}
+		else
+		{
+			const BVHNode& left = nodes[node.leftFirst];
+			const BVHNode& right = nodes[node.leftFirst + 1];
+
+			node.boundsMin = glm::min(left.boundsMin, right.boundsMin);
+			node.boundsMax = glm::max(left.boundsMax, right.boundsMax);
+		}
+
+		return NodeCost(node);
+	};
+
+	// Every builder adds children after their parents, so going backwards through the nodes always reaches children first
+	double cost = 0.0;
+
+	if (pool == nullptr || pool->GetThreadCount() == 1 || nodes.size() < parallelBuildMin)
+	{
+		for (size_t i = nodes.size(); i-- > 0;)
+		{
+			cost += refitNode((unsigned int)i);
+		}
+	}
+	else
+	{
+		// Split the top of the tree a level at a time, until there are enough subtrees under it to share out
+
+		unsigned int subtreeTarget = pool->GetThreadCount() * subtreeTasksPerThread;
+
+		std::vector<unsigned int> topNodes;
+		std::vector<unsigned int> subtrees(1, 0);
+		std::vector<unsigned int> nextLevel;
+
+		while (subtrees.size() < subtreeTarget)
+		{
+			nextLevel.clear();
+
+			for (unsigned int index : subtrees)
+			{
+				if (nodes[index].IsLeaf())
+				{
+					nextLevel.push_back(index);
+				}
+				else
+				{
+					topNodes.push_back(index);
+					nextLevel.push_back(nodes[index].leftFirst);
+					nextLevel.push_back(nodes[index].leftFirst + 1);
+				}
+			}
+
+			// Nothing left to split, the whole tree is near the top
+			if (nextLevel.size() == subtrees.size())
+			{
+				break;
+			}
+
+			subtrees.swap(nextLevel);
+		}
+
+		std::vector<double> subtreeCosts(subtrees.size());
+
+		pool->ParallelFor((unsigned int)subtrees.size(), [&](unsigned int task, unsigned int)
+		{
+			// A walk down the subtree visits parents before their children, so doing it backwards refits them in the right order
+			std::vector<unsigned int> order;
+			std::vector<unsigned int> stack(1, subtrees[task]);
+
+			while (!stack.empty())
+			{
+				unsigned int index = stack.back();
+				stack.pop_back();
+
+				order.push_back(index);
+
+				// Left first, the order the builders add nodes in, so the walk goes through memory mostly forwards
+				if (!nodes[index].IsLeaf())
+				{
+					stack.push_back(nodes[index].leftFirst + 1);
+					stack.push_back(nodes[index].leftFirst);
+				}
+			}
+
+			double subtreeCost = 0.0;
+
+			for (size_t i = order.size(); i-- > 0;)
+			{
+				subtreeCost += refitNode(order[i]);
+			}
+
+			subtreeCosts[task] = subtreeCost;
+		});
+
+		for (double subtreeCost : subtreeCosts)
+		{
+			cost += subtreeCost;
+		}
+
+		// The top nodes were added a level at a time, so backwards they're also children first
+		for (size_t i = topNodes.size(); i-- > 0;)
+		{
+			cost += refitNode(topNodes[i]);
+		}
+	}
+
+	AABB rootBox;
+	rootBox.min = nodes[0].boundsMin;
+	rootBox.max = nodes[0].boundsMax;
+
+	float rootArea = rootBox.SurfaceArea();
+
+	sahCost = rootArea > 0.0f ? (float)(cost / rootArea) : intersectCost * nodes[0].count;
+
+	refitTimeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+
+float BVH::CalculateSahCost() const
+{
+	if (!IsBuilt())
+	{
+		return 0.0f;
+	}
+
+	const BVHNode* nodeData = GetNodes();
+	unsigned int nodeCount = GetNodeCount();
+
+	AABB rootBox;
+	rootBox.min = nodeData[0].boundsMin;
+	rootBox.max = nodeData[0].boundsMax;
+
+	float rootArea = rootBox.SurfaceArea();
+
+	if (rootArea <= 0.0f)
+	{
+		return intersectCost * nodeData[0].count;
+	}
+
+	// Each node is paid for by the fraction of rays that reach it, which goes with its surface area
+	double cost = 0.0;
+
+	for (unsigned int i = 0; i < nodeCount; i++)
+	{
+		cost += NodeCost(nodeData[i]);
+	}
+
+	return (float)(cost / rootArea);
+}
+
+
+void BVH::Save(SceneCache::Writer& writer) const
+{
+	writer.Write(GetNodes(), GetNodeCount());
+}
+
+bool BVH::Map(SceneCache::Reader& reader, unsigned int primCount)
+{
+	size_t nodeCount = 0;
+	const BVHNode* cachedNodes = reader.Read<BVHNode>(nodeCount);
+
+	if (cachedNodes == nullptr)
+	{
+		return false;
+	}
+
+	// Traversal follows whatever indices it finds, so a damaged cache has to be caught here rather than read out of bounds later
+	// The builders always add children after their parent, which also rules out loops, so one pass in order finds each node's depth
+	std::vector<unsigned char> depths(nodeCount, 0);
+
+	for (size_t i = 0; i < nodeCount; i++)
+	{
+		const BVHNode& node = cachedNodes[i];
+
+		if (node.IsLeaf())
+		{
+			if ((unsigned long long)node.leftFirst + node.count > primCount)
+			{
+				return false;
+			}
+
+			continue;
+		}
+
+		if (node.leftFirst <= i || (size_t)node.leftFirst + 1 >= nodeCount || depths[i] + 2 > traversalStackSize)
+		{
+			return false;
+		}
+
+		for (size_t child = node.leftFirst; child <= (size_t)node.leftFirst + 1; child++)
+		{
+			depths[child] = std::max(depths[child], (unsigned char)(depths[i] + 1));
+		}
+	}
+
+	nodes.clear();
+	nodes.shrink_to_fit();
+	primIndices.clear();
+	primIndices.shrink_to_fit();
+
+	// The SAH cost would be another pass over every node, for a number only the statistics print
+	mappedNodes = nodeCount > 0 ? cachedNodes : nullptr;
+	mappedNodeCount = (unsigned int)nodeCount;
+	buildTimeMs = 0.0;
+	refitTimeMs = 0.0;
+	builtSahCost = 0.0f;
+	sahCost = 0.0f;
+
+	return true;
+}
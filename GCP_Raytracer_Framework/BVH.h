@@ -0,0 +1,544 @@
+#pragma once
+
+#include "GCP_GFX_Framework.h"
+#include "Ray.h"
+#include "RayPacket.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "SceneCache.h"
+
+#include <cfloat>
+#include <vector>
+
+// Axis aligned bounding box
+struct AABB
+{
+	glm::vec3 min = glm::vec3(FLT_MAX);
+
+	glm::vec3 max = glm::vec3(-FLT_MAX);
+
+	void Grow(const glm::vec3& point)
+	{
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+
+	void Grow(const AABB& box)
+	{
+		min = glm::min(min, box.min);
+		max = glm::max(max, box.max);
+	}
+
+	glm::vec3 Centre() const
+	{
+		return (min + max) * 0.5f;
+	}
+
+	float SurfaceArea() const
+	{
+		glm::vec3 size = max - min;
+
+		// An empty box has negative size
+		if (size.x < 0.0f)
+		{
+			return 0.0f;
+		}
+
+		return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+	}
+};
+
+// 32 bytes, so two nodes fit in a cache line
+struct BVHNode
+{
+	glm::vec3 boundsMin;
+
+	// Inner nodes: index of the left child, the right child is always the next node
+	// Leaves: index of the first primitive in the BVH's primitive index list
+	unsigned int leftFirst;
+
+	glm::vec3 boundsMax;
+
+	// Number of primitives in a leaf, 0 for inner nodes
+	unsigned int count;
+
+	bool IsLeaf() const { return count > 0; }
+};
+
+// Ways of building a BVH, the SAH build makes faster trees and the linear builds make them much sooner
+enum class BVHBuilder
+{
+	// Binned surface area heuristic
+	SAH,
+
+	// Linear BVH from primitives sorted along a Morton curve, with 10 bits a axis
+	Linear30,
+
+	// The same with 21 bits a axis, slower to sort but keeps big or clustered scenes from piling up in one cell
+	Linear63
+};
+
+const char* BVHBuilderName(BVHBuilder builder);
+
+// Bounding volume hierarchy over a list of primitive bounding boxes
+// It knows nothing about the primitives themselves, the caller intersects them when traversal reaches a leaf
+class BVH
+{
+	private:
+
+		std::vector<BVHNode> nodes;
+
+		// Leaves point at a run of entries in here, which index the original primitive list
+		std::vector<unsigned int> primIndices;
+
+		double buildTimeMs = 0.0;
+
+		double refitTimeMs = 0.0;
+
+		// SAH cost straight after the last build, and as of the last build or refit
+		float builtSahCost = 0.0f;
+
+		float sahCost = 0.0f;
+
+		// Nodes that live in a mapped scene cache, used instead of nodes when set
+		const BVHNode* mappedNodes = nullptr;
+
+		unsigned int mappedNodeCount = 0;
+
+		// Entries in the traversal stacks, a walk down holds at most one per level, so this is deep enough for any tree the builders make
+		static const int traversalStackSize = 128;
+
+	public:
+
+		// Most primitives a leaf will hold
+		static const unsigned int maxLeafSize = 8;
+
+		// The SAH build goes top down, splitting each node where the binned surface area heuristic says is cheapest
+		// With a pool, the big nodes near the root are binned and partitioned across all of its threads,
+		// then the subtrees under them are built as separate tasks, one thread each
+		// The linear builds radix sort the primitives by the Morton code of their centres, then make the whole hierarchy in one pass over the sorted codes
+		void Build(const std::vector<AABB>& primBounds, ThreadPool* pool = nullptr, BVHBuilder builder = BVHBuilder::SAH);
+
+		bool IsBuilt() const { return GetNodeCount() > 0; }
+
+		const BVHNode* GetNodes() const { return mappedNodes != nullptr ? mappedNodes : nodes.data(); }
+
+		unsigned int GetNodeCount() const { return mappedNodes != nullptr ? mappedNodeCount : (unsigned int)nodes.size(); }
+
+		// Only kept by BVHs built here, a mapped one has none
+		const std::vector<unsigned int>& GetPrimIndices() const { return primIndices; }
+
+		// Writes the nodes to a scene cache
+		void Save(SceneCache::Writer& writer) const;
+
+		// Uses the nodes in a scene cache where they are, until the next Build
+		// A mapped BVH can't be refitted, as that needs the primitive order it was built with
+		// Fails unless every node stays inside the tree, every leaf inside primCount primitives, and the tree is shallow enough to walk
+		bool Map(SceneCache::Reader& reader, unsigned int primCount);
+
+		bool IsMapped() const { return mappedNodes != nullptr; }
+
+		// Bytes held by the nodes and primitive index list
+		size_t GetMemoryBytes() const { return nodes.capacity() * sizeof(BVHNode) + primIndices.capacity() * sizeof(unsigned int); }
+
+		double GetBuildTimeMs() const { return buildTimeMs; }
+
+		// Updates the bounds of every node after primitives have moved, keeping the shape of the tree
+		// primBounds must hold the same primitives in the same order as the last Build
+		// Much quicker than building again, but the further primitives move from where they were built the looser the tree gets
+		// With a pool, subtrees near the bottom are refitted by separate tasks before the nodes above them
+		void Refit(const std::vector<AABB>& primBounds, ThreadPool* pool = nullptr);
+
+		double GetRefitTimeMs() const { return refitTimeMs; }
+
+		// Expected cost of tracing a ray through the tree by the surface area heuristic, lower is better
+		float CalculateSahCost() const;
+
+		// SAH cost after the last refit over the cost when the tree was built, 1 straight after a build
+		// Shows how much refitting has loosened the tree, so the caller can tell when it's worth building again
+		float GetSahCostRatio() const { return builtSahCost > 0.0f ? sahCost / builtSahCost : 1.0f; }
+
+		// Walks the tree nearest child first, calling intersectLeaf(first, count, tMax) for each leaf the ray reaches before tMax
+		// intersectLeaf should test primitives primIndices[first] to primIndices[first + count - 1] and pull tMax in to any closer hit
+		// Starts from the node at index root, the whole tree by default
+		// Returns the number of nodes visited
+		template<typename IntersectLeaf>
+		unsigned int Traverse(const Ray& ray, float& tMax, IntersectLeaf intersectLeaf, unsigned int root = 0) const;
+
+		// Walks the tree with every ray of a packet at once, calling intersectLeaf(first, count, mask) for each leaf any of the rays in mask still reaches
+		// intersectLeaf should test the rays in mask, bit i for ray i, against the leaf's primitives and pull their packet.tMax in to any closer hit
+		// A node that the bounds of the whole packet show none of its rays can reach is skipped with one interval test,
+		// otherwise its rays are tested 4 at a time with SSE and the ones that hit it are carried down as a lane mask
+		// Once fewer than a quarter of the packet's rays reach a node, or if the packet isn't coherent, the rays left go on one at a time through Traverse,
+		// which calls intersectRay(ray, first, count, tMax) for ray number ray where intersectLeaf would have been called
+		// Returns the number of nodes visited, counting a node the packet visits once however many of its rays test it
+		template<typename IntersectLeaf, typename IntersectRay>
+		unsigned int TraversePacket(RayPacket& packet, IntersectLeaf intersectLeaf, IntersectRay intersectRay) const;
+
+		// For occlusion, where any hit will do, so the walk stops at the first leaf that has one
+		// The nearer child is still taken first, as for Traverse, though tMax never shrinks so nothing gets culled by it
+		// intersectLeaf(first, count, tMax) is called the same way as for Traverse but returns true if anything was hit before tMax
+		// Returns true if intersectLeaf ever did
+		template<typename IntersectLeaf>
+		bool TraverseAny(const Ray& ray, float tMax, IntersectLeaf intersectLeaf) const;
+
+		// Slab test, returns the distance the ray enters the box or FLT_MAX if it misses or enters beyond tMax
+		static float IntersectNode(const BVHNode& node, const glm::vec3& origin, const glm::vec3& invDirection, float tMax)
+		{
+			glm::vec3 t0 = (node.boundsMin - origin) * invDirection;
+			glm::vec3 t1 = (node.boundsMax - origin) * invDirection;
+
+			glm::vec3 tSmall = glm::min(t0, t1);
+			glm::vec3 tLarge = glm::max(t0, t1);
+
+			float tEnter = glm::max(glm::max(tSmall.x, tSmall.y), glm::max(tSmall.z, 0.0f));
+			float tExit = glm::min(glm::min(tLarge.x, tLarge.y), glm::min(tLarge.z, tMax));
+
+			return tEnter <= tExit ? tEnter : FLT_MAX;
+		}
+
+		// Interval test of a node against every ray of a coherent packet at once, false if none of them can hit it before maxTMax
+		// Otherwise sets tEnter to the least distance any of them could enter it at
+		static bool PacketMayHitNode(const BVHNode& node, const RayPacket& packet, float maxTMax, float& tEnter)
+		{
+			float enter = 0.0f;
+			float exit = maxTMax;
+
+			for (int axis = 0; axis < 3; axis++)
+			{
+				// Every ray in the packet enters through the same face on each axis, the one facing against their direction
+				bool negative = packet.invDirectionMax[axis] < 0.0f;
+				float nearPlane = negative ? node.boundsMax[axis] : node.boundsMin[axis];
+				float farPlane = negative ? node.boundsMin[axis] : node.boundsMax[axis];
+
+				// Least distance to the near face and most distance to the far face over every origin and inverse direction in the packet
+				float nearLow = nearPlane - packet.originMax[axis];
+				float nearHigh = nearPlane - packet.originMin[axis];
+				float farLow = farPlane - packet.originMax[axis];
+				float farHigh = farPlane - packet.originMin[axis];
+
+				float nearMin = glm::min(glm::min(nearLow * packet.invDirectionMin[axis], nearLow * packet.invDirectionMax[axis]),
+					glm::min(nearHigh * packet.invDirectionMin[axis], nearHigh * packet.invDirectionMax[axis]));
+				float farMax = glm::max(glm::max(farLow * packet.invDirectionMin[axis], farLow * packet.invDirectionMax[axis]),
+					glm::max(farHigh * packet.invDirectionMin[axis], farHigh * packet.invDirectionMax[axis]));
+
+				enter = glm::max(enter, nearMin);
+				exit = glm::min(exit, farMax);
+			}
+
+			tEnter = enter;
+
+			return enter <= exit;
+		}
+
+		// Slab test of the 4 rays of a packet starting at ray first, returns a bit for each one that hits the node before its tMax
+		// The same sums as IntersectNode, so a ray gets the same answer either way
+		static unsigned int IntersectNodeGroup(const BVHNode& node, const RayPacket& packet, unsigned int first)
+		{
+			__m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.x), _mm_load_ps(&packet.originX[first])), _mm_load_ps(&packet.invDirectionX[first]));
+			__m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.y), _mm_load_ps(&packet.originY[first])), _mm_load_ps(&packet.invDirectionY[first]));
+			__m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.z), _mm_load_ps(&packet.originZ[first])), _mm_load_ps(&packet.invDirectionZ[first]));
+			__m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.x), _mm_load_ps(&packet.originX[first])), _mm_load_ps(&packet.invDirectionX[first]));
+			__m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.y), _mm_load_ps(&packet.originY[first])), _mm_load_ps(&packet.invDirectionY[first]));
+			__m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.z), _mm_load_ps(&packet.originZ[first])), _mm_load_ps(&packet.invDirectionZ[first]));
+
+			__m128 tEnter = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_setzero_ps()));
+			__m128 tExit = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_load_ps(&packet.tMax[first])));
+
+			return (unsigned int)_mm_movemask_ps(_mm_cmple_ps(tEnter, tExit));
+		}
+};
+
+
+template<typename IntersectLeaf>
+unsigned int BVH::Traverse(const Ray& ray, float& tMax, IntersectLeaf intersectLeaf, unsigned int root) const
+{
+	if (!IsBuilt())
+	{
+		return 0;
+	}
+
+	const BVHNode* nodeData = GetNodes();
+
+	glm::vec3 invDirection = 1.0f / ray.direction;
+
+	const BVHNode* stack[traversalStackSize];
+	int stackSize = 0;
+
+	const BVHNode* node = &nodeData[root];
+	unsigned int visited = 1;
+
+	if (IntersectNode(*node, ray.origin, invDirection, tMax) == FLT_MAX)
+	{
+		return visited;
+	}
+
+	while (true)
+	{
+		if (node->IsLeaf())
+		{
+			intersectLeaf(node->leftFirst, node->count, tMax);
+		}
+		else
+		{
+			const BVHNode* near = &nodeData[node->leftFirst];
+			const BVHNode* far = near + 1;
+
+			float tNear = IntersectNode(*near, ray.origin, invDirection, tMax);
+			float tFar = IntersectNode(*far, ray.origin, invDirection, tMax);
+			visited += 2;
+
+			if (tFar < tNear)
+			{
+				std::swap(near, far);
+				std::swap(tNear, tFar);
+			}
+
+			if (tNear != FLT_MAX)
+			{
+				// Come back to the far child later, if the near one doesn't find a hit in front of it
+				if (tFar != FLT_MAX)
+				{
+					stack[stackSize++] = far;
+				}
+
+				node = near;
+				continue;
+			}
+		}
+
+		// Pop the next node that the ray still reaches
+		bool found = false;
+
+		while (stackSize > 0)
+		{
+			node = stack[--stackSize];
+
+			if (IntersectNode(*node, ray.origin, invDirection, tMax) != FLT_MAX)
+			{
+				found = true;
+				break;
+			}
+		}
+
+		if (!found)
+		{
+			return visited;
+		}
+	}
+}
+
+template<typename IntersectLeaf, typename IntersectRay>
+unsigned int BVH::TraversePacket(RayPacket& packet, IntersectLeaf intersectLeaf, IntersectRay intersectRay) const
+{
+	if (!IsBuilt() || packet.count == 0)
+	{
+		return 0;
+	}
+
+	const BVHNode* nodeData = GetNodes();
+	unsigned int visited = 0;
+
+	// Rays that have gone their own way finish the walk from nodeIndex down on their own
+	auto traceAlone = [&](unsigned int nodeIndex, unsigned long long mask)
+	{
+		for (; mask != 0; mask &= mask - 1)
+		{
+			unsigned int ray = (unsigned int)FirstSetBit64(mask);
+
+			visited += Traverse(packet.rays[ray], packet.tMax[ray], [&](unsigned int first, unsigned int count, float& tMax)
+			{
+				intersectRay(ray, first, count, tMax);
+			}, nodeIndex);
+		}
+	};
+
+	if (!packet.coherent)
+	{
+		traceAlone(0, packet.GetFullMask());
+		return visited;
+	}
+
+	// Furthest any ray might still find a hit, only pulled in after leaves as that's the only place tMax changes
+	float packetTMax = 0.0f;
+
+	for (unsigned int i = 0; i < packet.count; i++)
+	{
+		packetTMax = glm::max(packetTMax, packet.tMax[i]);
+	}
+
+	// Which of the rays in mask hit the node, only testing the groups that have any
+	auto testNode = [&](const BVHNode& node, unsigned long long mask, float& tEnter)
+	{
+		visited++;
+
+		unsigned long long hits = 0;
+
+		if (PacketMayHitNode(node, packet, packetTMax, tEnter))
+		{
+			for (unsigned int group = 0; group < packet.GetGroupCount(); group++)
+			{
+				unsigned int shift = group * RayPacket::groupSize;
+				unsigned int groupMask = (unsigned int)(mask >> shift) & 0xfu;
+
+				if (groupMask != 0)
+				{
+					hits |= (unsigned long long)(IntersectNodeGroup(node, packet, shift) & groupMask) << shift;
+				}
+			}
+		}
+
+		return hits;
+	};
+
+	// Nodes to come back to, with the rays that reached them when they were pushed
+	struct PacketStackEntry
+	{
+		unsigned int node;
+
+		unsigned long long mask;
+	};
+
+	PacketStackEntry stack[traversalStackSize];
+	int stackSize = 0;
+
+	// Once fewer than a quarter of the rays are left, tracing them together costs more than it saves
+	unsigned int divergedRays = (packet.count + 3) / 4;
+
+	float tEnter;
+	unsigned int nodeIndex = 0;
+	unsigned long long mask = testNode(nodeData[0], packet.GetFullMask(), tEnter);
+
+	while (true)
+	{
+		if (mask != 0 && (unsigned int)CountSetBits64(mask) < divergedRays)
+		{
+			traceAlone(nodeIndex, mask);
+		}
+		else if (mask != 0 && nodeData[nodeIndex].IsLeaf())
+		{
+			const BVHNode& node = nodeData[nodeIndex];
+
+			intersectLeaf(node.leftFirst, node.count, mask);
+
+			packetTMax = 0.0f;
+
+			for (unsigned int i = 0; i < packet.count; i++)
+			{
+				packetTMax = glm::max(packetTMax, packet.tMax[i]);
+			}
+		}
+		else if (mask != 0)
+		{
+			unsigned int near = nodeData[nodeIndex].leftFirst;
+			unsigned int far = near + 1;
+
+			float tNear;
+			float tFar;
+
+			unsigned long long nearMask = testNode(nodeData[near], mask, tNear);
+			unsigned long long farMask = testNode(nodeData[far], mask, tFar);
+
+			// Nearer by the closest any ray could enter it, the rays all head the same way so this is usually the one most of them reach first
+			if (farMask != 0 && (nearMask == 0 || tFar < tNear))
+			{
+				std::swap(near, far);
+				std::swap(nearMask, farMask);
+			}
+
+			if (nearMask != 0)
+			{
+				if (farMask != 0)
+				{
+					stack[stackSize++] = { far, farMask };
+				}
+
+				nodeIndex = near;
+				mask = nearMask;
+				continue;
+			}
+		}
+
+		// Pop the next node that any of its rays still reach, their tMax may have been pulled in since it was pushed
+		mask = 0;
+
+		while (stackSize > 0 && mask == 0)
+		{
+			PacketStackEntry entry = stack[--stackSize];
+
+			nodeIndex = entry.node;
+			mask = testNode(nodeData[nodeIndex], entry.mask, tEnter);
+		}
+
+		if (mask == 0)
+		{
+			return visited;
+		}
+	}
+}
+
+template<typename IntersectLeaf>
+bool BVH::TraverseAny(const Ray& ray, float tMax, IntersectLeaf intersectLeaf) const
+{
+	if (!IsBuilt())
+	{
+		return false;
+	}
+
+	const BVHNode* nodeData = GetNodes();
+
+	glm::vec3 invDirection = 1.0f / ray.direction;
+
+	const BVHNode* stack[traversalStackSize];
+	int stackSize = 0;
+
+	// tMax never moves, so a node is only tested once, when it's reached
+	if (IntersectNode(nodeData[0], ray.origin, invDirection, tMax) == FLT_MAX)
+	{
+		return false;
+	}
+
+	stack[stackSize++] = &nodeData[0];
+
+	while (stackSize > 0)
+	{
+		const BVHNode* node = stack[--stackSize];
+
+		if (node->IsLeaf())
+		{
+			float leafTMax = tMax;
+
+			if (intersectLeaf(node->leftFirst, node->count, leafTMax))
+			{
+				return true;
+			}
+
+			continue;
+		}
+
+		const BVHNode* near = &nodeData[node->leftFirst];
+		const BVHNode* far = near + 1;
+
+		float tNear = IntersectNode(*near, ray.origin, invDirection, tMax);
+		float tFar = IntersectNode(*far, ray.origin, invDirection, tMax);
+
+		if (tFar < tNear)
+		{
+			std::swap(near, far);
+			std::swap(tNear, tFar);
+		}
+
+		// Nearer child first, -bench occlusion measures it a little quicker than taking them in the order they're stored
+		if (tFar != FLT_MAX)
+		{
+			stack[stackSize++] = far;
+		}
+
+		if (tNear != FLT_MAX)
+		{
+			stack[stackSize++] = near;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,2193 @@
+
+#include "Benchmark.h"
+#include "Sphere.h"
+#include "SphereSoA.h"
+#include "BVH.h"
+#include "Mesh.h"
+#include "InstanceBVH.h"
+#include "MeshLoader.h"
+#include "SceneCache.h"
+#include "SceneLoader.h"
+#include "RayTracer.h"
+#include "Camera.h"
+#include "WavefrontRenderer.h"
+#include "Sampler.h"
+#include "PixelFormat.h"
+#include "AllocationCounter.h"
+
+#define GLM_ENABLE_EXPERIMENTAL
+#include <GLM/gtc/matrix_transform.hpp>
+#include <GLM/gtx/intersect.hpp>
+
+#if defined(_WIN32)
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+	#include <psapi.h>
+	#pragma comment(lib, "psapi.lib")
+#endif
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+
+// Milliseconds since some fixed point, for timing
+static double NowMs()
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+// Most memory the process has held at once so far, or 0 if it can't be found out
+static size_t PeakMemoryBytes()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+	{
+		return counters.PeakWorkingSetSize;
+	}
+#else
+	std::ifstream status("/proc/self/status");
+	std::string line;
+
+	while (std::getline(status, line))
+	{
+		if (line.compare(0, 6, "VmHWM:") == 0)
+		{
+			return (size_t)std::stoull(line.substr(6)) * 1024;
+		}
+	}
+#endif
+
+	return 0;
+}
+
+
+// Bumpy square of size by size quads, two triangles each, lying in the xy plane from 0 to size
+static Mesh MakeTerrain(int size, std::mt19937& random)
+{
+	std::uniform_real_distribution<float> bumps(0.0f, 1.0f);
+
+	Mesh terrain(glm::vec3(1.0f));
+	terrain.Reserve((size + 1) * (size + 1), size * size * 2);
+
+	for (int y = 0; y <= size; ++y)
+	{
+		for (int x = 0; x <= size; ++x)
+		{
+			terrain.AddVertex(glm::vec3((float)x, (float)y, 3.0f * std::sin(x * 0.05f) * std::cos(y * 0.07f) + bumps(random)));
+		}
+	}
+
+	for (int y = 0; y < size; ++y)
+	{
+		for (int x = 0; x < size; ++x)
+		{
+			unsigned int corner = y * (size + 1) + x;
+
+			terrain.AddTriangle(corner, corner + 1, corner + size + 2);
+			terrain.AddTriangle(corner, corner + size + 2, corner + size + 1);
+		}
+	}
+
+	return terrain;
+}
+
+
+void Benchmark::ThreadScaling(TileRenderer& renderer, unsigned int maxThreads, const std::function<void(const Tile&)>& renderTile)
+{
+	// Powers of two, plus the full thread count if that isn't one already
+	std::vector<unsigned int> threadCounts;
+	for (unsigned int threads = 1; threads < maxThreads; threads *= 2)
+	{
+		threadCounts.push_back(threads);
+	}
+	threadCounts.push_back(maxThreads);
+
+	// Each count keeps its best of a few runs, so one slow run doesn't skew the curve
+	const int runsPerCount = 3;
+
+	double singleThreadMs = 0.0;
+
+	std::cout << "INFO: Thread scaling, " << renderer.GetTileCount() << " tiles of " << renderer.GetTileSize() << "x" << renderer.GetTileSize() << std::endl;
+	std::cout << "  threads     time (ms)   speedup   efficiency" << std::endl;
+
+	for (unsigned int threads : threadCounts)
+	{
+		ThreadPool pool(threads);
+
+		double bestMs = 0.0;
+
+		for (int run = 0; run < runsPerCount; ++run)
+		{
+			double start = NowMs();
+			renderer.Render(pool, renderTile);
+			double elapsed = NowMs() - start;
+
+			if (run == 0 || elapsed < bestMs)
+			{
+				bestMs = elapsed;
+			}
+		}
+
+		if (threads == 1)
+		{
+			singleThreadMs = bestMs;
+		}
+
+		double speedup = singleThreadMs / bestMs;
+
+		std::cout << std::fixed << std::setprecision(2)
+			<< "  " << std::setw(7) << threads
+			<< "  " << std::setw(12) << bestMs
+			<< "  " << std::setw(8) << speedup
+			<< "  " << std::setw(10) << (100.0 * speedup / threads) << "%" << std::endl;
+	}
+
+	std::cout << std::defaultfloat;
+}
+
+
+void Benchmark::FrameAllocations(TileRenderer& renderer, ThreadPool& pool, const std::function<void(const Tile&)>& renderTile)
+{
+	const int frameCount = 10;
+
+	if (!AllocationCounter::enabled)
+	{
+		std::cerr << "ERROR: counting allocations needs a build with GCP_COUNT_ALLOCATIONS defined, such as the Benchmark configuration" << std::endl;
+		return;
+	}
+
+	unsigned long long before = AllocationCounter::GetCount();
+	double start = NowMs();
+	renderer.Render(pool, renderTile);
+	double firstMs = NowMs() - start;
+	unsigned long long firstAllocations = AllocationCounter::GetCount() - before;
+
+	unsigned long long worstAllocations = 0;
+	unsigned long long totalAllocations = 0;
+	double totalMs = 0.0;
+
+	for (int frame = 0; frame < frameCount; ++frame)
+	{
+		before = AllocationCounter::GetCount();
+		start = NowMs();
+		renderer.Render(pool, renderTile);
+		totalMs += NowMs() - start;
+
+		unsigned long long allocations = AllocationCounter::GetCount() - before;
+
+		worstAllocations = allocations > worstAllocations ? allocations : worstAllocations;
+		totalAllocations += allocations;
+	}
+
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "INFO: Heap allocations, " << pool.GetThreadCount() << " threads, " << renderer.GetTileCount() << " tiles" << std::endl;
+	std::cout << "  first frame          " << std::setw(8) << firstAllocations << " allocations  " << std::setw(10) << firstMs << " ms" << std::endl;
+	std::cout << "  next " << frameCount << " frames, each " << std::setw(8) << (double)totalAllocations / frameCount << " allocations  " << std::setw(10) << totalMs / frameCount << " ms, "
+		<< worstAllocations << " at most" << std::endl;
+
+	if (totalAllocations != 0)
+	{
+		std::cerr << "WARNING: rendering a frame allocated memory once per thread buffers had grown" << std::endl;
+	}
+
+	std::cout << std::defaultfloat << std::setprecision(6);
+}
+
+void Benchmark::SphereKernels(SimdLevel maxLevel)
+{
+	const unsigned int sphereCount = 1024;
+	const unsigned int rayCount = 4096;
+	const unsigned int leafSize = BVH::maxLeafSize;
+
+	// Spheres scattered through a box, rays from inside the box towards random points in it, so roughly half the tests hit
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> inBox(0.0f, 100.0f);
+	std::uniform_real_distribution<float> sizes(2.0f, 20.0f);
+
+	std::vector<Sphere> spheres;
+	SphereSoA store;
+
+	spheres.reserve(sphereCount);
+	store.Reserve(sphereCount);
+
+	for (unsigned int i = 0; i < sphereCount; ++i)
+	{
+		glm::vec3 centre(inBox(random), inBox(random), inBox(random));
+		float radius = sizes(random);
+
+		spheres.push_back(Sphere(centre, radius, glm::vec3(1)));
+		store.Add(centre, radius, i);
+	}
+
+	std::vector<Ray> rays;
+	rays.reserve(rayCount);
+
+	for (unsigned int i = 0; i < rayCount; ++i)
+	{
+		glm::vec3 origin(inBox(random), inBox(random), inBox(random));
+		glm::vec3 target(inBox(random), inBox(random), inBox(random));
+
+		rays.push_back(Ray(origin, glm::normalize(target - origin + glm::vec3(0.001f))));
+	}
+
+	// Reference answers, the closest hit in each leaf for each ray
+	std::vector<int> referenceHit(rayCount * (sphereCount / leafSize));
+	std::vector<float> referenceDistance(referenceHit.size());
+
+	for (unsigned int r = 0; r < rayCount; ++r)
+	{
+		for (unsigned int leaf = 0; leaf < sphereCount / leafSize; ++leaf)
+		{
+			int closest = -1;
+			float closestDistance = FLT_MAX;
+
+			for (unsigned int i = leaf * leafSize; i < (leaf + 1) * leafSize; ++i)
+			{
+				RayIntersection intersection = spheres[i].RayIntersect(rays[r]);
+
+				if (intersection.m_isIntersection && intersection.m_distance < closestDistance)
+				{
+					closest = (int)i;
+					closestDistance = intersection.m_distance;
+				}
+			}
+
+			referenceHit[r * (sphereCount / leafSize) + leaf] = closest;
+			referenceDistance[r * (sphereCount / leafSize) + leaf] = closestDistance;
+		}
+	}
+
+	std::cout << "INFO: Sphere kernels, " << rayCount << " rays against " << sphereCount << " spheres in groups of " << leafSize << std::endl;
+	std::cout << "  kernel    mismatches   M tests/s   hit rate" << std::endl;
+
+	for (int level = (int)SimdLevel::Scalar; level <= (int)maxLevel; ++level)
+	{
+		SphereSoA::IntersectFunction intersect = SphereSoA::GetIntersectFunction((SimdLevel)level);
+
+		// Correctness, same sphere and the same distance to within rounding
+		unsigned int mismatches = 0;
+
+		for (unsigned int r = 0; r < rayCount; ++r)
+		{
+			for (unsigned int leaf = 0; leaf < sphereCount / leafSize; ++leaf)
+			{
+				float distance = FLT_MAX;
+				int hit = intersect(store, rays[r], leaf * leafSize, leafSize, distance);
+
+				unsigned int answer = r * (sphereCount / leafSize) + leaf;
+
+				if (hit != referenceHit[answer] || (hit >= 0 && glm::abs(distance - referenceDistance[answer]) > 1e-3f * referenceDistance[answer]))
+				{
+					mismatches++;
+				}
+			}
+		}
+
+		// Speed, best of a few passes over every ray and leaf
+		double bestMs = 0.0;
+		int hits = 0;
+
+		for (int pass = 0; pass < 5; ++pass)
+		{
+			hits = 0;
+
+			double start = NowMs();
+
+			for (unsigned int r = 0; r < rayCount; ++r)
+			{
+				for (unsigned int leaf = 0; leaf < sphereCount / leafSize; ++leaf)
+				{
+					float distance = FLT_MAX;
+					hits += intersect(store, rays[r], leaf * leafSize, leafSize, distance) >= 0;
+				}
+			}
+
+			double elapsed = NowMs() - start;
+
+			if (pass == 0 || elapsed < bestMs)
+			{
+				bestMs = elapsed;
+			}
+		}
+
+		double testsPerSecond = (double)rayCount * sphereCount / (bestMs / 1000.0);
+
+		std::cout << std::fixed << std::setprecision(1)
+			<< "  " << std::left << std::setw(8) << SimdLevelName((SimdLevel)level) << std::right
+			<< "  " << std::setw(10) << mismatches
+			<< "  " << std::setw(10) << testsPerSecond / 1e6
+			<< "  " << std::setw(8) << 100.0 * hits / ((double)rayCount * (sphereCount / leafSize)) << "%" << std::endl;
+	}
+
+	std::cout << std::defaultfloat;
+}
+
+
+void Benchmark::BVHBuild(unsigned int maxThreads)
+{
+	const unsigned int sphereCounts[] = { 1000000, 10000000 };
+
+	std::vector<unsigned int> threadCounts;
+	for (unsigned int threads = 1; threads < maxThreads; threads *= 2)
+	{
+		threadCounts.push_back(threads);
+	}
+	threadCounts.push_back(maxThreads);
+
+	for (unsigned int sphereCount : sphereCounts)
+	{
+		// Same density of spheres whatever the count, so the trees are alike apart from size
+		std::mt19937 random(1234);
+		std::uniform_real_distribution<float> inBox(0.0f, 10.0f * std::cbrt((float)sphereCount));
+		std::uniform_real_distribution<float> sizes(0.5f, 5.0f);
+
+		// Only the bounds are needed, making millions of Sphere objects would just time their constructors
+		std::vector<AABB> bounds(sphereCount);
+
+		for (AABB& box : bounds)
+		{
+			glm::vec3 centre(inBox(random), inBox(random), inBox(random));
+			float radius = sizes(random);
+
+			box.min = centre - glm::vec3(radius);
+			box.max = centre + glm::vec3(radius);
+		}
+
+		// The big build only gets one run per thread count, it's slow enough that one is steady
+		const int runsPerCount = sphereCount > 1000000 ? 1 : 3;
+
+		const BVHBuilder builders[] = { BVHBuilder::SAH, BVHBuilder::Linear30, BVHBuilder::Linear63 };
+
+		std::cout << "INFO: BVH build, " << sphereCount << " spheres" << std::endl;
+		std::cout << "  builder        threads     time (ms)   M prims/s   speedup      nodes   SAH cost" << std::endl;
+
+		for (BVHBuilder builder : builders)
+		{
+			double singleThreadMs = 0.0;
+
+			for (unsigned int threads : threadCounts)
+			{
+				ThreadPool pool(threads);
+				BVH bvh;
+
+				double bestMs = 0.0;
+
+				for (int run = 0; run < runsPerCount; ++run)
+				{
+					bvh.Build(bounds, &pool, builder);
+
+					if (run == 0 || bvh.GetBuildTimeMs() < bestMs)
+					{
+						bestMs = bvh.GetBuildTimeMs();
+					}
+				}
+
+				if (threads == 1)
+				{
+					singleThreadMs = bestMs;
+				}
+
+				std::cout << std::fixed << std::setprecision(2)
+					<< "  " << std::left << std::setw(12) << BVHBuilderName(builder) << std::right
+					<< "  " << std::setw(7) << threads
+					<< "  " << std::setw(12) << bestMs
+					<< "  " << std::setw(10) << sphereCount / bestMs / 1000.0
+					<< "  " << std::setw(8) << singleThreadMs / bestMs
+					<< "  " << std::setw(9) << bvh.GetNodeCount()
+					<< "  " << std::setw(9) << bvh.CalculateSahCost() << std::endl;
+			}
+		}
+	}
+
+	std::cout << std::defaultfloat;
+}
+
+void Benchmark::BVHRefit(unsigned int maxThreads)
+{
+	const unsigned int sphereCount = 1000000;
+	const int frameCount = 60;
+
+	// Same as RayTracer's default
+	const float rebuildCostRatio = 1.5f;
+
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> inBox(0.0f, 10.0f * std::cbrt((float)sphereCount));
+	std::uniform_real_distribution<float> sizes(0.5f, 5.0f);
+	std::uniform_real_distribution<float> velocities(-2.0f, 2.0f);
+
+	std::vector<glm::vec3> centres(sphereCount);
+	std::vector<float> radii(sphereCount);
+	std::vector<glm::vec3> frameMoves(sphereCount);
+	std::vector<AABB> bounds(sphereCount);
+
+	for (unsigned int i = 0; i < sphereCount; ++i)
+	{
+		centres[i] = glm::vec3(inBox(random), inBox(random), inBox(random));
+		radii[i] = sizes(random);
+		frameMoves[i] = glm::vec3(velocities(random), velocities(random), velocities(random));
+	}
+
+	auto calculateBounds = [&]()
+	{
+		for (unsigned int i = 0; i < sphereCount; ++i)
+		{
+			bounds[i].min = centres[i] - glm::vec3(radii[i]);
+			bounds[i].max = centres[i] + glm::vec3(radii[i]);
+		}
+	};
+
+	ThreadPool pool(maxThreads);
+	BVH bvh;
+
+	calculateBounds();
+	bvh.Build(bounds, &pool);
+
+	double buildMs = bvh.GetBuildTimeMs();
+	double totalRefitMs = 0.0;
+	double totalRebuildMs = 0.0;
+	int rebuilds = 0;
+
+	std::cout << "INFO: BVH refit, " << sphereCount << " spheres moving every frame, " << maxThreads << " threads" << std::endl;
+	std::cout << "INFO: First build took " << buildMs << " ms, rebuilding once the SAH cost is " << rebuildCostRatio << " times what it was" << std::endl;
+	std::cout << "    frame   refit (ms)   cost ratio   rebuild (ms)" << std::endl;
+
+	for (int frame = 1; frame <= frameCount; ++frame)
+	{
+		for (unsigned int i = 0; i < sphereCount; ++i)
+		{
+			centres[i] += frameMoves[i];
+		}
+
+		calculateBounds();
+		bvh.Refit(bounds, &pool);
+
+		double refitMs = bvh.GetRefitTimeMs();
+		float costRatio = bvh.GetSahCostRatio();
+		double rebuildMs = 0.0;
+
+		totalRefitMs += refitMs;
+
+		if (costRatio > rebuildCostRatio)
+		{
+			bvh.Build(bounds, &pool);
+
+			rebuildMs = bvh.GetBuildTimeMs();
+			totalRebuildMs += rebuildMs;
+			rebuilds++;
+		}
+
+		// Every frame would be a lot of output, the ones that rebuilt matter most
+		if (rebuildMs > 0.0 || frame % 10 == 0 || frame == 1)
+		{
+			std::cout << std::fixed << std::setprecision(2)
+				<< "  " << std::setw(7) << frame
+				<< "  " << std::setw(11) << refitMs
+				<< "  " << std::setw(11) << costRatio
+				<< "  " << std::setw(13);
+
+			if (rebuildMs > 0.0)
+			{
+				std::cout << rebuildMs << std::endl;
+			}
+			else
+			{
+				std::cout << "-" << std::endl;
+			}
+		}
+	}
+
+	double refitFramesMs = totalRefitMs + totalRebuildMs;
+
+	std::cout << "INFO: " << frameCount << " frames took " << refitFramesMs << " ms refitting with " << rebuilds << " rebuilds, against "
+		<< buildMs * frameCount << " ms building every frame, " << buildMs * frameCount / refitFramesMs << " times faster" << std::endl;
+
+	std::cout << std::defaultfloat;
+}
+
+void Benchmark::TriangleIntersection()
+{
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	auto randomDirection = [&]()
+	{
+		glm::vec3 direction;
+
+		do
+		{
+			direction = glm::vec3(unit(random), unit(random), unit(random)) * 2.0f - 1.0f;
+		}
+		while (glm::dot(direction, direction) > 1.0f || glm::dot(direction, direction) < 0.01f);
+
+		return glm::normalize(direction);
+	};
+
+	// glm::intersectRayTriangle hits from both sides and also behind the ray, so only hits in front count, the same as the watertight test
+	auto glmClosestHit = [](const Ray& ray, const glm::vec3* vertices, unsigned int triangleCount, float& tMax)
+	{
+		int closest = -1;
+
+		for (unsigned int i = 0; i < triangleCount; ++i)
+		{
+			glm::vec2 barycentrics;
+			float distance;
+
+			if (glm::intersectRayTriangle(ray.origin, ray.direction, vertices[i * 3], vertices[i * 3 + 1], vertices[i * 3 + 2], barycentrics, distance) && distance > 0.0f && distance < tMax)
+			{
+				tMax = distance;
+				closest = (int)i;
+			}
+		}
+
+		return closest;
+	};
+
+	// Random triangles, with glm getting them as plain vertex triples, which is the quickest way for it to read them
+
+	const unsigned int soupCount = 4096;
+	const unsigned int soupRays = 2000;
+
+	Mesh soup(glm::vec3(1.0f));
+	std::vector<glm::vec3> soupVertices;
+
+	for (unsigned int i = 0; i < soupCount; ++i)
+	{
+		glm::vec3 centre = glm::vec3(unit(random), unit(random), unit(random)) * 100.0f;
+
+		for (int corner = 0; corner < 3; ++corner)
+		{
+			soupVertices.push_back(centre + randomDirection() * 5.0f);
+			soup.AddVertex(soupVertices.back());
+		}
+
+		soup.AddTriangle(i * 3, i * 3 + 1, i * 3 + 2);
+	}
+
+	std::vector<Ray> rays;
+	rays.reserve(soupRays);
+
+	for (unsigned int i = 0; i < soupRays; ++i)
+	{
+		rays.push_back(Ray(glm::vec3(unit(random), unit(random), unit(random)) * 100.0f, randomDirection()));
+	}
+
+	int disagreements = 0;
+	float worstDistanceError = 0.0f;
+	double glmMs = 0.0;
+	double watertightMs = 0.0;
+
+	for (const Ray& ray : rays)
+	{
+		float glmDistance = FLT_MAX;
+		float watertightDistance = FLT_MAX;
+
+		double start = NowMs();
+		int glmHit = glmClosestHit(ray, soupVertices.data(), soupCount, glmDistance);
+		glmMs += NowMs() - start;
+
+		start = NowMs();
+		TriangleHit hit;
+		soup.IntersectTriangles(ray, WatertightRay(ray), 0, soupCount, watertightDistance, hit);
+		watertightMs += NowMs() - start;
+
+		if (glmHit != hit.triangle)
+		{
+			disagreements++;
+		}
+		else if (glmHit >= 0)
+		{
+			worstDistanceError = glm::max(worstDistanceError, std::abs(glmDistance - watertightDistance) / glmDistance);
+		}
+	}
+
+	double tests = (double)soupCount * soupRays;
+
+	std::cout << "INFO: Ray/triangle tests, " << soupRays << " rays against " << soupCount << " random triangles each" << std::endl;
+	std::cout << "  test                 M tests/s" << std::endl;
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "  glm                 " << std::setw(10) << tests / glmMs / 1000.0 << std::endl;
+	std::cout << "  watertight          " << std::setw(10) << tests / watertightMs / 1000.0 << std::endl;
+	std::cout << std::defaultfloat << std::setprecision(6);
+	std::cout << "INFO: Closest hits that differ from glm: " << disagreements << ", largest relative distance difference " << worstDistanceError << std::endl;
+
+	// A tilted grid, with rays aimed exactly at its vertices and edge midpoints, where rounding can let a ray slip between triangles
+	// Only the triangles around each target are tested, the ray has to hit at least one of them
+
+	const int gridSize = 64;
+
+	Mesh grid(glm::vec3(1.0f));
+	std::vector<glm::vec3> gridVertices;
+
+	glm::vec3 gridU = glm::vec3(0.731f, 0.117f, 0.213f);
+	glm::vec3 gridV = glm::vec3(-0.093f, 0.677f, 0.311f);
+	glm::vec3 gridNormal = glm::normalize(glm::cross(gridU, gridV));
+
+	for (int y = 0; y <= gridSize; ++y)
+	{
+		for (int x = 0; x <= gridSize; ++x)
+		{
+			grid.AddVertex(glm::vec3(3.3f, -1.7f, 2.9f) + gridU * (float)x + gridV * (float)y);
+		}
+	}
+
+	for (int y = 0; y < gridSize; ++y)
+	{
+		for (int x = 0; x < gridSize; ++x)
+		{
+			unsigned int corner = y * (gridSize + 1) + x;
+
+			grid.AddTriangle(corner, corner + 1, corner + gridSize + 2);
+			grid.AddTriangle(corner, corner + gridSize + 2, corner + gridSize + 1);
+		}
+	}
+
+	for (unsigned int i = 0; i < grid.GetTriangleCount(); ++i)
+	{
+		glm::vec3 v0, v1, v2;
+		grid.GetTriangle(i, v0, v1, v2);
+
+		gridVertices.push_back(v0);
+		gridVertices.push_back(v1);
+		gridVertices.push_back(v2);
+	}
+
+	const int raysPerTarget = 8;
+
+	int targetRays = 0;
+	int glmLeaks = 0;
+	int watertightLeaks = 0;
+
+	for (int y = 1; y < gridSize; ++y)
+	{
+		for (int x = 1; x < gridSize; ++x)
+		{
+			glm::vec3 vertex = grid.GetVertex(y * (gridSize + 1) + x);
+
+			glm::vec3 targets[3] = { vertex, (vertex + grid.GetVertex(y * (gridSize + 1) + x + 1)) * 0.5f, (vertex + grid.GetVertex((y + 1) * (gridSize + 1) + x)) * 0.5f };
+
+			for (const glm::vec3& target : targets)
+			{
+				for (int i = 0; i < raysPerTarget; ++i)
+				{
+					// From above the grid, at any angle
+					glm::vec3 direction = randomDirection();
+
+					if (glm::dot(direction, gridNormal) > 0.0f)
+					{
+						direction = -direction;
+					}
+
+					Ray ray(target - direction * (10.0f + unit(random) * 100.0f), direction);
+
+					// Two rows of two quads around the target
+					unsigned int rows[2] = { (unsigned int)(((y - 1) * gridSize + x - 1) * 2), (unsigned int)((y * gridSize + x - 1) * 2) };
+
+					float glmDistance = FLT_MAX;
+					float watertightDistance = FLT_MAX;
+					TriangleHit hit;
+					WatertightRay watertightRay(ray);
+
+					for (unsigned int row : rows)
+					{
+						glmClosestHit(ray, &gridVertices[row * 3], 4, glmDistance);
+						grid.IntersectTriangles(ray, watertightRay, row, 4, watertightDistance, hit);
+					}
+
+					glmLeaks += glmDistance == FLT_MAX ? 1 : 0;
+					watertightLeaks += hit.triangle < 0 ? 1 : 0;
+					targetRays++;
+				}
+			}
+		}
+	}
+
+	std::cout << "INFO: Rays aimed at shared edges and vertices: " << targetRays << ", slipped through with glm: " << glmLeaks << ", with the watertight test: " << watertightLeaks << std::endl;
+
+	// A bumpy terrain of about a million triangles, traced through its BVH
+
+	const int terrainSize = 708;
+	const unsigned int terrainRays = 200000;
+
+	Mesh terrain = MakeTerrain(terrainSize, random);
+
+	terrain.BuildBVH();
+
+	std::vector<Ray> terrainRayList;
+	terrainRayList.reserve(terrainRays);
+
+	for (unsigned int i = 0; i < terrainRays; ++i)
+	{
+		glm::vec3 direction = randomDirection();
+		direction.z = -std::abs(direction.z) - 0.2f;
+
+		terrainRayList.push_back(Ray(glm::vec3(unit(random), unit(random), 0.0f) * (float)terrainSize + glm::vec3(0.0f, 0.0f, 20.0f), glm::normalize(direction)));
+	}
+
+	unsigned int hits = 0;
+	unsigned long long visited = 0;
+
+	double start = NowMs();
+
+	for (const Ray& ray : terrainRayList)
+	{
+		float distance = FLT_MAX;
+		TriangleHit hit;
+
+		visited += terrain.Intersect(ray, distance, hit);
+		hits += hit.triangle >= 0 ? 1 : 0;
+	}
+
+	double traceMs = NowMs() - start;
+
+	std::cout << "INFO: " << terrain.GetTriangleCount() << " triangle mesh, " << terrainRays << " rays in " << traceMs << " ms, "
+		<< terrainRays / traceMs / 1000.0 << " M rays/s, " << hits << " hits, " << (double)visited / terrainRays << " nodes visited per ray" << std::endl;
+}
+
+void Benchmark::Instancing(unsigned int maxThreads)
+{
+	const int terrainSize = 708;
+	const unsigned int instanceCount = 100000;
+	const unsigned int rayCount = 100000;
+
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	ThreadPool pool(maxThreads);
+
+	std::vector<Mesh> meshes;
+	meshes.push_back(MakeTerrain(terrainSize, random));
+
+	Mesh& terrain = meshes[0];
+	terrain.BuildBVH(&pool);
+
+	// Copies spread through a cube with about a copy's width between them, turned and scaled at random
+	float worldSize = terrainSize * 2.0f * std::cbrt((float)instanceCount);
+
+	InstanceBVH instances;
+
+	for (unsigned int i = 0; i < instanceCount; ++i)
+	{
+		glm::vec3 axis = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) * 2.0f - 1.0f + glm::vec3(0.01f));
+
+		glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(unit(random), unit(random), unit(random)) * worldSize);
+		transform = glm::rotate(transform, unit(random) * 6.283f, axis);
+		transform = glm::scale(transform, glm::vec3(0.5f + unit(random)));
+
+		instances.AddInstance(0, transform);
+	}
+
+	instances.Build(meshes, &pool);
+
+	// Flattening every copy into one mesh would need the mesh's memory per copy, and building it would go at about the same rate per triangle
+
+	const double bytesPerGB = 1024.0 * 1024.0 * 1024.0;
+
+	double meshGB = terrain.GetMemoryBytes() / bytesPerGB;
+	double instancesGB = instances.GetMemoryBytes() / bytesPerGB;
+	double flatGB = meshGB * instanceCount;
+
+	double meshBuildSeconds = terrain.GetBVH().GetBuildTimeMs() / 1000.0;
+	double instancesBuildSeconds = instances.GetBVH().GetBuildTimeMs() / 1000.0;
+	double flatBuildSeconds = meshBuildSeconds * instanceCount;
+
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "INFO: " << instanceCount << " instances of a " << terrain.GetTriangleCount() << " triangle mesh, " << maxThreads << " threads" << std::endl;
+	std::cout << "                                memory (GB)     build (s)" << std::endl;
+	std::cout << "  mesh and its BVH          " << std::setw(15) << meshGB << "  " << std::setw(12) << meshBuildSeconds << std::endl;
+	std::cout << "  instances and their BVH   " << std::setw(15) << instancesGB << "  " << std::setw(12) << instancesBuildSeconds << std::endl;
+	std::cout << "  total                     " << std::setw(15) << meshGB + instancesGB << "  " << std::setw(12) << meshBuildSeconds + instancesBuildSeconds << std::endl;
+	std::cout << "  flattened, estimated      " << std::setw(15) << flatGB << "  " << std::setw(12) << flatBuildSeconds << std::endl;
+	std::cout << std::setprecision(0);
+	std::cout << "INFO: Instancing uses " << flatGB / (meshGB + instancesGB) << " times less memory and builds " << flatBuildSeconds / (meshBuildSeconds + instancesBuildSeconds) << " times faster" << std::endl;
+
+	// Rays from anywhere in the world in any direction, most pass through many copies' bounds
+
+	std::vector<Ray> rays;
+	rays.reserve(rayCount);
+
+	for (unsigned int i = 0; i < rayCount; ++i)
+	{
+		glm::vec3 direction = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) * 2.0f - 1.0f + glm::vec3(0.001f));
+
+		rays.push_back(Ray(glm::vec3(unit(random), unit(random), unit(random)) * worldSize, direction));
+	}
+
+	std::vector<unsigned int> hits(pool.GetThreadCount(), 0);
+	std::vector<unsigned long long> visited(pool.GetThreadCount(), 0);
+
+	double start = NowMs();
+
+	pool.ParallelFor(rayCount, [&](unsigned int index, unsigned int threadIndex)
+	{
+		float distance = FLT_MAX;
+		InstanceHit hit;
+
+		visited[threadIndex] += instances.Intersect(meshes, rays[index], distance, hit);
+		hits[threadIndex] += hit.instance >= 0 ? 1 : 0;
+	});
+
+	double traceMs = NowMs() - start;
+
+	unsigned int totalHits = 0;
+	unsigned long long totalVisited = 0;
+
+	for (unsigned int i = 0; i < pool.GetThreadCount(); ++i)
+	{
+		totalHits += hits[i];
+		totalVisited += visited[i];
+	}
+
+	std::cout << "INFO: " << rayCount << " rays in " << std::setprecision(1) << traceMs << " ms, " << std::setprecision(2) << rayCount / traceMs / 1000.0 << " M rays/s, "
+		<< totalHits << " hits, " << std::setprecision(1) << (double)totalVisited / rayCount << " nodes visited per ray over both levels" << std::endl;
+
+	std::cout << std::defaultfloat << std::setprecision(6);
+}
+
+void Benchmark::MeshLoading(const char* filename, unsigned int maxThreads)
+{
+	const double bytesPerMB = 1024.0 * 1024.0;
+
+	std::vector<unsigned int> threadCounts;
+	for (unsigned int threads = 1; threads < maxThreads; threads *= 2)
+	{
+		threadCounts.push_back(threads);
+	}
+	threadCounts.push_back(maxThreads);
+
+	std::ifstream file(filename, std::ios::binary | std::ios::ate);
+	double fileMB = file ? (double)file.tellg() / bytesPerMB : 0.0;
+
+	size_t memoryBefore = PeakMemoryBytes();
+	size_t meshBytes = 0;
+
+	// The loader prints a line for each load, the table comes after them
+	std::vector<double> loadMs;
+
+	for (unsigned int threads : threadCounts)
+	{
+		ThreadPool pool(threads);
+
+		Mesh mesh(glm::vec3(1.0f));
+
+		double start = NowMs();
+
+		if (!MeshLoader::Load(filename, mesh, &pool))
+		{
+			return;
+		}
+
+		loadMs.push_back(NowMs() - start);
+		meshBytes = mesh.GetMemoryBytes();
+	}
+
+	// The file is mapped rather than read, so as long as parsed pages are handed back the peak should be near the mesh itself
+	size_t peakBytes = PeakMemoryBytes();
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "INFO: Loading " << filename << ", " << fileMB << " MB" << std::endl;
+	std::cout << "  threads     load (ms)      MB/s   speedup" << std::endl;
+
+	for (size_t i = 0; i < threadCounts.size(); ++i)
+	{
+		std::cout << "  " << std::setw(7) << threadCounts[i] << "  " << std::setw(12) << loadMs[i] << "  " << std::setw(8) << fileMB / (loadMs[i] / 1000.0)
+			<< "  " << std::setw(7) << std::setprecision(2) << loadMs[0] / loadMs[i] << std::setprecision(1) << std::endl;
+	}
+
+	std::cout << "INFO: Mesh " << meshBytes / bytesPerMB << " MB, peak memory " << peakBytes / bytesPerMB << " MB, " << memoryBefore / bytesPerMB << " MB of it before loading" << std::endl;
+
+	std::cout << std::defaultfloat << std::setprecision(6);
+}
+
+void Benchmark::SceneCaching(const char* filename, unsigned int maxThreads)
+{
+	const char* cacheFile = "SceneCachingBenchmark.cache";
+	const unsigned int rayCount = 1000000;
+
+	ThreadPool pool(maxThreads);
+	std::mt19937 random(1234);
+
+	// Without a cache, the source is hashed to check the cache against, then loaded and built
+
+	double start = NowMs();
+
+	unsigned long long sourceHash = 0;
+	Mesh built(glm::vec3(1.0f));
+
+	if (filename != nullptr)
+	{
+		if (!SceneCache::HashFile(filename, sourceHash, &pool) || !MeshLoader::Load(filename, built, &pool))
+		{
+			return;
+		}
+	}
+	else
+	{
+		built = MakeTerrain(1000, random);
+	}
+
+	built.BuildBVH(&pool);
+
+	double buildMs = NowMs() - start;
+
+	start = NowMs();
+
+	SceneCache::Writer writer;
+
+	if (!writer.Open(cacheFile))
+	{
+		std::cerr << "ERROR: could not open scene cache for writing: " << cacheFile << std::endl;
+		return;
+	}
+
+	built.Save(writer);
+
+	if (!writer.Finish(sourceHash))
+	{
+		std::cerr << "ERROR: could not write scene cache: " << cacheFile << std::endl;
+		return;
+	}
+
+	double saveMs = NowMs() - start;
+
+	// With one, the source is still hashed to check the cache is up to date, then the cache is mapped
+
+	start = NowMs();
+
+	unsigned long long checkHash = 0;
+
+	if (filename != nullptr)
+	{
+		SceneCache::HashFile(filename, checkHash, &pool);
+	}
+
+	SceneCache::Reader reader;
+	Mesh mapped(glm::vec3(1.0f));
+
+	if (!reader.Open(cacheFile, checkHash) || !mapped.Map(reader))
+	{
+		std::cerr << "ERROR: could not map the scene cache back: " << cacheFile << std::endl;
+		return;
+	}
+
+	double mapMs = NowMs() - start;
+
+	// Rays from inside the mesh's bounds in every direction, most of them hit
+
+	AABB bounds = built.GetBounds();
+
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::vector<Ray> rays;
+	rays.reserve(rayCount);
+
+	for (unsigned int i = 0; i < rayCount; ++i)
+	{
+		glm::vec3 origin = bounds.min + glm::vec3(unit(random), unit(random), unit(random)) * (bounds.max - bounds.min);
+		glm::vec3 direction = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) * 2.0f - 1.0f + glm::vec3(0.001f));
+
+		rays.push_back(Ray(origin, direction));
+	}
+
+	std::vector<int> builtHits(rayCount);
+	std::vector<int> mappedHits(rayCount);
+
+	auto trace = [&](const Mesh& mesh, std::vector<int>& hits)
+	{
+		double traceStart = NowMs();
+
+		pool.ParallelFor(rayCount, [&](unsigned int index, unsigned int)
+		{
+			float distance = FLT_MAX;
+			TriangleHit hit;
+
+			mesh.Intersect(rays[index], distance, hit);
+			hits[index] = hit.triangle >= 0 ? (int)mesh.GetTriangleId((unsigned int)hit.triangle) : -1;
+		});
+
+		return NowMs() - traceStart;
+	};
+
+	double mappedFirstMs = trace(mapped, mappedHits);
+	double mappedMs = trace(mapped, mappedHits);
+	double builtMs = trace(built, builtHits);
+
+	unsigned int mismatches = 0;
+
+	for (unsigned int i = 0; i < rayCount; ++i)
+	{
+		mismatches += builtHits[i] != mappedHits[i] ? 1 : 0;
+	}
+
+	std::ifstream cache(cacheFile, std::ios::binary | std::ios::ate);
+	double cacheMB = (double)cache.tellg() / (1024.0 * 1024.0);
+	cache.close();
+
+	reader.Close();
+	std::remove(cacheFile);
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "INFO: " << built.GetTriangleCount() << " triangles, " << maxThreads << " threads, " << cacheMB << " MB cache" << std::endl;
+	std::cout << "  load and build              " << std::setw(10) << buildMs << " ms" << std::endl;
+	std::cout << "  save the cache              " << std::setw(10) << saveMs << " ms" << std::endl;
+	std::cout << "  map the cache               " << std::setw(10) << mapMs << " ms" << std::endl;
+	std::cout << "  " << rayCount << " rays, built       " << std::setw(10) << builtMs << " ms" << std::endl;
+	std::cout << "  " << rayCount << " rays, mapped      " << std::setw(10) << mappedMs << " ms, " << mappedFirstMs << " ms the first time" << std::endl;
+	std::cout << std::setprecision(0);
+	std::cout << "INFO: Starting from the cache is " << buildMs / mapMs << " times faster, " << mismatches << " of " << rayCount << " rays hit a different triangle" << std::endl;
+
+	std::cout << std::defaultfloat << std::setprecision(6);
+}
+
+void Benchmark::SceneParsing(unsigned int maxThreads)
+{
+	const char* sceneFile = "SceneParsingBenchmark.scene";
+	const unsigned int sphereCounts[] = { 1000000, 10000000 };
+	const char* materialNames[] = { "red", "green", "blue", "white", "grey", "gold", "glass", "mirror" };
+	const double bytesPerMB = 1024.0 * 1024.0;
+
+	std::vector<unsigned int> threadCounts;
+	for (unsigned int threads = 1; threads < maxThreads; threads *= 2)
+	{
+		threadCounts.push_back(threads);
+	}
+	threadCounts.push_back(maxThreads);
+
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> position(-1000.0f, 1000.0f);
+	std::uniform_real_distribution<float> radius(0.1f, 2.0f);
+	std::uniform_int_distribution<int> material(0, 8);
+
+	struct Result
+	{
+		unsigned int sphereCount;
+		unsigned int threads;
+		double fileMB;
+		double parseMs;
+	};
+
+	// The loader prints a line for each load, the table comes after them
+	std::vector<Result> results;
+
+	for (unsigned int sphereCount : sphereCounts)
+	{
+		// Written the way a tool exporting a scene would, with materials at the top and most spheres naming one
+		FILE* file = fopen(sceneFile, "w");
+
+		if (file == nullptr)
+		{
+			std::cerr << "ERROR: could not open scene file for writing: " << sceneFile << std::endl;
+			return;
+		}
+
+		fprintf(file, "# %u random spheres\nsize 640 480\ncamera 0 0 2000 0 0 0 60\nlight directional -1 -1 -1 1 1 1\n", sphereCount);
+
+		for (unsigned int i = 0; i < 8; i++)
+		{
+			fprintf(file, "material %s %.3f %.3f %.3f\n", materialNames[i], (i & 1) * 0.8f + 0.1f, ((i >> 1) & 1) * 0.8f + 0.1f, ((i >> 2) & 1) * 0.8f + 0.1f);
+		}
+
+		for (unsigned int i = 0; i < sphereCount; i++)
+		{
+			float x = position(random);
+			float y = position(random);
+			float z = position(random);
+			float r = radius(random);
+			int m = material(random);
+
+			fprintf(file, "sphere %.3f %.3f %.3f %.3f %s\n", x, y, z, r, m < 8 ? materialNames[m] : "");
+		}
+
+		fclose(file);
+
+		std::ifstream written(sceneFile, std::ios::binary | std::ios::ate);
+		double fileMB = (double)written.tellg() / bytesPerMB;
+		written.close();
+
+		for (unsigned int threads : threadCounts)
+		{
+			ThreadPool pool(threads);
+
+			Scene scene;
+
+			double start = NowMs();
+
+			if (!SceneLoader::Load(sceneFile, scene, &pool) || scene.spheres.GetCount() != sphereCount)
+			{
+				std::remove(sceneFile);
+				return;
+			}
+
+			results.push_back({ sphereCount, threads, fileMB, NowMs() - start });
+		}
+	}
+
+	std::remove(sceneFile);
+
+	// Linear scaling shows as the same nanoseconds per sphere at every size
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "INFO: Parsing scene files" << std::endl;
+	std::cout << "     spheres  threads     file (MB)    parse (ms)      MB/s   Mspheres/s   ns/sphere" << std::endl;
+
+	for (const Result& result : results)
+	{
+		std::cout << "  " << std::setw(10) << result.sphereCount << "  " << std::setw(7) << result.threads << "  " << std::setw(12) << result.fileMB
+			<< "  " << std::setw(12) << result.parseMs << "  " << std::setw(8) << result.fileMB / (result.parseMs / 1000.0)
+			<< "  " << std::setw(11) << std::setprecision(2) << result.sphereCount / (result.parseMs * 1000.0)
+			<< "  " << std::setw(10) << std::setprecision(1) << result.parseMs * 1e6 / result.sphereCount << std::endl;
+	}
+
+	std::cout << std::defaultfloat << std::setprecision(6);
+}
+
+void Benchmark::Occlusion(unsigned int maxThreads)
+{
+	const unsigned int sphereCount = 1000000;
+	const int terrainSize = 700;
+	const float sceneSize = 700.0f;
+	const unsigned int rayCount = 1000000;
+	const unsigned int raysPerTask = 4096;
+
+	ThreadPool pool(maxThreads);
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> across(0.0f, sceneSize);
+	std::uniform_real_distribution<float> above(10.0f, 110.0f);
+	std::uniform_real_distribution<float> sizes(0.2f, 1.0f);
+
+	// A layer of spheres floating over the terrain, like foliage
+	SphereSoA spheres;
+	spheres.Reserve(sphereCount);
+
+	for (unsigned int i = 0; i < sphereCount; ++i)
+	{
+		spheres.Add(glm::vec3(across(random), across(random), above(random)), sizes(random), i);
+	}
+
+	RayTracer rayTracer(std::move(spheres), std::vector<unsigned int>(sphereCount, 0), std::vector<Material>(1));
+
+	Mesh terrain = MakeTerrain(terrainSize, random);
+	terrain.BuildBVH(&pool);
+	rayTracer.AddMesh(std::move(terrain));
+	rayTracer.BuildBVH(&pool);
+
+	// Shadow rays from points on the terrain to a point light high over one corner, the segment stops at the light
+	const glm::vec3 lightPosition(0.0f, 0.0f, 400.0f);
+
+	std::vector<Ray> rays;
+	std::vector<float> segmentLengths;
+	rays.reserve(rayCount);
+	segmentLengths.reserve(rayCount);
+
+	for (unsigned int i = 0; i < rayCount; ++i)
+	{
+		// Dropped straight down onto the terrain from under the spheres to find a point on it, then lifted a little so the ray doesn't hit where it starts
+		float x = across(random);
+		float y = across(random);
+
+		HitRecord ground;
+		// Tilted off the z axis, the slab test can't place rays exactly along an axis that start exactly on a node's face
+		glm::vec3 down = glm::normalize(glm::vec3(0.001f, 0.001f, -1.0f));
+		glm::vec3 start(x, y, 8.0f);
+
+		rayTracer.Intersect(Ray(start, down), ground);
+
+		glm::vec3 origin = start + (ground.t - 0.01f) * down;
+
+		rays.push_back(Ray(origin, glm::normalize(lightPosition - origin)));
+		segmentLengths.push_back(glm::length(lightPosition - origin));
+	}
+
+	std::vector<char> closestBlocked(rayCount);
+	std::vector<char> anyBlocked(rayCount);
+
+	auto time = [&](const std::function<void(unsigned int)>& traceRay)
+	{
+		double best = 0.0;
+
+		for (int run = 0; run < 3; ++run)
+		{
+			double start = NowMs();
+
+			pool.ParallelFor((rayCount + raysPerTask - 1) / raysPerTask, [&](unsigned int task, unsigned int)
+			{
+				for (unsigned int i = task * raysPerTask; i < std::min((task + 1) * raysPerTask, rayCount); ++i)
+				{
+					traceRay(i);
+				}
+			});
+
+			double elapsed = NowMs() - start;
+			best = run == 0 || elapsed < best ? elapsed : best;
+		}
+
+		return best;
+	};
+
+	double closestMs = time([&](unsigned int i)
+	{
+		HitRecord hit;
+		hit.t = segmentLengths[i];
+
+		closestBlocked[i] = rayTracer.Intersect(rays[i], hit) ? 1 : 0;
+	});
+
+	double anyMs = time([&](unsigned int i)
+	{
+		anyBlocked[i] = rayTracer.IsOccluded(rays[i], segmentLengths[i]) ? 1 : 0;
+	});
+
+	unsigned int blocked = 0;
+	unsigned int mismatches = 0;
+
+	for (unsigned int i = 0; i < rayCount; ++i)
+	{
+		blocked += closestBlocked[i];
+		mismatches += closestBlocked[i] != anyBlocked[i] ? 1 : 0;
+	}
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "INFO: Occlusion, " << sphereCount << " spheres and " << terrainSize * terrainSize * 2 << " triangles, " << rayCount << " segments, "
+		<< maxThreads << " threads, " << 100.0 * blocked / rayCount << "% blocked" << std::endl;
+	std::cout << "  query            time (ms)   Mrays/s" << std::endl;
+	std::cout << "  closest hit   " << std::setw(12) << closestMs << "  " << std::setw(8) << std::setprecision(3) << rayCount / (closestMs * 1000.0) << std::setprecision(1) << std::endl;
+	std::cout << "  occlusion     " << std::setw(12) << anyMs << "  " << std::setw(8) << std::setprecision(3) << rayCount / (anyMs * 1000.0) << std::setprecision(1) << std::endl;
+	std::cout << std::setprecision(2);
+	std::cout << "INFO: Occlusion queries are " << closestMs / anyMs << " times faster, " << mismatches << " of " << rayCount << " segments disagree" << std::endl;
+
+	std::cout << std::defaultfloat << std::setprecision(6);
+}
+
+void Benchmark::ManyLights(unsigned int maxThreads)
+{
+	const int terrainSize = 256;
+	const unsigned int sphereCount = 2000;
+	const int pointsAcross = 256;
+	const unsigned int pointCount = pointsAcross * pointsAcross;
+	const unsigned int pointsPerTask = 1024;
+	const unsigned int referencePoints = 1024;
+	const unsigned int maxReferenceLights = 1000;
+	const unsigned int errorSamples = 16;
+	const unsigned int lightCounts[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+
+	ThreadPool pool(maxThreads);
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> across(0.0f, (float)terrainSize);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	Mesh terrain = MakeTerrain(terrainSize, random);
+	terrain.BuildBVH(&pool);
+
+	// Spheres sitting on the terrain to cast shadows
+	SphereSoA spheres;
+	spheres.Reserve(sphereCount);
+
+	for (unsigned int i = 0; i < sphereCount; ++i)
+	{
+		spheres.Add(glm::vec3(across(random), across(random), 4.0f), 0.5f + 2.0f * unit(random), i);
+	}
+
+	// Rays looking down onto the terrain, one per point shaded, tilted off the z axis so the slab test can place them
+	// Each starts back along the tilt so it still lands on the terrain over its own point
+	const glm::vec3 tilt(0.1f, 0.05f, -1.0f);
+	const float height = 200.0f;
+
+	std::vector<Ray> rays;
+	rays.reserve(pointCount);
+
+	for (int y = 0; y < pointsAcross; ++y)
+	{
+		for (int x = 0; x < pointsAcross; ++x)
+		{
+			glm::vec3 over((x + 0.5f) * terrainSize / pointsAcross, (y + 0.5f) * terrainSize / pointsAcross, 0.0f);
+
+			rays.push_back(Ray(over - height * tilt, glm::normalize(tilt)));
+		}
+	}
+
+	std::vector<glm::vec3> colours(pointCount);
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "INFO: Many lights, " << terrainSize * terrainSize * 2 << " triangles, " << sphereCount << " spheres, " << pointCount << " points, 1 light sample a point, "
+		<< maxThreads << " threads" << std::endl;
+	std::cout << "  lights   depth   tree (ns/point)   every light (ns/point)   tree error   random error" << std::endl;
+
+	for (unsigned int lightCount : lightCounts)
+	{
+		// Point lights scattered over the terrain, with the total power the same whatever the count
+		std::vector<Light> lights(lightCount);
+
+		for (Light& light : lights)
+		{
+			light.type = LightType::Point;
+			light.position = glm::vec3(across(random), across(random), 5.0f + 55.0f * unit(random));
+			light.colour = glm::vec3(0.5f + unit(random), 0.5f + unit(random), 0.5f + unit(random)) * (20000.0f / lightCount);
+		}
+
+		RayTracer rayTracer(spheres, std::vector<unsigned int>(sphereCount, 0), std::vector<Material>(1));
+		rayTracer.AddMesh(terrain);
+		rayTracer.SetLights(lights);
+		rayTracer.BuildBVH(&pool);
+
+		const LightTree& lightTree = rayTracer.GetLightTree();
+
+		// Deepest leaf, parents always come before their children
+		const BVHNode* nodes = lightTree.GetBVH().GetNodes();
+		std::vector<int> nodeDepth(lightTree.GetBVH().GetNodeCount(), 0);
+		int depth = 0;
+
+		for (unsigned int i = 0; i < nodeDepth.size(); ++i)
+		{
+			if (!nodes[i].IsLeaf())
+			{
+				nodeDepth[nodes[i].leftFirst] = nodeDepth[i] + 1;
+				nodeDepth[nodes[i].leftFirst + 1] = nodeDepth[i] + 1;
+			}
+
+			depth = std::max(depth, nodeDepth[i]);
+		}
+
+		double treeMs = 0.0;
+
+		for (int run = 0; run < 3; ++run)
+		{
+			double start = NowMs();
+
+			pool.ParallelFor((pointCount + pointsPerTask - 1) / pointsPerTask, [&](unsigned int task, unsigned int)
+			{
+				// Whole rows of points, which stand in for the pixels
+				unsigned int first = task * pointsPerTask;
+				int row = (int)(first / pointsAcross);
+				int rows = (int)(std::min(pointsPerTask, pointCount - first) / pointsAcross);
+
+				rayTracer.TraceRays(&rays[first], glm::ivec2(0, row), glm::ivec2(pointsAcross, row + rows), &colours[first]);
+			});
+
+			double elapsed = NowMs() - start;
+			treeMs = run == 0 || elapsed < treeMs ? elapsed : treeMs;
+		}
+
+		// The first few points, shaded by every light with a shadow ray each, and by a few picks from the tree and at random
+		std::vector<glm::vec3> points(referencePoints);
+		std::vector<glm::vec3> normals(referencePoints);
+
+		for (unsigned int i = 0; i < referencePoints; ++i)
+		{
+			const Ray& ray = rays[i * (pointCount / referencePoints)];
+			HitRecord hit;
+
+			rayTracer.Intersect(ray, hit);
+
+			points[i] = ray.origin + hit.t * ray.direction;
+			normals[i] = rayTracer.GetNormal(ray, hit);
+			normals[i] = glm::dot(normals[i], ray.direction) > 0.0f ? -normals[i] : normals[i];
+		}
+
+		// Luminance of the light from one place on one light, divided by the chance of picking both
+		auto shadeSample = [&](unsigned int point, const Light& light, float pdf, glm::vec2 u)
+		{
+			LightSample sample;
+
+			if (!light.Sample(points[point], u, sample))
+			{
+				return 0.0f;
+			}
+
+			float cosine = glm::dot(sample.direction, normals[point]);
+
+			if (cosine <= 0.0f || rayTracer.IsOccluded(Ray(points[point] + normals[point] * 0.01f, sample.direction), sample.distance * 0.999f))
+			{
+				return 0.0f;
+			}
+
+			return cosine * glm::dot(sample.colour, glm::vec3(0.2126f, 0.7152f, 0.0722f)) / pdf;
+		};
+
+		std::vector<float> exact(referencePoints);
+		std::vector<float> treeSquaredError(referencePoints);
+		std::vector<float> randomSquaredError(referencePoints);
+		double everyMs = 0.0;
+		bool haveReference = lightCount <= maxReferenceLights;
+
+		if (haveReference)
+		{
+			double start = NowMs();
+
+			pool.ParallelFor(referencePoints, [&](unsigned int point, unsigned int)
+			{
+				float sum = 0.0f;
+
+				for (unsigned int light = 0; light < lightCount; ++light)
+				{
+					sum += shadeSample(point, lights[light], 1.0f, glm::vec2(0.0f));
+				}
+
+				exact[point] = sum;
+			});
+
+			everyMs = (NowMs() - start) * pointCount / referencePoints;
+
+			pool.ParallelFor(referencePoints, [&](unsigned int point, unsigned int)
+			{
+				std::mt19937 pointRandom(point);
+				std::uniform_real_distribution<float> u(0.0f, 1.0f);
+
+				treeSquaredError[point] = 0.0f;
+				randomSquaredError[point] = 0.0f;
+
+				for (unsigned int sample = 0; sample < errorSamples; ++sample)
+				{
+					float pdf = 0.0f;
+					int picked = lightTree.Sample(points[point], normals[point], u(pointRandom), pdf);
+					float treeValue = picked >= 0 ? shadeSample(point, lightTree.GetLight((unsigned int)picked), pdf, glm::vec2(0.0f)) : 0.0f;
+
+					unsigned int randomLight = std::min((unsigned int)(u(pointRandom) * lightCount), lightCount - 1);
+					float randomValue = shadeSample(point, lights[randomLight], 1.0f / lightCount, glm::vec2(0.0f));
+
+					treeSquaredError[point] += (treeValue - exact[point]) * (treeValue - exact[point]) / errorSamples;
+					randomSquaredError[point] += (randomValue - exact[point]) * (randomValue - exact[point]) / errorSamples;
+				}
+			});
+		}
+
+		// Root mean square error of one sample against the mean exact value
+		double exactSum = 0.0;
+		double treeSum = 0.0;
+		double randomSum = 0.0;
+
+		for (unsigned int i = 0; i < referencePoints; ++i)
+		{
+			exactSum += exact[i];
+			treeSum += treeSquaredError[i];
+			randomSum += randomSquaredError[i];
+		}
+
+		double exactMean = exactSum / referencePoints;
+
+		std::cout << "  " << std::setw(7) << lightCount << "  " << std::setw(6) << depth << "  " << std::setw(16) << treeMs * 1.0e6 / pointCount;
+
+		if (haveReference && exactMean > 0.0)
+		{
+			std::cout << "  " << std::setw(23) << everyMs * 1.0e6 / pointCount << std::setprecision(2)
+				<< "  " << std::setw(10) << std::sqrt(treeSum / referencePoints) / exactMean << "  " << std::setw(12) << std::sqrt(randomSum / referencePoints) / exactMean
+				<< std::setprecision(1) << std::endl;
+		}
+		else
+		{
+			std::cout << "  " << std::setw(23) << "-" << "  " << std::setw(10) << "-" << "  " << std::setw(12) << "-" << std::endl;
+		}
+	}
+
+	std::cout << "INFO: Tree times include the ray that finds each point, every light is only shaded up to " << maxReferenceLights << " lights" << std::endl;
+	std::cout << "INFO: Errors are the root mean square error of one sample over the mean exact value" << std::endl;
+
+	std::cout << std::defaultfloat << std::setprecision(6);
+}
+
+void Benchmark::Wavefront(unsigned int maxThreads)
+{
+	const int terrainSize = 1024;
+	const unsigned int sphereCount = 200000;
+	const unsigned int materialCount = 16;
+	const unsigned int pointLightCount = 8;
+	const unsigned int bounces = 4;
+	const glm::ivec2 size(640, 480);
+
+	ThreadPool pool(maxThreads);
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> across(0.0f, (float)terrainSize);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	// Every surface is diffuse, so every hit sends a path off in its own direction, the case breadth first rendering is for
+	std::vector<Material> materials(materialCount);
+
+	for (Material& material : materials)
+	{
+		material.colour = glm::vec3(0.2f + 0.7f * unit(random), 0.2f + 0.7f * unit(random), 0.2f + 0.7f * unit(random));
+	}
+
+	SphereSoA spheres;
+	spheres.Reserve(sphereCount);
+	std::vector<unsigned int> sphereMaterials(sphereCount);
+
+	for (unsigned int i = 0; i < sphereCount; ++i)
+	{
+		spheres.Add(glm::vec3(across(random), across(random), 3.0f + 2.0f * unit(random)), 0.5f + 1.5f * unit(random), i);
+		sphereMaterials[i] = i % materialCount;
+	}
+
+	std::vector<Light> lights(pointLightCount + 1);
+
+	lights[0].type = LightType::Directional;
+	lights[0].direction = glm::normalize(glm::vec3(-0.3f, -0.5f, -1.0f));
+	lights[0].colour = glm::vec3(0.8f, 0.75f, 0.7f);
+
+	for (unsigned int i = 1; i <= pointLightCount; ++i)
+	{
+		lights[i].type = LightType::Point;
+		lights[i].position = glm::vec3(across(random), across(random), 20.0f + 20.0f * unit(random));
+		lights[i].colour = glm::vec3(0.5f + unit(random), 0.5f + unit(random), 0.5f + unit(random)) * 200.0f;
+	}
+
+	RayTracer rayTracer(std::move(spheres), std::move(sphereMaterials), std::move(materials));
+
+	Mesh terrain = MakeTerrain(terrainSize, random);
+	terrain.BuildBVH(&pool);
+	rayTracer.AddMesh(std::move(terrain));
+	rayTracer.SetLights(std::move(lights));
+	rayTracer.SetMaxBounces(bounces);
+	rayTracer.BuildBVH(&pool);
+
+	// Looking across the terrain from above one corner, so rays go from near spheres to far ones
+	float side = (float)terrainSize;
+	Camera camera(glm::vec3(-0.05f, -0.05f, 0.1f) * side, glm::vec3(0.5f * side, 0.5f * side, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), 60.0f, size);
+
+	// A pixel at a time, through the same tiles and 64 pixel runs as the main loop
+	TileRenderer tileRenderer(size);
+	std::vector<glm::vec3> tileImage((size_t)size.x * size.y);
+
+	auto renderTile = [&](const Tile& tile)
+	{
+		const int runLength = 64;
+
+		static thread_local std::vector<Ray> rays;
+
+		int tileWidth = tile.max.x - tile.min.x;
+
+		rays.resize((size_t)tileWidth * (tile.max.y - tile.min.y));
+
+		camera.GetRays(tile.min, tile.max, rays.data());
+
+		for (int y = tile.min.y; y < tile.max.y; y++)
+		{
+			const Ray* rowRays = &rays[(size_t)(y - tile.min.y) * tileWidth];
+
+			for (int runStart = tile.min.x; runStart < tile.max.x; runStart += runLength)
+			{
+				int runEnd = glm::min(runStart + runLength, tile.max.x);
+
+				rayTracer.TraceRays(rowRays + (runStart - tile.min.x), glm::ivec2(runStart, y), glm::ivec2(runEnd, y + 1), &tileImage[(size_t)y * size.x + runStart]);
+			}
+		}
+	};
+
+	double tileMs = 0.0;
+
+	for (int run = 0; run < 3; ++run)
+	{
+		double start = NowMs();
+
+		tileRenderer.Render(pool, renderTile);
+
+		double elapsed = NowMs() - start;
+		tileMs = run == 0 || elapsed < tileMs ? elapsed : tileMs;
+	}
+
+	// Keeps the stage times of its fastest frame
+	WavefrontRenderer wavefrontRenderer;
+	WavefrontRenderer fastest;
+	double wavefrontMs = 0.0;
+
+	for (int run = 0; run < 3; ++run)
+	{
+		double start = NowMs();
+
+		wavefrontRenderer.Render(rayTracer, camera, size, &pool);
+
+		double elapsed = NowMs() - start;
+
+		if (run == 0 || elapsed < wavefrontMs)
+		{
+			wavefrontMs = elapsed;
+			fastest = wavefrontRenderer;
+		}
+	}
+
+	// Both follow exactly the same paths, so the wavefront renderer's count is the count for both
+	unsigned long long rayCount = fastest.GetRayCount();
+
+	const std::vector<glm::vec3>& wavefrontImage = fastest.GetImage();
+	float maxDifference = 0.0f;
+
+	for (size_t i = 0; i < tileImage.size(); ++i)
+	{
+		glm::vec3 difference = glm::abs(tileImage[i] - wavefrontImage[i]);
+
+		maxDifference = glm::max(maxDifference, glm::max(glm::max(difference.x, difference.y), difference.z));
+	}
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "INFO: Wavefront, " << terrainSize * terrainSize * 2 << " triangles, " << sphereCount << " diffuse spheres, " << pointLightCount << " point lights and a directional light, "
+		<< bounces << " bounces, " << size.x << "x" << size.y << ", " << maxThreads << " threads" << std::endl;
+	std::cout << "  renderer        time (ms)   Mrays/s" << std::endl;
+	std::cout << "  per pixel    " << std::setw(12) << tileMs << "  " << std::setw(8) << std::setprecision(2) << rayCount / (tileMs * 1000.0) << std::setprecision(1) << std::endl;
+	std::cout << "  wavefront    " << std::setw(12) << wavefrontMs << "  " << std::setw(8) << std::setprecision(2) << rayCount / (wavefrontMs * 1000.0) << std::setprecision(1) << std::endl;
+
+	fastest.PrintStats();
+
+	std::cout << std::setprecision(2);
+	std::cout << "INFO: Wavefront is " << tileMs / wavefrontMs << " times as fast, images differ by at most " << std::scientific << maxDifference << std::endl;
+
+	std::cout << std::defaultfloat << std::setprecision(6);
+}
+
+void Benchmark::RayPackets(unsigned int maxThreads)
+{
+	const unsigned int sphereCount = 200000;
+	const int terrainSize = 700;
+	const float sceneSize = 700.0f;
+	const glm::ivec2 size(1280, 720);
+	const int packetSizes[] = { 1, 2, 8 };
+
+	ThreadPool pool(maxThreads);
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> across(0.0f, sceneSize);
+	std::uniform_real_distribution<float> above(2.0f, 30.0f);
+	std::uniform_real_distribution<float> sizes(0.5f, 3.0f);
+
+	SphereSoA spheres;
+	spheres.Reserve(sphereCount);
+
+	for (unsigned int i = 0; i < sphereCount; ++i)
+	{
+		spheres.Add(glm::vec3(across(random), across(random), above(random)), sizes(random), i);
+	}
+
+	Mesh terrain = MakeTerrain(terrainSize, random);
+	terrain.BuildBVH(&pool);
+
+	// Looking across the scene from above one corner
+	Camera camera(glm::vec3(-0.05f, -0.05f, 0.15f) * sceneSize, glm::vec3(0.5f * sceneSize, 0.5f * sceneSize, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), 60.0f, size);
+
+	unsigned int rayCount = (unsigned int)(size.x * size.y);
+	const unsigned int packetsPerTask = 64;
+
+	// Camera rays made up front in each packet size's order, every packet's rays one after another, so only finding hits is timed
+	struct PacketOrder
+	{
+		std::vector<Ray> rays;
+
+		std::vector<unsigned int> pixels;
+
+		std::vector<unsigned int> packetStarts;
+	};
+
+	std::vector<PacketOrder> orders;
+
+	for (int packetSize : packetSizes)
+	{
+		PacketOrder order;
+		Ray rays[RayPacket::maxRays];
+
+		for (int y = 0; y < size.y; y += packetSize)
+		{
+			for (int x = 0; x < size.x; x += packetSize)
+			{
+				glm::ivec2 packetMin(x, y);
+				glm::ivec2 packetMax = glm::min(packetMin + packetSize, size);
+
+				camera.GetRays(packetMin, packetMax, rays);
+
+				order.packetStarts.push_back((unsigned int)order.rays.size());
+
+				for (int packetY = packetMin.y; packetY < packetMax.y; ++packetY)
+				{
+					for (int packetX = packetMin.x; packetX < packetMax.x; ++packetX)
+					{
+						order.rays.push_back(rays[order.rays.size() - order.packetStarts.back()]);
+						order.pixels.push_back((unsigned int)(packetY * size.x + packetX));
+					}
+				}
+			}
+		}
+
+		order.packetStarts.push_back(rayCount);
+		orders.push_back(std::move(order));
+	}
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "INFO: Ray packets, " << sphereCount << " spheres, " << size.x << "x" << size.y << " camera rays, " << maxThreads << " threads" << std::endl;
+	std::cout << "  scene                packet    time (ms)   Mrays/s   speedup   differing hits" << std::endl;
+
+	for (int withTerrain = 0; withTerrain < 2; ++withTerrain)
+	{
+		RayTracer rayTracer(spheres, std::vector<unsigned int>(sphereCount, 0), std::vector<Material>(1));
+
+		if (withTerrain)
+		{
+			rayTracer.AddMesh(terrain);
+		}
+
+		rayTracer.BuildBVH(&pool);
+
+		// Hits by pixel, so every packet size can be checked against single rays
+		std::vector<HitRecord> singleHits(rayCount);
+		std::vector<HitRecord> packetHits(rayCount);
+		std::vector<HitRecord> orderedHits(rayCount);
+		double singleMs = 0.0;
+
+		for (size_t sizeIndex = 0; sizeIndex < orders.size(); ++sizeIndex)
+		{
+			int packetSize = packetSizes[sizeIndex];
+			const PacketOrder& order = orders[sizeIndex];
+			unsigned int packetCount = (unsigned int)order.packetStarts.size() - 1;
+			double best = 0.0;
+
+			for (int run = 0; run < 3; ++run)
+			{
+				double start = NowMs();
+
+				pool.ParallelFor((packetCount + packetsPerTask - 1) / packetsPerTask, [&](unsigned int task, unsigned int)
+				{
+					for (unsigned int packet = task * packetsPerTask; packet < std::min((task + 1) * packetsPerTask, packetCount); ++packet)
+					{
+						unsigned int first = order.packetStarts[packet];
+						unsigned int count = order.packetStarts[packet + 1] - first;
+
+						for (unsigned int i = first; i < first + count; ++i)
+						{
+							orderedHits[i] = HitRecord();
+						}
+
+						if (packetSize == 1)
+						{
+							rayTracer.Intersect(order.rays[first], orderedHits[first]);
+						}
+						else
+						{
+							rayTracer.IntersectPacket(&order.rays[first], count, &orderedHits[first]);
+						}
+					}
+				});
+
+				double elapsed = NowMs() - start;
+				best = run == 0 || elapsed < best ? elapsed : best;
+			}
+
+			std::vector<HitRecord>& hits = packetSize == 1 ? singleHits : packetHits;
+
+			for (unsigned int i = 0; i < rayCount; ++i)
+			{
+				hits[order.pixels[i]] = orderedHits[i];
+			}
+
+			singleMs = packetSize == 1 ? best : singleMs;
+
+			std::cout << "  " << (withTerrain ? "spheres and terrain" : "spheres            ") << "  " << std::setw(3) << packetSize << "x" << std::left << std::setw(3) << packetSize << std::right
+				<< "  " << std::setw(10) << best << "  " << std::setw(8) << std::setprecision(2) << rayCount / (best * 1000.0) << "  " << std::setw(8) << singleMs / best << std::setprecision(1);
+
+			if (packetSize == 1)
+			{
+				std::cout << "  " << std::setw(15) << "-" << std::endl;
+				continue;
+			}
+
+			unsigned int differing = 0;
+
+			for (unsigned int i = 0; i < rayCount; ++i)
+			{
+				differing += singleHits[i].primitive != packetHits[i].primitive || singleHits[i].instance != packetHits[i].instance ? 1 : 0;
+			}
+
+			std::cout << "  " << std::setw(15) << differing << std::endl;
+		}
+	}
+
+	std::cout << std::defaultfloat << std::setprecision(6);
+}
+
+void Benchmark::Samplers(unsigned int maxThreads)
+{
+	const int imageSize = 256;
+	const unsigned int samplesPerPixel = 16;
+
+	// Numbers each sample draws, about what a bounce with a few light samples uses
+	const unsigned int dimensions = 12;
+	const unsigned int pixelCount = imageSize * imageSize;
+	const double numbersPerRun = (double)pixelCount * samplesPerPixel * dimensions;
+
+	ThreadPool pool(maxThreads);
+
+	// Each row of pixels adds up what it drew, so nothing is optimised away and the sums can be compared between thread counts
+	std::vector<float> rowSums(imageSize);
+
+	// Best of 3 runs over every row, on one thread without the pool or across it
+	auto timeRows = [&](bool threaded, const std::function<void(unsigned int row)>& drawRow)
+	{
+		double best = 0.0;
+
+		for (int run = 0; run < 3; ++run)
+		{
+			double start = NowMs();
+
+			if (threaded)
+			{
+				pool.ParallelFor(imageSize, [&](unsigned int row, unsigned int) { drawRow(row); });
+			}
+			else
+			{
+				for (unsigned int row = 0; row < (unsigned int)imageSize; ++row)
+				{
+					drawRow(row);
+				}
+			}
+
+			double elapsed = NowMs() - start;
+			best = run == 0 || elapsed < best ? elapsed : best;
+		}
+
+		return best;
+	};
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "INFO: Samplers, " << imageSize << "x" << imageSize << " pixels, " << samplesPerPixel << " samples a pixel, " << dimensions << " numbers a sample, "
+		<< maxThreads << " threads" << std::endl;
+	std::cout << "  generator    1 thread (M/s)   " << std::setw(2) << maxThreads << " threads (M/s)   same with every thread count" << std::endl;
+
+	// std::rand has one generator for the whole program, so it can only be timed on one thread
+	double randMs = timeRows(false, [&](unsigned int row)
+	{
+		float sum = 0.0f;
+
+		for (unsigned int i = 0; i < (unsigned int)imageSize * samplesPerPixel * dimensions; ++i)
+		{
+			sum += (float)std::rand() / ((float)RAND_MAX + 1.0f);
+		}
+
+		rowSums[row] = sum;
+	});
+
+	std::cout << "  std::rand  " << std::setw(16) << numbersPerRun / (randMs * 1000.0) << "  " << std::setw(16) << "-" << "  " << std::setw(28) << "-" << std::endl;
+
+	// A generator per row, as each thread or path would have its own
+	auto pcgRow = [&](unsigned int row)
+	{
+		Pcg32 random(row, row);
+		float sum = 0.0f;
+
+		for (unsigned int i = 0; i < (unsigned int)imageSize * samplesPerPixel * dimensions; ++i)
+		{
+			sum += random.NextFloat();
+		}
+
+		rowSums[row] = sum;
+	};
+
+	double pcgMs = timeRows(false, pcgRow);
+	std::vector<float> serialSums = rowSums;
+	double pcgThreadedMs = timeRows(true, pcgRow);
+
+	std::cout << "  pcg32      " << std::setw(16) << numbersPerRun / (pcgMs * 1000.0) << "  " << std::setw(16) << numbersPerRun / (pcgThreadedMs * 1000.0)
+		<< "  " << std::setw(28) << (serialSums == rowSums ? "yes" : "NO") << std::endl;
+
+	const SamplerType types[] = { SamplerType::Random, SamplerType::Sobol, SamplerType::BlueNoise };
+	const char* typeNames[] = { "random", "sobol", "bluenoise" };
+
+	// Made before timing, the first sampler to ask for it would otherwise pay for it
+	GetBlueNoiseMask();
+
+	for (int typeIndex = 0; typeIndex < 3; ++typeIndex)
+	{
+		// A sampler for each sample of each pixel, as TraceRays makes them, drawing its dimensions in pairs
+		auto samplerRow = [&](unsigned int row)
+		{
+			float sum = 0.0f;
+
+			for (int x = 0; x < imageSize; ++x)
+			{
+				for (unsigned int sample = 0; sample < samplesPerPixel; ++sample)
+				{
+					PixelSampler sampler(types[typeIndex], glm::ivec2(x, (int)row), sample);
+
+					for (unsigned int dimension = 0; dimension < dimensions; dimension += 2)
+					{
+						glm::vec2 u = sampler.Get2D();
+
+						sum += u.x + u.y;
+					}
+				}
+			}
+
+			rowSums[row] = sum;
+		};
+
+		double serialMs = timeRows(false, samplerRow);
+		serialSums = rowSums;
+		double threadedMs = timeRows(true, samplerRow);
+
+		std::cout << "  " << std::left << std::setw(9) << typeNames[typeIndex] << std::right << "  " << std::setw(16) << numbersPerRun / (serialMs * 1000.0)
+			<< "  " << std::setw(16) << numbersPerRun / (threadedMs * 1000.0) << "  " << std::setw(28) << (serialSums == rowSums ? "yes" : "NO") << std::endl;
+	}
+
+	// How well each sampler integrates a quarter disc, whose edge is like the edges of shapes and shadows a pixel's samples have to find
+	const unsigned int sampleCounts[] = { 1, 4, 16, 64 };
+	const double area = glm::pi<double>() / 4.0;
+
+	std::cout << "  sampler    rms error at 1, 4, 16 and 64 samples            neighbour error correlation at 1 sample" << std::endl;
+	std::cout << std::setprecision(5);
+
+	for (int typeIndex = 0; typeIndex < 3; ++typeIndex)
+	{
+		std::cout << "  " << std::left << std::setw(9) << typeNames[typeIndex] << std::right;
+
+		double correlation = 0.0;
+
+		for (unsigned int sampleCount : sampleCounts)
+		{
+			std::vector<double> errors(pixelCount);
+
+			pool.ParallelFor(imageSize, [&](unsigned int row, unsigned int)
+			{
+				for (int x = 0; x < imageSize; ++x)
+				{
+					unsigned int inside = 0;
+
+					for (unsigned int sample = 0; sample < sampleCount; ++sample)
+					{
+						glm::vec2 u = PixelSampler(types[typeIndex], glm::ivec2(x, (int)row), sample).Get2D();
+
+						inside += glm::dot(u, u) < 1.0f ? 1 : 0;
+					}
+
+					errors[row * imageSize + x] = (double)inside / sampleCount - area;
+				}
+			});
+
+			double squaredSum = 0.0;
+			double neighbourSum = 0.0;
+
+			for (unsigned int i = 0; i < pixelCount; ++i)
+			{
+				squaredSum += errors[i] * errors[i];
+
+				// The next pixel along the row, wrapping around
+				neighbourSum += errors[i] * errors[i - i % imageSize + (i + 1) % imageSize];
+			}
+
+			std::cout << "  " << std::setw(10) << std::sqrt(squaredSum / pixelCount);
+
+			correlation = sampleCount == 1 ? neighbourSum / squaredSum : correlation;
+		}
+
+		std::cout << "  " << std::setw(18) << correlation << std::endl;
+	}
+
+	std::cout << "INFO: M/s is millions of numbers drawn a second, a correlation below 0 means neighbouring pixels' errors tend to cancel out, as blue noise's do" << std::endl;
+
+	std::cout << std::defaultfloat << std::setprecision(6);
+}
+
+
+void Benchmark::PixelPacking(SimdLevel maxLevel)
+{
+	const glm::ivec2 size(1920, 1080);
+	const unsigned int pixelCount = size.x * size.y;
+	const glm::ivec2 size8K(7680, 4320);
+
+	// A little outside 0 to 1 so the clamping gets exercised too
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> channel(-0.05f, 1.05f);
+
+	std::vector<glm::vec3> colours(pixelCount);
+
+	for (glm::vec3& colour : colours)
+	{
+		colour = glm::vec3(channel(random), channel(random), channel(random));
+	}
+
+	std::cout << "INFO: Pixel packing, " << size.x << "x" << size.y << " colours, best of 5 passes" << std::endl;
+	std::cout << "  format   bytes/pixel   8K frame MB   level    off by one   vs scalar   M pixels/s" << std::endl;
+
+	for (int format = 0; format < 3; ++format)
+	{
+		FramebufferFormat framebufferFormat = (FramebufferFormat)format;
+		unsigned int bytesPerPixel = PixelFormat::BytesPerPixel(framebufferFormat);
+
+		std::vector<unsigned char> reference(pixelCount * bytesPerPixel);
+		std::vector<unsigned char> scalar(reference.size());
+		std::vector<unsigned char> packed(reference.size());
+
+		// Timed too, to show what going through GLM for every pixel would cost
+		double referenceStart = NowMs();
+
+		for (unsigned int i = 0; i < pixelCount; ++i)
+		{
+			PixelFormat::PackReference(framebufferFormat, colours[i], &reference[i * bytesPerPixel]);
+		}
+
+		double referenceMs = NowMs() - referenceStart;
+
+		std::cout << std::fixed << std::setprecision(1)
+			<< "  " << std::left << std::setw(6) << PixelFormat::Name(framebufferFormat) << std::right
+			<< "  " << std::setw(12) << bytesPerPixel
+			<< "  " << std::setw(12) << (double)size8K.x * size8K.y * bytesPerPixel / (1024.0 * 1024.0)
+			<< "   " << std::left << std::setw(6) << "GLM" << std::right
+			<< "  " << std::setw(12) << "-"
+			<< "  " << std::setw(10) << "-"
+			<< "  " << std::setw(11) << pixelCount / referenceMs / 1000.0 << std::endl;
+
+		PixelFormat::GetPackFunction(framebufferFormat, SimdLevel::Scalar)(colours.data(), pixelCount, scalar.data());
+
+		for (int level = (int)SimdLevel::Scalar; level <= (int)maxLevel; ++level)
+		{
+			PixelFormat::PackFunction pack = PixelFormat::GetPackFunction(framebufferFormat, (SimdLevel)level);
+
+			double bestMs = 0.0;
+
+			for (int pass = 0; pass < 5; ++pass)
+			{
+				double start = NowMs();
+
+				pack(colours.data(), pixelCount, packed.data());
+
+				double ms = NowMs() - start;
+
+				if (pass == 0 || ms < bestMs)
+				{
+					bestMs = ms;
+				}
+			}
+
+			// Pixels that differ from GLM's own packing, which should only ever be in the last place, and from the scalar version, which should be none
+			unsigned int offByOne = 0;
+			unsigned int notScalar = 0;
+
+			for (unsigned int i = 0; i < pixelCount; ++i)
+			{
+				if (memcmp(&packed[i * bytesPerPixel], &reference[i * bytesPerPixel], bytesPerPixel) != 0)
+				{
+					offByOne++;
+				}
+
+				if (memcmp(&packed[i * bytesPerPixel], &scalar[i * bytesPerPixel], bytesPerPixel) != 0)
+				{
+					notScalar++;
+				}
+			}
+
+			std::cout << std::fixed << std::setprecision(1)
+				<< "  " << std::left << std::setw(6) << PixelFormat::Name(framebufferFormat) << std::right
+				<< "  " << std::setw(12) << bytesPerPixel
+				<< "  " << std::setw(12) << (double)size8K.x * size8K.y * bytesPerPixel / (1024.0 * 1024.0)
+				<< "   " << std::left << std::setw(6) << SimdLevelName((SimdLevel)level) << std::right
+				<< "  " << std::setw(12) << offByOne
+				<< "  " << std::setw(10) << notScalar
+				<< "  " << std::setw(11) << pixelCount / bestMs / 1000.0 << std::endl;
+		}
+	}
+
+	std::cout << std::defaultfloat;
+}
+
+void Benchmark::TextureUpload(GCP_Framework& framework, glm::ivec2 size)
+{
+	const int framesPerTest = 100;
+	const int sparseTilesPerFrame = 4;
+	const int sparseTileSize = 32;
+
+	std::mt19937 random(1234);
+
+	std::cout << "INFO: Texture upload, " << size.x << "x" << size.y << " framebuffer, average of " << framesPerTest << " frames" << std::endl;
+	std::cout << "  path          update           KB/frame   regions/frame   upload ms    stall ms" << std::endl;
+
+	// Direct upload time per test, to show how much of it the pixel buffers take off the render thread
+	double directMs[3] = {};
+
+	for (int path = 0; path < 2; ++path)
+	{
+		framework.SetUploadPath(path == 0 ? UploadPath::Direct : UploadPath::PixelBuffer);
+
+		for (int test = 0; test < 3; ++test)
+		{
+			const char* name = "";
+			double totalBytes = 0.0;
+			double totalRegions = 0.0;
+			double totalMs = 0.0;
+			double totalStallMs = 0.0;
+
+			// Start from a clean texture so the first frame isn't carrying anything from before
+			framework.SetAllPixels(glm::vec3(0));
+			framework.Present();
+
+			for (int frame = 0; frame < framesPerTest; ++frame)
+			{
+				float shade = (frame % 2) ? 1.0f : 0.5f;
+
+				if (test == 0)
+				{
+					name = "full frame";
+					framework.SetAllPixels(glm::vec3(shade, 0, 0));
+				}
+				else if (test == 1)
+				{
+					name = "sparse tiles";
+
+					std::uniform_int_distribution<int> tileX(0, size.x / sparseTileSize - 1);
+					std::uniform_int_distribution<int> tileY(0, size.y / sparseTileSize - 1);
+
+					for (int tile = 0; tile < sparseTilesPerFrame; ++tile)
+					{
+						glm::ivec2 min(tileX(random) * sparseTileSize, tileY(random) * sparseTileSize);
+
+						for (int y = min.y; y < min.y + sparseTileSize; ++y)
+						{
+							for (int x = min.x; x < min.x + sparseTileSize; ++x)
+							{
+								framework.DrawPixel(glm::ivec2(x, y), glm::vec3(0, shade, 0));
+							}
+						}
+
+						framework.MarkDirty(min, min + glm::ivec2(sparseTileSize));
+					}
+				}
+				else
+				{
+					name = "unchanged";
+				}
+
+				framework.Present();
+
+				UploadStats stats = framework.GetUploadStats();
+				totalBytes += (double)stats.bytes;
+				totalRegions += stats.regions;
+				totalMs += stats.milliseconds;
+				totalStallMs += stats.stallMilliseconds;
+
+				// Keep the window responsive
+				framework.PollEvents();
+			}
+
+			std::cout << std::fixed << std::setprecision(3)
+				<< "  " << std::left << std::setw(12) << (path == 0 ? "direct" : "pixel buffer")
+				<< "  " << std::setw(14) << name << std::right
+				<< "  " << std::setw(10) << totalBytes / framesPerTest / 1024.0
+				<< "  " << std::setw(14) << totalRegions / framesPerTest
+				<< "  " << std::setw(10) << totalMs / framesPerTest
+				<< "  " << std::setw(10) << totalStallMs / framesPerTest << std::endl;
+
+			if (path == 0)
+			{
+				directMs[test] = totalMs;
+			}
+			else if (directMs[test] > 0.0)
+			{
+				std::cout << "                (" << (directMs[test] - totalMs) / framesPerTest << " ms/frame saved on the render thread over direct)" << std::endl;
+			}
+		}
+	}
+
+	// Leave the framework on its default
+	framework.SetUploadPath(UploadPath::Direct);
+
+	std::cout << std::defaultfloat;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "TileRenderer.h"
+#include "Simd.h"
+
+#include <functional>
+
+// Timing runs that print their results to the console
+namespace Benchmark
+{
+	// Renders the frame with 1, 2, 4 ... up to maxThreads threads and prints the time and speedup for each
+	void ThreadScaling(TileRenderer& renderer, unsigned int maxThreads, const std::function<void(const Tile&)>& renderTile);
+
+	// Renders the frame a few times on pool and prints the heap allocations each frame made, after the first has let per thread buffers grow
+	// The per pixel path shouldn't allocate at all, so anything but 0 is a regression
+	void FrameAllocations(TileRenderer& renderer, ThreadPool& pool, const std::function<void(const Tile&)>& renderTile);
+
+	// Checks every sphere intersection kernel up to maxLevel against Sphere::RayIntersect, then times them on BVH leaf sized groups of spheres
+	void SphereKernels(SimdLevel maxLevel);
+
+	// Builds BVHs over 1 million and 10 million random spheres with every builder, using 1, 2, 4 ... up to maxThreads threads
+	// Prints the build rate in primitives per second and the speedup, and the SAH cost so the quality of each builder's trees can be compared
+	void BVHBuild(unsigned int maxThreads);
+
+	// Moves 1 million spheres every frame and keeps their BVH up to date by refitting it with maxThreads threads
+	// Prints the refit time and how much the SAH cost has grown, building again whenever it's grown too much, then compares it all with building every frame
+	void BVHRefit(unsigned int maxThreads);
+
+	// Checks the watertight ray/triangle test against glm::intersectRayTriangle and times both on random triangles,
+	// counts the rays each lets slip between neighbouring triangles, then times rays through the BVH of a million triangle mesh
+	void TriangleIntersection();
+
+	// Places 100 thousand copies of a million triangle mesh with a two level BVH, prints the memory and build time against an estimate for
+	// flattening them all into one mesh, then times rays through the copies
+	void Instancing(unsigned int maxThreads);
+
+	// Loads an OBJ or PLY file with 1, 2, 4 ... up to maxThreads threads and prints the load time, the rate in MB/s and the speedup,
+	// then the peak memory used against the size of the mesh it loaded
+	void MeshLoading(const char* filename, unsigned int maxThreads);
+
+	// Times getting a mesh ready to trace by loading it and building its BVH against mapping it from a scene cache, with maxThreads threads,
+	// then checks rays hit the same triangles in both and times the first rays through the mapped one, which bring its pages in
+	// Uses filename if there is one, otherwise a generated terrain
+	void SceneCaching(const char* filename, unsigned int maxThreads);
+
+	// Writes scene files with 1 million and 10 million spheres, then parses each with 1, 2, 4 ... up to maxThreads threads
+	// Prints the parse time, the rate in MB/s and spheres per second, and the time per sphere to show it stays the same as scenes grow
+	void SceneParsing(unsigned int maxThreads);
+
+	// Builds a scene of 1 million spheres over a million triangle terrain, then times shadow ray segments through it with maxThreads threads,
+	// once with closest hit queries and once with occlusion queries, and checks both agree on which segments are blocked
+	void Occlusion(unsigned int maxThreads);
+
+	// Shades points on a terrain lit by 1 up to 1 million point lights, picking one light a point from the light tree, with maxThreads threads
+	// Prints the time per point and the depth of the tree, which should both grow with the log of the light count,
+	// against shading every light, and the error of the tree's picks against picking lights at random
+	void ManyLights(unsigned int maxThreads);
+
+	// Renders a diffuse terrain covered in coloured spheres with 4 bounces, a tile at a time with RayTracer::TraceRays like the main loop
+	// and then a stage at a time with WavefrontRenderer, with maxThreads threads
+	// Prints the frame time and Mrays/s of each, counting primary, secondary and shadow rays, the wavefront stage times, and checks both made the same image
+	void Wavefront(unsigned int maxThreads);
+
+	// Times camera rays finding their closest hits one at a time, in 2 by 2 packets and in 8 by 8 packets, with maxThreads threads,
+	// over a field of spheres on its own and then with a million triangle terrain under it
+	// Prints Mrays/s for each and checks the packets find the same hits as the single rays
+	void RayPackets(unsigned int maxThreads);
+
+	// Times drawing random numbers from std::rand, which glm::linearRand uses, from PCG32 and from each PixelSampler type, on one thread and on maxThreads,
+	// and checks every sampler draws the same numbers whatever the thread count
+	// Then prints the error each sampler gives integrating a quarter disc over every pixel at 1 to 64 samples, and how alike neighbouring pixels' errors are
+	void Samplers(unsigned int maxThreads);
+
+	// Checks every framebuffer format's packing up to maxLevel against GLM's packing functions, then times them
+	void PixelPacking(SimdLevel maxLevel);
+
+	// Times framebuffer uploads to OpenGL when the whole frame changes, when a few tiles change and when nothing does
+	// Runs once uploading directly and once through the pixel buffer ring, so the time taken off the render thread can be compared
+	void TextureUpload(GCP_Framework& framework, glm::ivec2 size);
+}
@@ -1,8 +1,48 @@
 #include "Camera.h"
 
-Ray Camera::GetRay(glm::ivec2 windowPos)
+#include <GLM/gtc/matrix_transform.hpp>
+
+Camera::Camera(glm::vec3 _position, glm::vec3 _target, glm::vec3 _up, float _fieldOfView, glm::ivec2 _imageSize) : position(_position)
+{
+	GCP_TRACE("Camera CTOR called");
+
+	glm::vec4 viewport(0.0f, 0.0f, (float)_imageSize.x, (float)_imageSize.y);
+
+	viewMat = glm::lookAt(_position, _target, _up);
+	projectionMat = glm::perspective(glm::radians(_fieldOfView), viewport.z / viewport.w, 1.0f, 10000.0f);
+
+	// The basis is unprojected with the camera at the origin, subtracting its position from points on the near plane afterwards would lose most of their precision
+	glm::mat4 rotation = glm::lookAt(glm::vec3(0.0f), _target - _position, _up);
+
+	// Points on the near plane move the same amount for every pixel, so three of them give the whole basis
+	pixelOrigin = glm::unProject(glm::vec3(0.5f, 0.5f, 0.0f), rotation, projectionMat, viewport);
+	pixelRight = glm::unProject(glm::vec3(1.5f, 0.5f, 0.0f), rotation, projectionMat, viewport) - pixelOrigin;
+	pixelUp = glm::unProject(glm::vec3(0.5f, 1.5f, 0.0f), rotation, projectionMat, viewport) - pixelOrigin;
+}
+
+Ray Camera::GetRay(glm::ivec2 windowPos) const
 {
-	Ray ray(glm::vec3(windowPos.x, windowPos.y, 0), glm::vec3(0, 0, -1));
+	glm::vec3 direction = pixelOrigin + (float)windowPos.x * pixelRight + (float)windowPos.y * pixelUp;
+
+	Ray ray(position, glm::normalize(direction));
 
 	return ray;
-}
\ No newline at end of file
+}
+
+void Camera::GetRays(glm::ivec2 min, glm::ivec2 max, Ray* rays) const
+{
+	for (int y = min.y; y < max.y; y++)
+	{
+		glm::vec3 rowStart = pixelOrigin + (float)y * pixelUp;
+
+		for (int x = min.x; x < max.x; x++)
+		{
+			// One multiply-add per axis, which the compiler fuses where the CPU has FMA
+			glm::vec3 direction = (float)x * pixelRight + rowStart;
+
+			rays->origin = position;
+			rays->direction = glm::normalize(direction);
+			rays++;
+		}
+	}
+}
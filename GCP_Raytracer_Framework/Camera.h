@@ -2,33 +2,46 @@
 
 #include "GCP_GFX_Framework.h"
 #include "Ray.h"
+#include "Trace.h"
 
-#include <iostream>
-
+// Perspective pinhole camera
+// The view and projection are only used once, to work out the direction through pixel (0, 0) and how it changes a pixel across and a pixel up,
+// after that a ray's direction is one multiply-add per axis from the start of its row
 class Camera
 {
-	//private:
+	private:
+
+		glm::mat4 viewMat;
+
+		glm::mat4 projectionMat;
+
+		glm::vec3 position;
 
-		//glm::mat4 viewMat1;
+		// Direction through the centre of pixel (0, 0), the bottom left one, not normalised
+		glm::vec3 pixelOrigin;
 
-		//glm::mat4 viewMat2;
+		// What moving one pixel right and one pixel up adds to the direction
+		glm::vec3 pixelRight;
 
-		//glm::mat4 viewMat3;
+		glm::vec3 pixelUp;
 
 	public:
 
-		Camera()
-		{
-			std::cout << "Camera CTOR called" << std::endl;
-		}
+		// Looks from position at target with up roughly up, fieldOfView is vertical and in degrees
+		Camera(glm::vec3 _position, glm::vec3 _target, glm::vec3 _up, float _fieldOfView, glm::ivec2 _imageSize);
 
 		~Camera()
 		{
-			std::cout << "Camera DTOR called" << std::endl;
+			GCP_TRACE("Camera DTOR called");
 		}
 
-		Ray GetRay(glm::ivec2 windowPos);
+		const glm::mat4& GetViewMatrix() const { return viewMat; }
+
+		const glm::mat4& GetProjectionMatrix() const { return projectionMat; }
+
+		// Ray through the centre of a pixel, y counts up from the bottom of the image like the framebuffer's does
+		Ray GetRay(glm::ivec2 windowPos) const;
 
-	
-		
+		// Fills rays with one ray per pixel from min up to but not including max, a row at a time starting with the bottom one
+		void GetRays(glm::ivec2 min, glm::ivec2 max, Ray* rays) const;
 };
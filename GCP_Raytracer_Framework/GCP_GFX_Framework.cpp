@@ -4,22 +4,42 @@
 
 #include <GL/glew.h>
 
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+
 // Handles local (CPU side) and OpenGL framebuffer functionality
 class Framebuffer
 {
 public:
 
-	Framebuffer(unsigned int w, unsigned int h)
+	// Without OpenGL only the CPU side buffer is made, for rendering with no window
+	Framebuffer(unsigned int w, unsigned int h, FramebufferFormat format, bool useGL = true)
 	{
 		_width = w; _height = h;
 
+		_format = format;
+		_bytesPerPixel = PixelFormat::BytesPerPixel(format);
+		_pack = PixelFormat::GetPackFunction(format, DetectSimdLevel());
+
 		GenLocalFramebuffer();
-		GenGLFramebuffer();
+		GenDirtyTiles();
+
+		if (useGL)
+		{
+			GenGLFramebuffer();
+		}
 	}
 
 	~Framebuffer()
 	{
-		glDeleteTextures(1, &_glTexName);
+		DeletePixelBuffers();
+
+		if (_glTexName != 0)
+		{
+			glDeleteTextures(1, &_glTexName);
+		}
 		delete[] _localBuffer;
 	}
 
@@ -28,29 +48,122 @@ public:
 
 	void SetAllPixels(glm::vec3 colour);
 
-	// Sends local framebuffer copy to OpenGL texture
+	// Draws count pixels in a row starting from position, converting them all at once is much quicker than one at a time
+	void DrawPixels(glm::ivec2 position, const glm::vec3* colours, int count);
+
+	// Flags every dirty tile touching the rectangle (max is exclusive)
+	// Drawing pixels doesn't flag anything, so a thread drawing while another calls UpdateGL only publishes a region once it's finished
+	// and the upload is guaranteed to see all of its pixels
+	void MarkDirty(glm::ivec2 min, glm::ivec2 max);
+
+	// Sends the parts of the local framebuffer that changed since last time to the OpenGL texture
 	void UpdateGL();
 
+	UploadStats GetUploadStats() const { return _uploadStats; }
+
+	// Pixel buffers are made the next time UpdateGL needs them
+	void SetUploadPath(UploadPath path) { _uploadPath = path; }
+
 	// Binds the OpenGL texture for use with rendering it to screen
 	void BindGLTex();
 
+	// Writes the local framebuffer to a binary PPM image, top row first so it matches what's shown on screen
+	bool SavePPM(const std::string& filename);
+
 protected:
 	unsigned int _glTexName = 0;
 
 	unsigned int _width = 0;
 	unsigned int _height = 0;
 
-	// The CPU side framebuffer
-	glm::vec3* _localBuffer = nullptr;
+	// The CPU side framebuffer, _bytesPerPixel bytes of _format for each pixel
+	unsigned char* _localBuffer = nullptr;
+
+	FramebufferFormat _format = FramebufferFormat::RGB32F;
+	unsigned int _bytesPerPixel = 0;
+	PixelFormat::PackFunction _pack = nullptr;
+
+	// Changes are tracked in square blocks of pixels, one flag each, so UpdateGL only sends what was marked
+	static const unsigned int _dirtyTileSize = 32;
+	unsigned int _dirtyTilesX = 0;
+	unsigned int _dirtyTilesY = 0;
+	std::unique_ptr<std::atomic<unsigned char>[]> _dirtyTiles;
+
+	UploadStats _uploadStats;
+
+	// A rectangle of dirty pixels to upload, max is exclusive
+	struct DirtyRegion
+	{
+		unsigned int x, y, width, height;
+	};
+
+	// Kept between uploads so collecting regions doesn't allocate every frame
+	std::vector<DirtyRegion> _dirtyRegions;
+
+	UploadPath _uploadPath = UploadPath::Direct;
+
+	// Ring of pixel buffer objects for UploadPath::PixelBuffer, each is laid out like the whole local buffer
+	// While OpenGL copies out of one, the next upload fills another, a fence on each says when it's free again
+	static const int _pixelBufferCount = 3;
+	unsigned int _pixelBuffers[_pixelBufferCount] = {};
+	GLsync _pixelBufferFences[_pixelBufferCount] = {};
+	// Only set when the buffers are persistently mapped, otherwise they get mapped each upload
+	void* _pixelBufferMemory[_pixelBufferCount] = {};
+	int _nextPixelBuffer = 0;
 
 	void GenLocalFramebuffer();
 
+	void GenDirtyTiles();
+
 	void GenGLFramebuffer();
 
+	void GenPixelBuffers();
+
+	void DeletePixelBuffers();
+
+	// Clears the dirty flags and turns them into rows of regions
+	void CollectDirtyRegions();
+
+	void UploadDirect();
+
+	void UploadThroughPixelBuffer();
+
 };
 
 
 
+// OpenGL's names for each framebuffer format, as the texture stores it and as the local buffer holds it
+GLenum GetGLInternalFormat(FramebufferFormat format)
+{
+	switch (format)
+	{
+	case FramebufferFormat::RGB16F:
+		return GL_RGB16F;
+	case FramebufferFormat::SRGBA8:
+		return GL_SRGB8_ALPHA8;
+	default:
+		return GL_RGB32F;
+	}
+}
+
+GLenum GetGLFormat(FramebufferFormat format)
+{
+	return format == FramebufferFormat::SRGBA8 ? GL_RGBA : GL_RGB;
+}
+
+GLenum GetGLType(FramebufferFormat format)
+{
+	switch (format)
+	{
+	case FramebufferFormat::RGB16F:
+		return GL_HALF_FLOAT;
+	case FramebufferFormat::SRGBA8:
+		return GL_UNSIGNED_BYTE;
+	default:
+		return GL_FLOAT;
+	}
+}
+
 // An initialisation function, mainly for GLEW
 // This will also print to console the version of OpenGL we are using
 bool InitGL()
@@ -324,7 +437,7 @@ GLuint LoadShaders(std::string vertFilename, std::string fragFilename)
 }
 
 // Sets up SDL, OpenGL, framebuffer
-bool GCP_Framework::Init( glm::ivec2 screenSize )
+bool GCP_Framework::Init( glm::ivec2 screenSize, FramebufferFormat format )
 {
 	_screenSize = screenSize;
 
@@ -410,7 +523,21 @@ bool GCP_Framework::Init( glm::ivec2 screenSize )
 	// Create the shaders and link them together into the shader program
 	_shaderProgram = LoadShaders("VertShader.txt", "FragShader.txt");
 
-	_mainBuffer = new Framebuffer(winWidth, winHeight);
+	_mainBuffer = new Framebuffer(winWidth, winHeight, format);
+
+	_mainBuffer->SetAllPixels(glm::vec3(0, 0, 0));
+
+	return true;
+}
+
+
+// Sets up just the framebuffer, no SDL, window or OpenGL
+bool GCP_Framework::InitHeadless( glm::ivec2 screenSize, FramebufferFormat format )
+{
+	_screenSize = screenSize;
+	_headless = true;
+
+	_mainBuffer = new Framebuffer(_screenSize.x, _screenSize.y, format, false);
 
 	_mainBuffer->SetAllPixels(glm::vec3(0, 0, 0));
 
@@ -418,6 +545,30 @@ bool GCP_Framework::Init( glm::ivec2 screenSize )
 }
 
 
+void GCP_Framework::MarkDirty(glm::ivec2 min, glm::ivec2 max)
+{
+	// sanity check that Init() has been called
+	assert(_mainBuffer != nullptr);
+
+	_mainBuffer->MarkDirty(min, max);
+}
+
+void GCP_Framework::SetUploadPath(UploadPath path)
+{
+	// sanity check that Init() has been called
+	assert(_mainBuffer != nullptr);
+
+	_mainBuffer->SetUploadPath(path);
+}
+
+UploadStats GCP_Framework::GetUploadStats()
+{
+	// sanity check that Init() has been called
+	assert(_mainBuffer != nullptr);
+
+	return _mainBuffer->GetUploadStats();
+}
+
 void GCP_Framework::SetAllPixels(glm::vec3 pixelColour)
 {
 	// sanity check that Init() has been called
@@ -434,69 +585,45 @@ void GCP_Framework::DrawPixel(glm::ivec2 pixelPosition, glm::vec3 pixelColour)
 	_mainBuffer->DrawPixel(pixelPosition, pixelColour);
 }
 
-void GCP_Framework::ShowAndHold()
+void GCP_Framework::DrawPixels(glm::ivec2 pixelPosition, const glm::vec3* pixelColours, int count)
 {
 	// sanity check that Init() has been called
 	assert(_mainBuffer != nullptr);
 
-	// Show
+	_mainBuffer->DrawPixels(pixelPosition, pixelColours, count);
+}
 
-		// Specify the colour to clear the framebuffer to
-		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-		// This writes the above colour to the colour part of the framebuffer
-		glClear(GL_COLOR_BUFFER_BIT);
+bool GCP_Framework::SaveImage(const std::string& filename)
+{
+	// sanity check that Init() has been called
+	assert(_mainBuffer != nullptr);
 
-		// Send offline framebuffer to the OpenGL texture
-		_mainBuffer->UpdateGL();
+	return _mainBuffer->SavePPM(filename);
+}
 
-		// Binds OpenGL Texture
-		glActiveTexture(GL_TEXTURE0);
-		_mainBuffer->BindGLTex();
+void GCP_Framework::ShowAndHold()
+{
+	// sanity check that Init() has been called
+	assert(_mainBuffer != nullptr);
 
-		// Call our drawing function to draw that triangle!
-		DrawVAOTris(_triangleVAO, 6, _shaderProgram);
+	// There's no window to show anything in
+	if (_headless)
+	{
+		std::cerr << "WARNING: ShowAndHold called in headless mode, use SaveImage instead" << std::endl;
+		return;
+	}
 
+	// Show, everything drawn so far whether it was marked dirty or not
 
-		// This tells the renderer to actually show its contents to the screen
-		SDL_GL_SwapWindow(_SDLwindow);
+		_mainBuffer->MarkDirty(glm::ivec2(0), _screenSize);
+		Present();
 
 
 
 	// Hold
 
-		bool go = true;
-		while (go)
+		while (PollEvents())
 		{
-
-			// Here we are going to check for any input events
-			// Basically when you press the keyboard or move the mouse, the parameters are stored as something called an 'event'
-			// SDL has a queue of events
-			// We need to check for each event and then do something about it (called 'event handling')
-			// the SDL_Event is the datatype for the event
-			SDL_Event incomingEvent;
-			// SDL_PollEvent will check if there is an event in the queue
-			// If there's nothing in the queue it won't sit and wait around for an event to come along (there are functions which do this, and that can be useful too!)
-			// For an empty queue it will simply return 'false'
-			// If there is an event, the function will return 'true' and it will fill the 'incomingEvent' we have given it as a parameter with the event data
-			while (SDL_PollEvent(&incomingEvent))
-			{
-				// If we get in here, we have an event and need to figure out what to do with it
-				// For now, we will just use a switch based on the event's type
-				switch (incomingEvent.type)
-				{
-				case SDL_QUIT:
-					// The event type is SDL_QUIT
-					// This means we have been asked to quit - probably the user clicked on the 'x' at the top right corner of the window
-					// To quit we need to set our 'go' bool to false so that we can escape out of the game loop
-					go = false;
-					break;
-
-					// If you want to learn more about event handling and different SDL event types, see:
-					// https://wiki.libsdl.org/SDL_Event
-					// and also: https://wiki.libsdl.org/SDL_EventType
-				}
-			}
-
 			// Limiter to slow us down
 			SDL_Delay((unsigned int)((1.0f / 50.0f) * 1000.0f));
 		}
@@ -504,12 +631,95 @@ void GCP_Framework::ShowAndHold()
 
 	// Cleanup
 
-		SDL_GL_DeleteContext(_SDLglcontext);
-		SDL_DestroyWindow(_SDLwindow);
-		SDL_Quit();
+		Shutdown();
 
 }
 
+void GCP_Framework::Present()
+{
+	// sanity check that Init() has been called
+	assert(_mainBuffer != nullptr);
+
+	if (_headless)
+	{
+		return;
+	}
+
+	// Specify the colour to clear the framebuffer to
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	// This writes the above colour to the colour part of the framebuffer
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	// Send offline framebuffer to the OpenGL texture
+	_mainBuffer->UpdateGL();
+
+	// Binds OpenGL Texture
+	glActiveTexture(GL_TEXTURE0);
+	_mainBuffer->BindGLTex();
+
+	// Call our drawing function to draw that triangle!
+	DrawVAOTris(_triangleVAO, 6, _shaderProgram);
+
+
+	// This tells the renderer to actually show its contents to the screen
+	SDL_GL_SwapWindow(_SDLwindow);
+}
+
+bool GCP_Framework::PollEvents()
+{
+	if (_headless)
+	{
+		return true;
+	}
+
+	bool go = true;
+
+	// Here we are going to check for any input events
+	// Basically when you press the keyboard or move the mouse, the parameters are stored as something called an 'event'
+	// SDL has a queue of events
+	// We need to check for each event and then do something about it (called 'event handling')
+	// the SDL_Event is the datatype for the event
+	SDL_Event incomingEvent;
+	// SDL_PollEvent will check if there is an event in the queue
+	// If there's nothing in the queue it won't sit and wait around for an event to come along (there are functions which do this, and that can be useful too!)
+	// For an empty queue it will simply return 'false'
+	// If there is an event, the function will return 'true' and it will fill the 'incomingEvent' we have given it as a parameter with the event data
+	while (SDL_PollEvent(&incomingEvent))
+	{
+		// If we get in here, we have an event and need to figure out what to do with it
+		// For now, we will just use a switch based on the event's type
+		switch (incomingEvent.type)
+		{
+		case SDL_QUIT:
+			// The event type is SDL_QUIT
+			// This means we have been asked to quit - probably the user clicked on the 'x' at the top right corner of the window
+			// To quit we need to set our 'go' bool to false so that we can escape out of the game loop
+			go = false;
+			break;
+
+			// If you want to learn more about event handling and different SDL event types, see:
+			// https://wiki.libsdl.org/SDL_Event
+			// and also: https://wiki.libsdl.org/SDL_EventType
+		}
+	}
+
+	return go;
+}
+
+void GCP_Framework::Shutdown()
+{
+	if (_headless || _SDLwindow == nullptr)
+	{
+		return;
+	}
+
+	SDL_GL_DeleteContext(_SDLglcontext);
+	SDL_DestroyWindow(_SDLwindow);
+	SDL_Quit();
+
+	_SDLwindow = nullptr;
+}
+
 GCP_Framework::~GCP_Framework()
 {
 	delete _mainBuffer;
@@ -520,20 +730,62 @@ GCP_Framework::~GCP_Framework()
 
 void Framebuffer::DrawPixel(glm::ivec2 position, glm::vec3 colour)
 {
-	position = glm::clamp(position, glm::ivec2(0), glm::ivec2(_width, _height));
-	colour = glm::clamp(colour, 0.0f, 1.0f);
+	position = glm::clamp(position, glm::ivec2(0), glm::ivec2(_width - 1, _height - 1));
 
 	// Store in local memory only, only send to OpenGL when we've got all pixel draw calls finished
-	_localBuffer[position.y * _width + position.x] = colour;
+	_pack(&colour, 1, _localBuffer + ((size_t)position.y * _width + position.x) * _bytesPerPixel);
 }
 
 void Framebuffer::SetAllPixels(glm::vec3 colour)
 {
-	colour = glm::clamp(colour, 0.0f, 1.0f);
+	// Pack the colour once and copy the bytes everywhere
+	unsigned char pixel[16];
+	_pack(&colour, 1, pixel);
+
+	for (size_t i = 0; i < (size_t)_width * _height; ++i)
+	{
+		memcpy(_localBuffer + i * _bytesPerPixel, pixel, _bytesPerPixel);
+	}
+
+	MarkDirty(glm::ivec2(0), glm::ivec2(_width, _height));
+}
+
+void Framebuffer::DrawPixels(glm::ivec2 position, const glm::vec3* colours, int count)
+{
+	// Cut the run down to the part that's inside the image
+	if (position.y < 0 || position.y >= (int)_height)
+	{
+		return;
+	}
+
+	if (position.x < 0)
+	{
+		colours -= position.x;
+		count += position.x;
+		position.x = 0;
+	}
+
+	count = glm::min(count, (int)_width - position.x);
+
+	if (count <= 0)
+	{
+		return;
+	}
+
+	_pack(colours, (unsigned int)count, _localBuffer + ((size_t)position.y * _width + position.x) * _bytesPerPixel);
+}
+
+void Framebuffer::MarkDirty(glm::ivec2 min, glm::ivec2 max)
+{
+	min = glm::clamp(min, glm::ivec2(0), glm::ivec2(_width, _height));
+	max = glm::clamp(max, glm::ivec2(0), glm::ivec2(_width, _height));
 
-	for (unsigned int i = 0; i < _width * _height; ++i)
+	for (int tileY = min.y / (int)_dirtyTileSize; tileY * (int)_dirtyTileSize < max.y; ++tileY)
 	{
-		_localBuffer[i] = colour;
+		for (int tileX = min.x / (int)_dirtyTileSize; tileX * (int)_dirtyTileSize < max.x; ++tileX)
+		{
+			_dirtyTiles[tileY * _dirtyTilesX + tileX].store(1, std::memory_order_release);
+		}
 	}
 }
 
@@ -541,10 +793,168 @@ void Framebuffer::SetAllPixels(glm::vec3 colour)
 
 void Framebuffer::UpdateGL()
 {
-	// Send offline framebuffer to the OpenGL texture
-	glBindTexture(GL_TEXTURE_2D, _glTexName);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, _width, _height, 0, GL_RGB, GL_FLOAT, _localBuffer);
+	auto startTime = std::chrono::steady_clock::now();
+
+	_uploadStats = UploadStats();
+
+	CollectDirtyRegions();
+
+	if (!_dirtyRegions.empty())
+	{
+		// Send offline framebuffer to the OpenGL texture
+		glBindTexture(GL_TEXTURE_2D, _glTexName);
+
+		// Regions are picked out of a full width image, so tell OpenGL how long its rows are
+		// and that they're packed tight, RGB16F rows aren't always a multiple of 4 bytes
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, _width);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+		if (_uploadPath == UploadPath::PixelBuffer && _pixelBuffers[0] == 0)
+		{
+			GenPixelBuffers();
+		}
+
+		if (_uploadPath == UploadPath::PixelBuffer && _pixelBuffers[0] != 0)
+		{
+			UploadThroughPixelBuffer();
+		}
+		else
+		{
+			UploadDirect();
+		}
+
+		// Put the unpack state back how we found it
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
+
+	_uploadStats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void Framebuffer::CollectDirtyRegions()
+{
+	_dirtyRegions.clear();
+
+	for (unsigned int tileY = 0; tileY < _dirtyTilesY; ++tileY)
+	{
+		unsigned int tileX = 0;
+
+		while (tileX < _dirtyTilesX)
+		{
+			// Clearing the flag before reading the pixels means anything drawn during the upload gets sent next time
+			if (!_dirtyTiles[tileY * _dirtyTilesX + tileX].exchange(0, std::memory_order_acquire))
+			{
+				++tileX;
+				continue;
+			}
+
+			// Neighbouring dirty tiles in the same row go up as one region
+			unsigned int runStart = tileX++;
+
+			while (tileX < _dirtyTilesX && _dirtyTiles[tileY * _dirtyTilesX + tileX].exchange(0, std::memory_order_acquire))
+			{
+				++tileX;
+			}
+
+			DirtyRegion region;
+			region.x = runStart * _dirtyTileSize;
+			region.y = tileY * _dirtyTileSize;
+			region.width = glm::min(tileX * _dirtyTileSize, _width) - region.x;
+			region.height = glm::min(region.y + _dirtyTileSize, _height) - region.y;
 
+			_dirtyRegions.push_back(region);
+
+			_uploadStats.bytes += region.width * region.height * _bytesPerPixel;
+			_uploadStats.regions++;
+		}
+	}
+}
+
+void Framebuffer::UploadDirect()
+{
+	// OpenGL has to copy out of our memory before glTexSubImage2D can return, so this thread waits for every byte
+	for (const DirtyRegion& region : _dirtyRegions)
+	{
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS, region.x);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS, region.y);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, region.x, region.y, region.width, region.height, GetGLFormat(_format), GetGLType(_format), _localBuffer);
+	}
+}
+
+void Framebuffer::UploadThroughPixelBuffer()
+{
+	int index = _nextPixelBuffer;
+	_nextPixelBuffer = (_nextPixelBuffer + 1) % _pixelBufferCount;
+
+	size_t bufferSize = (size_t)_width * _height * _bytesPerPixel;
+
+	// Wait for OpenGL to finish with this buffer from its last use, which is normally long done by the time we come round to it again
+	if (_pixelBufferFences[index] != nullptr)
+	{
+		auto waitStart = std::chrono::steady_clock::now();
+
+		GLenum waitResult = glClientWaitSync(_pixelBufferFences[index], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+
+		_uploadStats.stallMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - waitStart).count();
+
+		// Still busy after a second, or the wait failed, so OpenGL may yet read from it
+		// This frame goes up directly instead and the fence stays, so the buffer is waited on again next time round
+		if (waitResult != GL_ALREADY_SIGNALED && waitResult != GL_CONDITION_SATISFIED)
+		{
+			UploadDirect();
+			return;
+		}
+
+		glDeleteSync(_pixelBufferFences[index]);
+		_pixelBufferFences[index] = nullptr;
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _pixelBuffers[index]);
+
+	// The fence already tells us the buffer is free, so OpenGL doesn't need to synchronise the mapping
+	char* memory = (char*)_pixelBufferMemory[index];
+
+	if (memory == nullptr)
+	{
+		memory = (char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bufferSize, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	}
+
+	if (memory == nullptr)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		UploadDirect();
+		return;
+	}
+
+	// Copy each region into the same place it sits in the local buffer, one row at a time
+	for (const DirtyRegion& region : _dirtyRegions)
+	{
+		for (unsigned int y = region.y; y < region.y + region.height; ++y)
+		{
+			size_t offset = ((size_t)y * _width + region.x) * _bytesPerPixel;
+
+			memcpy(memory + offset, _localBuffer + offset, region.width * _bytesPerPixel);
+		}
+	}
+
+	if (_pixelBufferMemory[index] == nullptr)
+	{
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	}
+
+	// With a buffer bound, the data pointer is an offset into it, and the copy to the texture happens on OpenGL's own time
+	for (const DirtyRegion& region : _dirtyRegions)
+	{
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS, region.x);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS, region.y);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, region.x, region.y, region.width, region.height, GetGLFormat(_format), GetGLType(_format), 0);
+	}
+
+	_pixelBufferFences[index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 }
 
 void Framebuffer::BindGLTex()
@@ -553,9 +963,120 @@ void Framebuffer::BindGLTex()
 }
 
 
+bool Framebuffer::SavePPM(const std::string& filename)
+{
+	std::ofstream file(filename, std::ios::binary);
+
+	if (!file.is_open())
+	{
+		std::cerr << "ERROR: could not open image file for writing: " << filename << std::endl;
+		return false;
+	}
+
+	file << "P6\n" << _width << " " << _height << "\n255\n";
+
+	std::vector<unsigned char> row(_width * 3);
+
+	// Row 0 is the bottom of the OpenGL texture, so go backwards to write the top row first
+	for (int y = (int)_height - 1; y >= 0; --y)
+	{
+		for (unsigned int x = 0; x < _width; ++x)
+		{
+			glm::vec3 colour = PixelFormat::Unpack(_format, _localBuffer + ((size_t)y * _width + x) * _bytesPerPixel);
+
+			row[x * 3 + 0] = (unsigned char)(colour.r * 255.0f + 0.5f);
+			row[x * 3 + 1] = (unsigned char)(colour.g * 255.0f + 0.5f);
+			row[x * 3 + 2] = (unsigned char)(colour.b * 255.0f + 0.5f);
+		}
+
+		file.write((const char*)row.data(), row.size());
+	}
+
+	if (!file.good())
+	{
+		std::cerr << "ERROR: failed writing image file: " << filename << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+
 void Framebuffer::GenLocalFramebuffer()
 {
-	_localBuffer = new glm::vec3[_width * _height];
+	_localBuffer = new unsigned char[(size_t)_width * _height * _bytesPerPixel];
+}
+
+void Framebuffer::GenDirtyTiles()
+{
+	_dirtyTilesX = (_width + _dirtyTileSize - 1) / _dirtyTileSize;
+	_dirtyTilesY = (_height + _dirtyTileSize - 1) / _dirtyTileSize;
+
+	_dirtyTiles.reset(new std::atomic<unsigned char>[_dirtyTilesX * _dirtyTilesY]);
+
+	for (unsigned int i = 0; i < _dirtyTilesX * _dirtyTilesY; ++i)
+	{
+		_dirtyTiles[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+void Framebuffer::GenPixelBuffers()
+{
+	size_t bufferSize = (size_t)_width * _height * _bytesPerPixel;
+
+	// Buffer storage (core in OpenGL 4.4) lets us map the buffers once and keep writing into them
+	bool persistent = GLEW_ARB_buffer_storage != GL_FALSE;
+
+	glGenBuffers(_pixelBufferCount, _pixelBuffers);
+
+	for (int i = 0; i < _pixelBufferCount; ++i)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _pixelBuffers[i]);
+
+		if (persistent)
+		{
+			// Coherent, so our writes are visible to OpenGL without flushing
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+			glBufferStorage(GL_PIXEL_UNPACK_BUFFER, bufferSize, nullptr, flags);
+			_pixelBufferMemory[i] = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bufferSize, flags);
+		}
+		else
+		{
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, bufferSize, nullptr, GL_STREAM_DRAW);
+		}
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	std::cout << "INFO: Framebuffer uploads through " << _pixelBufferCount << (persistent ? " persistently mapped" : "") << " pixel buffers" << std::endl;
+}
+
+void Framebuffer::DeletePixelBuffers()
+{
+	if (_pixelBuffers[0] == 0)
+	{
+		return;
+	}
+
+	for (int i = 0; i < _pixelBufferCount; ++i)
+	{
+		if (_pixelBufferFences[i] != nullptr)
+		{
+			glDeleteSync(_pixelBufferFences[i]);
+			_pixelBufferFences[i] = nullptr;
+		}
+
+		_pixelBufferMemory[i] = nullptr;
+	}
+
+	// Deleting a buffer also unmaps it
+	glDeleteBuffers(_pixelBufferCount, _pixelBuffers);
+
+	for (int i = 0; i < _pixelBufferCount; ++i)
+	{
+		_pixelBuffers[i] = 0;
+	}
 }
 
 void Framebuffer::GenGLFramebuffer()
@@ -576,6 +1097,8 @@ void Framebuffer::GenGLFramebuffer()
 	// We therefore either need to tell it to use linear or generate a mipmap
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, _width, _height, 0, GL_RGB, GL_FLOAT, 0);
+	// Immutable storage, allocated once here and only ever updated in place by UpdateGL
+	// Its format matches the local buffer so the driver doesn't have to convert anything on upload
+	glTexStorage2D(GL_TEXTURE_2D, 1, GetGLInternalFormat(_format), _width, _height);
 
 }
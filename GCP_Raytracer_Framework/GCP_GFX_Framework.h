@@ -7,12 +7,40 @@
 #include <iostream>
 #include <string>
 #include <fstream>
+#include <vector>
 
 #include <GLM/glm.hpp>
 
+#include "PixelFormat.h"
+
 // Forward declaration of internal utility class to handle framebuffer functionality
 class Framebuffer;
 
+// What the last framebuffer upload to OpenGL sent
+struct UploadStats
+{
+	size_t bytes = 0;
+
+	// Number of glTexSubImage2D calls
+	unsigned int regions = 0;
+
+	// Time spent in the upload on the calling thread
+	double milliseconds = 0.0;
+
+	// Part of that spent waiting for OpenGL to free up a pixel buffer
+	double stallMilliseconds = 0.0;
+};
+
+// How the framebuffer gets to OpenGL
+enum class UploadPath
+{
+	// glTexSubImage2D straight from the framebuffer, OpenGL copies it all before the call returns
+	Direct,
+
+	// Dirty regions are copied into a ring of pixel buffer objects, OpenGL then moves them into the texture in the background
+	PixelBuffer
+};
+
 // Main interface for the framework
 // Must call Init() before other functions
 class GCP_Framework
@@ -23,7 +51,13 @@ public:
 
 	// Must call Init after creation
 	// Sets up SDL, OpenGL and the internal framebuffer
-	bool Init( glm::ivec2 screenSize );
+	// The format sets how much memory and upload bandwidth each pixel takes, the default keeps full floats
+	bool Init( glm::ivec2 screenSize, FramebufferFormat format = FramebufferFormat::RGB32F );
+
+	// Alternative to Init for machines with no display or GPU
+	// Only the CPU side framebuffer is set up, so SDL and OpenGL are never touched
+	// Use SaveImage to get the result out, ShowAndHold does nothing
+	bool InitHeadless( glm::ivec2 screenSize, FramebufferFormat format = FramebufferFormat::RGB32F );
 
 	// Set all pixels to the same colour
 	// Colour is RGB, each must range from 0 to 1
@@ -33,16 +67,45 @@ public:
 	// Colour is RGB, each must range from 0 to 1
 	void DrawPixel(glm::ivec2 pixelPosition, glm::vec3 pixelColour);
 
+	// Set count pixels in a row, starting at pixelPosition and going right
+	// Much quicker than DrawPixel for each one, as the colours are converted to the framebuffer format together
+	void DrawPixels(glm::ivec2 pixelPosition, const glm::vec3* pixelColours, int count);
+
+	// Only the parts of the framebuffer marked here get sent to OpenGL by Present, SetAllPixels and ShowAndHold mark the whole of it
+	// Call this once a rectangle of pixels (max is exclusive) is finished, drawing from another thread while the window is being updated
+	// means the window never picks up a rectangle that's only partly drawn
+	void MarkDirty(glm::ivec2 min, glm::ivec2 max);
+
+	UploadStats GetUploadStats();
+
+	// Defaults to UploadPath::Direct
+	void SetUploadPath(UploadPath path);
+
 	// Sends framebuffer to OpenGL and displays to screen
 	// Will return when user closes the window
 	// SDL is uninitialised, you are expected to exit the program
 	void ShowAndHold();
 
+	// The pieces ShowAndHold is made of, for programs that want to keep drawing while they show the window
+	// Present sends the framebuffer to OpenGL and displays it, without waiting
+	void Present();
+
+	// Handles any waiting window events, returns false once the user has asked to quit
+	bool PollEvents();
+
+	// Closes the window and uninitialises SDL, ShowAndHold calls this itself
+	void Shutdown();
+
+	// Writes the framebuffer to disk as a binary PPM image
+	// Returns false if the file couldn't be written
+	bool SaveImage(const std::string& filename);
+
 protected:
 
 	// Internal variables
 		Framebuffer* _mainBuffer = nullptr;
 		glm::ivec2 _screenSize;
+		bool _headless = false;
 
 	// SDL variables
 		SDL_Window* _SDLwindow = nullptr;
@@ -0,0 +1,257 @@
+#include "InstanceBVH.h"
+
+
+unsigned int InstanceBVH::AddInstance(unsigned int meshIndex, const glm::mat4& transform)
+{
+	MeshInstance instance;
+	instance.meshIndex = meshIndex;
+	instance.objectToWorld = transform;
+	instance.worldToObject = glm::inverse(transform);
+
+	instances.push_back(instance);
+	instanceIds.push_back((unsigned int)instanceIds.size());
+
+	return (unsigned int)instances.size() - 1;
+}
+
+
+void InstanceBVH::Build(const std::vector<Mesh>& meshes, ThreadPool* pool, BVHBuilder builder)
+{
+	unsigned int instanceCount = GetInstanceCount();
+
+	std::vector<AABB> bounds(instanceCount);
+
+	// World bounds of each instance, around all eight corners of its mesh's bounds once they're moved into world space
+	auto calculateBounds = [&](unsigned int start, unsigned int end)
+	{
+		for (unsigned int i = start; i < end; i++)
+		{
+			AABB meshBounds = meshes[instances[i].meshIndex].GetBounds();
+
+			for (int corner = 0; corner < 8; corner++)
+			{
+				glm::vec3 point((corner & 1) ? meshBounds.max.x : meshBounds.min.x, (corner & 2) ? meshBounds.max.y : meshBounds.min.y, (corner & 4) ? meshBounds.max.z : meshBounds.min.z);
+
+				bounds[i].Grow(glm::vec3(instances[i].objectToWorld * glm::vec4(point, 1.0f)));
+			}
+		}
+	};
+
+	const unsigned int chunkSize = 4096;
+
+	ParallelForChunks(pool, instanceCount, chunkSize, [&](unsigned int, unsigned int start, unsigned int end)
+	{
+		calculateBounds(start, end);
+	});
+
+	bvh.Build(bounds, pool, builder);
+
+	// Put the instances in the order the leaves reference them
+
+	const std::vector<unsigned int>& primIndices = bvh.GetPrimIndices();
+
+	std::vector<MeshInstance> sortedInstances(instanceCount);
+	std::vector<unsigned int> sortedIds(instanceCount);
+
+	for (unsigned int i = 0; i < instanceCount; i++)
+	{
+		sortedInstances[i] = instances[primIndices[i]];
+		sortedIds[i] = instanceIds[primIndices[i]];
+	}
+
+	instances.swap(sortedInstances);
+	instanceIds.swap(sortedIds);
+
+	std::cout << "INFO: Instance BVH built over " << instanceCount << " instances in " << bvh.GetBuildTimeMs() << " ms, " << bvh.GetNodeCount() << " nodes" << std::endl;
+}
+
+
+// The direction isn't normalised again, so distances along the ray are the same in both spaces and tMax carries straight over
+static Ray ToObjectSpace(const MeshInstance& instance, const Ray& ray)
+{
+	return Ray(glm::vec3(instance.worldToObject * glm::vec4(ray.origin, 1.0f)), glm::mat3(instance.worldToObject) * ray.direction);
+}
+
+
+unsigned int InstanceBVH::Intersect(const std::vector<Mesh>& meshes, const Ray& ray, float& tMax, InstanceHit& hit) const
+{
+	const MeshInstance* instanceData = Instances();
+
+	unsigned int meshVisited = 0;
+
+	unsigned int visited = bvh.Traverse(ray, tMax, [&](unsigned int first, unsigned int count, float& leafTMax)
+	{
+		for (unsigned int i = first; i < first + count; i++)
+		{
+			const MeshInstance& instance = instanceData[i];
+
+			Ray objectRay = ToObjectSpace(instance, ray);
+
+			TriangleHit triangleHit;
+
+			meshVisited += meshes[instance.meshIndex].Intersect(objectRay, leafTMax, triangleHit);
+
+			if (triangleHit.triangle >= 0)
+			{
+				hit.instance = (int)i;
+				hit.triangleHit = triangleHit;
+			}
+		}
+	});
+
+	return visited + meshVisited;
+}
+
+unsigned int InstanceBVH::IntersectPacket(const std::vector<Mesh>& meshes, RayPacket& packet, InstanceHit* hits) const
+{
+	const MeshInstance* instanceData = Instances();
+
+	unsigned int meshVisited = 0;
+
+	// The rays that reach each instance, gathered into a packet of their own in its mesh's space
+	RayPacket objectPacket;
+	Ray objectRays[RayPacket::maxRays];
+	unsigned int packetRays[RayPacket::maxRays];
+	TriangleHit triangleHits[RayPacket::maxRays];
+
+	unsigned int visited = bvh.TraversePacket(packet, [&](unsigned int first, unsigned int count, unsigned long long mask)
+	{
+		for (unsigned int i = first; i < first + count; i++)
+		{
+			const MeshInstance& instance = instanceData[i];
+
+			unsigned int objectCount = 0;
+
+			for (unsigned long long rays = mask; rays != 0; rays &= rays - 1)
+			{
+				unsigned int ray = (unsigned int)FirstSetBit64(rays);
+
+				objectRays[objectCount] = ToObjectSpace(instance, packet.rays[ray]);
+				packetRays[objectCount++] = ray;
+			}
+
+			objectPacket.Set(objectRays, objectCount);
+
+			for (unsigned int j = 0; j < objectCount; j++)
+			{
+				objectPacket.tMax[j] = packet.tMax[packetRays[j]];
+				triangleHits[j] = TriangleHit();
+			}
+
+			meshVisited += meshes[instance.meshIndex].IntersectPacket(objectPacket, triangleHits);
+
+			for (unsigned int j = 0; j < objectCount; j++)
+			{
+				if (triangleHits[j].triangle >= 0)
+				{
+					packet.tMax[packetRays[j]] = objectPacket.tMax[j];
+					hits[packetRays[j]].instance = (int)i;
+					hits[packetRays[j]].triangleHit = triangleHits[j];
+				}
+			}
+		}
+	},
+	[&](unsigned int ray, unsigned int first, unsigned int count, float& leafTMax)
+	{
+		for (unsigned int i = first; i < first + count; i++)
+		{
+			const MeshInstance& instance = instanceData[i];
+
+			TriangleHit triangleHit;
+
+			meshVisited += meshes[instance.meshIndex].Intersect(ToObjectSpace(instance, packet.rays[ray]), leafTMax, triangleHit);
+
+			if (triangleHit.triangle >= 0)
+			{
+				hits[ray].instance = (int)i;
+				hits[ray].triangleHit = triangleHit;
+			}
+		}
+	});
+
+	return visited + meshVisited;
+}
+
+
+bool InstanceBVH::IsOccluded(const std::vector<Mesh>& meshes, const Ray& ray, float tMax) const
+{
+	const MeshInstance* instanceData = Instances();
+
+	return bvh.TraverseAny(ray, tMax, [&](unsigned int first, unsigned int count, float& leafTMax)
+	{
+		for (unsigned int i = first; i < first + count; i++)
+		{
+			const MeshInstance& instance = instanceData[i];
+
+			Ray objectRay = ToObjectSpace(instance, ray);
+
+			if (meshes[instance.meshIndex].IsOccluded(objectRay, leafTMax))
+			{
+				return true;
+			}
+		}
+
+		return false;
+	});
+}
+
+
+glm::vec3 InstanceBVH::GetNormal(const std::vector<Mesh>& meshes, const InstanceHit& hit) const
+{
+	const MeshInstance& instance = GetInstance((unsigned int)hit.instance);
+
+	glm::vec3 objectNormal = meshes[instance.meshIndex].GetNormal((unsigned int)hit.triangleHit.triangle);
+
+	// Normals move by the inverse transpose, so they stay at right angles to surfaces that are scaled unevenly
+	return glm::normalize(glm::transpose(glm::mat3(instance.worldToObject)) * objectNormal);
+}
+
+
+size_t InstanceBVH::GetMemoryBytes() const
+{
+	return instances.capacity() * sizeof(MeshInstance) + instanceIds.capacity() * sizeof(unsigned int) + bvh.GetMemoryBytes();
+}
+
+
+void InstanceBVH::Save(SceneCache::Writer& writer) const
+{
+	unsigned int instanceCount = GetInstanceCount();
+
+	writer.Write(Instances(), instanceCount);
+	writer.Write(mappedInstances != nullptr ? mappedInstanceIds : instanceIds.data(), instanceCount);
+
+	bvh.Save(writer);
+}
+
+bool InstanceBVH::Map(SceneCache::Reader& reader, unsigned int meshCount)
+{
+	size_t instanceCount = 0;
+
+	const MeshInstance* cachedInstances = reader.Read<MeshInstance>(instanceCount);
+	const unsigned int* cachedIds = reader.ReadExactly<unsigned int>(instanceCount);
+
+	if (reader.HasFailed() || !bvh.Map(reader, (unsigned int)instanceCount))
+	{
+		return false;
+	}
+
+	// Hits look the mesh up by index, so a damaged cache has to be caught here rather than read past the end of the list
+	for (size_t i = 0; i < instanceCount; i++)
+	{
+		if (cachedInstances[i].meshIndex >= meshCount || cachedIds[i] >= instanceCount)
+		{
+			return false;
+		}
+	}
+
+	instances.clear();
+	instances.shrink_to_fit();
+	instanceIds.clear();
+	instanceIds.shrink_to_fit();
+
+	mappedInstances = cachedInstances;
+	mappedInstanceIds = cachedIds;
+	mappedInstanceCount = (unsigned int)instanceCount;
+
+	return true;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "GCP_GFX_Framework.h"
+#include "Ray.h"
+#include "BVH.h"
+#include "Mesh.h"
+
+#include <vector>
+
+// One placed copy of a mesh, the mesh and its BVH are shared by every copy
+struct MeshInstance
+{
+	// Index into the mesh list the instances are built and traced with
+	unsigned int meshIndex;
+
+	glm::mat4 objectToWorld;
+
+	glm::mat4 worldToObject;
+};
+
+// Closest hit found so far among the instances
+struct InstanceHit
+{
+	// Index of the instance in the BVH's own order, or -1 if nothing was hit
+	int instance = -1;
+
+	TriangleHit triangleHit;
+};
+
+// The top level of a two level BVH, a BVH over the world space bounds of mesh instances
+// Each mesh's own BVH is the bottom level, rays are moved into a mesh's space when they reach one of its instances
+class InstanceBVH
+{
+	private:
+
+		// In BVH leaf order once built
+		std::vector<MeshInstance> instances;
+
+		// Which instance each one was when it was added
+		std::vector<unsigned int> instanceIds;
+
+		BVH bvh;
+
+		// Instances that live in a mapped scene cache, used instead of the vectors above when set
+		const MeshInstance* mappedInstances = nullptr;
+
+		const unsigned int* mappedInstanceIds = nullptr;
+
+		unsigned int mappedInstanceCount = 0;
+
+		const MeshInstance* Instances() const { return mappedInstances != nullptr ? mappedInstances : instances.data(); }
+
+	public:
+
+		// Returns the new instance's index, meshIndex refers to the list passed to Build and Intersect
+		unsigned int AddInstance(unsigned int meshIndex, const glm::mat4& transform);
+
+		unsigned int GetInstanceCount() const { return mappedInstances != nullptr ? mappedInstanceCount : (unsigned int)instances.size(); }
+
+		// Which instance this was when it was added, instances move when the BVH is built
+		unsigned int GetInstanceId(unsigned int instance) const { return mappedInstances != nullptr ? mappedInstanceIds[instance] : instanceIds[instance]; }
+
+		const MeshInstance& GetInstance(unsigned int instance) const { return Instances()[instance]; }
+
+		// Builds the top level BVH, every mesh an instance uses must have its own BVH built already
+		void Build(const std::vector<Mesh>& meshes, ThreadPool* pool = nullptr, BVHBuilder builder = BVHBuilder::SAH);
+
+		const BVH& GetBVH() const { return bvh; }
+
+		// Finds the closest triangle of any instance that the ray hits before tMax, pulling tMax in to it and filling in hit
+		// Returns the number of nodes visited in both levels
+		unsigned int Intersect(const std::vector<Mesh>& meshes, const Ray& ray, float& tMax, InstanceHit& hit) const;
+
+		// Intersect for every ray of a packet at once, pulling each one's packet.tMax in to its closest hit and filling in its entry in hits
+		// The rays that reach an instance go on through its mesh as a packet of their own, moved into the mesh's space
+		// Returns the number of nodes visited in both levels
+		unsigned int IntersectPacket(const std::vector<Mesh>& meshes, RayPacket& packet, InstanceHit* hits) const;
+
+		// True if the ray hits any instance before tMax, stopping at the first one it does
+		bool IsOccluded(const std::vector<Mesh>& meshes, const Ray& ray, float tMax) const;
+
+		// World space normal of the triangle that was hit
+		glm::vec3 GetNormal(const std::vector<Mesh>& meshes, const InstanceHit& hit) const;
+
+		// Bytes used by the instances and the top level BVH, not counting the meshes
+		size_t GetMemoryBytes() const;
+
+		// Writes the instances and the top level BVH to a scene cache, the BVH should be built first
+		void Save(SceneCache::Writer& writer) const;
+
+		// Uses the instances and BVH in a scene cache where they are, no more instances can be added after
+		// Fails if an instance refers to a mesh past meshCount or any other index in them is out of range
+		bool Map(SceneCache::Reader& reader, unsigned int meshCount);
+};
@@ -0,0 +1,129 @@
+#include "Light.h"
+
+#include <GLM/gtc/constants.hpp>
+
+#include <cmath>
+
+
+// Weights of red, green and blue in perceived brightness
+static const glm::vec3 luminanceWeights(0.2126f, 0.7152f, 0.0722f);
+
+
+bool Light::Sample(const glm::vec3& point, glm::vec2 u, LightSample& sample) const
+{
+	switch (type)
+	{
+	case LightType::Directional:
+	{
+		sample.direction = -direction;
+		sample.distance = FLT_MAX;
+		sample.colour = colour;
+
+		return true;
+	}
+	case LightType::Point:
+	{
+		glm::vec3 toLight = position - point;
+		float distanceSquared = glm::dot(toLight, toLight);
+
+		if (distanceSquared <= 0.0f)
+		{
+			return false;
+		}
+
+		sample.distance = std::sqrt(distanceSquared);
+		sample.direction = toLight / sample.distance;
+		sample.colour = colour / distanceSquared;
+
+		return true;
+	}
+	case LightType::Area:
+	{
+		// Uniformly over the rectangle, so the chance of each place is one over the area
+		glm::vec3 toLight = position + u.x * edgeU + u.y * edgeV - point;
+		glm::vec3 facing = glm::cross(edgeU, edgeV);
+
+		float area = glm::length(facing);
+		float distanceSquared = glm::dot(toLight, toLight);
+
+		if (area <= 0.0f || distanceSquared <= 0.0f)
+		{
+			return false;
+		}
+
+		sample.distance = std::sqrt(distanceSquared);
+		sample.direction = toLight / sample.distance;
+
+		// Cosine at the light, the point has to be in front of it
+		float lightCosine = -glm::dot(sample.direction, facing) / area;
+
+		if (lightCosine <= 0.0f)
+		{
+			return false;
+		}
+
+		sample.colour = colour * (lightCosine * area / (glm::pi<float>() * distanceSquared));
+
+		return true;
+	}
+	case LightType::Sphere:
+	{
+		// Uniformly over the cone of directions the sphere covers as seen from the point
+		glm::vec3 toCentre = position - point;
+		float distanceSquared = glm::dot(toCentre, toCentre);
+		float radiusSquared = radius * radius;
+
+		// Points on or in the sphere can't see its outside
+		if (distanceSquared <= radiusSquared)
+		{
+			return false;
+		}
+
+		float distance = std::sqrt(distanceSquared);
+		glm::vec3 axis = toCentre / distance;
+
+		// 1 - cos of the cone's half angle, written so it doesn't cancel away for small, far spheres
+		float sineSquaredMax = radiusSquared / distanceSquared;
+		float oneMinusCosMax = sineSquaredMax / (1.0f + std::sqrt(1.0f - sineSquaredMax));
+
+		float cosTheta = 1.0f - u.x * oneMinusCosMax;
+		float sinTheta = std::sqrt(glm::max(1.0f - cosTheta * cosTheta, 0.0f));
+		float phi = 2.0f * glm::pi<float>() * u.y;
+
+		// Any two directions at right angles to the axis and each other
+		glm::vec3 side = std::abs(axis.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+		glm::vec3 tangent = glm::normalize(glm::cross(side, axis));
+		glm::vec3 bitangent = glm::cross(axis, tangent);
+
+		sample.direction = glm::normalize(cosTheta * axis + sinTheta * (std::cos(phi) * tangent + std::sin(phi) * bitangent));
+
+		// Where that direction first meets the sphere
+		float along = distance * cosTheta;
+		sample.distance = along - std::sqrt(glm::max(radiusSquared - (distanceSquared - along * along), 0.0f));
+
+		// The chance of each direction is one over the cone's solid angle, 2 pi (1 - cos)
+		sample.colour = colour * (2.0f * oneMinusCosMax);
+
+		return true;
+	}
+	}
+
+	return false;
+}
+
+float Light::GetPower() const
+{
+	float luminance = glm::dot(colour, luminanceWeights);
+
+	switch (type)
+	{
+	case LightType::Point:
+		return 4.0f * glm::pi<float>() * luminance;
+	case LightType::Area:
+		return glm::pi<float>() * glm::length(glm::cross(edgeU, edgeV)) * luminance;
+	case LightType::Sphere:
+		return 4.0f * glm::pi<float>() * glm::pi<float>() * radius * radius * luminance;
+	default:
+		return 0.0f;
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "GCP_GFX_Framework.h"
+
+#include <cfloat>
+
+enum class LightType
+{
+	// Shines out in every direction from a position
+	Point,
+
+	// So far away that it shines the same way everywhere
+	Directional,
+
+	// A one sided rectangle, shining out of the side its edges wind anticlockwise on
+	Area,
+
+	// A sphere with an emissive material, shining out of its whole surface
+	Sphere
+};
+
+// Light arriving at a point from one place on a light
+struct LightSample
+{
+	// Normalised, from the point towards the light
+	glm::vec3 direction;
+
+	// How far along direction the light is, FLT_MAX for directional lights, shadow rays stop short of it
+	float distance;
+
+	// What arrives divided by the chance of sampling this place, a surface reflects colour * albedo * the cosine of the angle to its normal
+	glm::vec3 colour;
+};
+
+// Point and directional colours are what a white surface facing the light shows, at a distance of 1 for point lights
+// Area and sphere colours are the radiance leaving their surface, so a white surface with one filling its whole view shows that colour
+struct Light
+{
+	LightType type = LightType::Directional;
+
+	// Where a point light is, the corner an area light's edges start from or a sphere light's centre
+	glm::vec3 position = glm::vec3(0.0f);
+
+	// Which way a directional light shines, normalised
+	glm::vec3 direction = glm::vec3(0.0f, -1.0f, 0.0f);
+
+	glm::vec3 colour = glm::vec3(1.0f);
+
+	// An area light's two edges
+	glm::vec3 edgeU = glm::vec3(0.0f);
+
+	glm::vec3 edgeV = glm::vec3(0.0f);
+
+	float radius = 0.0f;
+
+	// Index of the sphere a sphere light was made from
+	unsigned int sphere = 0;
+
+	// Picks a place on the light to shade point with, u is a pair of random numbers from 0 to 1
+	// Returns false if nothing from that place reaches the point, like the back of an area light
+	bool Sample(const glm::vec3& point, glm::vec2 u, LightSample& sample) const;
+
+	// Luminance of all the light it gives off, for choosing between lights, directional lights have none as they're everywhere at once
+	float GetPower() const;
+};
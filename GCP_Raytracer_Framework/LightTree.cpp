@@ -0,0 +1,226 @@
+#include "LightTree.h"
+
+#include <cmath>
+#include <iostream>
+
+
+// Bounds of everything a light could shine from
+static AABB GetLightBounds(const Light& light)
+{
+	AABB bounds;
+
+	switch (light.type)
+	{
+	case LightType::Area:
+		bounds.Grow(light.position);
+		bounds.Grow(light.position + light.edgeU);
+		bounds.Grow(light.position + light.edgeV);
+		bounds.Grow(light.position + light.edgeU + light.edgeV);
+		break;
+	case LightType::Sphere:
+		bounds.Grow(light.position - glm::vec3(light.radius));
+		bounds.Grow(light.position + glm::vec3(light.radius));
+		break;
+	default:
+		bounds.Grow(light.position);
+		break;
+	}
+
+	return bounds;
+}
+
+
+void LightTree::Build(const std::vector<Light>& allLights, ThreadPool* pool)
+{
+	std::vector<Light> unsorted;
+	std::vector<AABB> unsortedBounds;
+
+	for (const Light& light : allLights)
+	{
+		if (light.type != LightType::Directional)
+		{
+			unsorted.push_back(light);
+			unsortedBounds.push_back(GetLightBounds(light));
+		}
+	}
+
+	lights.clear();
+	lightBounds.clear();
+	lightPower.clear();
+	nodePower.clear();
+	bvh = BVH();
+
+	if (unsorted.empty())
+	{
+		return;
+	}
+
+	bvh.Build(unsortedBounds, pool, BVHBuilder::SAH);
+
+	// Put the lights in the order the leaves reference them, so each leaf is one run of them
+
+	const std::vector<unsigned int>& primIndices = bvh.GetPrimIndices();
+	unsigned int lightCount = (unsigned int)primIndices.size();
+
+	lights.resize(lightCount);
+	lightBounds.resize(lightCount);
+	lightPower.resize(lightCount);
+
+	for (unsigned int i = 0; i < lightCount; i++)
+	{
+		lights[i] = unsorted[primIndices[i]];
+		lightBounds[i] = unsortedBounds[primIndices[i]];
+		lightPower[i] = lights[i].GetPower();
+	}
+
+	// Children always come after their parents, so going backwards reaches both children before the node itself
+
+	const BVHNode* nodes = bvh.GetNodes();
+	unsigned int nodeCount = bvh.GetNodeCount();
+
+	nodePower.resize(nodeCount);
+
+	for (unsigned int i = nodeCount; i-- > 0;)
+	{
+		const BVHNode& node = nodes[i];
+
+		if (node.IsLeaf())
+		{
+			float power = 0.0f;
+
+			for (unsigned int light = node.leftFirst; light < node.leftFirst + node.count; light++)
+			{
+				power += lightPower[light];
+			}
+
+			nodePower[i] = power;
+		}
+		else
+		{
+			nodePower[i] = nodePower[node.leftFirst] + nodePower[node.leftFirst + 1];
+		}
+	}
+
+	std::cout << "INFO: Light tree built over " << lightCount << " lights in " << bvh.GetBuildTimeMs() << " ms, " << nodeCount << " nodes" << std::endl;
+}
+
+
+float LightTree::Importance(const glm::vec3& point, const glm::vec3& normal, const AABB& bounds, float power)
+{
+	glm::vec3 halfSize = (bounds.max - bounds.min) * 0.5f;
+	glm::vec3 toCentre = bounds.Centre() - point;
+
+	// How far the highest corner of the box is above the surface, a box entirely under it can't light the point at all
+	float height = glm::dot(normal, toCentre) + glm::dot(glm::abs(normal), halfSize);
+
+	if (height <= 0.0f)
+	{
+		return 0.0f;
+	}
+
+	// Points in or near a box would get huge weights from the distance to its centre, so the distance is never taken as less than the box's own size
+	float distanceSquared = glm::max(glm::dot(toCentre, toCentre), glm::dot(halfSize, halfSize));
+
+	if (distanceSquared <= 0.0f)
+	{
+		return power;
+	}
+
+	float cosine = glm::min(height / std::sqrt(distanceSquared), 1.0f);
+
+	return power * cosine / distanceSquared;
+}
+
+
+int LightTree::Sample(const glm::vec3& point, const glm::vec3& normal, float u, float& pdf) const
+{
+	if (!bvh.IsBuilt())
+	{
+		return -1;
+	}
+
+	const BVHNode* nodes = bvh.GetNodes();
+	const BVHNode* node = &nodes[0];
+
+	pdf = 1.0f;
+
+	// u is stretched back out to 0 to 1 after each choice, so one number is enough for the whole walk down
+	while (!node->IsLeaf())
+	{
+		unsigned int left = node->leftFirst;
+
+		AABB leftBounds;
+		leftBounds.min = nodes[left].boundsMin;
+		leftBounds.max = nodes[left].boundsMax;
+
+		AABB rightBounds;
+		rightBounds.min = nodes[left + 1].boundsMin;
+		rightBounds.max = nodes[left + 1].boundsMax;
+
+		float leftImportance = Importance(point, normal, leftBounds, nodePower[left]);
+		float rightImportance = Importance(point, normal, rightBounds, nodePower[left + 1]);
+
+		if (leftImportance + rightImportance <= 0.0f)
+		{
+			return -1;
+		}
+
+		float leftChance = leftImportance / (leftImportance + rightImportance);
+
+		if (u < leftChance)
+		{
+			u = u / leftChance;
+			pdf *= leftChance;
+			node = &nodes[left];
+		}
+		else
+		{
+			u = (u - leftChance) / (1.0f - leftChance);
+			pdf *= 1.0f - leftChance;
+			node = &nodes[left + 1];
+		}
+
+		u = glm::min(u, 0.99999994f);
+	}
+
+	// The leaf's lights are few enough to weigh one by one
+	float importance[BVH::maxLeafSize];
+	float total = 0.0f;
+	int last = -1;
+
+	for (unsigned int i = 0; i < node->count; i++)
+	{
+		unsigned int light = node->leftFirst + i;
+
+		importance[i] = Importance(point, normal, lightBounds[light], lightPower[light]);
+		total += importance[i];
+
+		if (importance[i] > 0.0f)
+		{
+			last = (int)i;
+		}
+	}
+
+	if (last < 0)
+	{
+		return -1;
+	}
+
+	float target = u * total;
+
+	for (int i = 0; i < last; i++)
+	{
+		if (target < importance[i])
+		{
+			pdf *= importance[i] / total;
+			return (int)node->leftFirst + i;
+		}
+
+		target -= importance[i];
+	}
+
+	// Whatever rounding has left over goes to the last light that can reach the point
+	pdf *= importance[last] / total;
+
+	return (int)node->leftFirst + last;
+}
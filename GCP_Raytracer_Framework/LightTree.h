@@ -0,0 +1,48 @@
+#pragma once
+
+#include "GCP_GFX_Framework.h"
+#include "BVH.h"
+#include "Light.h"
+#include "ThreadPool.h"
+
+#include <vector>
+
+// A BVH over the lights that have a place in the scene, with the total power of the lights under each node
+// Shading picks one light at a time by walking down from the root, choosing each child by how much its lights could give the point,
+// so the cost of a pick grows with the depth of the tree, the log of the light count, rather than with the light count itself
+// Directional lights are everywhere at once so they can't go in it, they're shaded separately
+class LightTree
+{
+	private:
+
+		// In BVH leaf order once built
+		std::vector<Light> lights;
+
+		std::vector<AABB> lightBounds;
+
+		std::vector<float> lightPower;
+
+		BVH bvh;
+
+		// Total power of the lights under each node
+		std::vector<float> nodePower;
+
+		// Rough guess at how much light from a box of lights with the given power reaches a point on a surface, 0 if none can
+		static float Importance(const glm::vec3& point, const glm::vec3& normal, const AABB& bounds, float power);
+
+	public:
+
+		// Builds the tree over the point, area and sphere lights, skipping any directional ones
+		void Build(const std::vector<Light>& allLights, ThreadPool* pool = nullptr);
+
+		unsigned int GetLightCount() const { return (unsigned int)lights.size(); }
+
+		// Lights are in the tree's own order
+		const Light& GetLight(unsigned int index) const { return lights[index]; }
+
+		const BVH& GetBVH() const { return bvh; }
+
+		// Picks a light to shade a point with normal by, using one random number u from 0 to 1
+		// Returns its index and the chance it had of being picked in pdf, or -1 if no light can reach the point
+		int Sample(const glm::vec3& point, const glm::vec3& normal, float u, float& pdf) const;
+};
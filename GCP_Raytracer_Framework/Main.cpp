@@ -1,10 +1,20 @@
 
 #include "GCP_GFX_Framework.h"
-#include "Sphere.h"
 #include "RayTracer.h"
 #include "Camera.h"
 #include "Ray.h"
-
+#include "ThreadPool.h"
+#include "TileRenderer.h"
+#include "WavefrontRenderer.h"
+#include "Benchmark.h"
+#include "Simd.h"
+#include "MeshLoader.h"
+#include "SceneLoader.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <utility>
 #include <vector>
 
 //MADE IT TO PAGE 19
@@ -12,48 +22,499 @@
 
 int main(int argc, char* argv[])
 {
+	// Render settings, can be changed from the command line
+	//   -threads N   number of render threads (defaults to the number of CPU cores)
+	//   -scene F     the scene file to render, Default.scene if not given
+	//   -tile N      tile size in pixels, overrides the scene's
+	//   -speedup     time the frame with 1 to N threads and print the speedup curve
+	//   -stats       print BVH statistics after the frame
+	//   -allocations render the frame a few times and print the heap allocations each one made, which should be none, Benchmark configuration only
+	//   -simd X      sphere intersection kernel: scalar, sse41 or avx2 (defaults to the best the CPU has)
+	//   -bench X     run a benchmark and exit instead of rendering, X is one of: spheres, triangles, instances, occlusion, lights, wavefront, packets, samplers, load, cache, scene, pack, bvh, refit, upload
+	//   -headless F  no window or OpenGL, render straight to the PPM image file F and exit
+	//   -upload X    how the framebuffer gets to OpenGL: direct (the default) or pbo
+	//   -format X    framebuffer storage: rgb32f (the default), rgb16f or srgba8
+	//   -progressive show tiles on screen as they finish instead of waiting for the whole frame
+	//   -wavefront   render the frame a stage at a time over every ray with WavefrontRenderer instead of a tile at a time
+	//   -packets N   trace camera rays in N by N packets, 8 (the default) or 2, or 1 to trace each on its own
+	//   -builder X   how the BVH is built: sah, lbvh or lbvh63, overrides the scene's
+	//   -mesh F      load the OBJ or PLY file F into the scene as well, or time loading it with -bench load
+	//   -cache F     keep the built scene in the file F, later runs map it rather than loading and building the scene while the scene and mesh files are unchanged
+	unsigned int threadCount = (unsigned int)SDL_GetCPUCount();
+	const char* sceneFile = "Default.scene";
+	// 0 takes the scene's
+	int tileSize = 0;
+	bool reportSpeedup = false;
+	bool reportStats = false;
+	bool reportAllocations = false;
+	SimdLevel simdLevel = DetectSimdLevel();
+	const char* benchmark = nullptr;
+	const char* headlessOutput = nullptr;
+	bool progressive = false;
+	bool wavefront = false;
+	int packetSize = 8;
+	UploadPath uploadPath = UploadPath::Direct;
+	FramebufferFormat format = FramebufferFormat::RGB32F;
+	BVHBuilder bvhBuilder = BVHBuilder::SAH;
+	bool bvhBuilderSet = false;
+	const char* meshFile = nullptr;
+	const char* cacheFile = nullptr;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc)
+		{
+			threadCount = (unsigned int)atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-scene") == 0 && i + 1 < argc)
+		{
+			sceneFile = argv[++i];
+		}
+		else if (strcmp(argv[i], "-tile") == 0 && i + 1 < argc)
+		{
+			tileSize = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-speedup") == 0)
+		{
+			reportSpeedup = true;
+		}
+		else if (strcmp(argv[i], "-stats") == 0)
+		{
+			reportStats = true;
+		}
+		else if (strcmp(argv[i], "-allocations") == 0)
+		{
+			reportAllocations = true;
+		}
+		else if (strcmp(argv[i], "-simd") == 0 && i + 1 < argc)
+		{
+			i++;
+
+			// Never ask for more than the CPU has
+			SimdLevel requested = strcmp(argv[i], "avx2") == 0 ? SimdLevel::AVX2 : (strcmp(argv[i], "sse41") == 0 ? SimdLevel::SSE41 : SimdLevel::Scalar);
+			simdLevel = requested < simdLevel ? requested : simdLevel;
+		}
+		else if (strcmp(argv[i], "-bench") == 0 && i + 1 < argc)
+		{
+			benchmark = argv[++i];
+		}
+		else if (strcmp(argv[i], "-headless") == 0 && i + 1 < argc)
+		{
+			headlessOutput = argv[++i];
+		}
+		else if (strcmp(argv[i], "-progressive") == 0)
+		{
+			progressive = true;
+		}
+		else if (strcmp(argv[i], "-wavefront") == 0)
+		{
+			wavefront = true;
+		}
+		else if (strcmp(argv[i], "-packets") == 0 && i + 1 < argc)
+		{
+			i++;
+			packetSize = atoi(argv[i]);
+
+			// The packet traversal only comes in these sizes
+			if (packetSize != 1 && packetSize != 2 && packetSize != 8)
+			{
+				std::cerr << "ERROR: -packets takes 1, 2 or 8, not " << argv[i] << std::endl;
+				return -1;
+			}
+		}
+		else if (strcmp(argv[i], "-upload") == 0 && i + 1 < argc)
+		{
+			uploadPath = strcmp(argv[++i], "pbo") == 0 ? UploadPath::PixelBuffer : UploadPath::Direct;
+		}
+		else if (strcmp(argv[i], "-format") == 0 && i + 1 < argc)
+		{
+			i++;
+			format = strcmp(argv[i], "srgba8") == 0 ? FramebufferFormat::SRGBA8 : (strcmp(argv[i], "rgb16f") == 0 ? FramebufferFormat::RGB16F : FramebufferFormat::RGB32F);
+		}
+		else if (strcmp(argv[i], "-builder") == 0 && i + 1 < argc)
+		{
+			i++;
+			bvhBuilder = strcmp(argv[i], "lbvh63") == 0 ? BVHBuilder::Linear63 : (strcmp(argv[i], "lbvh") == 0 ? BVHBuilder::Linear30 : BVHBuilder::SAH);
+			bvhBuilderSet = true;
+		}
+		else if (strcmp(argv[i], "-mesh") == 0 && i + 1 < argc)
+		{
+			meshFile = argv[++i];
+		}
+		else if (strcmp(argv[i], "-cache") == 0 && i + 1 < argc)
+		{
+			cacheFile = argv[++i];
+		}
+	}
+
+	if (threadCount < 1)
+	{
+		threadCount = 1;
+	}
+
+	// Benchmarks that don't need a window
+	if (benchmark != nullptr && strcmp(benchmark, "upload") != 0)
+	{
+		if (strcmp(benchmark, "spheres") == 0)
+		{
+			Benchmark::SphereKernels(simdLevel);
+		}
+		else if (strcmp(benchmark, "triangles") == 0)
+		{
+			Benchmark::TriangleIntersection();
+		}
+		else if (strcmp(benchmark, "instances") == 0)
+		{
+			Benchmark::Instancing(threadCount);
+		}
+		else if (strcmp(benchmark, "load") == 0)
+		{
+			if (meshFile == nullptr)
+			{
+				std::cerr << "ERROR: the load benchmark needs a mesh file, give one with -mesh" << std::endl;
+				return -1;
+			}
+
+			Benchmark::MeshLoading(meshFile, threadCount);
+		}
+		else if (strcmp(benchmark, "cache") == 0)
+		{
+			Benchmark::SceneCaching(meshFile, threadCount);
+		}
+		else if (strcmp(benchmark, "occlusion") == 0)
+		{
+			Benchmark::Occlusion(threadCount);
+		}
+		else if (strcmp(benchmark, "lights") == 0)
+		{
+			Benchmark::ManyLights(threadCount);
+		}
+		else if (strcmp(benchmark, "wavefront") == 0)
+		{
+			Benchmark::Wavefront(threadCount);
+		}
+		else if (strcmp(benchmark, "packets") == 0)
+		{
+			Benchmark::RayPackets(threadCount);
+		}
+		else if (strcmp(benchmark, "samplers") == 0)
+		{
+			Benchmark::Samplers(threadCount);
+		}
+		else if (strcmp(benchmark, "scene") == 0)
+		{
+			Benchmark::SceneParsing(threadCount);
+		}
+		else if (strcmp(benchmark, "pack") == 0)
+		{
+			Benchmark::PixelPacking(simdLevel);
+		}
+		else if (strcmp(benchmark, "bvh") == 0)
+		{
+			Benchmark::BVHBuild(threadCount);
+		}
+		else if (strcmp(benchmark, "refit") == 0)
+		{
+			Benchmark::BVHRefit(threadCount);
+		}
+		else
+		{
+			std::cerr << "ERROR: unknown benchmark: " << benchmark << std::endl;
+			return -1;
+		}
+
+		return 0;
+	}
+
+	// Threads for loading the scene, building the BVH and tracing the frame
+
+	ThreadPool threadPool(threadCount);
+
+	Scene scene;
+
+	if (!SceneLoader::Load(sceneFile, scene, &threadPool))
+	{
+		return -1;
+	}
+
 	// Set window size
-	glm::ivec2 winSize(640, 480);
+	glm::ivec2 winSize = scene.size;
+
+	tileSize = tileSize > 0 ? tileSize : scene.tileSize;
+	bvhBuilder = bvhBuilderSet ? bvhBuilder : scene.builder;
 
 	// This will handle rendering to screen
 	GCP_Framework _myFramework;
 
 	// Initialises SDL and OpenGL and sets up a framebuffer
-	if (!_myFramework.Init(winSize))
+	// Headless only needs the framebuffer
+	bool initialised = headlessOutput != nullptr ? _myFramework.InitHeadless(winSize, format) : _myFramework.Init(winSize, format);
+
+	if (!initialised)
 	{
 		return -1;
 	}
 
-	//Instantiate some sphere objects
-
-	Sphere sphere1 = Sphere(glm::vec3(50, 50, 50), 40, glm::vec3(1, 0, 0));
+	_myFramework.SetUploadPath(uploadPath);
 
-	Sphere sphere2 = Sphere(glm::vec3(600, 250, 80), 60, glm::vec3(1, 1, 0));
+	// Benchmarks that need OpenGL
+	if (benchmark != nullptr)
+	{
+		if (headlessOutput != nullptr)
+		{
+			std::cerr << "ERROR: the " << benchmark << " benchmark needs OpenGL, it can't run headless" << std::endl;
+			return -1;
+		}
 
-	Sphere sphere3 = Sphere(glm::vec3(250, 400, 200), 40, glm::vec3(0, 0, 1));
+		Benchmark::TextureUpload(_myFramework, winSize);
 
-	std::vector<Sphere> spheres = { sphere1, sphere2, sphere3 };
+		_myFramework.Shutdown();
+		return 0;
+	}
 
 	//Instantiate Ray Tracer and Camera
 
-	RayTracer rayTracer(spheres);
+	// The scene's colours go with the meshes, so they're picked up before the materials are handed over
+	std::vector<glm::vec3> meshColours;
+
+	for (const SceneMesh& sceneMesh : scene.meshes)
+	{
+		meshColours.push_back(scene.materials[sceneMesh.material].colour);
+	}
+
+	RayTracer rayTracer(std::move(scene.spheres), std::move(scene.sphereMaterials), std::move(scene.materials));
+
+	rayTracer.SetLights(std::move(scene.lights));
+
+	rayTracer.SetLightSamples((unsigned int)scene.lightSamples);
+
+	rayTracer.SetMaxBounces((unsigned int)scene.bounces);
+
+	rayTracer.SetRouletteBounces((unsigned int)scene.rouletteBounces);
 
-	Camera camera;
+	rayTracer.SetSamplerType(scene.sampler);
 
-	glm::ivec2 pixelPos(0, 0);
+	rayTracer.SetSamplesPerPixel((unsigned int)scene.samples);
 
-	for (int y = 0; y < 480; y++)
+	rayTracer.SetSimdLevel(simdLevel);
+
+	rayTracer.SetPrimaryPacketSize((unsigned int)(packetSize * packetSize));
+
+	rayTracer.SetBVHBuilder(bvhBuilder);
+
+	// The cache is out of date once the scene file or any mesh file it was built from changes
+	unsigned long long sourceHash = 0;
+
+	if (cacheFile != nullptr)
 	{
-		for (int x = 0; x < 640; x++)
+		std::vector<std::string> sourceFiles = { sceneFile };
+
+		for (const SceneMesh& sceneMesh : scene.meshes)
+		{
+			sourceFiles.push_back(sceneMesh.filename);
+		}
+
+		if (meshFile != nullptr)
+		{
+			sourceFiles.push_back(meshFile);
+		}
+
+		for (const std::string& sourceFile : sourceFiles)
 		{
-			pixelPos = glm::ivec2(x, y);
+			unsigned long long fileHash = 0;
+
+			if (!SceneCache::HashFile(sourceFile, fileHash, &threadPool))
+			{
+				std::cerr << "ERROR: could not open scene source file: " << sourceFile << std::endl;
+				return -1;
+			}
 
-			Ray ray = camera.GetRay(pixelPos);
+			sourceHash = SceneCache::HashBytes(&fileHash, sizeof(fileHash), sourceHash);
+		}
+	}
+
+	if (cacheFile == nullptr || !rayTracer.LoadCache(cacheFile, sourceHash))
+	{
+		for (size_t i = 0; i < scene.meshes.size(); i++)
+		{
+			Mesh mesh(meshColours[i]);
 
-			glm::vec3 colour = rayTracer.TraceRay(ray);
+			if (!MeshLoader::Load(scene.meshes[i].filename, mesh, &threadPool))
+			{
+				return -1;
+			}
 
-			_myFramework.DrawPixel(pixelPos, colour);
+			rayTracer.AddMesh(std::move(mesh));
 		}
+
+		if (meshFile != nullptr)
+		{
+			Mesh mesh(glm::vec3(1, 1, 1));
+
+			if (!MeshLoader::Load(meshFile, mesh, &threadPool))
+			{
+				return -1;
+			}
+
+			rayTracer.AddMesh(std::move(mesh));
+		}
+
+		rayTracer.BuildBVH(&threadPool);
+
+		if (cacheFile != nullptr)
+		{
+			rayTracer.SaveCache(cacheFile, sourceHash);
+		}
+	}
+
+	rayTracer.EnableStats(reportStats);
+
+	Camera camera(scene.camera.position, scene.camera.target, scene.camera.up, scene.camera.fieldOfView, winSize);
+
+	//Split the frame into tiles and trace them on every core
+
+	TileRenderer tileRenderer(winSize, tileSize);
+
+	// Made into a std::function once here, rather than every time it's passed to the renderer
+	std::function<void(const Tile&)> renderTile = [&](const Tile& tile)
+	{
+		// Colours are gathered a run at a time so the framebuffer can convert them to its format together
+		const int runLength = 64;
+		glm::vec3 colours[runLength];
+
+		// The whole tile's rays are made in one go, into a buffer each thread keeps so it only grows the first time
+		static thread_local std::vector<Ray> rays;
+
+		int tileWidth = tile.max.x - tile.min.x;
+
+		rays.resize((size_t)tileWidth * (tile.max.y - tile.min.y));
+
+		if (packetSize > 1)
+		{
+			// A packet sized square of pixels at a time, so TraceRays gets each packet's rays next to each other
+			for (int blockY = tile.min.y; blockY < tile.max.y; blockY += packetSize)
+			{
+				for (int blockX = tile.min.x; blockX < tile.max.x; blockX += packetSize)
+				{
+					glm::ivec2 blockMin(blockX, blockY);
+					glm::ivec2 blockMax = glm::min(blockMin + packetSize, tile.max);
+					int blockWidth = blockMax.x - blockMin.x;
+
+					camera.GetRays(blockMin, blockMax, rays.data());
+
+					rayTracer.TraceRays(rays.data(), blockMin, blockMax, colours);
+
+					for (int y = blockMin.y; y < blockMax.y; y++)
+					{
+						_myFramework.DrawPixels(glm::ivec2(blockMin.x, y), &colours[(y - blockMin.y) * blockWidth], blockWidth);
+					}
+				}
+			}
+
+			_myFramework.MarkDirty(tile.min, tile.max);
+			return;
+		}
+
+		camera.GetRays(tile.min, tile.max, rays.data());
+
+		for (int y = tile.min.y; y < tile.max.y; y++)
+		{
+			const Ray* rowRays = &rays[(size_t)(y - tile.min.y) * tileWidth];
+
+			for (int runStart = tile.min.x; runStart < tile.max.x; runStart += runLength)
+			{
+				int runEnd = glm::min(runStart + runLength, tile.max.x);
+
+				rayTracer.TraceRays(rowRays + (runStart - tile.min.x), glm::ivec2(runStart, y), glm::ivec2(runEnd, y + 1), colours);
+
+				_myFramework.DrawPixels(glm::ivec2(runStart, y), colours, runEnd - runStart);
+			}
+		}
+
+		// Lets the window pick the whole tile up in its next upload
+		_myFramework.MarkDirty(tile.min, tile.max);
+	};
+
+	if (reportSpeedup)
+	{
+		Benchmark::ThreadScaling(tileRenderer, threadCount, renderTile);
+	}
+	else if (reportAllocations)
+	{
+		Benchmark::FrameAllocations(tileRenderer, threadPool, renderTile);
+	}
+	else if (wavefront)
+	{
+		WavefrontRenderer wavefrontRenderer;
+
+		wavefrontRenderer.Render(rayTracer, camera, winSize, &threadPool);
+
+		const std::vector<glm::vec3>& image = wavefrontRenderer.GetImage();
+
+		for (int y = 0; y < winSize.y; y++)
+		{
+			_myFramework.DrawPixels(glm::ivec2(0, y), &image[(size_t)y * winSize.x], winSize.x);
+		}
+
+		_myFramework.MarkDirty(glm::ivec2(0, 0), winSize);
+
+		if (reportStats)
+		{
+			wavefrontRenderer.PrintStats();
+		}
+	}
+	else if (progressive && headlessOutput == nullptr)
+	{
+		// Trace on the pool in the background while this thread keeps the window up to date
+
+		tileRenderer.RenderAsync(threadPool, renderTile);
+
+		bool windowOpen = true;
+
+		while (!tileRenderer.IsFinished())
+		{
+			if (!_myFramework.PollEvents())
+			{
+				windowOpen = false;
+				tileRenderer.Cancel();
+				break;
+			}
+
+			_myFramework.Present();
+
+			// Same rate ShowAndHold runs at
+			SDL_Delay((unsigned int)((1.0f / 50.0f) * 1000.0f));
+		}
+
+		tileRenderer.Wait();
+
+		std::cout << "INFO: First tile finished after " << tileRenderer.GetFirstTileMs() << " ms" << std::endl;
+
+		if (!windowOpen)
+		{
+			_myFramework.Shutdown();
+			return 0;
+		}
+	}
+	else
+	{
+		tileRenderer.Render(threadPool, renderTile);
+	}
+
+	if (reportStats)
+	{
+		rayTracer.PrintStats();
+	}
+
+	if (headlessOutput != nullptr)
+	{
+		if (!_myFramework.SaveImage(headlessOutput))
+		{
+			return -1;
+		}
+
+		std::cout << "INFO: Saved " << headlessOutput << std::endl;
+		return 0;
 	}
 
 
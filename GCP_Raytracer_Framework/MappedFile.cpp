@@ -0,0 +1,149 @@
+#include "MappedFile.h"
+
+#if defined(_WIN32)
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+
+#if defined(_WIN32)
+
+bool MappedFile::Open(const std::string& filename, FileAccess access)
+{
+	Close();
+
+	DWORD accessFlag = access == FileAccess::Sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS;
+
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, accessFlag, nullptr);
+
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+	if (mapping == nullptr)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+	if (view == nullptr)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	fileHandle = file;
+	mappingHandle = mapping;
+	data = (const char*)view;
+	size = (size_t)fileSize.QuadPart;
+
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data != nullptr)
+	{
+		UnmapViewOfFile(data);
+		CloseHandle(mappingHandle);
+		CloseHandle(fileHandle);
+	}
+
+	data = nullptr;
+	size = 0;
+	fileHandle = nullptr;
+	mappingHandle = nullptr;
+}
+
+void MappedFile::Release(size_t offset, size_t length) const
+{
+	// Unlocking pages that were never locked takes them out of the working set, the file stays mapped
+	VirtualUnlock((void*)(data + offset), length);
+}
+
+#else
+
+bool MappedFile::Open(const std::string& filename, FileAccess access)
+{
+	Close();
+
+	int file = open(filename.c_str(), O_RDONLY);
+
+	if (file < 0)
+	{
+		return false;
+	}
+
+	struct stat status;
+
+	if (fstat(file, &status) != 0 || status.st_size == 0)
+	{
+		close(file);
+		return false;
+	}
+
+	void* view = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+
+	if (view == MAP_FAILED)
+	{
+		close(file);
+		return false;
+	}
+
+	madvise(view, (size_t)status.st_size, access == FileAccess::Sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+
+	fileDescriptor = file;
+	data = (const char*)view;
+	size = (size_t)status.st_size;
+
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data != nullptr)
+	{
+		munmap((void*)data, size);
+		close(fileDescriptor);
+	}
+
+	data = nullptr;
+	size = 0;
+	fileDescriptor = -1;
+}
+
+void MappedFile::Release(size_t offset, size_t length) const
+{
+	// Only whole pages can be dropped, so the partial pages at either end stay
+	size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+
+	size_t start = (offset + pageSize - 1) / pageSize * pageSize;
+	size_t end = (offset + length) / pageSize * pageSize;
+
+	if (end > start)
+	{
+		madvise((void*)(data + start), end - start, MADV_DONTNEED);
+	}
+}
+
+#endif
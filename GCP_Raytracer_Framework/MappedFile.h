@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// How a mapped file is going to be read, which tells the OS whether reading ahead is worth it
+enum class FileAccess
+{
+	// Start to end, like the loaders parsing it, so pages can be read ahead and dropped once passed
+	Sequential,
+
+	// Wherever rays happen to go, like a scene cache's BVH nodes and triangles, so only what's touched is read and it stays
+	Random
+};
+
+// A whole file mapped read only into memory, so it can be parsed where it is rather than read into a buffer first
+// Pages are only read from disk when they're touched, and Release hands them back once they've been parsed
+class MappedFile
+{
+	private:
+
+		const char* data = nullptr;
+
+		size_t size = 0;
+
+#if defined(_WIN32)
+		void* fileHandle = nullptr;
+
+		void* mappingHandle = nullptr;
+#else
+		int fileDescriptor = -1;
+#endif
+
+	public:
+
+		MappedFile() {}
+
+		~MappedFile() { Close(); }
+
+		MappedFile(const MappedFile&) = delete;
+
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		// Fails on files that can't be opened and on empty ones, which can't be mapped
+		bool Open(const std::string& filename, FileAccess access = FileAccess::Sequential);
+
+		void Close();
+
+		bool IsOpen() const { return data != nullptr; }
+
+		const char* GetData() const { return data; }
+
+		size_t GetSize() const { return size; }
+
+		// Says a range won't be read again, so its pages can leave the process's memory rather than counting against it until Close
+		void Release(size_t offset, size_t length) const;
+};
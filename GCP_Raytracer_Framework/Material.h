@@ -0,0 +1,12 @@
+#pragma once
+
+#include "GCP_GFX_Framework.h"
+
+// How a surface looks, spheres share these by index
+struct Material
+{
+	glm::vec3 colour = glm::vec3(1.0f);
+
+	// Radiance the surface gives off itself, spheres with any become sphere lights
+	glm::vec3 emission = glm::vec3(0.0f);
+};
@@ -0,0 +1,395 @@
+#include "Mesh.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+WatertightRay::WatertightRay(const Ray& ray)
+{
+	glm::vec3 absDirection = glm::abs(ray.direction);
+
+	kz = absDirection.x > absDirection.y ? (absDirection.x > absDirection.z ? 0 : 2) : (absDirection.y > absDirection.z ? 1 : 2);
+	kx = (kz + 1) % 3;
+	ky = (kx + 1) % 3;
+
+	// Looking down -z mirrors the 2D space, swapping x and y mirrors it back so triangles keep their winding
+	if (ray.direction[kz] < 0.0f)
+	{
+		std::swap(kx, ky);
+	}
+
+	shearX = ray.direction[kx] / ray.direction[kz];
+	shearY = ray.direction[ky] / ray.direction[kz];
+	shearZ = 1.0f / ray.direction[kz];
+}
+
+
+void Mesh::Reserve(unsigned int vertexCount, unsigned int triangleCount)
+{
+	positionX.reserve(vertexCount);
+	positionY.reserve(vertexCount);
+	positionZ.reserve(vertexCount);
+	indices.reserve(triangleCount * 3);
+	triangleIds.reserve(triangleCount);
+}
+
+unsigned int Mesh::AddVertex(glm::vec3 position)
+{
+	positionX.push_back(position.x);
+	positionY.push_back(position.y);
+	positionZ.push_back(position.z);
+
+	return (unsigned int)positionX.size() - 1;
+}
+
+void Mesh::AddTriangle(unsigned int a, unsigned int b, unsigned int c)
+{
+	triangleIds.push_back((unsigned int)triangleIds.size());
+
+	indices.push_back(a);
+	indices.push_back(b);
+	indices.push_back(c);
+}
+
+void Mesh::Resize(unsigned int vertexCount, unsigned int triangleCount)
+{
+	positionX.resize(vertexCount);
+	positionY.resize(vertexCount);
+	positionZ.resize(vertexCount);
+	indices.resize((size_t)triangleCount * 3);
+	triangleIds.resize(triangleCount);
+
+	mappedPositionX = nullptr;
+	mappedPositionY = nullptr;
+	mappedPositionZ = nullptr;
+	mappedIndices = nullptr;
+	mappedTriangleIds = nullptr;
+	mappedVertexCount = 0;
+	mappedTriangleCount = 0;
+
+	for (unsigned int i = 0; i < triangleCount; i++)
+	{
+		triangleIds[i] = i;
+	}
+}
+
+void Mesh::GetTriangle(unsigned int triangle, glm::vec3& v0, glm::vec3& v1, glm::vec3& v2) const
+{
+	const unsigned int* corners = Indices() + (size_t)triangle * 3;
+
+	v0 = GetVertex(corners[0]);
+	v1 = GetVertex(corners[1]);
+	v2 = GetVertex(corners[2]);
+}
+
+
+void Mesh::BuildBVH(ThreadPool* pool, BVHBuilder builder)
+{
+	unsigned int triangleCount = GetTriangleCount();
+
+	std::vector<AABB> bounds(triangleCount);
+
+	auto calculateBounds = [&](unsigned int start, unsigned int end)
+	{
+		for (unsigned int i = start; i < end; i++)
+		{
+			glm::vec3 v0, v1, v2;
+			GetTriangle(i, v0, v1, v2);
+
+			bounds[i].min = glm::min(v0, glm::min(v1, v2));
+			bounds[i].max = glm::max(v0, glm::max(v1, v2));
+		}
+	};
+
+	const unsigned int chunkSize = 65536;
+
+	ParallelForChunks(pool, triangleCount, chunkSize, [&](unsigned int, unsigned int start, unsigned int end)
+	{
+		calculateBounds(start, end);
+	});
+
+	bvh.Build(bounds, pool, builder);
+
+	// Put the triangles in the order the leaves reference them, so each leaf is one run of the index list
+
+	const std::vector<unsigned int>& primIndices = bvh.GetPrimIndices();
+
+	std::vector<unsigned int> sortedIndices(indices.size());
+	std::vector<unsigned int> sortedIds(triangleCount);
+
+	for (unsigned int i = 0; i < triangleCount; i++)
+	{
+		unsigned int triangle = primIndices[i];
+
+		sortedIndices[i * 3 + 0] = indices[triangle * 3 + 0];
+		sortedIndices[i * 3 + 1] = indices[triangle * 3 + 1];
+		sortedIndices[i * 3 + 2] = indices[triangle * 3 + 2];
+		sortedIds[i] = triangleIds[triangle];
+	}
+
+	indices.swap(sortedIndices);
+	triangleIds.swap(sortedIds);
+
+	std::cout << "INFO: Mesh BVH built over " << triangleCount << " triangles in " << bvh.GetBuildTimeMs() << " ms, " << bvh.GetNodeCount() << " nodes" << std::endl;
+}
+
+
+size_t Mesh::GetMemoryBytes() const
+{
+	size_t positionBytes = (positionX.capacity() + positionY.capacity() + positionZ.capacity()) * sizeof(float);
+	size_t triangleBytes = (indices.capacity() + triangleIds.capacity()) * sizeof(unsigned int);
+
+	return positionBytes + triangleBytes + bvh.GetMemoryBytes();
+}
+
+
+void Mesh::Save(SceneCache::Writer& writer) const
+{
+	unsigned int vertexCount = GetVertexCount();
+	unsigned int triangleCount = GetTriangleCount();
+
+	writer.Write(&colour, 1);
+	writer.Write(PositionX(), vertexCount);
+	writer.Write(PositionY(), vertexCount);
+	writer.Write(PositionZ(), vertexCount);
+	writer.Write(Indices(), (size_t)triangleCount * 3);
+	writer.Write(TriangleIds(), triangleCount);
+
+	bvh.Save(writer);
+}
+
+bool Mesh::Map(SceneCache::Reader& reader)
+{
+	const glm::vec3* cachedColour = reader.ReadExactly<glm::vec3>(1);
+
+	size_t vertexCount = 0;
+	size_t triangleCount = 0;
+
+	const float* cachedPositionX = reader.Read<float>(vertexCount);
+	const float* cachedPositionY = reader.ReadExactly<float>(vertexCount);
+	const float* cachedPositionZ = reader.ReadExactly<float>(vertexCount);
+	const unsigned int* cachedIndices = reader.Read<unsigned int>(triangleCount);
+	const unsigned int* cachedTriangleIds = reader.ReadExactly<unsigned int>(triangleCount / 3);
+
+	if (reader.HasFailed() || triangleCount % 3 != 0 || !bvh.Map(reader, (unsigned int)(triangleCount / 3)))
+	{
+		return false;
+	}
+
+	// Corners index the vertices on every hit, so a damaged cache has to be caught here rather than read past their end
+	for (size_t i = 0; i < triangleCount; i++)
+	{
+		if (cachedIndices[i] >= vertexCount)
+		{
+			return false;
+		}
+	}
+
+	for (size_t i = 0; i < triangleCount / 3; i++)
+	{
+		if (cachedTriangleIds[i] >= triangleCount / 3)
+		{
+			return false;
+		}
+	}
+
+	Resize(0, 0);
+	positionX.shrink_to_fit();
+	positionY.shrink_to_fit();
+	positionZ.shrink_to_fit();
+	indices.shrink_to_fit();
+	triangleIds.shrink_to_fit();
+
+	colour = *cachedColour;
+	mappedPositionX = cachedPositionX;
+	mappedPositionY = cachedPositionY;
+	mappedPositionZ = cachedPositionZ;
+	mappedIndices = cachedIndices;
+	mappedTriangleIds = cachedTriangleIds;
+	mappedVertexCount = (unsigned int)vertexCount;
+	mappedTriangleCount = (unsigned int)(triangleCount / 3);
+
+	return true;
+}
+
+
+AABB Mesh::GetBounds() const
+{
+	AABB bounds;
+
+	if (bvh.IsBuilt())
+	{
+		bounds.min = bvh.GetNodes()[0].boundsMin;
+		bounds.max = bvh.GetNodes()[0].boundsMax;
+
+		return bounds;
+	}
+
+	for (unsigned int i = 0; i < GetVertexCount(); i++)
+	{
+		bounds.Grow(GetVertex(i));
+	}
+
+	return bounds;
+}
+
+
+unsigned int Mesh::Intersect(const Ray& ray, float& tMax, TriangleHit& hit) const
+{
+	WatertightRay watertightRay(ray);
+
+	if (!bvh.IsBuilt())
+	{
+		IntersectTriangles(ray, watertightRay, 0, GetTriangleCount(), tMax, hit);
+		return 0;
+	}
+
+	return bvh.Traverse(ray, tMax, [&](unsigned int first, unsigned int count, float& leafTMax)
+	{
+		IntersectTriangles(ray, watertightRay, first, count, leafTMax, hit);
+	});
+}
+
+unsigned int Mesh::IntersectPacket(RayPacket& packet, TriangleHit* hits) const
+{
+	// Set up once a ray rather than at every leaf
+	WatertightRay watertightRays[RayPacket::maxRays];
+
+	for (unsigned int i = 0; i < packet.count; i++)
+	{
+		watertightRays[i] = WatertightRay(packet.rays[i]);
+	}
+
+	if (!bvh.IsBuilt())
+	{
+		for (unsigned int i = 0; i < packet.count; i++)
+		{
+			IntersectTriangles(packet.rays[i], watertightRays[i], 0, GetTriangleCount(), packet.tMax[i], hits[i]);
+		}
+
+		return 0;
+	}
+
+	// The watertight test has no SIMD form, so each ray the packet brings to a leaf is tested on its own there
+	return bvh.TraversePacket(packet, [&](unsigned int first, unsigned int count, unsigned long long mask)
+	{
+		for (; mask != 0; mask &= mask - 1)
+		{
+			unsigned int ray = (unsigned int)FirstSetBit64(mask);
+
+			IntersectTriangles(packet.rays[ray], watertightRays[ray], first, count, packet.tMax[ray], hits[ray]);
+		}
+	},
+	[&](unsigned int ray, unsigned int first, unsigned int count, float& tMax)
+	{
+		IntersectTriangles(packet.rays[ray], watertightRays[ray], first, count, tMax, hits[ray]);
+	});
+}
+
+bool Mesh::IsOccluded(const Ray& ray, float tMax) const
+{
+	WatertightRay watertightRay(ray);
+
+	TriangleHit hit;
+
+	if (!bvh.IsBuilt())
+	{
+		IntersectTriangles(ray, watertightRay, 0, GetTriangleCount(), tMax, hit);
+		return hit.triangle >= 0;
+	}
+
+	return bvh.TraverseAny(ray, tMax, [&](unsigned int first, unsigned int count, float& leafTMax)
+	{
+		IntersectTriangles(ray, watertightRay, first, count, leafTMax, hit);
+		return hit.triangle >= 0;
+	});
+}
+
+void Mesh::IntersectTriangles(const Ray& ray, const WatertightRay& watertightRay, unsigned int first, unsigned int count, float& tMax, TriangleHit& hit) const
+{
+	// Reading the position arrays in the ray's axis order does the change of axes for free
+	const float* axes[3] = { PositionX(), PositionY(), PositionZ() };
+
+	const unsigned int* triangleCorners = Indices();
+
+	const float* px = axes[watertightRay.kx];
+	const float* py = axes[watertightRay.ky];
+	const float* pz = axes[watertightRay.kz];
+
+	float originX = ray.origin[watertightRay.kx];
+	float originY = ray.origin[watertightRay.ky];
+	float originZ = ray.origin[watertightRay.kz];
+
+	float shearX = watertightRay.shearX;
+	float shearY = watertightRay.shearY;
+	float shearZ = watertightRay.shearZ;
+
+	for (unsigned int triangle = first; triangle < first + count; triangle++)
+	{
+		const unsigned int* corners = &triangleCorners[triangle * 3];
+
+		// Vertices relative to the ray origin, sheared so the ray runs along z
+
+		float az = pz[corners[0]] - originZ;
+		float bz = pz[corners[1]] - originZ;
+		float cz = pz[corners[2]] - originZ;
+
+		float ax = px[corners[0]] - originX - shearX * az;
+		float ay = py[corners[0]] - originY - shearY * az;
+		float bx = px[corners[1]] - originX - shearX * bz;
+		float by = py[corners[1]] - originY - shearY * bz;
+		float cx = px[corners[2]] - originX - shearX * cz;
+		float cy = py[corners[2]] - originY - shearY * cz;
+
+		// Scaled barycentrics, which side of each edge the ray passes
+		float u = cx * by - cy * bx;
+		float v = ax * cy - ay * cx;
+		float w = bx * ay - by * ax;
+
+		// Exactly on an edge, float can't tell which side so double decides, which keeps neighbouring triangles agreeing
+		if (u == 0.0f || v == 0.0f || w == 0.0f)
+		{
+			u = (float)((double)cx * (double)by - (double)cy * (double)bx);
+			v = (float)((double)ax * (double)cy - (double)ay * (double)cx);
+			w = (float)((double)bx * (double)ay - (double)by * (double)ax);
+		}
+
+		// Both sides are hit, so signs only have to agree
+		if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f))
+		{
+			continue;
+		}
+
+		float det = u + v + w;
+
+		// Seen edge on
+		if (det == 0.0f)
+		{
+			continue;
+		}
+
+		// Distance scaled by det, checked against 0 and tMax before paying for the divide
+		float t = u * shearZ * az + v * shearZ * bz + w * shearZ * cz;
+
+		if (det > 0.0f ? (t <= 0.0f || t >= tMax * det) : (t >= 0.0f || t <= tMax * det))
+		{
+			continue;
+		}
+
+		float inverseDet = 1.0f / det;
+
+		tMax = t * inverseDet;
+		hit.triangle = (int)triangle;
+		hit.barycentrics = glm::vec2(v * inverseDet, w * inverseDet);
+	}
+}
+
+
+glm::vec3 Mesh::GetNormal(unsigned int triangle) const
+{
+	glm::vec3 v0, v1, v2;
+	GetTriangle(triangle, v0, v1, v2);
+
+	return glm::normalize(glm::cross(v1 - v0, v2 - v0));
+}
+
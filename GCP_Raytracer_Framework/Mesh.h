@@ -0,0 +1,165 @@
+#pragma once
+
+#include "GCP_GFX_Framework.h"
+#include "Ray.h"
+#include "BVH.h"
+#include "SceneCache.h"
+
+#include <vector>
+
+// A ray set up for the watertight ray/triangle test, from Woop, Benthin and Wald, "Watertight Ray/Triangle Intersection"
+// Triangles are moved into a space where the ray starts at the origin and runs along +z, then tested in 2D there
+// A ray that hits an edge shared by two triangles always hits at least one of them, it can't slip through between them
+struct WatertightRay
+{
+	// Axes of the ray's space, z is the one the direction is longest along and x and y are swapped to keep the winding the same
+	int kx;
+
+	int ky;
+
+	int kz;
+
+	// Shear that lines the direction up with z, and the scale along it
+	float shearX;
+
+	float shearY;
+
+	float shearZ;
+
+	// Left unset, for arrays that are filled in afterwards
+	WatertightRay() {}
+
+	WatertightRay(const Ray& ray);
+};
+
+// Closest hit found so far by a mesh
+struct TriangleHit
+{
+	// Index of the triangle in the mesh's own order, or -1 if nothing was hit
+	int triangle = -1;
+
+	// Weights of the triangle's second and third vertices at the hit, the first gets what's left
+	glm::vec2 barycentrics;
+};
+
+// Triangle mesh with indexed vertices
+// Positions are kept as a separate array per axis, so the watertight test can read them in its own axis order without shuffling
+class Mesh
+{
+	private:
+
+		std::vector<float> positionX;
+
+		std::vector<float> positionY;
+
+		std::vector<float> positionZ;
+
+		// Three vertex indices a triangle, reordered into BVH leaf order when the BVH is built
+		std::vector<unsigned int> indices;
+
+		// Which triangle each one was when it was added
+		std::vector<unsigned int> triangleIds;
+
+		glm::vec3 colour;
+
+		BVH bvh;
+
+		// Arrays that live in a mapped scene cache, used instead of the vectors above when set
+		const float* mappedPositionX = nullptr;
+
+		const float* mappedPositionY = nullptr;
+
+		const float* mappedPositionZ = nullptr;
+
+		const unsigned int* mappedIndices = nullptr;
+
+		const unsigned int* mappedTriangleIds = nullptr;
+
+		unsigned int mappedVertexCount = 0;
+
+		unsigned int mappedTriangleCount = 0;
+
+		const float* PositionX() const { return mappedIndices != nullptr ? mappedPositionX : positionX.data(); }
+
+		const float* PositionY() const { return mappedIndices != nullptr ? mappedPositionY : positionY.data(); }
+
+		const float* PositionZ() const { return mappedIndices != nullptr ? mappedPositionZ : positionZ.data(); }
+
+		const unsigned int* Indices() const { return mappedIndices != nullptr ? mappedIndices : indices.data(); }
+
+		const unsigned int* TriangleIds() const { return mappedIndices != nullptr ? mappedTriangleIds : triangleIds.data(); }
+
+	public:
+
+		Mesh(glm::vec3 _colour) : colour(_colour)
+		{
+		}
+
+		void Reserve(unsigned int vertexCount, unsigned int triangleCount);
+
+		// Returns the new vertex's index
+		unsigned int AddVertex(glm::vec3 position);
+
+		void AddTriangle(unsigned int a, unsigned int b, unsigned int c);
+
+		// Sizes the mesh for loaders that fill the arrays in place through the pointers below, any vertices and triangles are left unset
+		// Also stops a mapped mesh using the scene cache
+		void Resize(unsigned int vertexCount, unsigned int triangleCount);
+
+		float* GetPositionX() { return positionX.data(); }
+
+		float* GetPositionY() { return positionY.data(); }
+
+		float* GetPositionZ() { return positionZ.data(); }
+
+		// Three vertex indices a triangle
+		unsigned int* GetIndices() { return indices.data(); }
+
+		unsigned int GetVertexCount() const { return mappedIndices != nullptr ? mappedVertexCount : (unsigned int)positionX.size(); }
+
+		unsigned int GetTriangleCount() const { return mappedIndices != nullptr ? mappedTriangleCount : (unsigned int)triangleIds.size(); }
+
+		glm::vec3 GetVertex(unsigned int index) const { return glm::vec3(PositionX()[index], PositionY()[index], PositionZ()[index]); }
+
+		void GetTriangle(unsigned int triangle, glm::vec3& v0, glm::vec3& v1, glm::vec3& v2) const;
+
+		// Which triangle this was when it was added, triangles move when the BVH is built
+		unsigned int GetTriangleId(unsigned int triangle) const { return TriangleIds()[triangle]; }
+
+		// Builds the BVH over the triangles, call once every triangle has been added
+		// Until then Intersect tests every triangle
+		void BuildBVH(ThreadPool* pool = nullptr, BVHBuilder builder = BVHBuilder::SAH);
+
+		const BVH& GetBVH() const { return bvh; }
+
+		// Bytes held by the vertices, triangles and BVH, a mapped mesh holds none of its own
+		size_t GetMemoryBytes() const;
+
+		// Writes the colour, vertices, triangles and BVH to a scene cache, the BVH should be built first
+		void Save(SceneCache::Writer& writer) const;
+
+		// Uses the vertices, triangles and BVH in a scene cache where they are, the mesh can't be added to or built again after
+		// Fails if any index in them is out of range
+		bool Map(SceneCache::Reader& reader);
+
+		AABB GetBounds() const;
+
+		// Finds the closest triangle the ray hits before tMax, pulling tMax in to it and filling in hit
+		// Returns the number of BVH nodes visited
+		unsigned int Intersect(const Ray& ray, float& tMax, TriangleHit& hit) const;
+
+		// Intersect for every ray of a packet at once, pulling each one's packet.tMax in to its closest hit and filling in its entry in hits
+		// Returns the number of BVH nodes visited
+		unsigned int IntersectPacket(RayPacket& packet, TriangleHit* hits) const;
+
+		// True if the ray hits any triangle before tMax, stopping at the first BVH leaf with a hit
+		bool IsOccluded(const Ray& ray, float tMax) const;
+
+		// The watertight test over triangles first to first + count - 1, the same as BVH leaves use
+		void IntersectTriangles(const Ray& ray, const WatertightRay& watertightRay, unsigned int first, unsigned int count, float& tMax, TriangleHit& hit) const;
+
+		// Face normal, facing the side the vertices wind anticlockwise on
+		glm::vec3 GetNormal(unsigned int triangle) const;
+
+		glm::vec3 GetColour() const { return colour; }
+};
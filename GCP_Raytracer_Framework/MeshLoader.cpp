@@ -0,0 +1,769 @@
+#include "MeshLoader.h"
+#include "MappedFile.h"
+#include "TextParsing.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+// Bytes of OBJ text a task parses at a time
+static const size_t objChunkBytes = 8 * 1024 * 1024;
+
+// PLY vertices or faces a task parses at a time
+static const unsigned int plyChunkRecords = 1 << 20;
+
+
+static void PrintLoaded(const std::string& filename, const Mesh& mesh, size_t fileBytes, std::chrono::steady_clock::time_point startTime)
+{
+	double loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+	std::cout << "INFO: Loaded " << filename << ", " << mesh.GetVertexCount() << " vertices and " << mesh.GetTriangleCount() << " triangles in " << loadMs << " ms, "
+		<< fileBytes / (1024.0 * 1024.0) / (loadMs / 1000.0) << " MB/s" << std::endl;
+}
+
+
+bool MeshLoader::Load(const std::string& filename, Mesh& mesh, ThreadPool* pool)
+{
+	size_t dot = filename.find_last_of('.');
+
+	std::string extension = dot == std::string::npos ? "" : filename.substr(dot + 1);
+
+	for (char& c : extension)
+	{
+		c = (char)std::tolower((unsigned char)c);
+	}
+
+	if (extension == "obj")
+	{
+		return LoadOBJ(filename, mesh, pool);
+	}
+
+	if (extension == "ply")
+	{
+		return LoadPLY(filename, mesh, pool);
+	}
+
+	std::cerr << "ERROR: unknown mesh file type, expected .obj or .ply: " << filename << std::endl;
+	return false;
+}
+
+
+// OBJ
+
+// A run of whole lines and what it holds
+struct ObjChunk
+{
+	const char* start;
+
+	const char* end;
+
+	unsigned long long vertexCount = 0;
+
+	unsigned long long triangleCount = 0;
+
+	// Where in the mesh this chunk's vertices and triangles go
+	unsigned long long firstVertex = 0;
+
+	unsigned long long firstTriangle = 0;
+
+	// The first line that couldn't be read, if any
+	const char* badLine = nullptr;
+};
+
+bool MeshLoader::LoadOBJ(const std::string& filename, Mesh& mesh, ThreadPool* pool)
+{
+	auto startTime = std::chrono::steady_clock::now();
+
+	MappedFile file;
+
+	if (!file.Open(filename))
+	{
+		std::cerr << "ERROR: could not open mesh file: " << filename << std::endl;
+		return false;
+	}
+
+	const char* data = file.GetData();
+	const char* dataEnd = data + file.GetSize();
+
+	// Split into chunks of about the same size, each starting on a new line
+
+	std::vector<const char*> boundaries = SplitLines(data, dataEnd, objChunkBytes);
+
+	std::vector<ObjChunk> chunks(boundaries.size() - 1);
+
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		chunks[i].start = boundaries[i];
+		chunks[i].end = boundaries[i + 1];
+	}
+
+	// First pass counts the vertices and triangles in each chunk, so every chunk knows where its own go in the mesh
+	// A face with n corners is a fan of n - 2 triangles
+
+	ParallelForChunks(pool, (unsigned int)chunks.size(), 1, [&](unsigned int chunkIndex, unsigned int, unsigned int)
+	{
+		ObjChunk& chunk = chunks[chunkIndex];
+
+		for (const char* p = chunk.start; p < chunk.end; p = SkipLine(p, chunk.end))
+		{
+			p = SkipSpaces(p, chunk.end);
+
+			if (IsKeyword(p, chunk.end, 'v'))
+			{
+				chunk.vertexCount++;
+			}
+			else if (IsKeyword(p, chunk.end, 'f'))
+			{
+				unsigned long long corners = 0;
+
+				// A comment ends the corners, here and in the parsing pass, so both agree on the count
+				for (p = SkipSpaces(p + 1, chunk.end); !IsLineEnd(p, chunk.end); p = SkipSpaces(p, chunk.end))
+				{
+					p = SkipName(p, chunk.end);
+					corners++;
+				}
+
+				chunk.triangleCount += corners >= 3 ? corners - 2 : 0;
+			}
+		}
+
+		file.Release(chunk.start - data, chunk.end - chunk.start);
+	});
+
+	unsigned long long vertexCount = 0;
+	unsigned long long triangleCount = 0;
+
+	for (ObjChunk& chunk : chunks)
+	{
+		chunk.firstVertex = vertexCount;
+		chunk.firstTriangle = triangleCount;
+
+		vertexCount += chunk.vertexCount;
+		triangleCount += chunk.triangleCount;
+	}
+
+	if (vertexCount > UINT_MAX || triangleCount * 3 > UINT_MAX)
+	{
+		std::cerr << "ERROR: too many vertices or triangles for one mesh: " << filename << std::endl;
+		return false;
+	}
+
+	mesh.Resize((unsigned int)vertexCount, (unsigned int)triangleCount);
+
+	float* positionX = mesh.GetPositionX();
+	float* positionY = mesh.GetPositionY();
+	float* positionZ = mesh.GetPositionZ();
+	unsigned int* indices = mesh.GetIndices();
+
+	// Second pass parses straight into the mesh
+
+	ParallelForChunks(pool, (unsigned int)chunks.size(), 1, [&](unsigned int chunkIndex, unsigned int, unsigned int)
+	{
+		ObjChunk& chunk = chunks[chunkIndex];
+
+		unsigned long long vertex = chunk.firstVertex;
+		unsigned int* triangle = indices + chunk.firstTriangle * 3;
+
+		for (const char* p = chunk.start; p < chunk.end; p = SkipLine(p, chunk.end))
+		{
+			const char* line = p;
+
+			p = SkipSpaces(p, chunk.end);
+
+			if (IsKeyword(p, chunk.end, 'v'))
+			{
+				// Anything after z, a w or a vertex colour, is ignored
+				float x, y, z;
+
+				if ((p = ParseFloat(SkipSpaces(p + 1, chunk.end), chunk.end, x)) == nullptr ||
+					(p = ParseFloat(SkipSpaces(p, chunk.end), chunk.end, y)) == nullptr ||
+					(p = ParseFloat(SkipSpaces(p, chunk.end), chunk.end, z)) == nullptr)
+				{
+					chunk.badLine = line;
+					break;
+				}
+
+				positionX[vertex] = x;
+				positionY[vertex] = y;
+				positionZ[vertex] = z;
+				vertex++;
+			}
+			else if (IsKeyword(p, chunk.end, 'f'))
+			{
+				// Corners are v, v/vt, v//vn or v/vt/vn, indices count from 1 and negative ones count back from the last vertex read
+				unsigned int corners = 0;
+				unsigned int firstCorner = 0;
+				unsigned int lastCorner = 0;
+
+				for (p = SkipSpaces(p + 1, chunk.end); !IsLineEnd(p, chunk.end); p = SkipSpaces(p, chunk.end))
+				{
+					long long index;
+
+					// 0 isn't an index at all, rather than counting back from the end like the negative ones
+					if ((p = ParseInteger(p, chunk.end, index)) == nullptr || index == 0)
+					{
+						p = nullptr;
+						break;
+					}
+
+					index = index > 0 ? index - 1 : (long long)vertex + index;
+
+					if (index < 0 || index >= (long long)vertexCount)
+					{
+						p = nullptr;
+						break;
+					}
+
+					p = SkipName(p, chunk.end);
+
+					unsigned int corner = (unsigned int)index;
+
+					if (corners == 0)
+					{
+						firstCorner = corner;
+					}
+					else if (corners >= 2)
+					{
+						triangle[0] = firstCorner;
+						triangle[1] = lastCorner;
+						triangle[2] = corner;
+						triangle += 3;
+					}
+
+					lastCorner = corner;
+					corners++;
+				}
+
+				if (p == nullptr)
+				{
+					chunk.badLine = line;
+					break;
+				}
+			}
+		}
+
+		file.Release(chunk.start - data, chunk.end - chunk.start);
+	});
+
+	for (const ObjChunk& chunk : chunks)
+	{
+		if (chunk.badLine != nullptr)
+		{
+			std::cerr << "ERROR: could not read line " << std::count(data, chunk.badLine, '\n') + 1 << " of mesh file: " << filename << std::endl;
+			mesh.Resize(0, 0);
+			return false;
+		}
+	}
+
+	PrintLoaded(filename, mesh, file.GetSize(), startTime);
+
+	return true;
+}
+
+
+// PLY
+
+enum class PlyType
+{
+	Invalid,
+	Int8,
+	UInt8,
+	Int16,
+	UInt16,
+	Int32,
+	UInt32,
+	Float32,
+	Float64
+};
+
+static PlyType ParsePlyType(const std::string& name)
+{
+	if (name == "char" || name == "int8") return PlyType::Int8;
+	if (name == "uchar" || name == "uint8") return PlyType::UInt8;
+	if (name == "short" || name == "int16") return PlyType::Int16;
+	if (name == "ushort" || name == "uint16") return PlyType::UInt16;
+	if (name == "int" || name == "int32") return PlyType::Int32;
+	if (name == "uint" || name == "uint32") return PlyType::UInt32;
+	if (name == "float" || name == "float32") return PlyType::Float32;
+	if (name == "double" || name == "float64") return PlyType::Float64;
+
+	return PlyType::Invalid;
+}
+
+static unsigned int PlyTypeSize(PlyType type)
+{
+	switch (type)
+	{
+		case PlyType::Int8: case PlyType::UInt8: return 1;
+		case PlyType::Int16: case PlyType::UInt16: return 2;
+		case PlyType::Int32: case PlyType::UInt32: case PlyType::Float32: return 4;
+		case PlyType::Float64: return 8;
+		default: return 0;
+	}
+}
+
+// Values are copied out byte by byte since nothing in the file is aligned
+// Little endian files are read as they are, which is every CPU this runs on
+template<typename T> static inline T ReadUnaligned(const char* p)
+{
+	T value;
+	memcpy(&value, p, sizeof(T));
+	return value;
+}
+
+static inline double ReadPlyValue(const char* p, PlyType type)
+{
+	switch (type)
+	{
+		case PlyType::Int8: return ReadUnaligned<signed char>(p);
+		case PlyType::UInt8: return ReadUnaligned<unsigned char>(p);
+		case PlyType::Int16: return ReadUnaligned<short>(p);
+		case PlyType::UInt16: return ReadUnaligned<unsigned short>(p);
+		case PlyType::Int32: return ReadUnaligned<int>(p);
+		case PlyType::UInt32: return ReadUnaligned<unsigned int>(p);
+		case PlyType::Float32: return ReadUnaligned<float>(p);
+		case PlyType::Float64: return ReadUnaligned<double>(p);
+		default: return 0.0;
+	}
+}
+
+static inline long long ReadPlyInteger(const char* p, PlyType type)
+{
+	switch (type)
+	{
+		case PlyType::Int8: return ReadUnaligned<signed char>(p);
+		case PlyType::UInt8: return ReadUnaligned<unsigned char>(p);
+		case PlyType::Int16: return ReadUnaligned<short>(p);
+		case PlyType::UInt16: return ReadUnaligned<unsigned short>(p);
+		case PlyType::Int32: return ReadUnaligned<int>(p);
+		case PlyType::UInt32: return ReadUnaligned<unsigned int>(p);
+		default: return (long long)ReadPlyValue(p, type);
+	}
+}
+
+struct PlyProperty
+{
+	std::string name;
+
+	PlyType type = PlyType::Invalid;
+
+	// Lists are a count followed by that many values of type
+	bool isList = false;
+
+	PlyType countType = PlyType::Invalid;
+};
+
+struct PlyElement
+{
+	std::string name;
+
+	unsigned long long count = 0;
+
+	std::vector<PlyProperty> properties;
+
+	// Bytes per record, or 0 if it has a list and records vary
+	unsigned int stride = 0;
+};
+
+// Returns the start of the next record, or nullptr if this one runs past the end of the file
+// Calls onList with each list property's index, count and values
+template<typename ListFunction> static inline const char* ReadPlyRecord(const char* p, const char* end, const PlyElement& element, ListFunction onList)
+{
+	for (size_t i = 0; i < element.properties.size(); i++)
+	{
+		const PlyProperty& property = element.properties[i];
+
+		if (!property.isList)
+		{
+			p += PlyTypeSize(property.type);
+			continue;
+		}
+
+		unsigned int countSize = PlyTypeSize(property.countType);
+
+		if (end - p < (ptrdiff_t)countSize)
+		{
+			return nullptr;
+		}
+
+		long long count = ReadPlyInteger(p, property.countType);
+		p += countSize;
+
+		if (count < 0 || (unsigned long long)(end - p) < (unsigned long long)count * PlyTypeSize(property.type))
+		{
+			return nullptr;
+		}
+
+		onList(i, count, p);
+		p += count * PlyTypeSize(property.type);
+	}
+
+	return p <= end ? p : nullptr;
+}
+
+// Reads the text header up to end_header, returns where the data starts or nullptr if the header isn't one this can read
+static const char* ReadPlyHeader(const MappedFile& file, const std::string& filename, std::vector<PlyElement>& elements)
+{
+	const char* data = file.GetData();
+	const char* dataEnd = data + file.GetSize();
+
+	const char* body = nullptr;
+
+	for (const char* line = data; line < dataEnd; line = SkipLine(line, dataEnd))
+	{
+		if (dataEnd - line >= 10 && memcmp(line, "end_header", 10) == 0)
+		{
+			body = SkipLine(line, dataEnd);
+			break;
+		}
+	}
+
+	if (file.GetSize() < 4 || memcmp(data, "ply", 3) != 0 || body == nullptr)
+	{
+		std::cerr << "ERROR: not a PLY file: " << filename << std::endl;
+		return nullptr;
+	}
+
+	// The header is small, so it's fine to read it with streams
+	std::istringstream header(std::string(data, body));
+	std::string line;
+
+	while (std::getline(header, line))
+	{
+		std::istringstream words(line);
+		std::string keyword;
+
+		words >> keyword;
+
+		if (keyword == "format")
+		{
+			std::string format;
+			words >> format;
+
+			if (format != "binary_little_endian")
+			{
+				std::cerr << "ERROR: only binary_little_endian PLY files are supported, not " << format << ": " << filename << std::endl;
+				return nullptr;
+			}
+		}
+		else if (keyword == "element")
+		{
+			PlyElement element;
+			words >> element.name >> element.count;
+			elements.push_back(element);
+		}
+		else if (keyword == "property" && !elements.empty())
+		{
+			PlyProperty property;
+			std::string type;
+
+			words >> type;
+
+			if (type == "list")
+			{
+				std::string countType;
+				words >> countType >> type;
+
+				property.isList = true;
+				property.countType = ParsePlyType(countType);
+			}
+
+			words >> property.name;
+			property.type = ParsePlyType(type);
+
+			if (property.type == PlyType::Invalid || (property.isList && property.countType == PlyType::Invalid))
+			{
+				std::cerr << "ERROR: unknown PLY property type in \"" << line << "\": " << filename << std::endl;
+				return nullptr;
+			}
+
+			elements.back().properties.push_back(property);
+		}
+	}
+
+	for (PlyElement& element : elements)
+	{
+		for (const PlyProperty& property : element.properties)
+		{
+			if (property.isList)
+			{
+				element.stride = 0;
+				break;
+			}
+
+			element.stride += PlyTypeSize(property.type);
+		}
+	}
+
+	return body;
+}
+
+bool MeshLoader::LoadPLY(const std::string& filename, Mesh& mesh, ThreadPool* pool)
+{
+	auto startTime = std::chrono::steady_clock::now();
+
+	MappedFile file;
+
+	if (!file.Open(filename))
+	{
+		std::cerr << "ERROR: could not open mesh file: " << filename << std::endl;
+		return false;
+	}
+
+	std::vector<PlyElement> elements;
+
+	const char* p = ReadPlyHeader(file, filename, elements);
+
+	if (p == nullptr)
+	{
+		return false;
+	}
+
+	const char* data = file.GetData();
+	const char* dataEnd = data + file.GetSize();
+
+	// Elements follow each other, so each one's start is found by stepping over the ones before it
+	// Faces vary in size, so they're stepped over one at a time, noting where every chunk of them starts and how many triangles it has
+
+	const PlyElement* vertexElement = nullptr;
+	const char* vertexData = nullptr;
+	unsigned int positionOffsets[3] = {};
+	PlyType positionTypes[3] = {};
+
+	const PlyElement* faceElement = nullptr;
+	size_t faceIndexProperty = 0;
+	std::vector<const char*> faceChunkStarts;
+	std::vector<unsigned long long> faceChunkTriangles;
+
+	unsigned long long triangleCount = 0;
+
+	for (const PlyElement& element : elements)
+	{
+		if (element.name == "vertex")
+		{
+			const char* axisNames[3] = { "x", "y", "z" };
+			unsigned int offset = 0;
+			int found = 0;
+
+			for (const PlyProperty& property : element.properties)
+			{
+				for (int axis = 0; axis < 3; axis++)
+				{
+					if (property.name == axisNames[axis])
+					{
+						positionOffsets[axis] = offset;
+						positionTypes[axis] = property.type;
+						found++;
+					}
+				}
+
+				offset += PlyTypeSize(property.type);
+			}
+
+			if (found != 3 || element.stride == 0)
+			{
+				std::cerr << "ERROR: PLY vertices need x, y and z and no list properties: " << filename << std::endl;
+				return false;
+			}
+
+			vertexElement = &element;
+			vertexData = p;
+		}
+		else if (element.name == "face")
+		{
+			faceElement = &element;
+
+			for (faceIndexProperty = 0; faceIndexProperty < element.properties.size(); faceIndexProperty++)
+			{
+				const PlyProperty& property = element.properties[faceIndexProperty];
+
+				if (property.isList && (property.name == "vertex_indices" || property.name == "vertex_index"))
+				{
+					break;
+				}
+			}
+
+			if (faceIndexProperty == element.properties.size())
+			{
+				std::cerr << "ERROR: PLY faces need a vertex_indices list: " << filename << std::endl;
+				return false;
+			}
+
+			for (unsigned long long face = 0; face < element.count; face++)
+			{
+				if (face % plyChunkRecords == 0)
+				{
+					faceChunkStarts.push_back(p);
+					faceChunkTriangles.push_back(0);
+				}
+
+				p = ReadPlyRecord(p, dataEnd, element, [&](size_t property, long long count, const char*)
+				{
+					if (property == faceIndexProperty && count >= 3)
+					{
+						faceChunkTriangles.back() += count - 2;
+						triangleCount += count - 2;
+					}
+				});
+
+				if (p == nullptr)
+				{
+					break;
+				}
+			}
+		}
+
+		// The faces have just been read a record at a time, anything else is skipped over
+		if (&element != faceElement)
+		{
+			if (element.stride != 0)
+			{
+				p = (unsigned long long)(dataEnd - p) >= element.count * element.stride ? p + element.count * element.stride : nullptr;
+			}
+			else
+			{
+				for (unsigned long long record = 0; record < element.count && p != nullptr; record++)
+				{
+					p = ReadPlyRecord(p, dataEnd, element, [](size_t, long long, const char*) {});
+				}
+			}
+		}
+
+		// A truncated element stops here, before any pointer arithmetic on what's left
+		if (p == nullptr)
+		{
+			break;
+		}
+	}
+
+	if (p == nullptr)
+	{
+		std::cerr << "ERROR: PLY file is shorter than its header says: " << filename << std::endl;
+		return false;
+	}
+
+	if (vertexElement == nullptr)
+	{
+		std::cerr << "ERROR: PLY file has no vertices: " << filename << std::endl;
+		return false;
+	}
+
+	if (vertexElement->count > UINT_MAX || triangleCount * 3 > UINT_MAX)
+	{
+		std::cerr << "ERROR: too many vertices or triangles for one mesh: " << filename << std::endl;
+		return false;
+	}
+
+	unsigned int vertexCount = (unsigned int)vertexElement->count;
+
+	mesh.Resize(vertexCount, (unsigned int)triangleCount);
+
+	float* positionX = mesh.GetPositionX();
+	float* positionY = mesh.GetPositionY();
+	float* positionZ = mesh.GetPositionZ();
+	unsigned int* indices = mesh.GetIndices();
+
+	// Vertices are all the same size, so each chunk knows where it starts
+
+	unsigned int vertexStride = vertexElement->stride;
+
+	ParallelForChunks(pool, vertexCount, plyChunkRecords, [&](unsigned int, unsigned int start, unsigned int end)
+	{
+		const char* record = vertexData + (size_t)start * vertexStride;
+
+		if (positionTypes[0] == PlyType::Float32 && positionTypes[1] == PlyType::Float32 && positionTypes[2] == PlyType::Float32)
+		{
+			for (unsigned int i = start; i < end; i++, record += vertexStride)
+			{
+				positionX[i] = ReadUnaligned<float>(record + positionOffsets[0]);
+				positionY[i] = ReadUnaligned<float>(record + positionOffsets[1]);
+				positionZ[i] = ReadUnaligned<float>(record + positionOffsets[2]);
+			}
+		}
+		else
+		{
+			for (unsigned int i = start; i < end; i++, record += vertexStride)
+			{
+				positionX[i] = (float)ReadPlyValue(record + positionOffsets[0], positionTypes[0]);
+				positionY[i] = (float)ReadPlyValue(record + positionOffsets[1], positionTypes[1]);
+				positionZ[i] = (float)ReadPlyValue(record + positionOffsets[2], positionTypes[2]);
+			}
+		}
+
+		file.Release(vertexData - data + (size_t)start * vertexStride, (size_t)(end - start) * vertexStride);
+	});
+
+	// Faces, fanned into triangles the same as OBJ faces
+
+	std::vector<unsigned long long> faceChunkFirstTriangle(faceChunkStarts.size());
+	std::vector<char> faceChunkBad(faceChunkStarts.size(), 0);
+
+	for (size_t chunk = 0, first = 0; chunk < faceChunkStarts.size(); chunk++)
+	{
+		faceChunkFirstTriangle[chunk] = first;
+		first += faceChunkTriangles[chunk];
+	}
+
+	ParallelForChunks(pool, (unsigned int)faceChunkStarts.size(), 1, [&](unsigned int chunk, unsigned int, unsigned int)
+	{
+		const PlyProperty& indexProperty = faceElement->properties[faceIndexProperty];
+		unsigned int indexSize = PlyTypeSize(indexProperty.type);
+
+		unsigned long long faceCount = std::min<unsigned long long>(plyChunkRecords, faceElement->count - (unsigned long long)chunk * plyChunkRecords);
+
+		const char* record = faceChunkStarts[chunk];
+		unsigned int* triangle = indices + faceChunkFirstTriangle[chunk] * 3;
+		bool bad = false;
+
+		for (unsigned long long face = 0; face < faceCount; face++)
+		{
+			record = ReadPlyRecord(record, dataEnd, *faceElement, [&](size_t property, long long count, const char* values)
+			{
+				if (property != faceIndexProperty || count < 3)
+				{
+					return;
+				}
+
+				long long firstCorner = ReadPlyInteger(values, indexProperty.type);
+				long long lastCorner = ReadPlyInteger(values + indexSize, indexProperty.type);
+
+				bad |= firstCorner < 0 || firstCorner >= vertexCount || lastCorner < 0 || lastCorner >= vertexCount;
+
+				for (long long corner = 2; corner < count; corner++)
+				{
+					long long index = ReadPlyInteger(values + corner * indexSize, indexProperty.type);
+
+					bad |= index < 0 || index >= vertexCount;
+
+					triangle[0] = (unsigned int)firstCorner;
+					triangle[1] = (unsigned int)lastCorner;
+					triangle[2] = (unsigned int)index;
+					triangle += 3;
+
+					lastCorner = index;
+				}
+			});
+		}
+
+		faceChunkBad[chunk] = bad ? 1 : 0;
+
+		file.Release(faceChunkStarts[chunk] - data, record - faceChunkStarts[chunk]);
+	});
+
+	if (std::find(faceChunkBad.begin(), faceChunkBad.end(), 1) != faceChunkBad.end())
+	{
+		std::cerr << "ERROR: PLY face uses a vertex that doesn't exist: " << filename << std::endl;
+		mesh.Resize(0, 0);
+		return false;
+	}
+
+	PrintLoaded(filename, mesh, file.GetSize(), startTime);
+
+	return true;
+}
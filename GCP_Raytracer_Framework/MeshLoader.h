@@ -0,0 +1,22 @@
+#pragma once
+
+#include "Mesh.h"
+#include "ThreadPool.h"
+
+#include <string>
+
+// Loads triangle meshes from Wavefront OBJ and binary PLY files straight into a Mesh
+// Files are mapped rather than read, split into chunks and parsed on the pool, and nothing is allocated per line or per number,
+// so big files load at close to the speed the disk can give them and the memory used is close to the size of the mesh itself
+namespace MeshLoader
+{
+	// Picks the loader from the file's extension, .obj or .ply
+	bool Load(const std::string& filename, Mesh& mesh, ThreadPool* pool = nullptr);
+
+	// Vertex positions and faces only, faces with more than three corners are split into a fan of triangles
+	// Texture coordinates, normals, groups and materials are skipped
+	bool LoadOBJ(const std::string& filename, Mesh& mesh, ThreadPool* pool = nullptr);
+
+	// binary_little_endian only, the vertex x, y and z and the face vertex_indices (or vertex_index) list are read and the rest skipped
+	bool LoadPLY(const std::string& filename, Mesh& mesh, ThreadPool* pool = nullptr);
+}
@@ -0,0 +1,298 @@
+
+#include "PixelFormat.h"
+
+#include <GLM/gtc/color_space.hpp>
+#include <GLM/gtc/packing.hpp>
+
+#include <cstring>
+
+
+namespace
+{
+	// sRGB encoding is a pow per channel, far too slow to do for every pixel
+	// Instead linear values are rounded to 12 bits and looked up, which is never more than 1 away from the exact encoding
+	const int srgbTableSize = 4096;
+
+	struct SrgbTable
+	{
+		unsigned char entries[srgbTableSize];
+
+		SrgbTable()
+		{
+			for (int i = 0; i < srgbTableSize; ++i)
+			{
+				float linear = (float)i / (float)(srgbTableSize - 1);
+
+				entries[i] = (unsigned char)glm::packUnorm1x8(glm::convertLinearToSRGB(glm::vec3(linear)).x);
+			}
+		}
+	};
+
+	// Built the first time it's used, C++11 makes that thread safe
+	const unsigned char* GetSrgbTable()
+	{
+		static SrgbTable table;
+
+		return table.entries;
+	}
+
+	inline int SrgbTableIndex(float value)
+	{
+		return (int)(glm::clamp(value, 0.0f, 1.0f) * (float)(srgbTableSize - 1) + 0.5f);
+	}
+
+
+	// Float to half float for values between 0 and 1, rounding ties to even like F16C does
+	// glm::packHalf1x16 rounds ties up, which would leave the scalar and SIMD framebuffers a bit apart
+	inline unsigned short FloatToHalf(float value)
+	{
+		unsigned int bits;
+		memcpy(&bits, &value, sizeof(bits));
+
+		int exponent = (int)(bits >> 23) - 127;
+
+		// Less than half the smallest half float, or exactly half which rounds to the even 0
+		if (exponent < -25)
+		{
+			return 0;
+		}
+
+		if (exponent < -14)
+		{
+			// Too small for a normal half, so it becomes a multiple of the smallest one, 2^-24
+			unsigned int mantissa = (bits & 0x7fffff) | 0x800000;
+			int shift = -1 - exponent;
+
+			unsigned int half = mantissa >> shift;
+			unsigned int remainder = mantissa & ((1u << shift) - 1);
+			unsigned int halfway = 1u << (shift - 1);
+
+			if (remainder > halfway || (remainder == halfway && (half & 1)))
+			{
+				half++;
+			}
+
+			return (unsigned short)half;
+		}
+
+		// Rebias the exponent and drop 13 bits of mantissa, a carry out of the mantissa correctly bumps the exponent
+		bits -= (127 - 15) << 23;
+
+		return (unsigned short)((bits + 0xfff + ((bits >> 13) & 1)) >> 13);
+	}
+
+
+	void PackRGB32FScalar(const glm::vec3* colours, unsigned int count, unsigned char* pixels)
+	{
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			glm::vec3 colour = glm::clamp(colours[i], 0.0f, 1.0f);
+
+			memcpy(pixels + i * sizeof(glm::vec3), &colour, sizeof(glm::vec3));
+		}
+	}
+
+	void PackRGB16FScalar(const glm::vec3* colours, unsigned int count, unsigned char* pixels)
+	{
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			glm::vec3 colour = glm::clamp(colours[i], 0.0f, 1.0f);
+
+			unsigned short halves[3] = { FloatToHalf(colour.r), FloatToHalf(colour.g), FloatToHalf(colour.b) };
+
+			memcpy(pixels + i * sizeof(halves), halves, sizeof(halves));
+		}
+	}
+
+	void PackSRGBA8Scalar(const glm::vec3* colours, unsigned int count, unsigned char* pixels)
+	{
+		const unsigned char* table = GetSrgbTable();
+
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			pixels[i * 4 + 0] = table[SrgbTableIndex(colours[i].r)];
+			pixels[i * 4 + 1] = table[SrgbTableIndex(colours[i].g)];
+			pixels[i * 4 + 2] = table[SrgbTableIndex(colours[i].b)];
+			pixels[i * 4 + 3] = 255;
+		}
+	}
+
+
+	// The SIMD versions treat 4 (or 8) colours as 12 (or 24) floats in a row, which is fine as every channel is converted the same way
+	// Whatever is left over at the end goes through the scalar version
+
+	SIMD_TARGET_SSE41
+	void PackRGB32FSSE41(const glm::vec3* colours, unsigned int count, unsigned char* pixels)
+	{
+		const float* in = (const float*)colours;
+		float* out = (float*)pixels;
+
+		__m128 zero = _mm_setzero_ps();
+		__m128 one = _mm_set1_ps(1.0f);
+
+		unsigned int i = 0;
+
+		for (; i + 4 <= count; i += 4)
+		{
+			for (int j = 0; j < 3; ++j)
+			{
+				__m128 value = _mm_loadu_ps(in + i * 3 + j * 4);
+
+				_mm_storeu_ps(out + i * 3 + j * 4, _mm_min_ps(_mm_max_ps(value, zero), one));
+			}
+		}
+
+		PackRGB32FScalar(colours + i, count - i, pixels + i * 12);
+	}
+
+	// The half float conversion needs F16C, which every CPU with AVX2 also has
+	SIMD_TARGET_F16C
+	void PackRGB16FF16C(const glm::vec3* colours, unsigned int count, unsigned char* pixels)
+	{
+		const float* in = (const float*)colours;
+
+		__m256 zero = _mm256_setzero_ps();
+		__m256 one = _mm256_set1_ps(1.0f);
+
+		unsigned int i = 0;
+
+		for (; i + 8 <= count; i += 8)
+		{
+			for (int j = 0; j < 3; ++j)
+			{
+				__m256 value = _mm256_loadu_ps(in + i * 3 + j * 8);
+
+				__m128i halves = _mm256_cvtps_ph(_mm256_min_ps(_mm256_max_ps(value, zero), one), _MM_FROUND_TO_NEAREST_INT);
+
+				_mm_storeu_si128((__m128i*)(pixels + i * 6 + j * 16), halves);
+			}
+		}
+
+		PackRGB16FScalar(colours + i, count - i, pixels + i * 6);
+	}
+
+	SIMD_TARGET_SSE41
+	void PackSRGBA8SSE41(const glm::vec3* colours, unsigned int count, unsigned char* pixels)
+	{
+		const unsigned char* table = GetSrgbTable();
+		const float* in = (const float*)colours;
+
+		__m128 zero = _mm_setzero_ps();
+		__m128 one = _mm_set1_ps(1.0f);
+		__m128 scale = _mm_set1_ps((float)(srgbTableSize - 1));
+		__m128 half = _mm_set1_ps(0.5f);
+
+		// Table indices for 4 colours
+		alignas(16) int indices[12];
+
+		unsigned int i = 0;
+
+		for (; i + 4 <= count; i += 4)
+		{
+			for (int j = 0; j < 3; ++j)
+			{
+				__m128 value = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i * 3 + j * 4), zero), one);
+
+				// Truncating after adding a half rounds, the same as SrgbTableIndex
+				_mm_store_si128((__m128i*)(indices + j * 4), _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(value, scale), half)));
+			}
+
+			for (int k = 0; k < 4; ++k)
+			{
+				pixels[(i + k) * 4 + 0] = table[indices[k * 3 + 0]];
+				pixels[(i + k) * 4 + 1] = table[indices[k * 3 + 1]];
+				pixels[(i + k) * 4 + 2] = table[indices[k * 3 + 2]];
+				pixels[(i + k) * 4 + 3] = 255;
+			}
+		}
+
+		PackSRGBA8Scalar(colours + i, count - i, pixels + i * 4);
+	}
+}
+
+
+unsigned int PixelFormat::BytesPerPixel(FramebufferFormat format)
+{
+	switch (format)
+	{
+	case FramebufferFormat::RGB16F:
+		return 6;
+	case FramebufferFormat::SRGBA8:
+		return 4;
+	default:
+		return 12;
+	}
+}
+
+const char* PixelFormat::Name(FramebufferFormat format)
+{
+	switch (format)
+	{
+	case FramebufferFormat::RGB16F:
+		return "RGB16F";
+	case FramebufferFormat::SRGBA8:
+		return "SRGBA8";
+	default:
+		return "RGB32F";
+	}
+}
+
+
+PixelFormat::PackFunction PixelFormat::GetPackFunction(FramebufferFormat format, SimdLevel level)
+{
+	switch (format)
+	{
+	case FramebufferFormat::RGB16F:
+		return level >= SimdLevel::AVX2 ? PackRGB16FF16C : PackRGB16FScalar;
+	case FramebufferFormat::SRGBA8:
+		return level >= SimdLevel::SSE41 ? PackSRGBA8SSE41 : PackSRGBA8Scalar;
+	default:
+		return level >= SimdLevel::SSE41 ? PackRGB32FSSE41 : PackRGB32FScalar;
+	}
+}
+
+
+void PixelFormat::PackReference(FramebufferFormat format, glm::vec3 colour, unsigned char* pixel)
+{
+	colour = glm::clamp(colour, 0.0f, 1.0f);
+
+	if (format == FramebufferFormat::RGB16F)
+	{
+		glm::uint64 halves = glm::packHalf4x16(glm::vec4(colour, 0.0f));
+
+		memcpy(pixel, &halves, 6);
+	}
+	else if (format == FramebufferFormat::SRGBA8)
+	{
+		glm::uint packed = glm::packUnorm4x8(glm::vec4(glm::convertLinearToSRGB(colour), 1.0f));
+
+		memcpy(pixel, &packed, 4);
+	}
+	else
+	{
+		memcpy(pixel, &colour, sizeof(glm::vec3));
+	}
+}
+
+glm::vec3 PixelFormat::Unpack(FramebufferFormat format, const unsigned char* pixel)
+{
+	if (format == FramebufferFormat::RGB16F)
+	{
+		glm::uint64 halves = 0;
+		memcpy(&halves, pixel, 6);
+
+		return glm::vec3(glm::unpackHalf4x16(halves));
+	}
+	else if (format == FramebufferFormat::SRGBA8)
+	{
+		glm::uint packed;
+		memcpy(&packed, pixel, 4);
+
+		return glm::convertSRGBToLinear(glm::vec3(glm::unpackUnorm4x8(packed)));
+	}
+
+	glm::vec3 colour;
+	memcpy(&colour, pixel, sizeof(glm::vec3));
+
+	return colour;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Simd.h"
+
+#include <GLM/glm.hpp>
+
+// How the framebuffer stores its pixels, on the CPU and in the OpenGL texture
+enum class FramebufferFormat
+{
+	// Three floats, 12 bytes a pixel, sent to OpenGL untouched
+	RGB32F,
+
+	// Three half floats, 6 bytes a pixel
+	RGB16F,
+
+	// sRGB encoded bytes plus an unused alpha, 4 bytes a pixel
+	// OpenGL decodes them back to linear when the texture is sampled, so the screen shows the same colours as RGB32F
+	SRGBA8
+};
+
+// Turning colours into each framebuffer format and back
+namespace PixelFormat
+{
+	unsigned int BytesPerPixel(FramebufferFormat format);
+
+	const char* Name(FramebufferFormat format);
+
+	// Writes count colours to pixels as packed pixels of one format, colours are clamped between 0 and 1 first
+	typedef void (*PackFunction)(const glm::vec3* colours, unsigned int count, unsigned char* pixels);
+
+	// Every level gives exactly the same bytes, so the choice only changes the speed
+	PackFunction GetPackFunction(FramebufferFormat format, SimdLevel level);
+
+	// Straight from the GLM packing and colour space functions, what the pack functions are checked against
+	// They can be one apart in the last place, sRGB goes through a 12 bit table and half floats round ties to even where GLM rounds them up
+	void PackReference(FramebufferFormat format, glm::vec3 colour, unsigned char* pixel);
+
+	// Reads one packed pixel back as a linear colour
+	glm::vec3 Unpack(FramebufferFormat format, const unsigned char* pixel);
+}
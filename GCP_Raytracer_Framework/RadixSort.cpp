@@ -0,0 +1,88 @@
+#include "RadixSort.h"
+
+#include <algorithm>
+
+
+// Keys per chunk when a pass is shared out across threads
+static const unsigned int chunkSize = 16384;
+
+// Bits of key a pass handles
+static const int radixBits = 8;
+static const unsigned int radixBuckets = 1 << radixBits;
+
+
+// Every pass counts each chunk's digits, works out where each chunk's run of every digit starts, then each chunk scatters its own keys
+void RadixSort::Sort(std::vector<unsigned long long>& keys, std::vector<unsigned int>& values, int keyBits, ThreadPool* pool, Scratch& scratch)
+{
+	unsigned int count = (unsigned int)keys.size();
+	unsigned int chunkCount = (count + chunkSize - 1) / chunkSize;
+
+	scratch.keys.resize(count);
+	scratch.values.resize(count);
+	scratch.offsets.resize(chunkCount * radixBuckets);
+
+	std::vector<unsigned int>& offsets = scratch.offsets;
+
+	for (int shift = 0; shift < keyBits; shift += radixBits)
+	{
+		std::fill(offsets.begin(), offsets.end(), 0);
+
+		ParallelForChunks(pool, count, chunkSize, [&](unsigned int chunk, unsigned int start, unsigned int end)
+		{
+			unsigned int* chunkCounts = &offsets[chunk * radixBuckets];
+
+			for (unsigned int i = start; i < end; ++i)
+			{
+				chunkCounts[(keys[i] >> shift) & (radixBuckets - 1)]++;
+			}
+		});
+
+		// Digits come in order, and within a digit the chunks do
+		unsigned int total = 0;
+		bool allOneDigit = false;
+
+		for (unsigned int digit = 0; digit < radixBuckets; ++digit)
+		{
+			unsigned int digitStart = total;
+
+			for (unsigned int chunk = 0; chunk < chunkCount; ++chunk)
+			{
+				unsigned int digitCount = offsets[chunk * radixBuckets + digit];
+
+				offsets[chunk * radixBuckets + digit] = total;
+				total += digitCount;
+			}
+
+			allOneDigit = allOneDigit || total - digitStart == count;
+		}
+
+		// Common for the top digits when the keys are close together, the pass wouldn't move anything
+		if (allOneDigit)
+		{
+			continue;
+		}
+
+		ParallelForChunks(pool, count, chunkSize, [&](unsigned int chunk, unsigned int start, unsigned int end)
+		{
+			unsigned int* chunkOffsets = &offsets[chunk * radixBuckets];
+
+			for (unsigned int i = start; i < end; ++i)
+			{
+				unsigned int destination = chunkOffsets[(keys[i] >> shift) & (radixBuckets - 1)]++;
+
+				scratch.keys[destination] = keys[i];
+				scratch.values[destination] = values[i];
+			}
+		});
+
+		keys.swap(scratch.keys);
+		values.swap(scratch.values);
+	}
+}
+
+void RadixSort::Sort(std::vector<unsigned long long>& keys, std::vector<unsigned int>& values, int keyBits, ThreadPool* pool)
+{
+	Scratch scratch;
+
+	Sort(keys, values, keyBits, pool, scratch);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "ThreadPool.h"
+
+#include <vector>
+
+// Stable least significant digit first radix sort of keys with a value carried along with each, spread across a thread pool
+// Used to put primitives in Morton order for the linear BVH builds and to sort the wavefront renderer's ray queues
+namespace RadixSort
+{
+	// Buffers a sort works in, kept between sorts so sorting as many keys again doesn't allocate
+	struct Scratch
+	{
+		std::vector<unsigned long long> keys;
+
+		std::vector<unsigned int> values;
+
+		// Counts of each digit in each chunk, then where each chunk's run of each digit starts
+		std::vector<unsigned int> offsets;
+	};
+
+	// Sorts keys from the lowest keyBits up, moving values along with them
+	// Chunks write in order within each digit, so the sort comes out the same however many threads there are
+	void Sort(std::vector<unsigned long long>& keys, std::vector<unsigned int>& values, int keyBits, ThreadPool* pool, Scratch& scratch);
+
+	// The same with scratch buffers that only last for the one sort
+	void Sort(std::vector<unsigned long long>& keys, std::vector<unsigned int>& values, int keyBits, ThreadPool* pool = nullptr);
+}
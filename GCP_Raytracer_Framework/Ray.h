@@ -1,6 +1,9 @@
 #pragma once
 
 #include "GCP_GFX_Framework.h"
+#include "Trace.h"
+
+#include <type_traits>
 
 class Ray
 {
@@ -11,15 +14,18 @@ class Ray
 		glm::vec3 direction;
 
 
-		Ray(glm::vec3 _origin, glm::vec3 _direction) : origin(_origin), direction(_direction)
+		// Left unset, for buffers that are filled in afterwards
+		Ray()
 		{
-			std::cout << "Ray CTOR called";
+			GCP_TRACE("Ray CTOR called");
 		}
 
-		~Ray()
+		Ray(glm::vec3 _origin, glm::vec3 _direction) : origin(_origin), direction(_direction)
 		{
-			std::cout << "Ray DTOR called";
+			GCP_TRACE("Ray CTOR called");
 		}
 			
 };
 
+// Rays are made for every pixel and copied into every test, so they have to stay as cheap as plain data
+static_assert(std::is_trivially_copyable<Ray>::value, "Ray should be trivially copyable");
@@ -0,0 +1,52 @@
+#include "RayPacket.h"
+
+
+void RayPacket::Set(const Ray* _rays, unsigned int _count, float _tMax)
+{
+	count = glm::min(_count, maxRays);
+
+	originMin = glm::vec3(FLT_MAX);
+	originMax = glm::vec3(-FLT_MAX);
+	invDirectionMin = glm::vec3(FLT_MAX);
+	invDirectionMax = glm::vec3(-FLT_MAX);
+
+	bool anyNegative[3] = { false, false, false };
+	bool anyPositive[3] = { false, false, false };
+	bool anyZero = false;
+
+	unsigned int paddedCount = GetGroupCount() * groupSize;
+
+	for (unsigned int i = 0; i < paddedCount; i++)
+	{
+		const Ray& ray = _rays[glm::min(i, count - 1)];
+
+		glm::vec3 invDirection = 1.0f / ray.direction;
+
+		rays[i] = ray;
+		originX[i] = ray.origin.x;
+		originY[i] = ray.origin.y;
+		originZ[i] = ray.origin.z;
+		directionX[i] = ray.direction.x;
+		directionY[i] = ray.direction.y;
+		directionZ[i] = ray.direction.z;
+		invDirectionX[i] = invDirection.x;
+		invDirectionY[i] = invDirection.y;
+		invDirectionZ[i] = invDirection.z;
+		tMax[i] = _tMax;
+
+		originMin = glm::min(originMin, ray.origin);
+		originMax = glm::max(originMax, ray.origin);
+		invDirectionMin = glm::min(invDirectionMin, invDirection);
+		invDirectionMax = glm::max(invDirectionMax, invDirection);
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			anyNegative[axis] = anyNegative[axis] || ray.direction[axis] < 0.0f;
+			anyPositive[axis] = anyPositive[axis] || ray.direction[axis] > 0.0f;
+			anyZero = anyZero || ray.direction[axis] == 0.0f;
+		}
+	}
+
+	// A 0 direction would put infinities into the interval test, where they could turn into NaNs
+	coherent = !anyZero && !(anyNegative[0] && anyPositive[0]) && !(anyNegative[1] && anyPositive[1]) && !(anyNegative[2] && anyPositive[2]);
+}
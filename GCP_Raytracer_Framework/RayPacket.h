@@ -0,0 +1,63 @@
+#pragma once
+
+#include "GCP_GFX_Framework.h"
+#include "Ray.h"
+
+#include <cfloat>
+
+// Up to 8 by 8 neighbouring rays traced through the BVHs together, an array per component so SSE can load 4 rays' worth of one at a time
+// Lanes past count repeat the last ray, so a group of 4 can always be loaded whole, the lane mask keeps them out of every result
+struct RayPacket
+{
+	static const unsigned int maxRays = 64;
+
+	// Rays per SSE register, the packet is traced a group of this many at a time
+	static const unsigned int groupSize = 4;
+
+	alignas(16) float originX[maxRays];
+
+	alignas(16) float originY[maxRays];
+
+	alignas(16) float originZ[maxRays];
+
+	alignas(16) float directionX[maxRays];
+
+	alignas(16) float directionY[maxRays];
+
+	alignas(16) float directionZ[maxRays];
+
+	alignas(16) float invDirectionX[maxRays];
+
+	alignas(16) float invDirectionY[maxRays];
+
+	alignas(16) float invDirectionZ[maxRays];
+
+	// Distance to each ray's closest hit so far, nodes and primitives further away are skipped
+	alignas(16) float tMax[maxRays];
+
+	// The same rays whole, for the parts traced a ray at a time
+	Ray rays[maxRays];
+
+	unsigned int count = 0;
+
+	// Bounds of every ray's origin and inverse direction, so one interval test can tell a node that the whole packet misses
+	glm::vec3 originMin;
+
+	glm::vec3 originMax;
+
+	glm::vec3 invDirectionMin;
+
+	glm::vec3 invDirectionMax;
+
+	// Whether every ray's direction has the same sign on each axis, and none of them is 0 on any axis
+	// The interval test and the packet's near child order rely on it, a packet that isn't is traced a ray at a time
+	bool coherent = false;
+
+	// Fills the packet from count rays, starting each one's tMax at the same value
+	void Set(const Ray* _rays, unsigned int _count, float _tMax = FLT_MAX);
+
+	unsigned int GetGroupCount() const { return (count + groupSize - 1) / groupSize; }
+
+	// One bit per ray, bit i for ray i, set for every ray in the packet
+	unsigned long long GetFullMask() const { return count == maxRays ? ~0ull : (1ull << count) - 1; }
+};
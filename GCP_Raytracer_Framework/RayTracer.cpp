@@ -0,0 +1,858 @@
+
+#include "RayTracer.h"
+
+#include <chrono>
+
+
+// Spheres a task works through at a time when a pass over them is shared across the pool
+static const unsigned int sphereChunkSize = 65536;
+
+
+void RayTracer::CalculateSphereBounds(ThreadPool* pool)
+{
+	unsigned int sphereCount = spheres.GetCount();
+
+	sphereBounds.resize(sphereCount);
+
+	ParallelForChunks(pool, sphereCount, sphereChunkSize, [&](unsigned int, unsigned int start, unsigned int end)
+	{
+		for (unsigned int i = start; i < end; i++)
+		{
+			glm::vec3 centre = spheres.GetCentre(i);
+			float radius = spheres.GetRadius(i);
+
+			sphereBounds[i].min = centre - glm::vec3(radius);
+			sphereBounds[i].max = centre + glm::vec3(radius);
+		}
+	});
+}
+
+
+void RayTracer::BuildLights(ThreadPool* pool)
+{
+	directionalLights.clear();
+
+	std::vector<Light> treeLights;
+
+	for (const Light& light : lights)
+	{
+		if (light.type == LightType::Directional)
+		{
+			directionalLights.push_back(light);
+		}
+		else
+		{
+			treeLights.push_back(light);
+		}
+	}
+
+	bool anyEmissive = false;
+
+	for (const Material& material : materials)
+	{
+		anyEmissive = anyEmissive || material.emission != glm::vec3(0.0f);
+	}
+
+	// Most scenes have no emissive materials, so the spheres are only gone through when there's something to find
+	for (unsigned int i = 0; anyEmissive && i < spheres.GetCount(); i++)
+	{
+		const Material& material = materials[sphereMaterials[i]];
+
+		if (material.emission != glm::vec3(0.0f))
+		{
+			Light light;
+			light.type = LightType::Sphere;
+			light.position = spheres.GetCentre(i);
+			light.radius = spheres.GetRadius(i);
+			light.colour = material.emission;
+			light.sphere = i;
+
+			treeLights.push_back(light);
+		}
+	}
+
+	lightTree.Build(treeLights, pool);
+}
+
+
+void RayTracer::BuildBVH(ThreadPool* pool)
+{
+	CalculateSphereBounds(pool);
+
+	bvh.Build(sphereBounds, pool, bvhBuilder);
+
+	// Lay the spheres out in the order the leaves reference them
+
+	const std::vector<unsigned int>& primIndices = bvh.GetPrimIndices();
+	unsigned int sphereCount = (unsigned int)primIndices.size();
+
+	sphereStore.Resize(sphereCount);
+
+	float* centreX = sphereStore.GetCentreX();
+	float* centreY = sphereStore.GetCentreY();
+	float* centreZ = sphereStore.GetCentreZ();
+	float* radii = sphereStore.GetRadii();
+	unsigned int* ids = sphereStore.GetIds();
+
+	ParallelForChunks(pool, sphereCount, sphereChunkSize, [&](unsigned int, unsigned int start, unsigned int end)
+	{
+		for (unsigned int i = start; i < end; i++)
+		{
+			unsigned int index = primIndices[i];
+			glm::vec3 centre = spheres.GetCentre(index);
+
+			centreX[i] = centre.x;
+			centreY[i] = centre.y;
+			centreZ[i] = centre.z;
+			radii[i] = spheres.GetRadius(index);
+			ids[i] = index;
+		}
+	});
+
+	std::cout << "INFO: BVH built over " << sphereCount << " spheres in " << bvh.GetBuildTimeMs() << " ms, " << bvh.GetNodeCount() << " nodes" << std::endl;
+
+	for (Mesh& mesh : meshes)
+	{
+		if (!mesh.GetBVH().IsBuilt())
+		{
+			mesh.BuildBVH(pool, bvhBuilder);
+		}
+	}
+
+	// Instances mapped from a scene cache already have their BVH, and no instances can be added to them
+	if (meshInstances.GetInstanceCount() > 0 && !meshInstances.GetBVH().IsMapped())
+	{
+		meshInstances.Build(meshes, pool, bvhBuilder);
+	}
+
+	BuildLights(pool);
+}
+
+
+unsigned int RayTracer::AddMesh(Mesh mesh)
+{
+	unsigned int meshIndex = AddSharedMesh(std::move(mesh));
+
+	meshInstances.AddInstance(meshIndex, glm::mat4(1.0f));
+
+	return meshIndex;
+}
+
+
+unsigned int RayTracer::AddSharedMesh(Mesh mesh)
+{
+	meshes.push_back(std::move(mesh));
+
+	return (unsigned int)meshes.size() - 1;
+}
+
+
+void RayTracer::RefitBVH(ThreadPool* pool)
+{
+	// A tree mapped from a scene cache doesn't have the primitive order refitting needs
+	if (!bvh.IsBuilt() || bvh.IsMapped())
+	{
+		BuildBVH(pool);
+		return;
+	}
+
+	CalculateSphereBounds(pool);
+
+	bvh.Refit(sphereBounds, pool);
+
+	if (bvh.GetSahCostRatio() > rebuildCostRatio)
+	{
+		std::cout << "INFO: Refitting raised the BVH's SAH cost " << bvh.GetSahCostRatio() << " times, building it again" << std::endl;
+
+		BuildBVH(pool);
+		return;
+	}
+
+	// The leaves still hold the same spheres in the same order, so the store only needs the new centres
+	const std::vector<unsigned int>& primIndices = bvh.GetPrimIndices();
+	unsigned int sphereCount = (unsigned int)primIndices.size();
+
+	ParallelForChunks(pool, sphereCount, sphereChunkSize, [&](unsigned int, unsigned int start, unsigned int end)
+	{
+		for (unsigned int i = start; i < end; i++)
+		{
+			sphereStore.Set(i, spheres.GetCentre(primIndices[i]), spheres.GetRadius(primIndices[i]));
+		}
+	});
+
+	// Sphere lights move with their spheres
+	BuildLights(pool);
+}
+
+
+bool RayTracer::SaveCache(const std::string& filename, unsigned long long sourceHash) const
+{
+	SceneCache::Writer writer;
+
+	if (!writer.Open(filename))
+	{
+		std::cerr << "WARNING: could not open scene cache for writing: " << filename << std::endl;
+		return false;
+	}
+
+	unsigned int builder = (unsigned int)bvhBuilder;
+	writer.Write(&builder, 1);
+
+	spheres.Save(writer);
+	writer.Write(sphereMaterials);
+	writer.Write(materials);
+	writer.Write(lights);
+
+	bvh.Save(writer);
+	sphereStore.Save(writer);
+
+	unsigned int meshCount = (unsigned int)meshes.size();
+	writer.Write(&meshCount, 1);
+
+	for (const Mesh& mesh : meshes)
+	{
+		mesh.Save(writer);
+	}
+
+	meshInstances.Save(writer);
+
+	if (!writer.Finish(sourceHash))
+	{
+		std::cerr << "WARNING: could not write scene cache: " << filename << std::endl;
+		return false;
+	}
+
+	std::cout << "INFO: Saved scene cache " << filename << std::endl;
+
+	return true;
+}
+
+
+bool RayTracer::LoadCache(const std::string& filename, unsigned long long sourceHash)
+{
+	auto startTime = std::chrono::steady_clock::now();
+
+	std::unique_ptr<SceneCache::Reader> reader(new SceneCache::Reader());
+
+	if (!reader->Open(filename, sourceHash))
+	{
+		return false;
+	}
+
+	const unsigned int* builder = reader->ReadExactly<unsigned int>(1);
+
+	if (builder != nullptr && *builder != (unsigned int)bvhBuilder)
+	{
+		std::cerr << "WARNING: scene cache was built with the " << BVHBuilderName((BVHBuilder)*builder) << " builder rather than " << BVHBuilderName(bvhBuilder) << ", ignoring it: " << filename << std::endl;
+		return false;
+	}
+
+	// Everything is mapped into new objects first, so a damaged cache leaves the current scene as it was
+
+	SphereSoA cachedSpheres;
+	BVH cachedBVH;
+	SphereSoA cachedStore;
+	std::vector<Mesh> cachedMeshes;
+	InstanceBVH cachedInstances;
+
+	bool mapped = cachedSpheres.Map(*reader);
+
+	size_t materialCount = 0;
+	size_t lightCount = 0;
+
+	const unsigned int* cachedSphereMaterials = reader->ReadExactly<unsigned int>(cachedSpheres.GetCount());
+	const Material* cachedMaterials = reader->Read<Material>(materialCount);
+	const Light* cachedLights = reader->Read<Light>(lightCount);
+
+	mapped = mapped && cachedBVH.Map(*reader, cachedSpheres.GetCount()) && cachedStore.Map(*reader);
+
+	const unsigned int* meshCount = reader->ReadExactly<unsigned int>(1);
+
+	// Not reserved, the count comes from the file and a damaged one would ask for far more meshes than there are,
+	// each mesh maps its own sections so the loop stops as soon as they run out
+	if (mapped && meshCount != nullptr)
+	{
+		for (unsigned int i = 0; i < *meshCount && mapped; i++)
+		{
+			cachedMeshes.push_back(Mesh(glm::vec3(0.0f)));
+			mapped = cachedMeshes.back().Map(*reader);
+		}
+	}
+
+	mapped = mapped && cachedInstances.Map(*reader, (unsigned int)cachedMeshes.size());
+
+	if (!mapped || reader->HasFailed() || cachedStore.GetCount() != cachedSpheres.GetCount())
+	{
+		std::cerr << "WARNING: scene cache is damaged, ignoring it: " << filename << std::endl;
+		return false;
+	}
+
+	// Materials are looked up per hit, so a bad index would read past the end of them, and so are the spheres the store's ids point back to
+	for (unsigned int i = 0; i < cachedSpheres.GetCount(); i++)
+	{
+		if (cachedSphereMaterials[i] >= materialCount || cachedStore.GetId(i) >= cachedSpheres.GetCount())
+		{
+			std::cerr << "WARNING: scene cache is damaged, ignoring it: " << filename << std::endl;
+			return false;
+		}
+	}
+
+	spheres = std::move(cachedSpheres);
+	sphereMaterials.assign(cachedSphereMaterials, cachedSphereMaterials + spheres.GetCount());
+	materials.assign(cachedMaterials, cachedMaterials + materialCount);
+	lights.assign(cachedLights, cachedLights + lightCount);
+	bvh = std::move(cachedBVH);
+	sphereStore = std::move(cachedStore);
+	meshes = std::move(cachedMeshes);
+	meshInstances = std::move(cachedInstances);
+	sphereBounds.clear();
+
+	// Anything mapped from an earlier cache has been replaced by now
+	sceneCache = std::move(reader);
+
+	// The light tree is quick to build and the sphere lights come from the cached spheres, so it isn't cached itself
+	BuildLights(nullptr);
+
+	double loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+	std::cout << "INFO: Loaded scene cache " << filename << ", " << spheres.GetCount() << " spheres, " << meshes.size() << " meshes and " << meshInstances.GetInstanceCount() << " instances in " << loadMs << " ms" << std::endl;
+
+	return true;
+}
+
+
+glm::vec3 RayTracer::TraceRay(const Ray& ray)
+{
+	glm::vec3 colour;
+
+	TraceRays(&ray, glm::ivec2(0), glm::ivec2(1), &colour);
+
+	return colour;
+}
+
+// Where a path has got to, kept between bounces
+struct PathState
+{
+	Ray ray;
+
+	// What's left of the light after every surface so far has reflected its share
+	glm::vec3 throughput;
+
+	// Which of the camera rays the path started from
+	unsigned int index;
+
+	PixelSampler sampler;
+};
+
+// Paths followed together, small enough that a batch and its hits sit comfortably on the stack
+static const unsigned int pathBatchSize = 64;
+
+void RayTracer::TraceRays(const Ray* rays, glm::ivec2 min, glm::ivec2 max, glm::vec3* colours)
+{
+	int width = max.x - min.x;
+	unsigned int count = (unsigned int)(width * (max.y - min.y));
+
+	// Each sample's paths start with their share of the pixel, so adding up their light averages it
+	glm::vec3 sampleWeight(1.0f / (float)samplesPerPixel);
+
+	PathState paths[pathBatchSize];
+	HitRecord hits[pathBatchSize];
+
+	unsigned long long batchPrimaryRays = 0;
+	unsigned long long batchSecondaryRays = 0;
+	unsigned long long batchPrimaryNanoseconds = 0;
+	unsigned long long batchSecondaryNanoseconds = 0;
+	unsigned long long batchShadowRays = 0;
+
+	// Every sample's batches in turn, each sample going over the rays from the start
+	unsigned int batchesPerSample = (count + pathBatchSize - 1) / pathBatchSize;
+
+	for (unsigned int batch = 0; batch < batchesPerSample * samplesPerPixel; batch++)
+	{
+		unsigned int sample = batch / batchesPerSample;
+		unsigned int batchStart = (batch % batchesPerSample) * pathBatchSize;
+		unsigned int livePaths = glm::min(pathBatchSize, count - batchStart);
+
+		for (unsigned int i = 0; i < livePaths; i++)
+		{
+			const Ray& ray = rays[batchStart + i];
+
+			glm::ivec2 pixel(min.x + (int)(batchStart + i) % width, min.y + (int)(batchStart + i) / width);
+
+			paths[i].ray = ray;
+			paths[i].throughput = sampleWeight;
+			paths[i].index = batchStart + i;
+			paths[i].sampler = PixelSampler(samplerType, pixel, sample);
+
+			// Background colour for rays that miss everything
+			if (sample == 0)
+			{
+				colours[batchStart + i] = glm::vec3(0, 0, 0);
+			}
+		}
+
+		for (unsigned int bounce = 0; livePaths > 0; bounce++)
+		{
+			// Find what every path in the batch hits next, timed as a whole so the clock isn't read per ray
+
+			std::chrono::steady_clock::time_point extendStart;
+
+			if (collectStats)
+			{
+				extendStart = std::chrono::steady_clock::now();
+			}
+
+			for (unsigned int i = 0; i < livePaths; i++)
+			{
+				hits[i] = HitRecord();
+			}
+
+			if (bounce == 0 && primaryPacketSize > 1)
+			{
+				// Nothing has moved yet, so the batch's camera rays are still in the caller's order
+				for (unsigned int first = 0; first < livePaths; first += primaryPacketSize)
+				{
+					IntersectPacket(&rays[batchStart + first], glm::min(primaryPacketSize, livePaths - first), &hits[first]);
+				}
+			}
+			else
+			{
+				for (unsigned int i = 0; i < livePaths; i++)
+				{
+					Intersect(paths[i].ray, hits[i]);
+				}
+			}
+
+			if (collectStats)
+			{
+				unsigned long long nanoseconds = (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - extendStart).count();
+
+				(bounce == 0 ? batchPrimaryRays : batchSecondaryRays) += livePaths;
+				(bounce == 0 ? batchPrimaryNanoseconds : batchSecondaryNanoseconds) += nanoseconds;
+			}
+
+			// Shade every hit, then move the paths that carry on to the front of the batch
+
+			unsigned int nextLivePaths = 0;
+
+			for (unsigned int i = 0; i < livePaths; i++)
+			{
+				PathState& path = paths[i];
+				const HitRecord& hit = hits[i];
+
+				if (hit.primitive < 0)
+				{
+					continue;
+				}
+
+				glm::vec3 point = path.ray.origin + hit.t * path.ray.direction;
+				glm::vec3 normal = GetFacingNormal(path.ray, hit);
+				glm::vec3 albedo = GetColour(hit);
+
+				// Emissive spheres are in the light tree, so after the camera ray their light has already been picked up by shading the surface before
+				if (bounce == 0)
+				{
+					colours[path.index] += path.throughput * GetEmission(hit);
+				}
+
+				glm::vec3 light(0, 0, 0);
+
+				path.sampler.SetDimension(bounce * GetSampleDimensions());
+
+				ForEachLightSample(point, normal, path.sampler, [&](const Ray& shadowRay, float tMax, const glm::vec3& contribution)
+				{
+					batchShadowRays++;
+
+					if (!IsOccluded(shadowRay, tMax))
+					{
+						light += contribution;
+					}
+				});
+
+				colours[path.index] += path.throughput * (light * albedo);
+
+				if (!ContinuePath(point, normal, albedo, bounce, path.throughput, path.sampler, path.ray))
+				{
+					continue;
+				}
+
+				paths[nextLivePaths++] = path;
+			}
+
+			livePaths = nextLivePaths;
+		}
+	}
+
+	if (collectStats)
+	{
+		primaryRays.fetch_add(batchPrimaryRays, std::memory_order_relaxed);
+		secondaryRays.fetch_add(batchSecondaryRays, std::memory_order_relaxed);
+		primaryNanoseconds.fetch_add(batchPrimaryNanoseconds, std::memory_order_relaxed);
+		secondaryNanoseconds.fetch_add(batchSecondaryNanoseconds, std::memory_order_relaxed);
+		shadowRays.fetch_add(batchShadowRays, std::memory_order_relaxed);
+	}
+}
+
+
+AABB RayTracer::GetBounds() const
+{
+	AABB bounds;
+
+	// The root of each BVH bounds everything under it
+	const BVH* trees[2] = { &bvh, &meshInstances.GetBVH() };
+
+	for (const BVH* tree : trees)
+	{
+		if (tree->IsBuilt())
+		{
+			AABB root;
+			root.min = tree->GetNodes()[0].boundsMin;
+			root.max = tree->GetNodes()[0].boundsMax;
+
+			bounds.Grow(root);
+		}
+	}
+
+	return bounds;
+}
+
+bool RayTracer::Intersect(const Ray& ray, HitRecord& hit)
+{
+	// Distance along the ray to the closest hit so far
+	float closestDistance = hit.t;
+	int closestObject = -1;
+
+	if (bvh.IsBuilt())
+	{
+		unsigned int visited = bvh.Traverse(ray, closestDistance, [&](unsigned int first, unsigned int count, float& tMax)
+		{
+			int sphereHit = intersectSpheres(sphereStore, ray, first, count, tMax);
+
+			if (sphereHit >= 0)
+			{
+				closestObject = (int)sphereStore.GetId(sphereHit);
+			}
+		});
+
+		if (collectStats)
+		{
+			raysTraced.fetch_add(1, std::memory_order_relaxed);
+			nodesVisited.fetch_add(visited, std::memory_order_relaxed);
+		}
+	}
+	else
+	{
+		//No BVH yet, so test every sphere
+
+		closestObject = intersectSpheres(spheres, ray, 0, spheres.GetCount(), closestDistance);
+	}
+
+	//Then the mesh instances, which can only pull closestDistance in further
+
+	InstanceHit instanceHit;
+
+	if (meshInstances.GetBVH().IsBuilt())
+	{
+		unsigned int visited = meshInstances.Intersect(meshes, ray, closestDistance, instanceHit);
+
+		if (collectStats)
+		{
+			nodesVisited.fetch_add(visited, std::memory_order_relaxed);
+		}
+	}
+
+	if (instanceHit.instance >= 0)
+	{
+		hit.t = closestDistance;
+		hit.primitive = instanceHit.triangleHit.triangle;
+		hit.instance = instanceHit.instance;
+		hit.barycentrics = instanceHit.triangleHit.barycentrics;
+
+		return true;
+	}
+
+	if (closestObject >= 0)
+	{
+		hit.t = closestDistance;
+		hit.primitive = closestObject;
+		hit.instance = -1;
+		hit.barycentrics = glm::vec2(0.0f);
+
+		return true;
+	}
+
+	return false;
+}
+
+void RayTracer::IntersectPacket(const Ray* rays, unsigned int count, HitRecord* hits)
+{
+	count = glm::min(count, RayPacket::maxRays);
+
+	if (!bvh.IsBuilt())
+	{
+		for (unsigned int i = 0; i < count; i++)
+		{
+			Intersect(rays[i], hits[i]);
+		}
+
+		return;
+	}
+
+	RayPacket packet;
+	packet.Set(rays, count);
+
+	// Sphere store indices, for every lane the packet holds as the kernel writes 4 at a time
+	int closestSpheres[RayPacket::maxRays];
+	InstanceHit instanceHits[RayPacket::maxRays];
+
+	for (unsigned int i = 0; i < RayPacket::maxRays; i++)
+	{
+		closestSpheres[i] = -1;
+	}
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		packet.tMax[i] = hits[i].t;
+	}
+
+	unsigned int visited = bvh.TraversePacket(packet, [&](unsigned int first, unsigned int leafCount, unsigned long long mask)
+	{
+		SphereSoA::IntersectPacket(sphereStore, packet, first, leafCount, mask, closestSpheres);
+	},
+	[&](unsigned int ray, unsigned int first, unsigned int leafCount, float& tMax)
+	{
+		int sphereHit = intersectSpheres(sphereStore, packet.rays[ray], first, leafCount, tMax);
+
+		if (sphereHit >= 0)
+		{
+			closestSpheres[ray] = sphereHit;
+		}
+	});
+
+	//Then the mesh instances, which can only pull each ray's tMax in further
+
+	if (meshInstances.GetBVH().IsBuilt())
+	{
+		visited += meshInstances.IntersectPacket(meshes, packet, instanceHits);
+	}
+
+	if (collectStats)
+	{
+		raysTraced.fetch_add(count, std::memory_order_relaxed);
+		nodesVisited.fetch_add(visited, std::memory_order_relaxed);
+	}
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		HitRecord& hit = hits[i];
+
+		if (instanceHits[i].instance >= 0)
+		{
+			hit.t = packet.tMax[i];
+			hit.primitive = instanceHits[i].triangleHit.triangle;
+			hit.instance = instanceHits[i].instance;
+			hit.barycentrics = instanceHits[i].triangleHit.barycentrics;
+		}
+		else if (closestSpheres[i] >= 0)
+		{
+			hit.t = packet.tMax[i];
+			hit.primitive = (int)sphereStore.GetId((unsigned int)closestSpheres[i]);
+			hit.instance = -1;
+			hit.barycentrics = glm::vec2(0.0f);
+		}
+	}
+}
+
+bool RayTracer::IsOccluded(const Ray& ray, float tMax) const
+{
+	bool occluded = false;
+
+	if (bvh.IsBuilt())
+	{
+		occluded = bvh.TraverseAny(ray, tMax, [&](unsigned int first, unsigned int count, float& leafTMax)
+		{
+			return intersectSpheres(sphereStore, ray, first, count, leafTMax) >= 0;
+		});
+	}
+	else
+	{
+		occluded = intersectSpheres(spheres, ray, 0, spheres.GetCount(), tMax) >= 0;
+	}
+
+	return occluded || (meshInstances.GetBVH().IsBuilt() && meshInstances.IsOccluded(meshes, ray, tMax));
+}
+
+
+glm::vec3 RayTracer::GetNormal(const Ray& ray, const HitRecord& hit) const
+{
+	if (hit.instance >= 0)
+	{
+		InstanceHit instanceHit;
+		instanceHit.instance = hit.instance;
+		instanceHit.triangleHit.triangle = hit.primitive;
+		instanceHit.triangleHit.barycentrics = hit.barycentrics;
+
+		return meshInstances.GetNormal(meshes, instanceHit);
+	}
+
+	return glm::normalize(ray.origin + hit.t * ray.direction - spheres.GetCentre((unsigned int)hit.primitive));
+}
+
+glm::vec3 RayTracer::GetFacingNormal(const Ray& ray, const HitRecord& hit) const
+{
+	glm::vec3 normal = GetNormal(ray, hit);
+
+	// Triangles can be seen from either side, and are lit from the side they're seen from
+	return glm::dot(normal, ray.direction) > 0.0f ? -normal : normal;
+}
+
+glm::vec3 RayTracer::GetColour(const HitRecord& hit) const
+{
+	if (hit.instance >= 0)
+	{
+		return meshes[meshInstances.GetInstance((unsigned int)hit.instance).meshIndex].GetColour();
+	}
+
+	return materials[sphereMaterials[hit.primitive]].colour;
+}
+
+glm::vec3 RayTracer::GetEmission(const HitRecord& hit) const
+{
+	if (hit.instance >= 0)
+	{
+		return glm::vec3(0.0f);
+	}
+
+	return materials[sphereMaterials[hit.primitive]].emission;
+}
+
+
+glm::vec3 RayTracer::Shade(const glm::vec3& point, const glm::vec3& surfaceNormal, const glm::vec3& colour, PixelSampler& sampler) const
+{
+	glm::vec3 light(0, 0, 0);
+
+	ForEachLightSample(point, surfaceNormal, sampler, [&](const Ray& shadowRay, float tMax, const glm::vec3& contribution)
+	{
+		if (!IsOccluded(shadowRay, tMax))
+		{
+			light += contribution;
+		}
+	});
+
+	return light * colour;
+}
+
+bool RayTracer::ContinuePath(const glm::vec3& point, const glm::vec3& surfaceNormal, const glm::vec3& colour, unsigned int bounce, glm::vec3& throughput, PixelSampler& sampler, Ray& ray) const
+{
+	// After the bounce's light samples, one for roulette and two for the direction
+	unsigned int firstDimension = bounce * GetSampleDimensions() + 3 * lightSamples;
+
+	if (bounce >= maxBounces)
+	{
+		return false;
+	}
+
+	// Bouncing in proportion to the cosine leaves just the albedo to carry on, the cosine and 1 / pi cancel with the chance of the direction
+	throughput *= colour;
+
+	if (bounce + 1 >= rouletteBounces)
+	{
+		float survival = glm::min(glm::max(throughput.r, glm::max(throughput.g, throughput.b)), 0.95f);
+
+		sampler.SetDimension(firstDimension);
+
+		if (sampler.Get1D() >= survival)
+		{
+			return false;
+		}
+
+		throughput /= survival;
+	}
+
+	if (throughput == glm::vec3(0.0f))
+	{
+		return false;
+	}
+
+	sampler.SetDimension(firstDimension + 1);
+
+	glm::vec2 u = sampler.Get2D();
+
+	ray = Ray(OffsetFromSurface(point, surfaceNormal), SampleCosineDirection(surfaceNormal, u.x, u.y));
+
+	return true;
+}
+
+
+void RayTracer::SetSimdLevel(SimdLevel level)
+{
+	intersectSpheres = SphereSoA::GetIntersectFunction(level);
+}
+
+
+void RayTracer::EnableStats(bool enable)
+{
+	collectStats = enable;
+
+	raysTraced = 0;
+	nodesVisited = 0;
+	primaryRays = 0;
+	secondaryRays = 0;
+	primaryNanoseconds = 0;
+	secondaryNanoseconds = 0;
+	shadowRays = 0;
+}
+
+void RayTracer::PrintStats()
+{
+	unsigned long long rays = raysTraced;
+	unsigned long long nodes = nodesVisited;
+
+	std::cout << "INFO: BVH build time: " << bvh.GetBuildTimeMs() << " ms (" << BVHBuilderName(bvhBuilder) << ")" << std::endl;
+	if (bvh.GetRefitTimeMs() > 0.0)
+	{
+		std::cout << "INFO: BVH refit time: " << bvh.GetRefitTimeMs() << " ms, SAH cost " << bvh.GetSahCostRatio() << " times what it was when built" << std::endl;
+	}
+
+	std::cout << "INFO: BVH node count: " << bvh.GetNodeCount() << " (" << bvh.GetNodeCount() * sizeof(BVHNode) / 1024 << " KB)" << std::endl;
+
+	if (rays > 0)
+	{
+		std::cout << "INFO: Average nodes visited per ray: " << (double)nodes / (double)rays << " over " << rays << " rays" << std::endl;
+	}
+
+	// Rates are per thread, from the time each thread spent on them, so they don't depend on how many threads there were
+	unsigned long long primary = primaryRays;
+	unsigned long long secondary = secondaryRays;
+
+	if (primary > 0)
+	{
+		std::cout << "INFO: Primary rays: " << primary << " at " << primary * 1000.0 / (double)primaryNanoseconds << " Mrays/s per thread" << std::endl;
+	}
+
+	if (secondary > 0)
+	{
+		std::cout << "INFO: Secondary rays: " << secondary << " at " << secondary * 1000.0 / (double)secondaryNanoseconds << " Mrays/s per thread";
+
+		if (primary > 0)
+		{
+			std::cout << ", " << (double)secondary / (double)primary << " a primary ray";
+		}
+
+		std::cout << std::endl;
+	}
+
+	unsigned long long shadow = shadowRays;
+
+	if (shadow > 0)
+	{
+		std::cout << "INFO: Shadow rays: " << shadow;
+
+		if (primary > 0)
+		{
+			std::cout << ", " << (double)shadow / (double)primary << " a primary ray";
+		}
+
+		std::cout << std::endl;
+	}
+}
@@ -3,28 +3,335 @@
 #include "GCP_GFX_Framework.h"
 #include "Sphere.h"
 #include "Ray.h"
+#include "BVH.h"
+#include "SphereSoA.h"
+#include "Mesh.h"
+#include "InstanceBVH.h"
+#include "SceneCache.h"
+#include "Material.h"
+#include "Light.h"
+#include "LightTree.h"
+#include "Sampling.h"
+#include "Sampler.h"
+#include "Trace.h"
+#include <atomic>
+#include <memory>
+#include <string>
 #include <vector>
 #include <iostream>
 
+// What a closest hit query found
+struct HitRecord
+{
+	// Distance along the ray, a query only looks for hits closer than this so it starts at FLT_MAX
+	float t = FLT_MAX;
+
+	// The sphere's index, or the triangle's index in its mesh's own order if instance is set, -1 if nothing was hit
+	int primitive = -1;
+
+	// The mesh instance hit, in the instance BVH's own order, or -1 for a sphere
+	int instance = -1;
+
+	// Weights of the triangle's second and third vertices, the first gets what's left, 0 for spheres
+	glm::vec2 barycentrics = glm::vec2(0.0f);
+};
+
 class RayTracer
 {
 	private:
 
-		std::vector<Sphere> listOfObjects;
+		// The scene cache the BVHs, sphere store and meshes are mapped from, if they came from one
+		std::unique_ptr<SceneCache::Reader> sceneCache;
+
+		// Every sphere's centre and radius in the order they were added, each one's id is its own index
+		SphereSoA spheres;
+
+		// Index into materials for each sphere
+		std::vector<unsigned int> sphereMaterials;
+
+		std::vector<Material> materials;
+
+		std::vector<Light> lights;
+
+		// The directional lights, which are shaded with every time, and a tree over the rest and the emissive spheres to pick from
+		std::vector<Light> directionalLights;
+
+		LightTree lightTree;
+
+		// Lights picked from the tree for each point shaded
+		unsigned int lightSamples = 1;
+
+		// Bounces a path can take after the camera ray, 0 shades only what the camera sees directly
+		unsigned int maxBounces = 0;
+
+		// Paths that have bounced this many times or more are ended at random, by how little light they still carry
+		unsigned int rouletteBounces = 3;
+
+		// Where paths get their random numbers, and how many paths TraceRays follows from each camera ray
+		SamplerType samplerType = SamplerType::Random;
+
+		unsigned int samplesPerPixel = 1;
+
+		// Camera rays TraceRays traces through the BVHs together as a packet, 0 or 1 traces each on its own
+		unsigned int primaryPacketSize = 0;
+
+		// Each mesh has its own BVH, shared by all of its instances
+		std::vector<Mesh> meshes;
+
+		// Where the meshes are placed, with a BVH over all of them that rays go through after the spheres
+		InstanceBVH meshInstances;
+
+		BVH bvh;
+
+		BVHBuilder bvhBuilder = BVHBuilder::SAH;
+
+		// Bounds of every sphere, kept between builds so refitting every frame doesn't allocate
+		std::vector<AABB> sphereBounds;
+
+		// RefitBVH builds the tree again once refitting has raised its SAH cost by this much
+		float rebuildCostRatio = 1.5f;
+
+		// Copy of the sphere centres and radii in BVH leaf order, so each leaf is one run of the arrays
+		SphereSoA sphereStore;
+
+		SphereSoA::IntersectFunction intersectSpheres;
+
+		void CalculateSphereBounds(ThreadPool* pool);
+
+		// Sorts the lights into directional ones and the light tree, adding a sphere light for every sphere with an emissive material
+		void BuildLights(ThreadPool* pool);
+
+		// Traversal counters, only updated while stats are switched on so normal renders don't fight over them
+		bool collectStats = false;
+
+		std::atomic<unsigned long long> raysTraced;
+
+		std::atomic<unsigned long long> nodesVisited;
+
+		// Rays from the camera and rays from bounces, with the time each thread spent finding what they hit
+		std::atomic<unsigned long long> primaryRays;
+
+		std::atomic<unsigned long long> secondaryRays;
+
+		std::atomic<unsigned long long> primaryNanoseconds;
+
+		std::atomic<unsigned long long> secondaryNanoseconds;
+
+		std::atomic<unsigned long long> shadowRays;
 
 	public:
 
-		RayTracer(std::vector<Sphere> _objects) : listOfObjects(_objects) 
+		// Takes the spheres as they are, so a scene loader can fill them in bulk rather than one sphere at a time
+		RayTracer(SphereSoA _spheres, std::vector<unsigned int> _sphereMaterials, std::vector<Material> _materials)
+			: spheres(std::move(_spheres)), sphereMaterials(std::move(_sphereMaterials)), materials(std::move(_materials)),
+			intersectSpheres(SphereSoA::GetIntersectFunction(DetectSimdLevel())), raysTraced(0), nodesVisited(0),
+			primaryRays(0), secondaryRays(0), primaryNanoseconds(0), secondaryNanoseconds(0), shadowRays(0)
 		{
-			std::cout << "RayTracer CTOR called" << std::endl;
+			GCP_TRACE("RayTracer CTOR called");
 		}
 
 		~RayTracer()
 		{
-			std::cout << "RayTracer DTOR called" << std::endl;
+			GCP_TRACE("RayTracer DTOR called");
+		}
+
+		// Meshes go alongside the spheres, add them before BuildBVH
+		// Adds a mesh drawn where it is, returns its index so more copies can be placed with AddInstance
+		unsigned int AddMesh(Mesh mesh);
+
+		// Adds a mesh that's only drawn where AddInstance places it
+		unsigned int AddSharedMesh(Mesh mesh);
+
+		// Places a copy of a mesh, every copy shares the mesh's triangles and BVH
+		void AddInstance(unsigned int meshIndex, const glm::mat4& transform) { meshInstances.AddInstance(meshIndex, transform); }
+
+		unsigned int GetMeshCount() const { return (unsigned int)meshes.size(); }
+
+		unsigned int GetInstanceCount() const { return meshInstances.GetInstanceCount(); }
+
+		// Lights every surface is shaded with, there are none to start with
+		// Set them before BuildBVH, which is where the light tree is built
+		void SetLights(std::vector<Light> _lights) { lights = std::move(_lights); }
+
+		// How many lights are picked from the light tree for each point shaded, more gives less noise for the cost of more shadow rays
+		void SetLightSamples(unsigned int samples) { lightSamples = glm::max(samples, 1u); }
+
+		const LightTree& GetLightTree() const { return lightTree; }
+
+		// How many times a path can bounce off surfaces after the camera ray, each bounce picking up the light the surface it reaches reflects
+		void SetMaxBounces(unsigned int bounces) { maxBounces = bounces; }
+
+		// Bounces after which Russian roulette can end a path, so long paths that carry little light stop early without biasing the image
+		void SetRouletteBounces(unsigned int bounces) { rouletteBounces = bounces; }
+
+		unsigned int GetMaxBounces() const { return maxBounces; }
+
+		// Chooses where paths get their random numbers, Random by default, Sobol and BlueNoise give less noise for the same samples
+		void SetSamplerType(SamplerType type) { samplerType = type; }
+
+		SamplerType GetSamplerType() const { return samplerType; }
+
+		// Paths TraceRays follows from each camera ray, each with the pixel's next sample index, averaged into the pixel's colour
+		void SetSamplesPerPixel(unsigned int samples) { samplesPerPixel = glm::max(samples, 1u); }
+
+		unsigned int GetSamplesPerPixel() const { return samplesPerPixel; }
+
+		// Sampler dimensions each bounce of a path has to itself, 3 per light sample from the tree and 3 for ContinuePath
+		unsigned int GetSampleDimensions() const { return 3 * lightSamples + 3; }
+
+		// Has TraceRays find the camera rays' hits in packets of this many consecutive rays, up to RayPacket::maxRays
+		// Packets only pay when their rays are close together, so the caller should hand TraceRays square blocks of pixels, 2 by 2 or 8 by 8
+		void SetPrimaryPacketSize(unsigned int size) { primaryPacketSize = glm::min(size, RayPacket::maxRays); }
+
+		// The most shadow rays ForEachLightSample makes for one point, one per directional light and the light samples from the tree
+		unsigned int GetMaxLightSamples() const { return (unsigned int)directionalLights.size() + (lightTree.GetLightCount() > 0 ? lightSamples : 0); }
+
+		// Builds the bounding volume hierarchy over the spheres, each mesh's own one, the one over the mesh instances and the light tree, call once the scene is set up
+		// Until then TraceRay tests every sphere
+		// Passing a pool spreads the build over its threads, which matters once there are millions of spheres
+		void BuildBVH(ThreadPool* pool = nullptr);
+
+		// Chooses how BuildBVH builds the tree, SAH by default
+		// The linear builders suit scenes that are rebuilt often, where build time matters more than trace time
+		void SetBVHBuilder(BVHBuilder builder) { bvhBuilder = builder; }
+
+		unsigned int GetSphereCount() const { return spheres.GetCount(); }
+
+		glm::vec3 GetSpherePosition(unsigned int index) const { return spheres.GetCentre(index); }
+
+		// Moves a sphere, the BVH doesn't see it until RefitBVH or BuildBVH is called
+		void SetSpherePosition(unsigned int index, glm::vec3 position) { spheres.Set(index, position, spheres.GetRadius(index)); }
+
+		// Brings the BVH up to date after spheres have moved, by refitting its bounds rather than building it again
+		// Builds it again instead if refitting has loosened it past the rebuild ratio, or it hasn't been built yet
+		// Only for moves, spheres can't be added or removed between BuildBVH and RefitBVH
+		void RefitBVH(ThreadPool* pool = nullptr);
+
+		void SetRebuildCostRatio(float ratio) { rebuildCostRatio = ratio; }
+
+		// Writes the spheres, meshes, instances and all of their BVHs to a scene cache, call after BuildBVH
+		// sourceHash is whatever the scene was made from, LoadCache only takes the cache back while it matches
+		bool SaveCache(const std::string& filename, unsigned long long sourceHash) const;
+
+		// Replaces the scene with one from a cache written by SaveCache, mapped and traced where it lies with nothing to build
+		// Returns false and leaves the scene alone if the cache is missing, out of date or was built with another BVH builder
+		// A cached scene can't be refitted, RefitBVH builds it again instead
+		bool LoadCache(const std::string& filename, unsigned long long sourceHash);
+
+		// Bounds of every sphere and mesh instance, once BuildBVH has been called
+		AABB GetBounds() const;
+
+		// Closest hit query, finds the closest sphere or triangle the ray hits before hit.t and fills in hit
+		// Returns false and leaves hit alone if there isn't one
+		bool Intersect(const Ray& ray, HitRecord& hit);
+
+		// Intersect for count rays at once, up to RayPacket::maxRays, traced through the BVHs together as a packet
+		// Each hit's t should be set to the ray's tMax beforehand, as it is by HitRecord's constructor
+		void IntersectPacket(const Ray* rays, unsigned int count, HitRecord* hits);
+
+		// Occlusion query for shadow rays, true if anything at all is hit before tMax
+		// Stops at the first hit it finds rather than the closest, and fills in nothing
+		bool IsOccluded(const Ray& ray, float tMax) const;
+
+		// World space surface normal at a hit from Intersect, facing out of spheres and the way mesh triangles wind anticlockwise
+		glm::vec3 GetNormal(const Ray& ray, const HitRecord& hit) const;
+
+		// GetNormal turned to face back along the ray, the side of the surface the ray sees
+		glm::vec3 GetFacingNormal(const Ray& ray, const HitRecord& hit) const;
+
+		// Colour of the surface at a hit from Intersect
+		glm::vec3 GetColour(const HitRecord& hit) const;
+
+		// Light the surface at a hit from Intersect gives off itself, only spheres can have any
+		glm::vec3 GetEmission(const HitRecord& hit) const;
+
+		glm::vec3 TraceRay(const Ray& ray);
+
+		// Path traces the camera rays of the pixels from min up to max into colours, a row at a time like Camera::GetRays, the way renderers should call it
+		// The pixels are only used to pick each path's random numbers, so anything that isn't a camera ray can be given any pixels that don't repeat
+		// Each pixel's colour is the average of samplesPerPixel paths from its camera ray, which differ only in their random numbers
+		// Paths are followed in batches held in a fixed size array on the calling thread's stack, one bounce of the whole batch at a time,
+		// so nothing recurses and nothing is allocated however many bounces there are
+		void TraceRays(const Ray* rays, glm::ivec2 min, glm::ivec2 max, glm::vec3* colours);
+
+		// Lambertian shading of a point on a surface of the given colour, with a shadow ray to every directional light
+		// and to a place on each light picked from the light tree, surfaceNormal should face the side the point is seen from
+		// sampler is the point's own, so the same point is always shaded the same way
+		glm::vec3 Shade(const glm::vec3& point, const glm::vec3& surfaceNormal, const glm::vec3& colour, PixelSampler& sampler) const;
+
+		// The shadow rays Shade traces, without tracing them, so they can be traced somewhere else
+		// Calls visit(shadowRay, tMax, contribution) for each one, contribution is the light it adds, before the surface colour, if nothing blocks it
+		// Draws 3 dimensions from the sampler for each light sample, starting at the one it's on, so paths set it to their bounce's first dimension beforehand
+		template<typename Visit> void ForEachLightSample(const glm::vec3& point, const glm::vec3& surfaceNormal, PixelSampler& sampler, Visit visit) const;
+
+		// Sets up the next ray of a path leaving a surface of the given colour at its bounce'th bounce, and scales throughput by what the surface reflects
+		// Returns false if the path ends here, because it has bounced as often as it can or Russian roulette ended it
+		// Draws from the last 3 of the bounce's sampler dimensions
+		bool ContinuePath(const glm::vec3& point, const glm::vec3& surfaceNormal, const glm::vec3& colour, unsigned int bounce, glm::vec3& throughput, PixelSampler& sampler, Ray& ray) const;
+
+		// Chooses which sphere intersection kernel the BVH leaves use, the best the CPU supports is picked by default
+		void SetSimdLevel(SimdLevel level);
+
+		// Turns the traversal counters on and resets them
+		void EnableStats(bool enable);
+
+		// Prints the BVH build time, node count and the average nodes visited per ray since EnableStats(true),
+		// then the primary and secondary rays traced and the rate each thread found their hits at
+		void PrintStats();
+
+
+};
+
+
+template<typename Visit> void RayTracer::ForEachLightSample(const glm::vec3& point, const glm::vec3& surfaceNormal, PixelSampler& sampler, Visit visit) const
+{
+	glm::vec3 origin = OffsetFromSurface(point, surfaceNormal);
+
+	for (const Light& source : directionalLights)
+	{
+		float cosine = glm::dot(-source.direction, surfaceNormal);
+
+		if (cosine > 0.0f)
+		{
+			visit(Ray(origin, -source.direction), FLT_MAX, cosine * source.colour);
 		}
+	}
+
+	if (lightTree.GetLightCount() == 0)
+	{
+		return;
+	}
 
-		glm::vec3 TraceRay(Ray ray);
+	unsigned int firstDimension = sampler.GetDimension();
 
+	for (unsigned int i = 0; i < lightSamples; i++)
+	{
+		sampler.SetDimension(firstDimension + 3 * i);
 
-};
\ No newline at end of file
+		float pdf = 0.0f;
+		int picked = lightTree.Sample(point, surfaceNormal, sampler.Get1D(), pdf);
+
+		// No light in the tree can reach the point, and that won't change for the next sample
+		if (picked < 0)
+		{
+			break;
+		}
+
+		glm::vec2 u = sampler.Get2D();
+
+		LightSample sample;
+
+		if (!lightTree.GetLight((unsigned int)picked).Sample(point, u, sample))
+		{
+			continue;
+		}
+
+		float cosine = glm::dot(sample.direction, surfaceNormal);
+
+		// Stopping a little short of the light keeps a sphere light's own surface from blocking it
+		if (cosine > 0.0f)
+		{
+			visit(Ray(origin, sample.direction), sample.distance * 0.999f, cosine * sample.colour / (pdf * (float)lightSamples));
+		}
+	}
+}
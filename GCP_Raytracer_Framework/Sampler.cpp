@@ -0,0 +1,157 @@
+#include "Sampler.h"
+
+#include <cmath>
+#include <vector>
+
+
+// Spread of the Gaussian each texel of the mask is blurred by, in texels, Ulichney's 1.5
+static const float blueNoiseSigma = 1.5f;
+
+// Fraction of the texels in the starting pattern that the rest are ranked around
+static const int blueNoiseStartDivisor = 10;
+
+// Ulichney's void and cluster, which ranks every texel so that any number of the lowest ranked ones are spread evenly over the tile
+// Each texel's energy is how close it is to the texels set so far, blurred with a Gaussian that wraps around the edges so the mask tiles
+static std::vector<unsigned int> BuildBlueNoiseMask()
+{
+	const int texelCount = blueNoiseSize * blueNoiseSize;
+
+	// Energy a set texel adds to one dx, dy away
+	std::vector<float> kernel(texelCount);
+
+	for (int dy = 0; dy < blueNoiseSize; ++dy)
+	{
+		for (int dx = 0; dx < blueNoiseSize; ++dx)
+		{
+			int x = glm::min(dx, blueNoiseSize - dx);
+			int y = glm::min(dy, blueNoiseSize - dy);
+
+			kernel[dy * blueNoiseSize + dx] = std::exp(-(float)(x * x + y * y) / (2.0f * blueNoiseSigma * blueNoiseSigma));
+		}
+	}
+
+	std::vector<float> energy(texelCount, 0.0f);
+	std::vector<unsigned char> set(texelCount, 0);
+
+	auto setTexel = [&](int texel, bool value)
+	{
+		int texelX = texel % blueNoiseSize;
+		int texelY = texel / blueNoiseSize;
+		float sign = value ? 1.0f : -1.0f;
+
+		set[texel] = value ? 1 : 0;
+
+		for (int y = 0; y < blueNoiseSize; ++y)
+		{
+			const float* kernelRow = &kernel[((y - texelY) & (blueNoiseSize - 1)) * blueNoiseSize];
+			float* energyRow = &energy[y * blueNoiseSize];
+
+			for (int x = 0; x < blueNoiseSize; ++x)
+			{
+				energyRow[x] += sign * kernelRow[(x - texelX) & (blueNoiseSize - 1)];
+			}
+		}
+	};
+
+	// The set texel with the most energy, the middle of the tightest cluster
+	auto tightestCluster = [&]()
+	{
+		int best = -1;
+
+		for (int texel = 0; texel < texelCount; ++texel)
+		{
+			best = set[texel] && (best < 0 || energy[texel] > energy[best]) ? texel : best;
+		}
+
+		return best;
+	};
+
+	// The unset texel with the least energy, the middle of the largest void
+	auto largestVoid = [&]()
+	{
+		int best = -1;
+
+		for (int texel = 0; texel < texelCount; ++texel)
+		{
+			best = !set[texel] && (best < 0 || energy[texel] < energy[best]) ? texel : best;
+		}
+
+		return best;
+	};
+
+	// A fixed seed, so the mask is the same every run
+	Pcg32 random(1234, 0);
+	int startCount = texelCount / blueNoiseStartDivisor;
+
+	for (int placed = 0; placed < startCount;)
+	{
+		int texel = (int)(random.NextUInt() % texelCount);
+
+		if (!set[texel])
+		{
+			setTexel(texel, true);
+			placed++;
+		}
+	}
+
+	// Moves the texel at the tightest cluster into the largest void until that would put it straight back, which leaves the pattern evenly spread
+	// Capped in case rounding leaves two texels swapping back and forth
+	for (int move = 0; move < texelCount; ++move)
+	{
+		int cluster = tightestCluster();
+
+		setTexel(cluster, false);
+
+		int emptiest = largestVoid();
+
+		setTexel(emptiest, true);
+
+		if (emptiest == cluster)
+		{
+			break;
+		}
+	}
+
+	std::vector<unsigned int> rank(texelCount);
+	std::vector<float> startEnergy = energy;
+	std::vector<unsigned char> startSet = set;
+
+	// The starting texels are ranked from the top down, taking away the tightest cluster each time
+	for (int next = startCount - 1; next >= 0; --next)
+	{
+		int cluster = tightestCluster();
+
+		rank[cluster] = (unsigned int)next;
+		setTexel(cluster, false);
+	}
+
+	// The rest from the starting pattern up, filling in the largest void each time
+	// With the same blur everywhere, the emptiest unset texel is also the one in the tightest cluster of unset texels, so this carries on to the last one
+	energy = startEnergy;
+	set = startSet;
+
+	for (int next = startCount; next < texelCount; ++next)
+	{
+		int emptiest = largestVoid();
+
+		rank[emptiest] = (unsigned int)next;
+		setTexel(emptiest, true);
+	}
+
+	// Each rank in the middle of its share of 0 to 1, as a 32 bit fraction
+	std::vector<unsigned int> mask(texelCount);
+
+	for (int texel = 0; texel < texelCount; ++texel)
+	{
+		mask[texel] = (unsigned int)(((2ull * rank[texel] + 1) << 31) / texelCount);
+	}
+
+	return mask;
+}
+
+const unsigned int* GetBlueNoiseMask()
+{
+	static const std::vector<unsigned int> mask = BuildBlueNoiseMask();
+
+	return mask.data();
+}
@@ -0,0 +1,243 @@
+#pragma once
+
+#include "GCP_GFX_Framework.h"
+
+// Random numbers for paths, from a small generator each path carries or from sequences that spread a pixel's samples out more evenly than random ones
+// What a path draws only depends on its pixel, its sample index and the dimension it draws from, never on the thread tracing it,
+// so there's no shared state to fight over and an image comes out the same whatever the thread count
+// Inline as they're used for every ray
+
+enum class SamplerType
+{
+	// PCG32, a stream per pixel seeded by the sample index
+	Random,
+
+	// Sobol points, shuffled and Owen scrambled with a hash of the pixel so neighbouring pixels aren't correlated
+	Sobol,
+
+	// Sobol points with their bits flipped by a blue noise mask tiled over the screen, so what error is left at a few samples per pixel is fine grained noise rather than clumps
+	// Flipping bits rather than adding keeps the points as evenly spread as Sobol's own
+	BlueNoise
+};
+
+// Mixes up the bits of x so numbers close together come out unrelated, Chris Wellons' lowbias32
+inline unsigned int HashUInt(unsigned int x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+
+	return x;
+}
+
+inline unsigned int HashCombine(unsigned int seed, unsigned int value)
+{
+	return HashUInt(seed ^ (value * 0x9e3779b9u));
+}
+
+// Number from 0 up to but not including 1, from the top 24 bits, as many as a float holds
+inline float ToUnitFloat(unsigned int bits)
+{
+	return (float)(bits >> 8) * (1.0f / 16777216.0f);
+}
+
+inline unsigned int ReverseBits(unsigned int x)
+{
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+	x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+	x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+	x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+
+	return x;
+}
+
+// Laine and Karras' permutation with Burley's constants, each bit is only changed by the bits below it
+inline unsigned int LaineKarrasPermutation(unsigned int x, unsigned int seed)
+{
+	x ^= x * 0x3d20adeau;
+	x += seed;
+	x *= (seed >> 16) | 1u;
+	x ^= x * 0x05526c56u;
+	x ^= x * 0x53a22864u;
+
+	return x;
+}
+
+// Owen scramble of a 32 bit fraction given with its bits reversed, each bit is flipped by a hash of the bits above it,
+// so points that were stratified stay stratified, the fraction comes back the right way round
+// Used on a sample index it shuffles the index within every power of 2 sized block instead, as the index's lowest bit is the fraction's highest
+inline unsigned int OwenScrambleReversed(unsigned int reversed, unsigned int seed)
+{
+	return ReverseBits(LaineKarrasPermutation(reversed, seed));
+}
+
+// The first two dimensions of the Sobol sequence as 32 bit fractions with their bits reversed, which is how Owen scrambling takes them
+// The first is the index itself, the van der Corput sequence, the second's generator matrix is Pascal's triangle mod 2,
+// where fraction bit i takes index bit j whenever j has every bit of i set, so rather than a step per index bit it's summed over supersets a bit of i at a time
+inline void Sobol2DReversed(unsigned int index, unsigned int& x, unsigned int& y)
+{
+	x = index;
+
+	index ^= (index >> 1) & 0x55555555u;
+	index ^= (index >> 2) & 0x33333333u;
+	index ^= (index >> 4) & 0x0f0f0f0fu;
+	index ^= (index >> 8) & 0x00ff00ffu;
+	index ^= (index >> 16) & 0x0000ffffu;
+
+	y = index;
+}
+
+// O'Neill's PCG32, 64 bits of state giving 32 bits at a time, each stream its own sequence that never runs into another's
+struct Pcg32
+{
+	unsigned long long state = 0;
+
+	// Odd, which stream the generator is on
+	unsigned long long increment = 1;
+
+	Pcg32() {}
+
+	Pcg32(unsigned long long seed, unsigned long long stream)
+		: increment((stream << 1) | 1u)
+	{
+		NextUInt();
+		state += seed;
+		NextUInt();
+	}
+
+	unsigned int NextUInt()
+	{
+		unsigned long long old = state;
+
+		state = old * 6364136223846793005ull + increment;
+
+		unsigned int xorShifted = (unsigned int)(((old >> 18) ^ old) >> 27);
+		unsigned int rotation = (unsigned int)(old >> 59);
+
+		return (xorShifted >> rotation) | (xorShifted << ((32 - rotation) & 31));
+	}
+
+	float NextFloat() { return ToUnitFloat(NextUInt()); }
+};
+
+// Width and height of the blue noise mask, which tiles
+static const int blueNoiseSize = 64;
+
+// A blueNoiseSize square of 32 bit fractions, a row at a time, each of blueNoiseSize * blueNoiseSize evenly spaced values used once
+// and placed by void and cluster so values close together are never near each other
+// Made the first time it's asked for, the same every time
+const unsigned int* GetBlueNoiseMask();
+
+// The numbers for one sample of one pixel, each path carries its own
+// A path's numbers come from dimensions, which are independent of each other, one for each Get1D and two for each Get2D
+// Paths should start each part of a bounce on the same dimension with SetDimension, so the same decision gets the same dimension in every pixel
+// and its samples are spread out over the pixel's sample indices, the Random sampler ignores dimensions and just carries on along its stream
+class PixelSampler
+{
+	private:
+
+		SamplerType type = SamplerType::Random;
+
+		glm::ivec2 pixel = glm::ivec2(0);
+
+		// Hash of the pixel, what decorrelates its numbers from every other pixel's
+		unsigned int pixelSeed = 0;
+
+		unsigned int sampleIndex = 0;
+
+		// Kept so shuffling it doesn't have to reverse it every time
+		unsigned int reversedIndex = 0;
+
+		unsigned int dimension = 0;
+
+		Pcg32 random;
+
+		const unsigned int* blueNoise = nullptr;
+
+		// The pixel's blue noise mask value for a dimension, read from further along the R2 sequence for each dimension so they're uncorrelated
+		unsigned int BlueNoiseBits(unsigned int index) const
+		{
+			unsigned int x = ((unsigned int)pixel.x + ((index * 0xc13fa9a9u) >> 26)) & (blueNoiseSize - 1);
+			unsigned int y = ((unsigned int)pixel.y + ((index * 0x91e10da5u) >> 26)) & (blueNoiseSize - 1);
+
+			return blueNoise[y * blueNoiseSize + x];
+		}
+
+	public:
+
+		PixelSampler() {}
+
+		// seed gives a whole image different numbers, such as a frame number for an animation
+		PixelSampler(SamplerType _type, glm::ivec2 _pixel, unsigned int _sampleIndex, unsigned int _seed = 0)
+			: type(_type), pixel(_pixel), pixelSeed(HashCombine(HashCombine(HashUInt(_seed), (unsigned int)_pixel.x), (unsigned int)_pixel.y)), sampleIndex(_sampleIndex),
+			reversedIndex(ReverseBits(_sampleIndex))
+		{
+			if (type == SamplerType::Random)
+			{
+				random = Pcg32(HashCombine(pixelSeed, sampleIndex), pixelSeed);
+			}
+			else if (type == SamplerType::BlueNoise)
+			{
+				blueNoise = GetBlueNoiseMask();
+			}
+		}
+
+		void SetDimension(unsigned int _dimension) { dimension = _dimension; }
+
+		unsigned int GetDimension() const { return dimension; }
+
+		// Number from 0 up to but not including 1
+		float Get1D()
+		{
+			unsigned int current = dimension++;
+
+			if (type == SamplerType::Random)
+			{
+				return random.NextFloat();
+			}
+
+			// Sobol scrambles and shuffles each pixel differently, blue noise the same everywhere so only the mask's bits differ between pixels
+			unsigned int dimensionSeed = type == SamplerType::Sobol ? HashCombine(pixelSeed, current) : HashUInt(current);
+			unsigned int shuffled = OwenScrambleReversed(reversedIndex, dimensionSeed);
+			unsigned int x = OwenScrambleReversed(shuffled, HashCombine(dimensionSeed, 1));
+
+			x ^= type == SamplerType::BlueNoise ? BlueNoiseBits(current) : 0;
+
+			return ToUnitFloat(x);
+		}
+
+		// Point in the unit square, from two dimensions that are stratified together
+		glm::vec2 Get2D()
+		{
+			unsigned int current = dimension;
+
+			dimension += 2;
+
+			if (type == SamplerType::Random)
+			{
+				float u1 = random.NextFloat();
+				float u2 = random.NextFloat();
+
+				return glm::vec2(u1, u2);
+			}
+
+			unsigned int dimensionSeed = type == SamplerType::Sobol ? HashCombine(pixelSeed, current) : HashUInt(current);
+			unsigned int x, y;
+
+			Sobol2DReversed(OwenScrambleReversed(reversedIndex, dimensionSeed), x, y);
+
+			x = OwenScrambleReversed(x, HashCombine(dimensionSeed, 1));
+			y = OwenScrambleReversed(y, HashCombine(dimensionSeed, 2));
+
+			if (type == SamplerType::BlueNoise)
+			{
+				x ^= BlueNoiseBits(current);
+				y ^= BlueNoiseBits(current + 1);
+			}
+
+			return glm::vec2(ToUnitFloat(x), ToUnitFloat(y));
+		}
+};
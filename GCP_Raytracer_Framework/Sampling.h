@@ -0,0 +1,36 @@
+#pragma once
+
+#include "GCP_GFX_Framework.h"
+#include "Ray.h"
+
+#include <GLM/gtc/constants.hpp>
+
+#include <cmath>
+
+// Directions and ray offsets shared by everything that follows paths, inline as they're used for every ray
+// The random numbers they're made from come from Sampler.h
+
+// Direction off a surface with the chance of each one going with the cosine to the normal, which is what a Lambertian surface reflects
+inline glm::vec3 SampleCosineDirection(const glm::vec3& normal, float u1, float u2)
+{
+	float radius = std::sqrt(u1);
+	float phi = 2.0f * glm::pi<float>() * u2;
+
+	glm::vec3 side = std::abs(normal.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+	glm::vec3 tangent = glm::normalize(glm::cross(side, normal));
+	glm::vec3 bitangent = glm::cross(normal, tangent);
+
+	float x = radius * std::cos(phi);
+	float y = radius * std::sin(phi);
+
+	return glm::normalize(x * tangent + y * bitangent + std::sqrt(glm::max(1.0f - u1, 0.0f)) * normal);
+}
+
+// Where a ray leaving a surface should start, a little way off it so it doesn't hit the surface again
+// The gap is bigger further from the origin, where floats are coarser
+inline glm::vec3 OffsetFromSurface(const glm::vec3& point, const glm::vec3& normal)
+{
+	float offset = 1e-4f * (1.0f + glm::max(glm::max(std::abs(point.x), std::abs(point.y)), std::abs(point.z)));
+
+	return point + normal * offset;
+}
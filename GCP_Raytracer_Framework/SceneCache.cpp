@@ -0,0 +1,215 @@
+#include "SceneCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+// Every array starts on a cache line, which is also enough for SIMD loads
+static const unsigned long long sectionAlignment = 64;
+
+static const char magic[8] = { 'G', 'C', 'P', 'S', 'C', 'E', 'N', 'E' };
+
+// Bytes of a file each task hashes
+static const size_t hashChunkBytes = 4 * 1024 * 1024;
+
+
+// Final mix of MurmurHash3, every bit of the input reaches every bit of the output
+static inline unsigned long long Mix(unsigned long long x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdull;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ull;
+	x ^= x >> 33;
+
+	return x;
+}
+
+unsigned long long SceneCache::HashBytes(const void* data, size_t size, unsigned long long seed)
+{
+	const unsigned long long prime = 0x9e3779b97f4a7c15ull;
+
+	const unsigned char* bytes = (const unsigned char*)data;
+
+	unsigned long long hash = seed ^ (size * prime);
+
+	// Eight bytes at a time
+	size_t i = 0;
+
+	for (; i + 8 <= size; i += 8)
+	{
+		unsigned long long word;
+		memcpy(&word, bytes + i, 8);
+
+		hash = (hash ^ Mix(word)) * prime;
+	}
+
+	unsigned long long tail = 0;
+
+	for (size_t shift = 0; i < size; i++, shift += 8)
+	{
+		tail |= (unsigned long long)bytes[i] << shift;
+	}
+
+	return Mix((hash ^ Mix(tail)) * prime);
+}
+
+bool SceneCache::HashFile(const std::string& filename, unsigned long long& hash, ThreadPool* pool)
+{
+	MappedFile file;
+
+	if (!file.Open(filename))
+	{
+		return false;
+	}
+
+	// Each chunk is hashed on its own and then the list of chunk hashes is hashed, so how the chunks are shared out doesn't matter
+
+	unsigned int chunkCount = (unsigned int)((file.GetSize() + hashChunkBytes - 1) / hashChunkBytes);
+
+	std::vector<unsigned long long> chunkHashes(chunkCount);
+
+	ParallelForChunks(pool, chunkCount, 1, [&](unsigned int chunk, unsigned int, unsigned int)
+	{
+		size_t start = chunk * hashChunkBytes;
+		size_t bytes = std::min(hashChunkBytes, file.GetSize() - start);
+
+		chunkHashes[chunk] = HashBytes(file.GetData() + start, bytes, chunk);
+
+		file.Release(start, bytes);
+	});
+
+	hash = HashBytes(chunkHashes.data(), chunkHashes.size() * sizeof(unsigned long long), file.GetSize());
+
+	return true;
+}
+
+
+bool SceneCache::Writer::Open(const std::string& filename)
+{
+	sections.clear();
+	offset = 0;
+
+	file.open(filename, std::ios::binary | std::ios::trunc);
+
+	if (!file)
+	{
+		return false;
+	}
+
+	// Room for the header, filled in by Finish
+	Header blank;
+	memset(&blank, 0, sizeof(blank));
+
+	file.write((const char*)&blank, sizeof(blank));
+	offset = sizeof(blank);
+
+	return true;
+}
+
+void SceneCache::Writer::WriteBytes(const void* data, size_t bytes)
+{
+	const char zeros[sectionAlignment] = {};
+
+	size_t paddingBytes = (size_t)((sectionAlignment - offset % sectionAlignment) % sectionAlignment);
+
+	file.write(zeros, paddingBytes);
+	offset += paddingBytes;
+
+	Section section;
+	section.offset = offset;
+	section.bytes = bytes;
+	sections.push_back(section);
+
+	file.write((const char*)data, bytes);
+	offset += bytes;
+}
+
+bool SceneCache::Writer::Finish(unsigned long long sourceHash)
+{
+	// The table goes through the same path as the arrays so it's aligned too
+	std::vector<Section> table = sections;
+
+	WriteBytes(table.data(), table.size() * sizeof(Section));
+
+	Header header;
+	memcpy(header.magic, magic, sizeof(magic));
+	header.version = version;
+	header.sectionCount = (unsigned int)table.size();
+	header.sourceHash = sourceHash;
+	header.fileBytes = offset;
+	header.sectionsOffset = sections.back().offset;
+
+	file.seekp(0);
+	file.write((const char*)&header, sizeof(header));
+	file.close();
+
+	return !file.fail();
+}
+
+
+bool SceneCache::Reader::Open(const std::string& filename, unsigned long long sourceHash)
+{
+	Close();
+
+	// Rays read the nodes and triangles in no particular order, and the pages they use should stay rather than be dropped as if they'd been passed
+	if (!file.Open(filename, FileAccess::Random))
+	{
+		return false;
+	}
+
+	const Header* header = (const Header*)file.GetData();
+
+	if (file.GetSize() < sizeof(Header) || memcmp(header->magic, magic, sizeof(magic)) != 0 || header->fileBytes != file.GetSize())
+	{
+		std::cerr << "WARNING: not a scene cache or not finished being written, ignoring it: " << filename << std::endl;
+		Close();
+		return false;
+	}
+
+	if (header->version != version)
+	{
+		std::cerr << "WARNING: scene cache is version " << header->version << " rather than " << version << ", ignoring it: " << filename << std::endl;
+		Close();
+		return false;
+	}
+
+	if (header->sourceHash != sourceHash)
+	{
+		std::cerr << "WARNING: scene cache was built from a different source, ignoring it: " << filename << std::endl;
+		Close();
+		return false;
+	}
+
+	if (header->sectionsOffset % sectionAlignment != 0 || header->sectionsOffset + (unsigned long long)header->sectionCount * sizeof(Section) > file.GetSize())
+	{
+		std::cerr << "WARNING: scene cache is damaged, ignoring it: " << filename << std::endl;
+		Close();
+		return false;
+	}
+
+	sections = (const Section*)(file.GetData() + header->sectionsOffset);
+	sectionCount = header->sectionCount;
+
+	for (unsigned int i = 0; i < sectionCount; i++)
+	{
+		if (sections[i].offset % sectionAlignment != 0 || sections[i].offset > header->sectionsOffset || sections[i].bytes > header->sectionsOffset - sections[i].offset)
+		{
+			std::cerr << "WARNING: scene cache is damaged, ignoring it: " << filename << std::endl;
+			Close();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void SceneCache::Reader::Close()
+{
+	file.Close();
+
+	sections = nullptr;
+	sectionCount = 0;
+	nextSection = 0;
+	failed = false;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Binary cache of a built scene, so later runs can map it and trace straight away rather than loading and building it again
+// The file is a header, then arrays of plain values one after another, each starting on a 64 byte boundary, then a table of where each array is
+// There are no pointers in it, only offsets from the start of the file, so it can be mapped anywhere and the arrays used where they lie
+// Arrays are written and read back in the same order, each class saving and mapping its own
+namespace SceneCache
+{
+	// Goes up whenever the layout of the file or of anything stored in it changes, so old caches are built again rather than misread
+	const unsigned int version = 3;
+
+	// Where an array is in the file
+	struct Section
+	{
+		unsigned long long offset;
+
+		unsigned long long bytes;
+	};
+
+	struct Header
+	{
+		char magic[8];
+
+		unsigned int version;
+
+		unsigned int sectionCount;
+
+		// Hash of the file the scene was built from, the cache is out of date once that changes
+		unsigned long long sourceHash;
+
+		// The whole file, a cache cut short while being written doesn't match
+		unsigned long long fileBytes;
+
+		// Where the section table starts
+		unsigned long long sectionsOffset;
+	};
+
+	// Hash of a block of memory, the same for the same bytes on every machine
+	unsigned long long HashBytes(const void* data, size_t size, unsigned long long seed = 0);
+
+	// Hash of a file's contents, worked out in fixed size chunks on the pool so big files don't hold up the start
+	// The hash doesn't depend on the number of threads, returns false if the file can't be read
+	bool HashFile(const std::string& filename, unsigned long long& hash, ThreadPool* pool = nullptr);
+
+	class Writer
+	{
+		private:
+
+			std::ofstream file;
+
+			std::vector<Section> sections;
+
+			unsigned long long offset = 0;
+
+			void WriteBytes(const void* data, size_t bytes);
+
+		public:
+
+			bool Open(const std::string& filename);
+
+			template<typename T> void Write(const T* data, size_t count)
+			{
+				static_assert(std::is_trivially_copyable<T>::value, "only plain values can go in a scene cache");
+
+				WriteBytes(data, count * sizeof(T));
+			}
+
+			template<typename T> void Write(const std::vector<T>& data)
+			{
+				Write(data.data(), data.size());
+			}
+
+			// Writes the section table and then the header, which is left blank until now so a file that wasn't finished never looks valid
+			bool Finish(unsigned long long sourceHash);
+	};
+
+	// Maps a cache and hands its arrays out in order, the arrays stay valid until the reader is closed or destroyed
+	class Reader
+	{
+		private:
+
+			MappedFile file;
+
+			const Section* sections = nullptr;
+
+			unsigned int sectionCount = 0;
+
+			unsigned int nextSection = 0;
+
+			bool failed = false;
+
+		public:
+
+			// Fails quietly if the file isn't there, and with a warning if it's from another version or a different source
+			bool Open(const std::string& filename, unsigned long long sourceHash);
+
+			void Close();
+
+			// The next array, with its length in count, or nullptr if it isn't there or isn't a whole number of T
+			template<typename T> const T* Read(size_t& count)
+			{
+				static_assert(std::is_trivially_copyable<T>::value, "only plain values can go in a scene cache");
+
+				if (failed || nextSection >= sectionCount || sections[nextSection].bytes % sizeof(T) != 0)
+				{
+					failed = true;
+					return nullptr;
+				}
+
+				const Section& section = sections[nextSection++];
+
+				count = (size_t)(section.bytes / sizeof(T));
+
+				return (const T*)(file.GetData() + section.offset);
+			}
+
+			// The next array when its length is already known, nullptr if it's some other length
+			template<typename T> const T* ReadExactly(size_t expectedCount)
+			{
+				size_t count = 0;
+				const T* data = Read<T>(count);
+
+				if (data != nullptr && count != expectedCount)
+				{
+					failed = true;
+					return nullptr;
+				}
+
+				return data;
+			}
+
+			// True once any read has failed, the rest of the cache can't be trusted after that
+			bool HasFailed() const { return failed; }
+	};
+}
@@ -0,0 +1,515 @@
+#include "SceneLoader.h"
+#include "MappedFile.h"
+#include "TextParsing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// Bytes of scene text a task parses at a time
+static const size_t sceneChunkBytes = 4 * 1024 * 1024;
+
+
+static const char* ParseVec3(const char* p, const char* end, glm::vec3& value)
+{
+	if ((p = ParseFloat(SkipSpaces(p, end), end, value.x)) == nullptr ||
+		(p = ParseFloat(SkipSpaces(p, end), end, value.y)) == nullptr ||
+		(p = ParseFloat(SkipSpaces(p, end), end, value.z)) == nullptr)
+	{
+		return nullptr;
+	}
+
+	return p;
+}
+
+// Positive integer, returns the character after it or nullptr if there isn't one
+static const char* ParseSize(const char* p, const char* end, int& value)
+{
+	long long parsed;
+
+	if ((p = ParseInteger(SkipSpaces(p, end), end, parsed)) == nullptr || parsed <= 0 || parsed > INT_MAX)
+	{
+		return nullptr;
+	}
+
+	value = (int)parsed;
+
+	return p;
+}
+
+// Integer that can be 0, returns the character after it or nullptr if there isn't one
+static const char* ParseCount(const char* p, const char* end, int& value)
+{
+	long long parsed;
+
+	if ((p = ParseInteger(SkipSpaces(p, end), end, parsed)) == nullptr || parsed < 0 || parsed > INT_MAX)
+	{
+		return nullptr;
+	}
+
+	value = (int)parsed;
+
+	return p;
+}
+
+static bool IsName(const std::string& name, const char* p, const char* nameEnd)
+{
+	return name.compare(0, std::string::npos, p, nameEnd - p) == 0;
+}
+
+// Binary search of the material names, order holds the material indices sorted by name
+// Returns -1 if there isn't one with the name
+static int FindMaterial(const Scene& scene, const std::vector<unsigned int>& order, const char* p, const char* nameEnd)
+{
+	auto found = std::lower_bound(order.begin(), order.end(), 0u, [&](unsigned int index, unsigned int)
+	{
+		return scene.materialNames[index].compare(0, std::string::npos, p, nameEnd - p) < 0;
+	});
+
+	if (found == order.end() || !IsName(scene.materialNames[*found], p, nameEnd))
+	{
+		return -1;
+	}
+
+	return (int)*found;
+}
+
+
+// A run of whole lines and what it holds
+struct SceneChunk
+{
+	const char* start;
+
+	const char* end;
+
+	unsigned long long sphereCount = 0;
+
+	// Where in the scene this chunk's spheres go
+	unsigned long long firstSphere = 0;
+
+	// Every line that isn't a sphere, a comment or blank, there are few enough of these to read one at a time afterwards
+	std::vector<const char*> otherLines;
+
+	// The first line that couldn't be read, if any
+	const char* badLine = nullptr;
+};
+
+bool SceneLoader::Load(const std::string& filename, Scene& scene, ThreadPool* pool)
+{
+	auto startTime = std::chrono::steady_clock::now();
+
+	MappedFile file;
+
+	if (!file.Open(filename))
+	{
+		std::cerr << "ERROR: could not open scene file: " << filename << std::endl;
+		return false;
+	}
+
+	const char* data = file.GetData();
+	const char* dataEnd = data + file.GetSize();
+
+	auto reportBadLine = [&](const char* line)
+	{
+		std::cerr << "ERROR: could not read line " << std::count(data, line, '\n') + 1 << " of scene file: " << filename << std::endl;
+	};
+
+	// Filled in here and only handed over once the whole file has been read, so a bad file leaves the scene as it was
+	Scene loaded;
+
+	loaded.materials.push_back(Material());
+	loaded.materialNames.push_back("default");
+
+	// Split into chunks of about the same size, each starting on a new line
+
+	std::vector<const char*> boundaries = SplitLines(data, dataEnd, sceneChunkBytes);
+
+	std::vector<SceneChunk> chunks(boundaries.size() - 1);
+
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		chunks[i].start = boundaries[i];
+		chunks[i].end = boundaries[i + 1];
+	}
+
+	// First pass counts the spheres in each chunk, so every chunk knows where its own go, and picks out the other lines
+
+	ParallelForChunks(pool, (unsigned int)chunks.size(), 1, [&](unsigned int chunkIndex, unsigned int, unsigned int)
+	{
+		SceneChunk& chunk = chunks[chunkIndex];
+
+		for (const char* p = chunk.start; p < chunk.end; p = SkipLine(p, chunk.end))
+		{
+			p = SkipSpaces(p, chunk.end);
+
+			if (IsWord(p, chunk.end, "sphere"))
+			{
+				chunk.sphereCount++;
+			}
+			else if (!IsLineEnd(p, chunk.end))
+			{
+				chunk.otherLines.push_back(p);
+			}
+		}
+	});
+
+	unsigned long long sphereCount = 0;
+
+	for (SceneChunk& chunk : chunks)
+	{
+		chunk.firstSphere = sphereCount;
+		sphereCount += chunk.sphereCount;
+	}
+
+	if (sphereCount > UINT_MAX - SphereSoA::padding)
+	{
+		std::cerr << "ERROR: too many spheres for one scene: " << filename << std::endl;
+		return false;
+	}
+
+	std::vector<const char*> otherLines;
+
+	for (const SceneChunk& chunk : chunks)
+	{
+		otherLines.insert(otherLines.end(), chunk.otherLines.begin(), chunk.otherLines.end());
+	}
+
+	// Materials go first, so anything can name one however far down the file it is
+
+	for (const char* line : otherLines)
+	{
+		if (!IsWord(line, dataEnd, "material"))
+		{
+			continue;
+		}
+
+		const char* name = SkipSpaces(line + strlen("material"), dataEnd);
+		const char* nameEnd = SkipName(name, dataEnd);
+
+		Material material;
+
+		const char* p = name != nameEnd ? ParseVec3(nameEnd, dataEnd, material.colour) : nullptr;
+
+		if (p != nullptr && IsWord(SkipSpaces(p, dataEnd), dataEnd, "emit"))
+		{
+			p = ParseVec3(SkipSpaces(p, dataEnd) + strlen("emit"), dataEnd, material.emission);
+		}
+
+		if (p == nullptr || !IsLineEnd(p, dataEnd))
+		{
+			reportBadLine(line);
+			return false;
+		}
+
+		if (IsName(loaded.materialNames[0], name, nameEnd))
+		{
+			loaded.materials[0] = material;
+		}
+		else
+		{
+			loaded.materials.push_back(material);
+			loaded.materialNames.push_back(std::string(name, nameEnd));
+		}
+	}
+
+	std::vector<unsigned int> materialOrder(loaded.materials.size());
+
+	for (unsigned int i = 0; i < (unsigned int)materialOrder.size(); i++)
+	{
+		materialOrder[i] = i;
+	}
+
+	std::sort(materialOrder.begin(), materialOrder.end(), [&](unsigned int a, unsigned int b)
+	{
+		return loaded.materialNames[a] < loaded.materialNames[b];
+	});
+
+	for (size_t i = 1; i < materialOrder.size(); i++)
+	{
+		if (loaded.materialNames[materialOrder[i]] == loaded.materialNames[materialOrder[i - 1]])
+		{
+			std::cerr << "ERROR: material " << loaded.materialNames[materialOrder[i]] << " is named twice in scene file: " << filename << std::endl;
+			return false;
+		}
+	}
+
+	// Then everything else that isn't a sphere, in file order
+
+	size_t slash = filename.find_last_of("/\\");
+	std::string folder = slash == std::string::npos ? "" : filename.substr(0, slash + 1);
+
+	for (const char* line : otherLines)
+	{
+		const char* p = nullptr;
+
+		if (IsWord(line, dataEnd, "material"))
+		{
+			continue;
+		}
+		else if (IsWord(line, dataEnd, "size"))
+		{
+			if ((p = ParseSize(line + strlen("size"), dataEnd, loaded.size.x)) != nullptr)
+			{
+				p = ParseSize(p, dataEnd, loaded.size.y);
+			}
+		}
+		else if (IsWord(line, dataEnd, "tile"))
+		{
+			p = ParseSize(line + strlen("tile"), dataEnd, loaded.tileSize);
+		}
+		else if (IsWord(line, dataEnd, "lightsamples"))
+		{
+			p = ParseSize(line + strlen("lightsamples"), dataEnd, loaded.lightSamples);
+		}
+		else if (IsWord(line, dataEnd, "bounces"))
+		{
+			p = ParseCount(line + strlen("bounces"), dataEnd, loaded.bounces);
+		}
+		else if (IsWord(line, dataEnd, "roulette"))
+		{
+			p = ParseCount(line + strlen("roulette"), dataEnd, loaded.rouletteBounces);
+		}
+		else if (IsWord(line, dataEnd, "samples"))
+		{
+			p = ParseSize(line + strlen("samples"), dataEnd, loaded.samples);
+		}
+		else if (IsWord(line, dataEnd, "sampler"))
+		{
+			p = SkipSpaces(line + strlen("sampler"), dataEnd);
+
+			if (IsWord(p, dataEnd, "random"))
+			{
+				loaded.sampler = SamplerType::Random;
+			}
+			else if (IsWord(p, dataEnd, "sobol"))
+			{
+				loaded.sampler = SamplerType::Sobol;
+			}
+			else if (IsWord(p, dataEnd, "bluenoise"))
+			{
+				loaded.sampler = SamplerType::BlueNoise;
+			}
+			else
+			{
+				p = nullptr;
+			}
+
+			p = p != nullptr ? SkipName(p, dataEnd) : nullptr;
+		}
+		else if (IsWord(line, dataEnd, "builder"))
+		{
+			p = SkipSpaces(line + strlen("builder"), dataEnd);
+
+			if (IsWord(p, dataEnd, "sah"))
+			{
+				loaded.builder = BVHBuilder::SAH;
+			}
+			else if (IsWord(p, dataEnd, "lbvh"))
+			{
+				loaded.builder = BVHBuilder::Linear30;
+			}
+			else if (IsWord(p, dataEnd, "lbvh63"))
+			{
+				loaded.builder = BVHBuilder::Linear63;
+			}
+			else
+			{
+				p = nullptr;
+			}
+
+			p = p != nullptr ? SkipName(p, dataEnd) : nullptr;
+		}
+		else if (IsWord(line, dataEnd, "camera"))
+		{
+			SceneCamera& camera = loaded.camera;
+
+			if ((p = ParseVec3(line + strlen("camera"), dataEnd, camera.position)) != nullptr &&
+				(p = ParseVec3(p, dataEnd, camera.target)) != nullptr &&
+				(p = ParseFloat(SkipSpaces(p, dataEnd), dataEnd, camera.fieldOfView)) != nullptr)
+			{
+				// Looking straight at its own position, or with a field of view it can't have, leaves the camera with no direction
+				if (camera.position == camera.target || camera.fieldOfView <= 0.0f || camera.fieldOfView >= 180.0f)
+				{
+					p = nullptr;
+				}
+			}
+		}
+		else if (IsWord(line, dataEnd, "light"))
+		{
+			Light light;
+
+			p = SkipSpaces(line + strlen("light"), dataEnd);
+
+			if (IsWord(p, dataEnd, "point"))
+			{
+				light.type = LightType::Point;
+				p = ParseVec3(p + strlen("point"), dataEnd, light.position);
+			}
+			else if (IsWord(p, dataEnd, "directional"))
+			{
+				light.type = LightType::Directional;
+				p = ParseVec3(p + strlen("directional"), dataEnd, light.direction);
+
+				if (p != nullptr && glm::dot(light.direction, light.direction) > 0.0f)
+				{
+					light.direction = glm::normalize(light.direction);
+				}
+				else
+				{
+					p = nullptr;
+				}
+			}
+			else if (IsWord(p, dataEnd, "area"))
+			{
+				light.type = LightType::Area;
+
+				if ((p = ParseVec3(p + strlen("area"), dataEnd, light.position)) != nullptr &&
+					(p = ParseVec3(p, dataEnd, light.edgeU)) != nullptr)
+				{
+					p = ParseVec3(p, dataEnd, light.edgeV);
+				}
+
+				// Edges along the same line make a rectangle with no area
+				if (p != nullptr && glm::dot(glm::cross(light.edgeU, light.edgeV), glm::cross(light.edgeU, light.edgeV)) <= 0.0f)
+				{
+					p = nullptr;
+				}
+			}
+			else
+			{
+				p = nullptr;
+			}
+
+			if (p != nullptr && (p = ParseVec3(p, dataEnd, light.colour)) != nullptr)
+			{
+				loaded.lights.push_back(light);
+			}
+		}
+		else if (IsWord(line, dataEnd, "mesh"))
+		{
+			const char* name = SkipSpaces(line + strlen("mesh"), dataEnd);
+			const char* nameEnd = SkipName(name, dataEnd);
+
+			SceneMesh mesh;
+
+			p = name != nameEnd ? nameEnd : nullptr;
+
+			if (p != nullptr)
+			{
+				mesh.filename = std::string(name, nameEnd);
+
+				// Paths from the root or a drive stay as they are
+				if (*name != '/' && *name != '\\' && !(nameEnd - name > 1 && name[1] == ':'))
+				{
+					mesh.filename = folder + mesh.filename;
+				}
+
+				const char* material = SkipSpaces(p, dataEnd);
+				const char* materialEnd = SkipName(material, dataEnd);
+
+				if (material != materialEnd)
+				{
+					int index = FindMaterial(loaded, materialOrder, material, materialEnd);
+
+					mesh.material = index >= 0 ? (unsigned int)index : 0;
+					p = index >= 0 ? materialEnd : nullptr;
+				}
+			}
+
+			if (p != nullptr)
+			{
+				loaded.meshes.push_back(mesh);
+			}
+		}
+
+		if (p == nullptr || !IsLineEnd(p, dataEnd))
+		{
+			reportBadLine(line);
+			return false;
+		}
+	}
+
+	// Second pass parses the spheres straight into the store, only looking up materials by name
+
+	loaded.spheres.Resize((unsigned int)sphereCount);
+	loaded.sphereMaterials.resize((size_t)sphereCount);
+
+	float* centreX = loaded.spheres.GetCentreX();
+	float* centreY = loaded.spheres.GetCentreY();
+	float* centreZ = loaded.spheres.GetCentreZ();
+	float* radii = loaded.spheres.GetRadii();
+	unsigned int* ids = loaded.spheres.GetIds();
+	unsigned int* sphereMaterials = loaded.sphereMaterials.data();
+
+	ParallelForChunks(pool, (unsigned int)chunks.size(), 1, [&](unsigned int chunkIndex, unsigned int, unsigned int)
+	{
+		SceneChunk& chunk = chunks[chunkIndex];
+
+		unsigned int sphere = (unsigned int)chunk.firstSphere;
+
+		for (const char* p = chunk.start; p < chunk.end; p = SkipLine(p, chunk.end))
+		{
+			p = SkipSpaces(p, chunk.end);
+
+			if (!IsWord(p, chunk.end, "sphere"))
+			{
+				continue;
+			}
+
+			const char* line = p;
+
+			glm::vec3 centre;
+			float radius;
+
+			if ((p = ParseVec3(p + strlen("sphere"), chunk.end, centre)) == nullptr ||
+				(p = ParseFloat(SkipSpaces(p, chunk.end), chunk.end, radius)) == nullptr || radius <= 0.0f)
+			{
+				chunk.badLine = line;
+				break;
+			}
+
+			const char* material = SkipSpaces(p, chunk.end);
+			const char* materialEnd = SkipName(material, chunk.end);
+
+			int materialIndex = material != materialEnd ? FindMaterial(loaded, materialOrder, material, materialEnd) : 0;
+
+			if (materialIndex < 0 || !IsLineEnd(materialEnd, chunk.end))
+			{
+				chunk.badLine = line;
+				break;
+			}
+
+			centreX[sphere] = centre.x;
+			centreY[sphere] = centre.y;
+			centreZ[sphere] = centre.z;
+			radii[sphere] = radius;
+			ids[sphere] = sphere;
+			sphereMaterials[sphere] = (unsigned int)materialIndex;
+			sphere++;
+		}
+
+		file.Release(chunk.start - data, chunk.end - chunk.start);
+	});
+
+	for (const SceneChunk& chunk : chunks)
+	{
+		if (chunk.badLine != nullptr)
+		{
+			reportBadLine(chunk.badLine);
+			return false;
+		}
+	}
+
+	scene = std::move(loaded);
+
+	double loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+	std::cout << "INFO: Loaded scene " << filename << ", " << scene.spheres.GetCount() << " spheres, " << scene.materials.size() << " materials, "
+		<< scene.lights.size() << " lights and " << scene.meshes.size() << " meshes in " << loadMs << " ms, "
+		<< file.GetSize() / (1024.0 * 1024.0) / (loadMs / 1000.0) << " MB/s" << std::endl;
+
+	return true;
+}
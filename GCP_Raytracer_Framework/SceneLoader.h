@@ -0,0 +1,102 @@
+#pragma once
+
+#include "GCP_GFX_Framework.h"
+#include "SphereSoA.h"
+#include "Material.h"
+#include "Light.h"
+#include "BVH.h"
+#include "Sampler.h"
+#include "ThreadPool.h"
+
+#include <string>
+#include <vector>
+
+// Where a scene is looked at from, looking down -z from the origin if the file doesn't say
+struct SceneCamera
+{
+	glm::vec3 position = glm::vec3(0.0f);
+
+	glm::vec3 target = glm::vec3(0.0f, 0.0f, -1.0f);
+
+	glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f);
+
+	// Vertical field of view in degrees
+	float fieldOfView = 60.0f;
+};
+
+// A mesh file the scene draws, loaded with MeshLoader
+struct SceneMesh
+{
+	// Relative paths in a scene file are from the scene file's folder, this is the path from the working directory
+	std::string filename;
+
+	unsigned int material = 0;
+};
+
+// Everything a scene file describes
+struct Scene
+{
+	// Centres and radii in file order, each sphere's id is its own index
+	SphereSoA spheres;
+
+	// Index into materials for each sphere
+	std::vector<unsigned int> sphereMaterials;
+
+	// Material 0 is plain white and named "default", it's what anything that doesn't name a material gets
+	std::vector<Material> materials;
+
+	std::vector<std::string> materialNames;
+
+	std::vector<Light> lights;
+
+	std::vector<SceneMesh> meshes;
+
+	SceneCamera camera;
+
+	// Render settings, with the values used when the file doesn't give them
+	glm::ivec2 size = glm::ivec2(640, 480);
+
+	int tileSize = 32;
+
+	// Lights picked from the light tree for each point shaded
+	int lightSamples = 1;
+
+	// Bounces a path takes after the camera ray, and the bounce Russian roulette starts at
+	int bounces = 0;
+
+	int rouletteBounces = 3;
+
+	// Paths traced through each pixel and where they get their random numbers
+	int samples = 1;
+
+	SamplerType sampler = SamplerType::Random;
+
+	BVHBuilder builder = BVHBuilder::SAH;
+};
+
+// Reads text scene files, one thing per line:
+//   size W H                               window or image size in pixels
+//   tile N                                 tile size in pixels
+//   builder sah|lbvh|lbvh63                how the BVH is built
+//   camera px py pz tx ty tz fov           position, the point it looks at and the vertical field of view in degrees
+//   lightsamples N                         lights picked from the light tree for each point shaded
+//   bounces N                              bounces each path takes after the camera ray, 0 only lights what the camera sees
+//   roulette N                             bounces after which Russian roulette can end a path early
+//   samples N                              paths traced through each pixel and averaged
+//   sampler random|sobol|bluenoise         where paths get their random numbers
+//   material name r g b [emit r g b]       a named colour, naming "default" changes the colour of material 0
+//                                          spheres with an emissive material are lights as well
+//   light point x y z r g b                a light at a position
+//   light directional dx dy dz r g b       a light that shines the same way everywhere
+//   light area x y z ux uy uz vx vy vz r g b
+//                                          a one sided rectangle from a corner along two edges, shining out of the side they wind anticlockwise on
+//   sphere x y z radius [material]
+//   mesh file [material]                   an OBJ or PLY file
+// Anything after a # is a comment, and materials can be named before or after the lines that use them
+namespace SceneLoader
+{
+	// The file is mapped and split into chunks, spheres are counted in parallel and then parsed in parallel straight into the scene's SphereSoA,
+	// so nothing is allocated per sphere and the time taken grows linearly with the number of spheres
+	// Every other line is read in file order once all the spheres are counted
+	bool Load(const std::string& filename, Scene& scene, ThreadPool* pool = nullptr);
+}
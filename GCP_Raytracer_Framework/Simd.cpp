@@ -0,0 +1,33 @@
+
+#include "Simd.h"
+
+#include <SDL/SDL.h>
+
+
+SimdLevel DetectSimdLevel()
+{
+	if (SDL_HasAVX2())
+	{
+		return SimdLevel::AVX2;
+	}
+
+	if (SDL_HasSSE41())
+	{
+		return SimdLevel::SSE41;
+	}
+
+	return SimdLevel::Scalar;
+}
+
+const char* SimdLevelName(SimdLevel level)
+{
+	switch (level)
+	{
+	case SimdLevel::AVX2:
+		return "AVX2";
+	case SimdLevel::SSE41:
+		return "SSE4.1";
+	default:
+		return "scalar";
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <immintrin.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+	#include <intrin.h>
+#endif
+
+// MSVC lets any function use any instruction set's intrinsics
+// GCC and Clang need to be told per function, so the rest of the program can still run on older CPUs
+#if defined(_MSC_VER) && !defined(__clang__)
+	#define SIMD_TARGET_SSE41
+	#define SIMD_TARGET_AVX2
+	#define SIMD_TARGET_F16C
+#else
+	#define SIMD_TARGET_SSE41 __attribute__((target("sse4.1")))
+	#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+	#define SIMD_TARGET_F16C __attribute__((target("avx2,f16c")))
+#endif
+
+// Instruction sets we have code paths for, best last
+enum class SimdLevel
+{
+	Scalar,
+	SSE41,
+	AVX2
+};
+
+// Best level this CPU supports, checked through SDL's CPU info
+SimdLevel DetectSimdLevel();
+
+const char* SimdLevelName(SimdLevel level);
+
+// Index of the lowest set bit, mask must not be 0
+inline int FirstSetBit(unsigned int mask)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (int)index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+// Index of the lowest set bit of a 64 bit mask, mask must not be 0
+inline int FirstSetBit64(unsigned long long mask)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	unsigned long index;
+	_BitScanForward64(&index, mask);
+	return (int)index;
+#else
+	return __builtin_ctzll(mask);
+#endif
+}
+
+// Number of set bits, without needing the POPCNT instruction
+inline int CountSetBits64(unsigned long long value)
+{
+	int count = 0;
+
+	for (; value != 0; value &= value - 1)
+	{
+		count++;
+	}
+
+	return count;
+}
+
+// Number of zero bits above the highest set bit, value must not be 0
+inline int LeadingZeros64(unsigned long long value)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return 63 - (int)index;
+#else
+	return __builtin_clzll(value);
+#endif
+}
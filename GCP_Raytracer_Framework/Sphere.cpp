@@ -2,54 +2,58 @@
 #include "Sphere.h"
 
 
-RayIntersection Sphere::RayIntersect(Ray ray) //FINDS THE CLOSEST POINT OF INTERSECTION 
+RayIntersection Sphere::RayIntersect(const Ray& ray) const //FINDS THE CLOSEST POINT OF INTERSECTION 
 {
 	RayIntersection rayIntersect;
+	rayIntersect.m_isIntersection = false;
+
+	glm::vec3 toCentre = position - ray.origin;
+
+	float radiusSquared = radius * radius;
+
 	//Check if the ray origin is inside the sphere
 
-	if ((ray.origin.x < position.x + radius && ray.origin.x > position.x - radius) && (ray.origin.y < position.y + radius && ray.origin.y > position.y - radius))
-	{
-		rayIntersect.m_isIntersection = false;
+	float centreDistanceSquared = glm::dot(toCentre, toCentre);
 
+	if (centreDistanceSquared < radiusSquared)
+	{
 		return rayIntersect;
 	}
 
-	//Calculate d
-
-	glm::vec3 d = sqrt(position - ray.origin - (glm::dot((position - ray.origin), ray.direction) * ray.direction));
+	//Check if the sphere is in front or behind the rays origin, if (p-a).n is negative it is behind
 
-	//Calculate x
+	float projection = glm::dot(toCentre, ray.direction);
 
-	glm::vec3 x = sqrt(radius * radius - d * d);
+	if (projection < 0.0f)
+	{
+		return rayIntersect;
+	}
 
-	//Calculate Closest Intersection
-	
-	glm::vec3 closestIntersection = ray.origin + ((glm::dot(position - ray.origin, ray.direction) - x) * ray.direction);
+	//Calculate d, the shortest distance from the sphere centre to the ray (kept squared to save a sqrt)
 
-	//Check if intersection is in front or behind the rays origin 
+	float dSquared = centreDistanceSquared - projection * projection;
 
-	if (closestIntersection.x < ray.origin.x)
+	if (dSquared > radiusSquared)
 	{
-		// if (p-a).n) is negative
-
-		if (glm::dot((position - ray.origin), ray.direction) < 0)
-		{
-			rayIntersect.m_isIntersection = false;
-			return rayIntersect;
-		}
+		return rayIntersect;
 	}
 
-	//IF THERE IS AN INTERSECTION
+	//Calculate x, the distance from the closest intersection to the point nearest the centre
+
+	float x = sqrtf(radiusSquared - dSquared);
+
+	//IF THERE IS AN INTERSECTION, calculate the closest one
 
 	rayIntersect.m_isIntersection = true;
-	rayIntersect.m_closestIntersection = closestIntersection;
+	rayIntersect.m_distance = projection - x;
+	rayIntersect.m_closestIntersection = ray.origin + rayIntersect.m_distance * ray.direction;
 
 	return rayIntersect;
 
 }
 
 
-glm::vec3 Sphere :: GetNormal(glm::vec3 point)
+glm::vec3 Sphere :: GetNormal(const glm::vec3& point) const
 {
 	//Find vector between the point on the sphere and its centre
 	glm::vec3 normal = point - position;
@@ -60,18 +64,3 @@ glm::vec3 Sphere :: GetNormal(glm::vec3 point)
 
 	return normal;
 }
-
-
-glm::vec3 Sphere :: Shade(glm::vec3 intersection)
-{
-	glm::vec3 surfaceNormal = GetNormal(intersection);
-
-	glm::vec3 distantLight = glm::vec3(1,1,1);
-
-	glm::vec3 lightColour = glm::vec3(0, 0, 0);
-
-
-	glm::vec3 light = (glm::dot(distantLight, surfaceNormal) * lightColour * colour);
-
-	return light;
-}
@@ -2,14 +2,18 @@
 
 #include "GCP_GFX_Framework.h"
 #include "Ray.h"
+#include "Trace.h"
 
-#include <iostream>
+#include <type_traits>
 
 struct RayIntersection
 {
 	bool m_isIntersection;
 
 	glm::vec3 m_closestIntersection;
+
+	// How far along the ray the intersection is
+	float m_distance;
 };
 
 class Sphere
@@ -26,19 +30,24 @@ class Sphere
 
 		Sphere(glm::vec3 _pos, float _radius, glm::vec3 _colour) : position(_pos), radius(_radius), colour(_colour)
 		{
-			std::cout << "Sphere CTOR called" << std::endl;
+			GCP_TRACE("Sphere CTOR called");
 		}
 
-		~Sphere()
-		{
-			std::cout << "Sphere DTOR called" << std::endl;
-		}
+		// Scalar reference version, the SphereSoA kernels must give the same answers
+		// Expects a normalised ray direction
+		RayIntersection RayIntersect(const Ray& ray) const;
 
-		RayIntersection RayIntersect(Ray ray);
+		glm::vec3 GetNormal(const glm::vec3& point) const;
 
-		glm::vec3 Shade(glm::vec3 intersection);
+		glm::vec3 GetPosition() const { return position; }
 
-		glm::vec3 GetNormal(glm::vec3 point);
+		void SetPosition(glm::vec3 _pos) { position = _pos; }
+
+		float GetRadius() const { return radius; }
+
+		glm::vec3 GetColour() const { return colour; }
 		
 
 };
+
+static_assert(std::is_trivially_copyable<Sphere>::value, "Sphere should be trivially copyable");
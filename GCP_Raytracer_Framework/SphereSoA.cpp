@@ -0,0 +1,399 @@
+
+#include "SphereSoA.h"
+
+#include <cfloat>
+#include <cmath>
+
+
+void SphereSoA::Clear()
+{
+	centreX.assign(padding, 0.0f);
+	centreY.assign(padding, 0.0f);
+	centreZ.assign(padding, 0.0f);
+	radius.assign(padding, 0.0f);
+	ids.clear();
+
+	mappedCentreX = nullptr;
+	mappedCentreY = nullptr;
+	mappedCentreZ = nullptr;
+	mappedRadius = nullptr;
+	mappedIds = nullptr;
+	mappedCount = 0;
+}
+
+void SphereSoA::Reserve(unsigned int count)
+{
+	centreX.reserve(count + padding);
+	centreY.reserve(count + padding);
+	centreZ.reserve(count + padding);
+	radius.reserve(count + padding);
+	ids.reserve(count);
+}
+
+void SphereSoA::Add(glm::vec3 _centre, float _radius, unsigned int _id)
+{
+	Unmap();
+
+	// The new sphere takes over the first padding entry and a fresh one goes on the end
+	unsigned int index = GetCount();
+
+	centreX[index] = _centre.x;
+	centreY[index] = _centre.y;
+	centreZ[index] = _centre.z;
+	radius[index] = _radius;
+
+	centreX.push_back(0.0f);
+	centreY.push_back(0.0f);
+	centreZ.push_back(0.0f);
+	radius.push_back(0.0f);
+
+	ids.push_back(_id);
+}
+
+void SphereSoA::Resize(unsigned int count)
+{
+	Clear();
+
+	centreX.resize(count + padding, 0.0f);
+	centreY.resize(count + padding, 0.0f);
+	centreZ.resize(count + padding, 0.0f);
+	radius.resize(count + padding, 0.0f);
+	ids.resize(count, 0);
+}
+
+void SphereSoA::Set(unsigned int index, glm::vec3 _centre, float _radius)
+{
+	Unmap();
+
+	centreX[index] = _centre.x;
+	centreY[index] = _centre.y;
+	centreZ[index] = _centre.z;
+	radius[index] = _radius;
+}
+
+
+void SphereSoA::Save(SceneCache::Writer& writer) const
+{
+	unsigned int count = GetCount();
+
+	writer.Write(CentreX(), count + padding);
+	writer.Write(CentreY(), count + padding);
+	writer.Write(CentreZ(), count + padding);
+	writer.Write(Radius(), count + padding);
+	writer.Write(Ids(), count);
+}
+
+void SphereSoA::Unmap()
+{
+	if (mappedIds == nullptr)
+	{
+		return;
+	}
+
+	unsigned int count = mappedCount;
+
+	centreX.assign(mappedCentreX, mappedCentreX + count + padding);
+	centreY.assign(mappedCentreY, mappedCentreY + count + padding);
+	centreZ.assign(mappedCentreZ, mappedCentreZ + count + padding);
+	radius.assign(mappedRadius, mappedRadius + count + padding);
+	ids.assign(mappedIds, mappedIds + count);
+
+	mappedCentreX = nullptr;
+	mappedCentreY = nullptr;
+	mappedCentreZ = nullptr;
+	mappedRadius = nullptr;
+	mappedIds = nullptr;
+	mappedCount = 0;
+}
+
+bool SphereSoA::Map(SceneCache::Reader& reader)
+{
+	size_t paddedCount = 0;
+
+	const float* cachedCentreX = reader.Read<float>(paddedCount);
+
+	if (cachedCentreX == nullptr || paddedCount < padding)
+	{
+		return false;
+	}
+
+	const float* cachedCentreY = reader.ReadExactly<float>(paddedCount);
+	const float* cachedCentreZ = reader.ReadExactly<float>(paddedCount);
+	const float* cachedRadius = reader.ReadExactly<float>(paddedCount);
+	const unsigned int* cachedIds = reader.ReadExactly<unsigned int>(paddedCount - padding);
+
+	if (reader.HasFailed())
+	{
+		return false;
+	}
+
+	Clear();
+
+	mappedCentreX = cachedCentreX;
+	mappedCentreY = cachedCentreY;
+	mappedCentreZ = cachedCentreZ;
+	mappedRadius = cachedRadius;
+	mappedIds = cachedIds;
+	mappedCount = (unsigned int)(paddedCount - padding);
+
+	return true;
+}
+
+
+SphereSoA::IntersectFunction SphereSoA::GetIntersectFunction(SimdLevel level)
+{
+	switch (level)
+	{
+	case SimdLevel::AVX2:
+		return IntersectAVX2;
+	case SimdLevel::SSE41:
+		return IntersectSSE41;
+	default:
+		return IntersectScalar;
+	}
+}
+
+
+// All three kernels follow Sphere::RayIntersect step for step, so they agree on every hit and miss
+// Rays starting inside a sphere don't hit it, and neither do spheres behind the ray origin
+
+int SphereSoA::IntersectScalar(const SphereSoA& store, const Ray& ray, unsigned int first, unsigned int count, float& tMax)
+{
+	const float* centreX = store.CentreX();
+	const float* centreY = store.CentreY();
+	const float* centreZ = store.CentreZ();
+	const float* radius = store.Radius();
+
+	int closest = -1;
+
+	for (unsigned int i = first; i < first + count; ++i)
+	{
+		float toCentreX = centreX[i] - ray.origin.x;
+		float toCentreY = centreY[i] - ray.origin.y;
+		float toCentreZ = centreZ[i] - ray.origin.z;
+
+		float radiusSquared = radius[i] * radius[i];
+		float centreDistanceSquared = toCentreX * toCentreX + toCentreY * toCentreY + toCentreZ * toCentreZ;
+		float projection = toCentreX * ray.direction.x + toCentreY * ray.direction.y + toCentreZ * ray.direction.z;
+		float dSquared = centreDistanceSquared - projection * projection;
+
+		if (centreDistanceSquared < radiusSquared || projection < 0.0f || dSquared > radiusSquared)
+		{
+			continue;
+		}
+
+		float distance = projection - sqrtf(radiusSquared - dSquared);
+
+		if (distance < tMax)
+		{
+			tMax = distance;
+			closest = (int)i;
+		}
+	}
+
+	return closest;
+}
+
+
+SIMD_TARGET_SSE41
+int SphereSoA::IntersectSSE41(const SphereSoA& store, const Ray& ray, unsigned int first, unsigned int count, float& tMax)
+{
+	const float* centreX = store.CentreX();
+	const float* centreY = store.CentreY();
+	const float* centreZ = store.CentreZ();
+	const float* radius = store.Radius();
+
+	const __m128 originX = _mm_set1_ps(ray.origin.x);
+	const __m128 originY = _mm_set1_ps(ray.origin.y);
+	const __m128 originZ = _mm_set1_ps(ray.origin.z);
+	const __m128 directionX = _mm_set1_ps(ray.direction.x);
+	const __m128 directionY = _mm_set1_ps(ray.direction.y);
+	const __m128 directionZ = _mm_set1_ps(ray.direction.z);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128i laneIndex = _mm_setr_epi32(0, 1, 2, 3);
+
+	int closest = -1;
+
+	// Four spheres per pass, lanes past the end of the range are masked off
+	for (unsigned int i = first; i < first + count; i += 4)
+	{
+		__m128 toCentreX = _mm_sub_ps(_mm_loadu_ps(&centreX[i]), originX);
+		__m128 toCentreY = _mm_sub_ps(_mm_loadu_ps(&centreY[i]), originY);
+		__m128 toCentreZ = _mm_sub_ps(_mm_loadu_ps(&centreZ[i]), originZ);
+		__m128 sphereRadius = _mm_loadu_ps(&radius[i]);
+
+		__m128 radiusSquared = _mm_mul_ps(sphereRadius, sphereRadius);
+		__m128 centreDistanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(toCentreX, toCentreX), _mm_mul_ps(toCentreY, toCentreY)), _mm_mul_ps(toCentreZ, toCentreZ));
+		__m128 projection = _mm_add_ps(_mm_add_ps(_mm_mul_ps(toCentreX, directionX), _mm_mul_ps(toCentreY, directionY)), _mm_mul_ps(toCentreZ, directionZ));
+		__m128 dSquared = _mm_sub_ps(centreDistanceSquared, _mm_mul_ps(projection, projection));
+
+		__m128 hit = _mm_cmpge_ps(centreDistanceSquared, radiusSquared);
+		hit = _mm_and_ps(hit, _mm_cmpge_ps(projection, zero));
+		hit = _mm_and_ps(hit, _mm_cmple_ps(dSquared, radiusSquared));
+
+		__m128i lanesLeft = _mm_set1_epi32((int)(first + count - i));
+		hit = _mm_and_ps(hit, _mm_castsi128_ps(_mm_cmpgt_epi32(lanesLeft, laneIndex)));
+
+		if (_mm_movemask_ps(hit) == 0)
+		{
+			continue;
+		}
+
+		// Missed lanes would take the square root of a negative number, so clamp them and let the mask throw them away
+		__m128 distance = _mm_sub_ps(projection, _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(radiusSquared, dSquared), zero)));
+
+		hit = _mm_and_ps(hit, _mm_cmplt_ps(distance, _mm_set1_ps(tMax)));
+
+		if (_mm_movemask_ps(hit) == 0)
+		{
+			continue;
+		}
+
+		// Closest hit among the lanes: swap pairs of lanes twice so every lane ends up holding the minimum
+		__m128 hitDistance = _mm_blendv_ps(_mm_set1_ps(FLT_MAX), distance, hit);
+		__m128 minimum = _mm_min_ps(hitDistance, _mm_shuffle_ps(hitDistance, hitDistance, _MM_SHUFFLE(2, 3, 0, 1)));
+		minimum = _mm_min_ps(minimum, _mm_shuffle_ps(minimum, minimum, _MM_SHUFFLE(1, 0, 3, 2)));
+
+		int lane = FirstSetBit((unsigned int)_mm_movemask_ps(_mm_and_ps(hit, _mm_cmpeq_ps(hitDistance, minimum))));
+
+		tMax = _mm_cvtss_f32(minimum);
+		closest = (int)i + lane;
+	}
+
+	return closest;
+}
+
+
+SIMD_TARGET_AVX2
+int SphereSoA::IntersectAVX2(const SphereSoA& store, const Ray& ray, unsigned int first, unsigned int count, float& tMax)
+{
+	const float* centreX = store.CentreX();
+	const float* centreY = store.CentreY();
+	const float* centreZ = store.CentreZ();
+	const float* radius = store.Radius();
+
+	const __m256 originX = _mm256_set1_ps(ray.origin.x);
+	const __m256 originY = _mm256_set1_ps(ray.origin.y);
+	const __m256 originZ = _mm256_set1_ps(ray.origin.z);
+	const __m256 directionX = _mm256_set1_ps(ray.direction.x);
+	const __m256 directionY = _mm256_set1_ps(ray.direction.y);
+	const __m256 directionZ = _mm256_set1_ps(ray.direction.z);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256i laneIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+	int closest = -1;
+
+	// Eight spheres per pass, which covers a whole BVH leaf in one go
+	for (unsigned int i = first; i < first + count; i += 8)
+	{
+		__m256 toCentreX = _mm256_sub_ps(_mm256_loadu_ps(&centreX[i]), originX);
+		__m256 toCentreY = _mm256_sub_ps(_mm256_loadu_ps(&centreY[i]), originY);
+		__m256 toCentreZ = _mm256_sub_ps(_mm256_loadu_ps(&centreZ[i]), originZ);
+		__m256 sphereRadius = _mm256_loadu_ps(&radius[i]);
+
+		__m256 radiusSquared = _mm256_mul_ps(sphereRadius, sphereRadius);
+		__m256 centreDistanceSquared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(toCentreX, toCentreX), _mm256_mul_ps(toCentreY, toCentreY)), _mm256_mul_ps(toCentreZ, toCentreZ));
+		__m256 projection = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(toCentreX, directionX), _mm256_mul_ps(toCentreY, directionY)), _mm256_mul_ps(toCentreZ, directionZ));
+		__m256 dSquared = _mm256_sub_ps(centreDistanceSquared, _mm256_mul_ps(projection, projection));
+
+		__m256 hit = _mm256_cmp_ps(centreDistanceSquared, radiusSquared, _CMP_GE_OQ);
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(projection, zero, _CMP_GE_OQ));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(dSquared, radiusSquared, _CMP_LE_OQ));
+
+		__m256i lanesLeft = _mm256_set1_epi32((int)(first + count - i));
+		hit = _mm256_and_ps(hit, _mm256_castsi256_ps(_mm256_cmpgt_epi32(lanesLeft, laneIndex)));
+
+		if (_mm256_movemask_ps(hit) == 0)
+		{
+			continue;
+		}
+
+		__m256 distance = _mm256_sub_ps(projection, _mm256_sqrt_ps(_mm256_max_ps(_mm256_sub_ps(radiusSquared, dSquared), zero)));
+
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(distance, _mm256_set1_ps(tMax), _CMP_LT_OQ));
+
+		if (_mm256_movemask_ps(hit) == 0)
+		{
+			continue;
+		}
+
+		// Closest hit among the lanes: fold the two halves together, then the same pair swaps as the SSE version
+		__m256 hitDistance = _mm256_blendv_ps(_mm256_set1_ps(FLT_MAX), distance, hit);
+		__m256 minimum = _mm256_min_ps(hitDistance, _mm256_permute2f128_ps(hitDistance, hitDistance, 1));
+		minimum = _mm256_min_ps(minimum, _mm256_shuffle_ps(minimum, minimum, _MM_SHUFFLE(2, 3, 0, 1)));
+		minimum = _mm256_min_ps(minimum, _mm256_shuffle_ps(minimum, minimum, _MM_SHUFFLE(1, 0, 3, 2)));
+
+		int lane = FirstSetBit((unsigned int)_mm256_movemask_ps(_mm256_and_ps(hit, _mm256_cmp_ps(hitDistance, minimum, _CMP_EQ_OQ))));
+
+		tMax = _mm256_cvtss_f32(minimum);
+		closest = (int)i + lane;
+	}
+
+	return closest;
+}
+
+
+void SphereSoA::IntersectPacket(const SphereSoA& store, RayPacket& packet, unsigned int first, unsigned int count, unsigned long long mask, int* closest)
+{
+	const float* centreX = store.CentreX();
+	const float* centreY = store.CentreY();
+	const float* centreZ = store.CentreZ();
+	const float* radius = store.Radius();
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128i laneBits = _mm_setr_epi32(1, 2, 4, 8);
+
+	for (unsigned int group = 0; group < packet.GetGroupCount(); group++)
+	{
+		unsigned int shift = group * RayPacket::groupSize;
+		int groupMask = (int)(mask >> shift) & 0xf;
+
+		if (groupMask == 0)
+		{
+			continue;
+		}
+
+		const __m128 originX = _mm_load_ps(&packet.originX[shift]);
+		const __m128 originY = _mm_load_ps(&packet.originY[shift]);
+		const __m128 originZ = _mm_load_ps(&packet.originZ[shift]);
+		const __m128 directionX = _mm_load_ps(&packet.directionX[shift]);
+		const __m128 directionY = _mm_load_ps(&packet.directionY[shift]);
+		const __m128 directionZ = _mm_load_ps(&packet.directionZ[shift]);
+		const __m128 active = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(groupMask), laneBits), laneBits));
+
+		__m128 tMax = _mm_load_ps(&packet.tMax[shift]);
+		__m128i closestGroup = _mm_loadu_si128((const __m128i*)&closest[shift]);
+
+		// The same sums as the single ray kernels, a ray at a time down the lanes
+		for (unsigned int i = first; i < first + count; ++i)
+		{
+			__m128 toCentreX = _mm_sub_ps(_mm_set1_ps(centreX[i]), originX);
+			__m128 toCentreY = _mm_sub_ps(_mm_set1_ps(centreY[i]), originY);
+			__m128 toCentreZ = _mm_sub_ps(_mm_set1_ps(centreZ[i]), originZ);
+
+			__m128 radiusSquared = _mm_set1_ps(radius[i] * radius[i]);
+			__m128 centreDistanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(toCentreX, toCentreX), _mm_mul_ps(toCentreY, toCentreY)), _mm_mul_ps(toCentreZ, toCentreZ));
+			__m128 projection = _mm_add_ps(_mm_add_ps(_mm_mul_ps(toCentreX, directionX), _mm_mul_ps(toCentreY, directionY)), _mm_mul_ps(toCentreZ, directionZ));
+			__m128 dSquared = _mm_sub_ps(centreDistanceSquared, _mm_mul_ps(projection, projection));
+
+			__m128 hit = _mm_and_ps(active, _mm_cmpge_ps(centreDistanceSquared, radiusSquared));
+			hit = _mm_and_ps(hit, _mm_cmpge_ps(projection, zero));
+			hit = _mm_and_ps(hit, _mm_cmple_ps(dSquared, radiusSquared));
+
+			if (_mm_movemask_ps(hit) == 0)
+			{
+				continue;
+			}
+
+			__m128 distance = _mm_sub_ps(projection, _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(radiusSquared, dSquared), zero)));
+
+			hit = _mm_and_ps(hit, _mm_cmplt_ps(distance, tMax));
+
+			tMax = _mm_or_ps(_mm_and_ps(hit, distance), _mm_andnot_ps(hit, tMax));
+			closestGroup = _mm_or_si128(_mm_and_si128(_mm_castps_si128(hit), _mm_set1_epi32((int)i)), _mm_andnot_si128(_mm_castps_si128(hit), closestGroup));
+		}
+
+		_mm_store_ps(&packet.tMax[shift], tMax);
+		_mm_storeu_si128((__m128i*)&closest[shift], closestGroup);
+	}
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "GCP_GFX_Framework.h"
+#include "Ray.h"
+#include "RayPacket.h"
+#include "Simd.h"
+#include "SceneCache.h"
+
+#include <vector>
+
+// Sphere centres and radii stored as separate arrays, so a SIMD register can be filled with the same field of 4 or 8 spheres in one load
+// Only holds what intersection needs, materials stay with the RayTracer
+class SphereSoA
+{
+	private:
+
+		std::vector<float> centreX;
+
+		std::vector<float> centreY;
+
+		std::vector<float> centreZ;
+
+		std::vector<float> radius;
+
+		// Which object each entry came from
+		std::vector<unsigned int> ids;
+
+		// Arrays that live in a mapped scene cache, used instead of the vectors above when set
+		const float* mappedCentreX = nullptr;
+
+		const float* mappedCentreY = nullptr;
+
+		const float* mappedCentreZ = nullptr;
+
+		const float* mappedRadius = nullptr;
+
+		const unsigned int* mappedIds = nullptr;
+
+		unsigned int mappedCount = 0;
+
+		const float* CentreX() const { return mappedIds != nullptr ? mappedCentreX : centreX.data(); }
+
+		const float* CentreY() const { return mappedIds != nullptr ? mappedCentreY : centreY.data(); }
+
+		const float* CentreZ() const { return mappedIds != nullptr ? mappedCentreZ : centreZ.data(); }
+
+		const float* Radius() const { return mappedIds != nullptr ? mappedRadius : radius.data(); }
+
+		const unsigned int* Ids() const { return mappedIds != nullptr ? mappedIds : ids.data(); }
+
+		// Copies mapped arrays into the store's own, before anything changes them
+		void Unmap();
+
+	public:
+
+		// Entries past the end that are always there, so the 8 wide kernel can load a full register near the end of the arrays
+		static const unsigned int padding = 8;
+
+		// Finds the closest sphere in [first, first + count) that the ray hits before tMax
+		// Returns its index in the store and pulls tMax in to the hit distance, or returns -1 if nothing was hit
+		typedef int (*IntersectFunction)(const SphereSoA& store, const Ray& ray, unsigned int first, unsigned int count, float& tMax);
+
+		SphereSoA() { Clear(); }
+
+		void Clear();
+
+		void Reserve(unsigned int count);
+
+		void Add(glm::vec3 centre, float radius, unsigned int id);
+
+		// Sizes the store for loaders that fill it in place through the pointers below, the entries are left at 0
+		void Resize(unsigned int count);
+
+		float* GetCentreX() { return centreX.data(); }
+
+		float* GetCentreY() { return centreY.data(); }
+
+		float* GetCentreZ() { return centreZ.data(); }
+
+		float* GetRadii() { return radius.data(); }
+
+		unsigned int* GetIds() { return ids.data(); }
+
+		// Moves or resizes an entry that's already there, keeping its id
+		void Set(unsigned int index, glm::vec3 centre, float radius);
+
+		unsigned int GetCount() const { return mappedIds != nullptr ? mappedCount : (unsigned int)ids.size(); }
+
+		unsigned int GetId(unsigned int index) const { return Ids()[index]; }
+
+		glm::vec3 GetCentre(unsigned int index) const { return glm::vec3(CentreX()[index], CentreY()[index], CentreZ()[index]); }
+
+		float GetRadius(unsigned int index) const { return Radius()[index]; }
+
+		// Writes the arrays, padding and all, to a scene cache
+		void Save(SceneCache::Writer& writer) const;
+
+		// Uses the arrays in a scene cache where they are, until the next Clear or until something is changed, which copies them first
+		bool Map(SceneCache::Reader& reader);
+
+		bool IsMapped() const { return mappedIds != nullptr; }
+
+		// Picks the kernel for an instruction set, falling back to the next best if it isn't compiled in
+		static IntersectFunction GetIntersectFunction(SimdLevel level);
+
+		static int IntersectScalar(const SphereSoA& store, const Ray& ray, unsigned int first, unsigned int count, float& tMax);
+
+		static int IntersectSSE41(const SphereSoA& store, const Ray& ray, unsigned int first, unsigned int count, float& tMax);
+
+		static int IntersectAVX2(const SphereSoA& store, const Ray& ray, unsigned int first, unsigned int count, float& tMax);
+
+		// The other way round for packets, each sphere in [first, first + count) against 4 of the packet's rays at a time, only the rays in mask
+		// Each ray that hits a sphere before its tMax has its tMax pulled in and the sphere's index in the store written to its entry in closest
+		// closest needs an entry for every ray the packet holds, padding included, SSE2 is all it needs so there is only the one kernel
+		static void IntersectPacket(const SphereSoA& store, RayPacket& packet, unsigned int first, unsigned int count, unsigned long long mask, int* closest);
+};
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// Small parsing helpers shared by the text file loaders
+// They work on a range of a mapped file rather than strings, so nothing is copied or allocated however many numbers there are
+
+// Spaces that separate the parts of a line, the newline ends it
+inline bool IsSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline const char* SkipSpaces(const char* p, const char* end)
+{
+	while (p < end && IsSpace(*p))
+	{
+		p++;
+	}
+
+	return p;
+}
+
+// Returns the start of the next line
+inline const char* SkipLine(const char* p, const char* end)
+{
+	const char* newline = (const char*)memchr(p, '\n', end - p);
+
+	return newline != nullptr ? newline + 1 : end;
+}
+
+// Names end at a space, the end of the line or a comment
+inline const char* SkipName(const char* p, const char* end)
+{
+	while (p < end && !IsSpace(*p) && *p != '\n' && *p != '#')
+	{
+		p++;
+	}
+
+	return p;
+}
+
+// True if nothing but spaces or a comment is left on the line
+inline bool IsLineEnd(const char* p, const char* end)
+{
+	p = SkipSpaces(p, end);
+
+	return p == end || *p == '\n' || *p == '#';
+}
+
+// Decimal number with an optional fraction and exponent, returns the character after it or nullptr if there isn't one
+// strtod is exact but slow and depends on the locale, the digits here are gathered into an integer and scaled once,
+// which is well within float precision
+inline const char* ParseFloat(const char* p, const char* end, float& value)
+{
+	static const double powersOfTen[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+	bool negative = false;
+
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		p++;
+	}
+
+	// A 64 bit integer holds 19 digits, any more can't change a float
+	unsigned long long mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool anyDigits = false;
+
+	for (; p < end && *p >= '0' && *p <= '9'; p++)
+	{
+		anyDigits = true;
+
+		if (digits < 19)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			digits += mantissa != 0 ? 1 : 0;
+		}
+		else
+		{
+			exponent++;
+		}
+	}
+
+	if (p < end && *p == '.')
+	{
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++)
+		{
+			anyDigits = true;
+
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				digits += mantissa != 0 ? 1 : 0;
+				exponent--;
+			}
+		}
+	}
+
+	if (!anyDigits)
+	{
+		return nullptr;
+	}
+
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char* q = p + 1;
+		bool negativeExponent = false;
+
+		if (q < end && (*q == '-' || *q == '+'))
+		{
+			negativeExponent = *q == '-';
+			q++;
+		}
+
+		int written = 0;
+		bool anyExponentDigits = false;
+
+		for (; q < end && *q >= '0' && *q <= '9'; q++)
+		{
+			anyExponentDigits = true;
+			written = std::min(written * 10 + (*q - '0'), 100000);
+		}
+
+		// An e with no digits after it isn't part of the number
+		if (anyExponentDigits)
+		{
+			exponent += negativeExponent ? -written : written;
+			p = q;
+		}
+	}
+
+	double result = (double)mantissa;
+
+	if (exponent < 0)
+	{
+		result = exponent >= -22 ? result / powersOfTen[-exponent] : result / std::pow(10.0, -exponent);
+	}
+	else if (exponent > 0)
+	{
+		result = exponent <= 22 ? result * powersOfTen[exponent] : result * std::pow(10.0, exponent);
+	}
+
+	value = (float)(negative ? -result : result);
+
+	return p;
+}
+
+// Decimal integer with an optional sign, returns the character after it or nullptr if there isn't one
+inline const char* ParseInteger(const char* p, const char* end, long long& value)
+{
+	bool negative = false;
+
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		p++;
+	}
+
+	const char* digitsStart = p;
+
+	value = 0;
+
+	for (; p < end && *p >= '0' && *p <= '9'; p++)
+	{
+		// Far past any index a mesh can have, stops it overflowing
+		if (value < (1LL << 40))
+		{
+			value = value * 10 + (*p - '0');
+		}
+	}
+
+	if (p == digitsStart)
+	{
+		return nullptr;
+	}
+
+	value = negative ? -value : value;
+
+	return p;
+}
+
+// Lines that start with the keyword followed by a space
+inline bool IsKeyword(const char* p, const char* end, char keyword)
+{
+	return end - p >= 2 && p[0] == keyword && IsSpace(p[1]);
+}
+
+// True if the token at p is word, followed by a space, the end of the line or the end of the range
+inline bool IsWord(const char* p, const char* end, const char* word)
+{
+	size_t length = strlen(word);
+
+	return (size_t)(end - p) >= length && memcmp(p, word, length) == 0 && (p + length == end || IsSpace(p[length]) || p[length] == '\n');
+}
+
+// Splits a range into chunks of about chunkBytes that each start on a new line, for loaders that parse the chunks in parallel
+// Returns the chunk boundaries, one more than the number of chunks
+inline std::vector<const char*> SplitLines(const char* data, const char* end, size_t chunkBytes)
+{
+	size_t chunkCount = std::max<size_t>(((size_t)(end - data) + chunkBytes - 1) / chunkBytes, 1);
+
+	std::vector<const char*> boundaries(chunkCount + 1);
+
+	boundaries[0] = data;
+
+	for (size_t i = 1; i < chunkCount; i++)
+	{
+		// A line longer than a chunk leaves empty chunks behind it
+		boundaries[i] = SkipLine(std::max(data + i * chunkBytes - 1, boundaries[i - 1]), end);
+	}
+
+	boundaries[chunkCount] = end;
+
+	return boundaries;
+}
@@ -0,0 +1,145 @@
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+
+// Set while a thread is running a loop body, so nested loops don't wait on themselves
+static thread_local bool insideJob = false;
+
+
+ThreadPool::ThreadPool(unsigned int _threadCount) : nextIndex(0)
+{
+	if (_threadCount < 1)
+	{
+		_threadCount = 1;
+	}
+
+	for (unsigned int i = 1; i < _threadCount; ++i)
+	{
+		workers.emplace_back(&ThreadPool::WorkerMain, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quitting = true;
+	}
+	wakeWorkers.notify_all();
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+
+void ThreadPool::ParallelFor(unsigned int count, const LoopBody& body)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	// Nothing to share the work with, or we are already one of the pool's threads
+	if (workers.empty() || insideJob || count == 1)
+	{
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			body(i, 0);
+		}
+		return;
+	}
+
+	std::lock_guard<std::mutex> submitLock(submitMutex);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job = &body;
+		jobCount = count;
+		nextIndex.store(0, std::memory_order_relaxed);
+		busyWorkers = (unsigned int)workers.size();
+		++jobGeneration;
+	}
+	wakeWorkers.notify_all();
+
+	// The calling thread works too, as thread 0
+	RunJob(body, count, 0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	workersDone.wait(lock, [this] { return busyWorkers == 0; });
+	job = nullptr;
+}
+
+
+void ThreadPool::WorkerMain(unsigned int threadIndex)
+{
+	unsigned int seenGeneration = 0;
+
+	while (true)
+	{
+		const LoopBody* body = nullptr;
+		unsigned int count = 0;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeWorkers.wait(lock, [&] { return quitting || jobGeneration != seenGeneration; });
+
+			if (quitting)
+			{
+				return;
+			}
+
+			seenGeneration = jobGeneration;
+			body = job;
+			count = jobCount;
+		}
+
+		RunJob(*body, count, threadIndex);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			--busyWorkers;
+		}
+		workersDone.notify_one();
+	}
+}
+
+void ThreadPool::RunJob(const LoopBody& body, unsigned int count, unsigned int threadIndex)
+{
+	insideJob = true;
+
+	for (unsigned int i = nextIndex.fetch_add(1, std::memory_order_relaxed); i < count; i = nextIndex.fetch_add(1, std::memory_order_relaxed))
+	{
+		body(i, threadIndex);
+	}
+
+	insideJob = false;
+}
+
+
+void ParallelForChunks(ThreadPool* pool, unsigned int count, unsigned int chunkSize, const std::function<void(unsigned int chunk, unsigned int start, unsigned int end)>& body)
+{
+	unsigned int chunkCount = (count + chunkSize - 1) / chunkSize;
+
+	auto runChunk = [&](unsigned int chunk, unsigned int)
+	{
+		unsigned int start = chunk * chunkSize;
+
+		body(chunk, start, start + std::min(chunkSize, count - start));
+	};
+
+	if (pool != nullptr)
+	{
+		pool->ParallelFor(chunkCount, runChunk);
+	}
+	else
+	{
+		for (unsigned int chunk = 0; chunk < chunkCount; ++chunk)
+		{
+			runChunk(chunk, 0);
+		}
+	}
+}
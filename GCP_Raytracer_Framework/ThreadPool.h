@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads that share out the iterations of a loop
+// The thread calling ParallelFor() also does work, so a pool of N threads only spawns N - 1 workers
+class ThreadPool
+{
+	public:
+
+		// Body of a parallel loop, given the loop index and the index of the thread running it (0 to GetThreadCount() - 1)
+		typedef std::function<void(unsigned int index, unsigned int threadIndex)> LoopBody;
+
+		ThreadPool(unsigned int _threadCount);
+
+		~ThreadPool();
+
+		unsigned int GetThreadCount() const { return (unsigned int)workers.size() + 1; }
+
+		// Calls body for every index in [0, count) and returns once they have all finished
+		// Indices are handed out one at a time, so uneven amounts of work per index still balance out
+		// Calling this from inside a loop body just runs the nested loop on the current thread
+		void ParallelFor(unsigned int count, const LoopBody& body);
+
+	private:
+
+		std::vector<std::thread> workers;
+
+		// Only one loop runs on the pool at a time
+		std::mutex submitMutex;
+
+		std::mutex mutex;
+		std::condition_variable wakeWorkers;
+		std::condition_variable workersDone;
+
+		const LoopBody* job = nullptr;
+		unsigned int jobCount = 0;
+		unsigned int jobGeneration = 0;
+		unsigned int busyWorkers = 0;
+		bool quitting = false;
+
+		std::atomic<unsigned int> nextIndex;
+
+		void WorkerMain(unsigned int threadIndex);
+
+		void RunJob(const LoopBody& body, unsigned int count, unsigned int threadIndex);
+};
+
+// Calls body(chunk, start, end) over count items split into chunks of chunkSize, chunks are numbered from 0 so a body can keep results per chunk
+// Runs across the pool, or in order on this thread if it's null
+void ParallelForChunks(ThreadPool* pool, unsigned int count, unsigned int chunkSize, const std::function<void(unsigned int chunk, unsigned int start, unsigned int end)>& body);
@@ -0,0 +1,102 @@
+
+#include "TileRenderer.h"
+
+
+TileRenderer::TileRenderer(glm::ivec2 _imageSize, int _tileSize) : imageSize(_imageSize), tileSize(_tileSize), tilesDone(0), cancelled(false), finished(true), firstTileMicroseconds(-1)
+{
+	if (tileSize < 1)
+	{
+		tileSize = 1;
+	}
+
+	// Tiles along the right and bottom edges get cut down to fit the image
+	for (int y = 0; y < imageSize.y; y += tileSize)
+	{
+		for (int x = 0; x < imageSize.x; x += tileSize)
+		{
+			Tile tile;
+			tile.min = glm::ivec2(x, y);
+			tile.max = glm::min(tile.min + glm::ivec2(tileSize), imageSize);
+
+			tiles.push_back(tile);
+		}
+	}
+}
+
+TileRenderer::~TileRenderer()
+{
+	Cancel();
+	Wait();
+}
+
+
+void TileRenderer::Render(ThreadPool& pool, const std::function<void(const Tile&)>& renderTile)
+{
+	Reset();
+	RenderTiles(pool, renderTile);
+}
+
+void TileRenderer::RenderAsync(ThreadPool& pool, std::function<void(const Tile&)> renderTile)
+{
+	// Only one render at a time
+	Wait();
+
+	// Reset before the thread starts, so IsFinished() is false as soon as this returns and an early Cancel() isn't lost
+	Reset();
+
+	renderThread = std::thread([this, &pool, renderTile]()
+	{
+		RenderTiles(pool, renderTile);
+	});
+}
+
+void TileRenderer::Reset()
+{
+	tilesDone = 0;
+	cancelled = false;
+	finished = false;
+	firstTileMicroseconds = -1;
+	startTime = std::chrono::steady_clock::now();
+}
+
+void TileRenderer::RenderTiles(ThreadPool& pool, const std::function<void(const Tile&)>& renderTile)
+{
+	pool.ParallelFor((unsigned int)tiles.size(), [&](unsigned int index, unsigned int)
+	{
+		if (cancelled.load(std::memory_order_relaxed))
+		{
+			return;
+		}
+
+		renderTile(tiles[index]);
+
+		// The first tile to finish records the time to first pixel
+		if (tilesDone.fetch_add(1) == 0)
+		{
+			firstTileMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+		}
+	});
+
+	finished = true;
+}
+
+void TileRenderer::Cancel()
+{
+	cancelled = true;
+}
+
+void TileRenderer::Wait()
+{
+	if (renderThread.joinable())
+	{
+		renderThread.join();
+	}
+}
+
+
+double TileRenderer::GetFirstTileMs() const
+{
+	long long microseconds = firstTileMicroseconds;
+
+	return microseconds < 0 ? -1.0 : microseconds / 1000.0;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "GCP_GFX_Framework.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// A rectangle of pixels, max is exclusive
+struct Tile
+{
+	glm::ivec2 min;
+
+	glm::ivec2 max;
+};
+
+// Splits the image into square tiles and renders them across a thread pool
+// Each tile belongs to exactly one thread, so tiles can write their pixels to the framebuffer without any locking
+class TileRenderer
+{
+	private:
+
+		glm::ivec2 imageSize;
+
+		int tileSize;
+
+		std::vector<Tile> tiles;
+
+		// Progress of the current render, safe to read from any thread
+		std::atomic<int> tilesDone;
+		std::atomic<bool> cancelled;
+		std::atomic<bool> finished;
+		std::atomic<long long> firstTileMicroseconds;
+
+		std::chrono::steady_clock::time_point startTime;
+
+		// Only used by RenderAsync
+		std::thread renderThread;
+
+		void Reset();
+
+		void RenderTiles(ThreadPool& pool, const std::function<void(const Tile&)>& renderTile);
+
+	public:
+
+		TileRenderer(glm::ivec2 _imageSize, int _tileSize = 32);
+
+		~TileRenderer();
+
+		// Calls renderTile once for every tile, returns when the whole image is done
+		void Render(ThreadPool& pool, const std::function<void(const Tile&)>& renderTile);
+
+		// Same as Render but on a background thread, so the caller can keep showing the image while it fills in
+		// renderTile is copied, anything it captures by reference must live until Wait() returns
+		void RenderAsync(ThreadPool& pool, std::function<void(const Tile&)> renderTile);
+
+		// Tiles that haven't started yet are skipped, tiles in progress still finish
+		void Cancel();
+
+		// Blocks until a RenderAsync call has finished
+		void Wait();
+
+		bool IsFinished() const { return finished; }
+
+		int GetTilesDone() const { return tilesDone; }
+
+		// Time from the start of the render until the first tile was finished, or -1 if none has been yet
+		double GetFirstTileMs() const;
+
+		int GetTileSize() const { return tileSize; }
+
+		int GetTileCount() const { return (int)tiles.size(); }
+
+		const std::vector<Tile>& GetTiles() const { return tiles; }
+};
@@ -0,0 +1,26 @@
+#pragma once
+
+// Lifetime tracing for the scene objects, for following what gets made and destroyed while debugging
+// Off unless GCP_TRACE_ENABLED is defined for the build, and then GCP_TRACE compiles to nothing, so classes that use it
+// cost nothing extra and stay trivially copyable as long as only their constructors trace
+// With it on, every ray traces, which slows a frame down by orders of magnitude
+
+#if defined(GCP_TRACE_ENABLED)
+
+	#include <iostream>
+	#include <sstream>
+
+	// Each line is built first and written in one go, so lines from different render threads don't get mixed together
+	#define GCP_TRACE(message) \
+		do \
+		{ \
+			std::ostringstream traceLine; \
+			traceLine << "TRACE: " << message << '\n'; \
+			std::cout << traceLine.str(); \
+		} while (false)
+
+#else
+
+	#define GCP_TRACE(message) do { } while (false)
+
+#endif
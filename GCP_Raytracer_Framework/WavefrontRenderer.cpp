@@ -0,0 +1,475 @@
+#include "WavefrontRenderer.h"
+
+#include <GLM/gtc/bitfield.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+
+// Rays per task when a stage is shared out across threads, and per chunk when counting the rays left after a sort
+static const unsigned int chunkSize = 4096;
+
+// Size of the squares of pixels camera rays are made in
+static const int generateTileSize = 16;
+
+// Bits of Morton code each axis of a ray's origin gets in its sort key, few enough for the whole key to sort in 4 radix passes
+static const int mortonAxisBits = 9;
+
+// Sort keys are the origin's Morton code above the direction's octant, so rays are traced a place at a time and only split up by where they go
+// within each place, dead rays have the bit above both set so they sort to the end
+static const int mortonShift = 3;
+static const unsigned long long deadKey = 1ull << (mortonShift + 3 * mortonAxisBits);
+static const int sortKeyBits = mortonShift + 3 * mortonAxisBits + 1;
+
+
+// Milliseconds since some fixed point, for timing
+static double NowMs()
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+void RayQueue::Resize(unsigned int count)
+{
+	originX.resize(count);
+	originY.resize(count);
+	originZ.resize(count);
+	directionX.resize(count);
+	directionY.resize(count);
+	directionZ.resize(count);
+}
+
+void RayQueue::SetRay(unsigned int index, const Ray& ray)
+{
+	originX[index] = ray.origin.x;
+	originY[index] = ray.origin.y;
+	originZ[index] = ray.origin.z;
+	directionX[index] = ray.direction.x;
+	directionY[index] = ray.direction.y;
+	directionZ[index] = ray.direction.z;
+}
+
+void PathQueue::Resize(unsigned int count)
+{
+	rays.Resize(count);
+	throughput.resize(count);
+	pixels.resize(count);
+	samplers.resize(count);
+}
+
+
+// Sort key of a live ray, rays with the same key start near each other and head the same way
+static unsigned long long RayKey(const RayQueue& rays, unsigned int index, const glm::vec3& boundsMin, const glm::vec3& scale)
+{
+	unsigned long long octant = (rays.directionX[index] < 0.0f ? 1 : 0) | (rays.directionY[index] < 0.0f ? 2 : 0) | (rays.directionZ[index] < 0.0f ? 4 : 0);
+
+	// Origins a little outside the bounds, from rays offset off their surfaces, go in the cells at the edges
+	glm::vec3 origin(rays.originX[index], rays.originY[index], rays.originZ[index]);
+	glm::vec3 cell = glm::clamp((origin - boundsMin) * scale, glm::vec3(0.0f), glm::vec3((float)((1 << mortonAxisBits) - 1)));
+
+	unsigned long long morton = glm::bitfieldInterleave((glm::uint16)cell.x, (glm::uint16)cell.y, (glm::uint16)cell.z);
+
+	return (morton << mortonShift) | octant;
+}
+
+
+void WavefrontRenderer::Render(RayTracer& rayTracer, const Camera& camera, glm::ivec2 size, ThreadPool* pool)
+{
+	unsigned int pixelCount = (unsigned int)(size.x * size.y);
+	unsigned int shadowSlots = rayTracer.GetMaxLightSamples();
+
+	AABB bounds = rayTracer.GetBounds();
+
+	sortBoundsMin = glm::min(bounds.min, bounds.max);
+	sortScale = glm::vec3(0.0f);
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float extent = bounds.max[axis] - bounds.min[axis];
+
+		if (extent > 0.0f)
+		{
+			sortScale[axis] = (float)(1 << mortonAxisBits) / extent;
+		}
+	}
+
+	primaryRayCount = 0;
+	secondaryRayCount = 0;
+	shadowRayCount = 0;
+	sortMs = 0.0;
+	extendMs = 0.0;
+	shadeMs = 0.0;
+	shadowMs = 0.0;
+	generateMs = 0.0;
+
+	double stageStart = NowMs();
+
+	image.resize(pixelCount);
+	cameraRays.resize(pixelCount);
+	paths.Resize(pixelCount);
+	nextPaths.Resize(pixelCount);
+	hits.resize(pixelCount);
+	shadeThroughput.resize(pixelCount);
+	shadeColour.resize(pixelCount);
+	shadowRays.Resize(pixelCount * shadowSlots);
+	shadowTMax.resize(pixelCount * shadowSlots);
+	shadowContributions.resize(pixelCount * shadowSlots);
+	sortedShadowRays.Resize(pixelCount * shadowSlots);
+	sortedShadowTMax.resize(pixelCount * shadowSlots);
+	shadowVisible.resize(pixelCount * shadowSlots);
+
+	generateMs += NowMs() - stageStart;
+
+	for (unsigned int sample = 0; sample < rayTracer.GetSamplesPerPixel(); ++sample)
+	{
+		RenderSample(rayTracer, camera, size, sample, pool);
+	}
+}
+
+void WavefrontRenderer::RenderSample(RayTracer& rayTracer, const Camera& camera, glm::ivec2 size, unsigned int sample, ThreadPool* pool)
+{
+	unsigned int pixelCount = (unsigned int)(size.x * size.y);
+	unsigned int shadowSlots = rayTracer.GetMaxLightSamples();
+	SamplerType samplerType = rayTracer.GetSamplerType();
+
+	// Each sample's paths start with their share of the pixel, so adding up their light averages it
+	glm::vec3 sampleWeight(1.0f / (float)rayTracer.GetSamplesPerPixel());
+
+	// Generate, camera rays are already in an order that goes through the BVHs together, so they go straight into paths without a sort
+
+	double stageStart = NowMs();
+
+	// A tile at a time, each tile's rays one after another in the queue, so the first rays through the BVHs are close together like the tile renderer's
+	int tilesAcross = (size.x + generateTileSize - 1) / generateTileSize;
+	int tilesDown = (size.y + generateTileSize - 1) / generateTileSize;
+
+	auto generateTile = [&](unsigned int tile, unsigned int)
+	{
+		glm::ivec2 min((int)tile % tilesAcross * generateTileSize, (int)tile / tilesAcross * generateTileSize);
+		glm::ivec2 max = glm::min(min + generateTileSize, size);
+
+		// Every row of tiles before this one is full width, and every tile before it in its row is as tall as it is
+		unsigned int i = (unsigned int)(min.y * size.x + min.x * (max.y - min.y));
+
+		camera.GetRays(min, max, &cameraRays[i]);
+
+		for (int y = min.y; y < max.y; ++y)
+		{
+			for (int x = min.x; x < max.x; ++x, ++i)
+			{
+				unsigned int pixel = (unsigned int)(y * size.x + x);
+
+				paths.rays.SetRay(i, cameraRays[i]);
+				paths.throughput[i] = sampleWeight;
+				paths.pixels[i] = pixel;
+				paths.samplers[i] = PixelSampler(samplerType, glm::ivec2(x, y), sample);
+
+				// Background colour for rays that miss everything
+				if (sample == 0)
+				{
+					image[pixel] = glm::vec3(0, 0, 0);
+				}
+			}
+		}
+	};
+
+	if (pool != nullptr)
+	{
+		pool->ParallelFor((unsigned int)(tilesAcross * tilesDown), generateTile);
+	}
+	else
+	{
+		for (unsigned int tile = 0; tile < (unsigned int)(tilesAcross * tilesDown); ++tile)
+		{
+			generateTile(tile, 0);
+		}
+	}
+
+	generateMs += NowMs() - stageStart;
+
+	unsigned int livePaths = pixelCount;
+
+	for (unsigned int bounce = 0; livePaths > 0; bounce++)
+	{
+		if (bounce > 0)
+		{
+			stageStart = NowMs();
+
+			livePaths = SortPaths(nextPaths, livePaths, paths, pool);
+
+			sortMs += NowMs() - stageStart;
+
+			if (livePaths == 0)
+			{
+				break;
+			}
+		}
+
+		(bounce == 0 ? primaryRayCount : secondaryRayCount) += livePaths;
+
+		stageStart = NowMs();
+
+		Extend(rayTracer, livePaths, pool);
+
+		extendMs += NowMs() - stageStart;
+		stageStart = NowMs();
+
+		Shade(rayTracer, livePaths, bounce, shadowSlots, pool);
+
+		shadeMs += NowMs() - stageStart;
+		stageStart = NowMs();
+
+		unsigned int shadowCount = SortShadowRays(livePaths * shadowSlots, pool);
+
+		sortMs += NowMs() - stageStart;
+
+		shadowRayCount += shadowCount;
+
+		stageStart = NowMs();
+
+		TraceShadows(rayTracer, livePaths, shadowCount, shadowSlots, pool);
+
+		shadowMs += NowMs() - stageStart;
+	}
+}
+
+
+unsigned int WavefrontRenderer::SortPaths(PathQueue& queue, unsigned int count, PathQueue& sorted, ThreadPool* pool)
+{
+	sortKeys.resize(count);
+	sortOrder.resize(count);
+	chunkLiveCounts.resize((count + chunkSize - 1) / chunkSize);
+
+	ParallelForChunks(pool, count, chunkSize, [&](unsigned int chunk, unsigned int start, unsigned int end)
+	{
+		unsigned int live = 0;
+
+		for (unsigned int i = start; i < end; ++i)
+		{
+			bool dead = queue.pixels[i] == PathQueue::deadPath;
+
+			sortKeys[i] = dead ? deadKey : RayKey(queue.rays, i, sortBoundsMin, sortScale);
+			sortOrder[i] = i;
+			live += dead ? 0 : 1;
+		}
+
+		chunkLiveCounts[chunk] = live;
+	});
+
+	RadixSort::Sort(sortKeys, sortOrder, sortKeyBits, pool, sortScratch);
+
+	unsigned int live = 0;
+
+	for (unsigned int chunkLive : chunkLiveCounts)
+	{
+		live += chunkLive;
+	}
+
+	ParallelForChunks(pool, live, chunkSize, [&](unsigned int, unsigned int start, unsigned int end)
+	{
+		for (unsigned int i = start; i < end; ++i)
+		{
+			unsigned int from = sortOrder[i];
+
+			sorted.rays.originX[i] = queue.rays.originX[from];
+			sorted.rays.originY[i] = queue.rays.originY[from];
+			sorted.rays.originZ[i] = queue.rays.originZ[from];
+			sorted.rays.directionX[i] = queue.rays.directionX[from];
+			sorted.rays.directionY[i] = queue.rays.directionY[from];
+			sorted.rays.directionZ[i] = queue.rays.directionZ[from];
+			sorted.throughput[i] = queue.throughput[from];
+			sorted.pixels[i] = queue.pixels[from];
+			sorted.samplers[i] = queue.samplers[from];
+		}
+	});
+
+	return live;
+}
+
+unsigned int WavefrontRenderer::SortShadowRays(unsigned int count, ThreadPool* pool)
+{
+	sortKeys.resize(count);
+	sortOrder.resize(count);
+	chunkLiveCounts.resize((count + chunkSize - 1) / chunkSize);
+
+	ParallelForChunks(pool, count, chunkSize, [&](unsigned int chunk, unsigned int start, unsigned int end)
+	{
+		unsigned int live = 0;
+
+		for (unsigned int i = start; i < end; ++i)
+		{
+			bool dead = shadowTMax[i] < 0.0f;
+
+			sortKeys[i] = dead ? deadKey : RayKey(shadowRays, i, sortBoundsMin, sortScale);
+			sortOrder[i] = i;
+			live += dead ? 0 : 1;
+
+			// Slots whose rays aren't traced let no light through
+			shadowVisible[i] = 0;
+		}
+
+		chunkLiveCounts[chunk] = live;
+	});
+
+	RadixSort::Sort(sortKeys, sortOrder, sortKeyBits, pool, sortScratch);
+
+	unsigned int live = 0;
+
+	for (unsigned int chunkLive : chunkLiveCounts)
+	{
+		live += chunkLive;
+	}
+
+	ParallelForChunks(pool, live, chunkSize, [&](unsigned int, unsigned int start, unsigned int end)
+	{
+		for (unsigned int i = start; i < end; ++i)
+		{
+			unsigned int from = sortOrder[i];
+
+			sortedShadowRays.originX[i] = shadowRays.originX[from];
+			sortedShadowRays.originY[i] = shadowRays.originY[from];
+			sortedShadowRays.originZ[i] = shadowRays.originZ[from];
+			sortedShadowRays.directionX[i] = shadowRays.directionX[from];
+			sortedShadowRays.directionY[i] = shadowRays.directionY[from];
+			sortedShadowRays.directionZ[i] = shadowRays.directionZ[from];
+			sortedShadowTMax[i] = shadowTMax[from];
+		}
+	});
+
+	return live;
+}
+
+
+void WavefrontRenderer::Extend(RayTracer& rayTracer, unsigned int count, ThreadPool* pool)
+{
+	ParallelForChunks(pool, count, chunkSize, [&](unsigned int, unsigned int start, unsigned int end)
+	{
+		for (unsigned int i = start; i < end; ++i)
+		{
+			hits[i] = HitRecord();
+
+			rayTracer.Intersect(paths.rays.GetRay(i), hits[i]);
+		}
+	});
+}
+
+void WavefrontRenderer::Shade(RayTracer& rayTracer, unsigned int count, unsigned int bounce, unsigned int shadowSlots, ThreadPool* pool)
+{
+	ParallelForChunks(pool, count, chunkSize, [&](unsigned int, unsigned int start, unsigned int end)
+	{
+		for (unsigned int i = start; i < end; ++i)
+		{
+			unsigned int firstSlot = i * shadowSlots;
+
+			for (unsigned int slot = firstSlot; slot < firstSlot + shadowSlots; ++slot)
+			{
+				shadowTMax[slot] = -1.0f;
+			}
+
+			nextPaths.pixels[i] = PathQueue::deadPath;
+
+			const HitRecord& hit = hits[i];
+
+			if (hit.primitive < 0)
+			{
+				continue;
+			}
+
+			Ray ray = paths.rays.GetRay(i);
+
+			glm::vec3 point = ray.origin + hit.t * ray.direction;
+			glm::vec3 normal = rayTracer.GetFacingNormal(ray, hit);
+			glm::vec3 albedo = rayTracer.GetColour(hit);
+
+			unsigned int pixel = paths.pixels[i];
+			PixelSampler sampler = paths.samplers[i];
+			glm::vec3 throughput = paths.throughput[i];
+
+			// Each pixel has one path, so no other thread is adding to it
+			if (bounce == 0)
+			{
+				image[pixel] += throughput * rayTracer.GetEmission(hit);
+			}
+
+			unsigned int slot = firstSlot;
+
+			sampler.SetDimension(bounce * rayTracer.GetSampleDimensions());
+
+			rayTracer.ForEachLightSample(point, normal, sampler, [&](const Ray& shadowRay, float tMax, const glm::vec3& contribution)
+			{
+				shadowRays.SetRay(slot, shadowRay);
+				shadowTMax[slot] = tMax;
+				shadowContributions[slot] = contribution;
+				slot++;
+			});
+
+			shadeThroughput[i] = throughput;
+			shadeColour[i] = albedo;
+
+			Ray next;
+
+			if (rayTracer.ContinuePath(point, normal, albedo, bounce, throughput, sampler, next))
+			{
+				nextPaths.rays.SetRay(i, next);
+				nextPaths.throughput[i] = throughput;
+				nextPaths.pixels[i] = pixel;
+				nextPaths.samplers[i] = sampler;
+			}
+		}
+	});
+}
+
+void WavefrontRenderer::TraceShadows(RayTracer& rayTracer, unsigned int pathCount, unsigned int shadowCount, unsigned int shadowSlots, ThreadPool* pool)
+{
+	ParallelForChunks(pool, shadowCount, chunkSize, [&](unsigned int, unsigned int start, unsigned int end)
+	{
+		for (unsigned int i = start; i < end; ++i)
+		{
+			shadowVisible[sortOrder[i]] = rayTracer.IsOccluded(sortedShadowRays.GetRay(i), sortedShadowTMax[i]) ? 0 : 1;
+		}
+	});
+
+	// Added up per path in slot order, the order shading a pixel at a time adds them in
+	ParallelForChunks(pool, pathCount, chunkSize, [&](unsigned int, unsigned int start, unsigned int end)
+	{
+		for (unsigned int i = start; i < end; ++i)
+		{
+			if (hits[i].primitive < 0)
+			{
+				continue;
+			}
+
+			glm::vec3 light(0, 0, 0);
+
+			for (unsigned int slot = i * shadowSlots; slot < (i + 1) * shadowSlots; ++slot)
+			{
+				if (shadowVisible[slot])
+				{
+					light += shadowContributions[slot];
+				}
+			}
+
+			image[paths.pixels[i]] += shadeThroughput[i] * (light * shadeColour[i]);
+		}
+	});
+}
+
+
+void WavefrontRenderer::PrintStats() const
+{
+	double frameMs = GetFrameMs();
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "INFO: Wavefront frame in " << frameMs << " ms, " << primaryRayCount << " primary, " << secondaryRayCount << " secondary and "
+		<< shadowRayCount << " shadow rays, " << std::setprecision(2) << GetRayCount() / (frameMs * 1000.0) << " Mrays/s" << std::setprecision(1) << std::endl;
+	std::cout << "  stage       time (ms)" << std::endl;
+	std::cout << "  generate " << std::setw(12) << generateMs << std::endl;
+	std::cout << "  sort     " << std::setw(12) << sortMs << std::endl;
+	std::cout << "  extend   " << std::setw(12) << extendMs << std::endl;
+	std::cout << "  shade    " << std::setw(12) << shadeMs << std::endl;
+	std::cout << "  shadow   " << std::setw(12) << shadowMs << std::endl;
+
+	std::cout << std::defaultfloat << std::setprecision(6);
+}
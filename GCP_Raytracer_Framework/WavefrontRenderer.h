@@ -0,0 +1,162 @@
+#pragma once
+
+#include "GCP_GFX_Framework.h"
+#include "RayTracer.h"
+#include "Camera.h"
+#include "RadixSort.h"
+#include "ThreadPool.h"
+
+#include <vector>
+
+// Rays waiting for a stage, an array per component so a stage only reads the parts it needs
+struct RayQueue
+{
+	std::vector<float> originX;
+
+	std::vector<float> originY;
+
+	std::vector<float> originZ;
+
+	std::vector<float> directionX;
+
+	std::vector<float> directionY;
+
+	std::vector<float> directionZ;
+
+	void Resize(unsigned int count);
+
+	unsigned int GetCount() const { return (unsigned int)originX.size(); }
+
+	Ray GetRay(unsigned int index) const
+	{
+		return Ray(glm::vec3(originX[index], originY[index], originZ[index]), glm::vec3(directionX[index], directionY[index], directionZ[index]));
+	}
+
+	void SetRay(unsigned int index, const Ray& ray);
+};
+
+// Paths waiting to be extended by their next ray
+struct PathQueue
+{
+	RayQueue rays;
+
+	// What's left of the light after every surface so far has reflected its share
+	std::vector<glm::vec3> throughput;
+
+	// Pixel each path adds its light to, a path that has ended has deadPath here
+	std::vector<unsigned int> pixels;
+
+	std::vector<PixelSampler> samplers;
+
+	static const unsigned int deadPath = 0xffffffffu;
+
+	void Resize(unsigned int count);
+};
+
+// Renders a whole frame breadth first, one stage at a time over every ray in flight, rather than following each pixel's path to the end
+//   generate   a camera ray for every pixel
+//   extend     finds what every path's ray hits
+//   shade      adds emission, makes the shadow rays for every hit and the next ray of every path that carries on
+//   shadow     traces the shadow rays and adds the light of those that get through to their pixels
+// Between stages the rays are sorted by the Morton code of their origin and then the octant of their direction, so rays that go through the same
+// parts of the BVHs are traced together and their nodes stay in cache, which a pixel's path can't do once it starts bouncing about
+// Camera rays start out in that sort of order already, so only the bounce and shadow rays are sorted
+// Every queue is kept between frames, so after the first frame nothing is allocated
+// Each path uses the same random numbers as RayTracer::TraceRays would give it, so the image comes out the same as rendering it a pixel at a time
+// With more than one sample per pixel the whole frame is rendered once per sample, adding each one's share to the image
+class WavefrontRenderer
+{
+	private:
+
+		PathQueue paths;
+
+		// Where the shade stage writes the paths that carry on, before they are sorted back into paths
+		PathQueue nextPaths;
+
+		std::vector<HitRecord> hits;
+
+		// What each path's surface reflects of the light its shadow rays find, set by the shade stage
+		std::vector<glm::vec3> shadeThroughput;
+
+		std::vector<glm::vec3> shadeColour;
+
+		// Every path has the same number of shadow ray slots, one per light sample, and a slot that's not needed has a negative tMax
+		RayQueue shadowRays;
+
+		std::vector<float> shadowTMax;
+
+		std::vector<glm::vec3> shadowContributions;
+
+		// The shadow rays sorted, and whether each slot's ray got through
+		RayQueue sortedShadowRays;
+
+		std::vector<float> sortedShadowTMax;
+
+		std::vector<unsigned char> shadowVisible;
+
+		// Camera rays for the generate stage
+		std::vector<Ray> cameraRays;
+
+		std::vector<unsigned long long> sortKeys;
+
+		std::vector<unsigned int> sortOrder;
+
+		RadixSort::Scratch sortScratch;
+
+		// Rays left after each chunk's dead ones are dropped, so sorting can tell how many are still live
+		std::vector<unsigned int> chunkLiveCounts;
+
+		std::vector<glm::vec3> image;
+
+		// Where origins are placed on the Morton curve, the scene's bounds
+		glm::vec3 sortBoundsMin;
+
+		glm::vec3 sortScale;
+
+		// Counts and stage times for the last frame
+		unsigned long long primaryRayCount = 0;
+
+		unsigned long long secondaryRayCount = 0;
+
+		unsigned long long shadowRayCount = 0;
+
+		double generateMs = 0.0;
+
+		double sortMs = 0.0;
+
+		double extendMs = 0.0;
+
+		double shadeMs = 0.0;
+
+		double shadowMs = 0.0;
+
+		// Generates the camera rays for one sample of every pixel and follows their paths to the end, adding their share of light to the image
+		void RenderSample(RayTracer& rayTracer, const Camera& camera, glm::ivec2 size, unsigned int sample, ThreadPool* pool);
+
+		// Sorts the first count of queue's keys and reorders it into sorted, dropping dead rays, returns how many are left
+		unsigned int SortPaths(PathQueue& queue, unsigned int count, PathQueue& sorted, ThreadPool* pool);
+
+		unsigned int SortShadowRays(unsigned int count, ThreadPool* pool);
+
+		void Extend(RayTracer& rayTracer, unsigned int count, ThreadPool* pool);
+
+		void Shade(RayTracer& rayTracer, unsigned int count, unsigned int bounce, unsigned int shadowSlots, ThreadPool* pool);
+
+		void TraceShadows(RayTracer& rayTracer, unsigned int pathCount, unsigned int shadowCount, unsigned int shadowSlots, ThreadPool* pool);
+
+	public:
+
+		// Renders a frame of the given size into the image, with the rayTracer's bounce, light sample and sampler settings
+		void Render(RayTracer& rayTracer, const Camera& camera, glm::ivec2 size, ThreadPool* pool = nullptr);
+
+		// A colour per pixel, a row at a time from the bottom row like the framebuffer
+		const std::vector<glm::vec3>& GetImage() const { return image; }
+
+		// Every ray traced in the last frame, primary, secondary and shadow
+		unsigned long long GetRayCount() const { return primaryRayCount + secondaryRayCount + shadowRayCount; }
+
+		double GetFrameMs() const { return generateMs + sortMs + extendMs + shadeMs + shadowMs; }
+
+		// Prints the rays each stage handled in the last frame and how long it took
+		void PrintStats() const;
+};